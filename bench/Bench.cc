@@ -0,0 +1,233 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "masterd.h"
+#include "Bench.h"
+#include <malloc.h>
+#include <new>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+tDaemonConfig	gm_BenchConfig;
+tDaemonConfig	*gm_pConfig			= &gm_BenchConfig;
+ServerStore		*gm_pStore			= NULL;
+
+std::atomic<U64>	gm_BenchAllocs(0);
+std::atomic<U64>	gm_BenchAllocBytes(0);
+std::atomic<S64>	gm_BenchLiveBytes(0);
+volatile U64	gm_BenchSink		= 0;
+
+
+//=============================================================================
+// Stand-ins for the core
+//=============================================================================
+
+void debugPrintf(const int level, const char *format, ...)
+{
+	va_list args;
+
+
+	// the benchmarks print their results, only problems are worth mixing in
+	if(level > DPRINT_WARN)
+		return;
+
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+// masterd's defaults, see MasterdCore::InitPrefs()
+static struct tBenchConfigInit
+{
+	tBenchConfigInit()
+	{
+		memset(&gm_BenchConfig, 0, sizeof(gm_BenchConfig));
+
+		gm_BenchConfig.heartbeat		= 180;
+		gm_BenchConfig.floodResetTime	= 60;
+		gm_BenchConfig.floodForgetTime	= 900;
+		gm_BenchConfig.floodBanTime		= 600;
+		gm_BenchConfig.floodMaxTickets	= 300;
+		gm_BenchConfig.floodBadMsgTicket	= 50;
+		gm_BenchConfig.listRate			= 500;
+		gm_BenchConfig.listMinRate		= 50;
+		gm_BenchConfig.listMaxRate		= 5000;
+		gm_BenchConfig.queryParallelThreshold	= 20000;
+	}
+} gm_BenchConfigInit;
+
+
+//=============================================================================
+// Allocation counting
+//=============================================================================
+
+void* operator new(size_t size)
+{
+	void *p;
+
+
+	gm_BenchAllocs.fetch_add(1, std::memory_order_relaxed);
+	gm_BenchAllocBytes.fetch_add(size, std::memory_order_relaxed);
+
+	p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+
+	gm_BenchLiveBytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	if(!p)
+		return;
+
+	gm_BenchLiveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+	free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+U64 benchNanoTime(void)
+{
+	struct timespec ts;
+
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (U64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+U64 benchResident(void)
+{
+	unsigned long	size, resident;
+	FILE			*f;
+
+
+	f = fopen("/proc/self/statm", "r");
+	if(!f)
+		return 0;
+
+	if(fscanf(f, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+
+	fclose(f);
+
+	return (U64)resident * sysconf(_SC_PAGESIZE);
+}
+
+bool benchParseSizes(const char *list, std::vector<U32> &sizes)
+{
+	char	*end;
+	U32		size;
+
+
+	sizes.clear();
+
+	while(*list)
+	{
+		size = strtoul(list, &end, 10);
+		if(end == list || !size)
+			return false;
+
+		sizes.push_back(size);
+
+		list = end;
+		if(*list == ',')
+			list++;
+	}
+
+	return !sizes.empty();
+}
+
+/**
+ * @brief Fill in the n'th server of a synthetic table.
+ *
+ * Servers are spread over 10.0.0.0/8 and a handful of ports, with up to
+ * 15 players each. The type names are pointed at, not copied, the caller
+ * sets them to NULL again before info goes away.
+ */
+void benchServer(U32 n, ServerAddress *addr, ServerInfo *info, const char *game, const char *mission)
+{
+	U32 *players;
+	U8	count = n % 16;
+	U32 i;
+
+
+	addr->addy[0]	= 10;
+	addr->addy[1]	= (n >> 16) & 0xFF;
+	addr->addy[2]	= (n >> 8) & 0xFF;
+	addr->addy[3]	= n & 0xFF;
+	addr->port		= 28000 + (n >> 24);
+
+	info->fingerprint	= 0;
+	info->gameType		= (char *)game;
+	info->missionType	= (char *)mission;
+	info->maxPlayers	= 32;
+	info->regions		= 1 << (n % 4);
+	info->version		= 1000 + n % 7;
+	info->infoFlags		= n % 3;
+	info->numBots		= n % 5;
+	info->CPUSpeed		= 2000 + n % 1000;
+
+	players = info->playerList.Reserve(count);
+	for(i=0; i < count; i++)
+		players[i] = n * 16 + i;
+}
+
+void benchFilter(ServerFilter *filter)
+{
+	filter->gameType	= NULL;
+	filter->missionType	= NULL;
+	filter->minPlayers	= 0;
+	filter->maxPlayers	= 255;
+	filter->regions		= 0;
+	filter->version		= 0;
+	filter->filterFlags	= 0;
+	filter->maxBots		= 255;
+	filter->minCPUSpeed	= 0;
+	filter->buddyCount	= 0;
+	filter->buddyList	= NULL;
+}
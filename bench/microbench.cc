@@ -0,0 +1,617 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "masterd.h"
+#include "Bench.h"
+#include "ServerStoreRAM.h"
+#include "netSocket.h"
+#include <unistd.h>
+
+/*
+
+pbms-microbench, timings of masterd's hot primitives.
+
+Each benchmark is run with twice the iterations until a run takes at least
+the minimum time, the last run is reported. Benchmarks of tables run once
+per table size. One JSON object per line is printed:
+
+	{"bench":"store.update","size":10000,"iterations":2097152,"ns_per_op":181.52,"allocs_per_op":0.000}
+
+size is the number of entries in the table, or the string length for the
+C-string benchmarks, 0 if neither applies. allocs_per_op counts calls of
+operator new.
+
+*/
+
+// run a benchmark for this many iterations, setup isn't timed
+typedef void (*tBenchFunc)(U64 iterations, void *arg);
+
+static U64		gm_MinTime		= 200000000ULL;	// nanoseconds a run takes at least
+static char		*gm_Only		= NULL;			// run only benchmarks containing this
+
+
+static void runBench(const char *name, U32 size, tBenchFunc setup, tBenchFunc run, void *arg)
+{
+	U64 iterations = 1, start, took, allocs;
+
+
+	if(gm_Only && !strstr(name, gm_Only))
+		return;
+
+	for(;;)
+	{
+		if(setup)
+			setup(iterations, arg);
+
+		allocs	= gm_BenchAllocs.load(std::memory_order_relaxed);
+		start	= benchNanoTime();
+
+		run(iterations, arg);
+
+		took	= benchNanoTime() - start;
+		allocs	= gm_BenchAllocs.load(std::memory_order_relaxed) - allocs;
+
+		if(took >= gm_MinTime || iterations >= (1ULL << 40))
+			break;
+
+		iterations *= 2;
+	}
+
+	printf("{\"bench\":\"%s\",\"size\":%u,\"iterations\":%llu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+		   name, size, (unsigned long long)iterations,
+		   (double)took / iterations, (double)allocs / iterations);
+	fflush(stdout);
+}
+
+
+//=============================================================================
+// Packet
+//=============================================================================
+
+typedef struct tPacketBench
+{
+	Packet	*write;
+	Packet	*read;
+	char	str[256];
+	U32		length;
+} tPacketBench;
+
+static void benchHeaderWrite(U64 iterations, void *arg)
+{
+	tPacketBench	*pb = (tPacketBench *)arg;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		pb->write->reset();
+		pb->write->writeHeader(8, 0, (U16)i, (U16)(i >> 16));
+	}
+
+	gm_BenchSink += pb->write->getLength();
+}
+
+static void benchHeaderRead(U64 iterations, void *arg)
+{
+	tPacketBench	*pb = (tPacketBench *)arg;
+	tPacketHeader	header;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		pb->read->reset();
+		pb->read->readHeader(header);
+		gm_BenchSink += header.session;
+	}
+}
+
+static void benchCStringWrite(U64 iterations, void *arg)
+{
+	tPacketBench	*pb = (tPacketBench *)arg;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		pb->write->reset();
+		pb->write->writeCString(pb->str, pb->length);
+	}
+
+	gm_BenchSink += pb->write->getLength();
+}
+
+static void benchCStringRead(U64 iterations, void *arg)
+{
+	tPacketBench	*pb = (tPacketBench *)arg;
+	char			*str;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		pb->read->reset();
+		str = pb->read->readCString();
+		gm_BenchSink += str[0];
+		delete[] str;
+	}
+}
+
+static void runPacketBenches(void)
+{
+	static const U32	lengths[] = { 8, 64, 255 };
+	tPacketBench		pb;
+	U32					i;
+
+
+	pb.write = new Packet(MAX_PACKET_SIZE);
+	pb.write->writeHeader(8, 0, 1, 2);
+	pb.read = new Packet(pb.write->getBufferPtr(), pb.write->getLength());
+
+	runBench("packet.header.write", 0, NULL, benchHeaderWrite, &pb);
+	runBench("packet.header.read", 0, NULL, benchHeaderRead, &pb);
+	delete pb.read;
+
+	for(i=0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+	{
+		pb.length = lengths[i];
+		memset(pb.str, 'a' + i, pb.length);
+		pb.str[pb.length] = 0;
+
+		pb.write->reset();
+		pb.write->writeCString(pb.str, pb.length);
+		pb.read = new Packet(pb.write->getBufferPtr(), pb.write->getLength());
+
+		runBench("packet.cstring.write", pb.length, NULL, benchCStringWrite, &pb);
+		runBench("packet.cstring.read", pb.length, NULL, benchCStringRead, &pb);
+		delete pb.read;
+	}
+
+	delete pb.write;
+}
+
+
+//=============================================================================
+// ServerAddress
+//=============================================================================
+
+static void benchAddressSet(U64 iterations, void *arg)
+{
+	ServerAddress	addr;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		addr.set("192.168.100.200", (U16)i);
+		gm_BenchSink += addr.address;
+	}
+}
+
+static void benchAddressToString(U64 iterations, void *arg)
+{
+	ServerAddress	*addr = (ServerAddress *)arg;
+	char			*str;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		str = addr->toString();
+		gm_BenchSink += str[0];
+		delete[] str;
+	}
+}
+
+static void benchAddressPutInto(U64 iterations, void *arg)
+{
+	ServerAddress	*addr = (ServerAddress *)arg;
+	netAddress		net;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		addr->putInto(&net);
+		gm_BenchSink += net.getPort();
+	}
+}
+
+static void runAddressBenches(void)
+{
+	ServerAddress addr("192.168.100.200", 28000);
+
+
+	runBench("address.set", 0, NULL, benchAddressSet, NULL);
+	runBench("address.tostring", 0, NULL, benchAddressToString, &addr);
+	runBench("address.putinto", 0, NULL, benchAddressPutInto, &addr);
+}
+
+
+//=============================================================================
+// UniqueStringList
+//=============================================================================
+
+typedef struct tStringBench
+{
+	UniqueStringList			list;
+	std::vector<std::string>	names;		// in the list
+	std::vector<char *>			refs;		// our copies, as the store keeps them
+} tStringBench;
+
+static void benchStringPush(U64 iterations, void *arg)
+{
+	tStringBench	*sb = (tStringBench *)arg;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+		gm_BenchSink += (U64)sb->list.Push(sb->names[i % sb->names.size()].c_str());
+}
+
+static void setupStringPopRef(U64 iterations, void *arg)
+{
+	tStringBench	*sb = (tStringBench *)arg;
+	U64				i;
+
+
+	// references for the run to drop, the strings stay in the list
+	for(i=0; i < iterations; i++)
+		sb->list.Push(sb->names[i % sb->names.size()].c_str());
+}
+
+static void benchStringPopRef(U64 iterations, void *arg)
+{
+	tStringBench	*sb = (tStringBench *)arg;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+		sb->list.PopRef(sb->refs[i % sb->refs.size()]);
+}
+
+static void benchStringGetMatch(U64 iterations, void *arg)
+{
+	tStringBench	*sb = (tStringBench *)arg;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+		gm_BenchSink += (U64)sb->list.GetMatch(sb->names[i % sb->names.size()].c_str());
+}
+
+static void benchStringMiss(U64 iterations, void *arg)
+{
+	U64 i;
+
+
+	for(i=0; i < iterations; i++)
+		gm_BenchSink += (U64)((tStringBench *)arg)->list.GetMatch("NoSuchType");
+}
+
+static void benchStringNew(U64 iterations, void *arg)
+{
+	tStringBench	*sb = (tStringBench *)arg;
+	char			*str;
+	U64				i;
+
+
+	// a string the list doesn't have, created and dropped again
+	for(i=0; i < iterations; i++)
+	{
+		str = sb->list.Push("NewType");
+		sb->list.PopRef(str);
+	}
+}
+
+static void runStringBenches(std::vector<U32> &sizes)
+{
+	tStringBench	*sb;
+	char			name[32];
+	U32				i, j;
+
+
+	for(i=0; i < sizes.size(); i++)
+	{
+		sb = new tStringBench;
+
+		for(j=0; j < sizes[i]; j++)
+		{
+			snprintf(name, sizeof(name), "GameType%u", j);
+			sb->names.push_back(name);
+			sb->refs.push_back(sb->list.Push(name));
+		}
+
+		runBench("strings.push", sizes[i], NULL, benchStringPush, sb);
+		runBench("strings.popref", sizes[i], setupStringPopRef, benchStringPopRef, sb);
+		runBench("strings.getmatch", sizes[i], NULL, benchStringGetMatch, sb);
+		runBench("strings.getmatch.miss", sizes[i], NULL, benchStringMiss, sb);
+		runBench("strings.push_popref.new", sizes[i], NULL, benchStringNew, sb);
+
+		delete sb;
+	}
+}
+
+
+//=============================================================================
+// FloodControl
+//=============================================================================
+
+typedef struct tFloodBench
+{
+	FloodControl				*flood;
+	std::vector<ServerAddress>	peers;
+} tFloodBench;
+
+static void benchCheckPeer(U64 iterations, void *arg)
+{
+	tFloodBench		*fb = (tFloodBench *)arg;
+	tPeerRecord		*peerrec;
+	U64				i;
+
+
+	for(i=0; i < iterations; i++)
+		gm_BenchSink += fb->flood->CheckPeer(fb->peers[i % fb->peers.size()], &peerrec, true);
+}
+
+static void runFloodBenches(std::vector<U32> &sizes)
+{
+	tFloodBench		fb;
+	ServerInfo		info;
+	U32				i, j;
+
+
+	// every packet is a ticket, don't let the peers get banned
+	gm_BenchConfig.floodMaxTickets = 0x7FFFFFFF;
+
+	for(i=0; i < sizes.size(); i++)
+	{
+		fb.flood = new FloodControl();
+		fb.peers.resize(sizes[i]);
+
+		for(j=0; j < sizes[i]; j++)
+		{
+			benchServer(j, &fb.peers[j], &info, NULL, NULL);
+			fb.flood->CheckPeer(fb.peers[j]);
+		}
+
+		runBench("flood.checkpeer", sizes[i], NULL, benchCheckPeer, &fb);
+
+		delete fb.flood;
+	}
+
+	gm_BenchConfig.floodMaxTickets = 300;
+}
+
+
+//=============================================================================
+// ServerStoreRAM
+//=============================================================================
+
+static const char *gm_GameTypes[]	= { "G0", "G1", "G2", "G3" };
+static const char *gm_MissionTypes[]	= { "CTF", "DM" };
+
+typedef struct tStoreBench
+{
+	ServerStoreRAM	*store;
+	U32				size;
+	ServerInfo		update;			// scratch info of the updates
+	Session			session;
+	ServerFilter	filter;
+} tStoreBench;
+
+static void benchStoreUpdate(U64 iterations, void *arg)
+{
+	tStoreBench		*sb = (tStoreBench *)arg;
+	ServerAddress	addr;
+	ServerInfo		*info = &sb->update;
+	U32				*players;
+	U32				n, version, i;
+	U64				it;
+
+
+	// every update changes the server, its mission and players, which stay
+	// its own so the buddy index doesn't grow lopsided.
+	for(it=0; it < iterations; it++)
+	{
+		n		= it % sb->size;
+		version	= (it / sb->size + 1) & 1;
+
+		benchServer(n, &addr, info, gm_GameTypes[n % 4], gm_MissionTypes[version]);
+
+		players = info->playerList.Get();
+		for(i=0; i < info->playerCount(); i++)
+			players[i] += version * 8;
+
+		sb->store->UpdateServer(&addr, info);
+	}
+
+	info->gameType		= NULL;
+	info->missionType	= NULL;
+}
+
+static void benchStoreUnchanged(U64 iterations, void *arg)
+{
+	tStoreBench		*sb = (tStoreBench *)arg;
+	ServerAddress	addr;
+	ServerInfo		*info = &sb->update;
+	U32				n;
+	U64				i;
+
+
+	// the info payload is the same as before, only its fingerprint is looked at
+	for(i=0; i < iterations; i++)
+	{
+		n = i % sb->size;
+
+		addr.addy[0]	= 10;
+		addr.addy[1]	= (n >> 16) & 0xFF;
+		addr.addy[2]	= (n >> 8) & 0xFF;
+		addr.addy[3]	= n & 0xFF;
+		addr.port		= 28000 + (n >> 24);
+
+		info->fingerprint = n +1;
+		sb->store->UpdateServer(&addr, info);
+	}
+
+	info->fingerprint = 0;
+}
+
+static void benchStoreQuery(U64 iterations, void *arg)
+{
+	tStoreBench	*sb = (tStoreBench *)arg;
+	U64			i;
+
+
+	for(i=0; i < iterations; i++)
+	{
+		sb->session.results.clear();
+		sb->store->QueryServers(&sb->session, &sb->filter);
+		gm_BenchSink += sb->session.total;
+	}
+}
+
+static void runStoreBenches(std::vector<U32> &sizes)
+{
+	tStoreBench		*sb;
+	ServerAddress	addr;
+	ServerInfo		info;
+	U32				buddies[4];
+	U32				i, j;
+
+
+	for(i=0; i < sizes.size(); i++)
+	{
+		sb = new tStoreBench;
+		sb->store	= new ServerStoreRAM();
+		sb->size	= sizes[i];
+
+		for(j=0; j < sizes[i]; j++)
+		{
+			benchServer(j, &addr, &info, gm_GameTypes[j % 4], gm_MissionTypes[0]);
+			info.fingerprint = j +1;
+			sb->store->UpdateServer(&addr, &info);
+		}
+
+		info.gameType		= NULL;
+		info.missionType	= NULL;
+
+		runBench("store.update.unchanged", sizes[i], NULL, benchStoreUnchanged, sb);
+
+		// everything, capped to what fits into the list packets
+		benchFilter(&sb->filter);
+		runBench("store.query.any", sizes[i], NULL, benchStoreQuery, sb);
+
+		// a quarter of the servers
+		sb->filter.gameType = (char *)gm_GameTypes[1];
+		runBench("store.query.game", sizes[i], NULL, benchStoreQuery, sb);
+
+		// a few percent of the servers
+		sb->filter.regions		= 2;
+		sb->filter.minPlayers	= 12;
+		runBench("store.query.filtered", sizes[i], NULL, benchStoreQuery, sb);
+
+		// players on four servers spread over the table
+		benchFilter(&sb->filter);
+		for(j=0; j < 4; j++)
+			buddies[j] = (((sizes[i] / 4) * j & ~15) + 5) * 16;
+		sb->filter.buddyCount	= 4;
+		sb->filter.buddyList	= buddies;
+		runBench("store.query.buddy", sizes[i], NULL, benchStoreQuery, sb);
+
+		// the filter doesn't own any of it
+		benchFilter(&sb->filter);
+
+		// last, it replaces the servers' info
+		runBench("store.update", sizes[i], NULL, benchStoreUpdate, sb);
+
+		delete sb->store;
+		delete sb;
+	}
+}
+
+
+//=============================================================================
+// Main
+//=============================================================================
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		   "  -s sizes    comma separated table sizes (default 1000,10000,100000)\n"
+		   "  -l sizes    comma separated string list sizes (default 4,32,256)\n"
+		   "  -t ms       least milliseconds a benchmark runs for (default 200)\n"
+		   "  -b name     only run benchmarks whose name contains this\n",
+		   name);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<U32>	sizes, lists;
+	int					opt;
+
+
+	benchParseSizes("1000,10000,100000", sizes);
+	benchParseSizes("4,32,256", lists);
+
+	while((opt = getopt(argc, argv, "s:l:t:b:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				if(!benchParseSizes(optarg, sizes))
+				{
+					fprintf(stderr, "Bad table sizes \"%s\".\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'l':
+				if(!benchParseSizes(optarg, lists))
+				{
+					fprintf(stderr, "Bad string list sizes \"%s\".\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 't':
+				gm_MinTime = strtoull(optarg, NULL, 10) * 1000000ULL;
+				break;
+
+			case 'b':
+				gm_Only = optarg;
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	initNetworkLib();
+
+	runPacketBenches();
+	runAddressBenches();
+	runStringBenches(lists);
+	runFloodBenches(sizes);
+	runStoreBenches(sizes);
+
+	return 0;
+}
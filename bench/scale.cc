@@ -0,0 +1,413 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "Bench.h"
+#include "ServerStoreRAM.h"
+#include <algorithm>
+#include <unistd.h>
+
+/*
+
+pbms-scale, how the RAM store holds up as the server list grows.
+
+For each table size the store is filled with synthetic servers and then
+measured: memory per server, update throughput, query latency for a few
+representative filters and the time DoProcessing() takes, worst case
+included. One JSON object per line is printed, the first one describes the
+run, the rest are a measurement of one table size each. Some of the lines
+of a Release build's run, the numbers depend on the machine:
+
+	{"metric":"config","heartbeat":180,"snapshot_interval":0,"query_threads":0,"query_parallel_threshold":20000}
+	{"metric":"memory","size":100000,"heap_per_server":578.0,"resident_per_server":649.3,"allocs_per_server":9.50}
+	{"metric":"query.game","size":100000,"samples":105,"results":25000,"mean_us":19219.75,"p50_us":19006.03,"p99_us":24044.52,"max_us":27548.81}
+	{"metric":"update","size":100000,"updates":100000,"ns_per_op":3047.13,"ops_per_sec":328177}
+	{"metric":"doprocessing.expire","size":100000,"samples":2000,"mean_us":20.65,"p50_us":18.31,"p99_us":28.85,"max_us":3010.47}
+
+Latencies are of single calls, max_us is the worst call seen. Heap bytes are
+those allocated through operator new, resident bytes are the growth of the
+process, both include the store's snapshots if they're on.
+
+*/
+
+static U64		gm_Budget		= 2000000000ULL;	// nanoseconds a latency measurement runs for, at most
+static U32		gm_Samples		= 200;				// calls a latency measurement makes, at most
+static U32		gm_MinUpdates	= 100000;			// updates a throughput measurement makes, at least
+
+static const char *gm_GameTypes[]	= { "G0", "G1", "G2", "G3" };
+static const char *gm_MissionTypes[]	= { "CTF", "DM" };
+
+typedef struct tScale
+{
+	ServerStoreRAM	*store;
+	U32				size;
+	U64				updates;		// changing updates made so far
+	ServerInfo		update;			// scratch info of the updates
+	Session			session;
+	ServerFilter	filter;
+} tScale;
+
+
+//=============================================================================
+// Helpers
+//=============================================================================
+
+static double percentile(std::vector<U64> &sorted, U32 pct)
+{
+	if(sorted.empty())
+		return 0;
+
+	return sorted[(sorted.size() -1) * pct / 100] / 1000.0;
+}
+
+static void printLatency(const char *metric, U32 size, std::vector<U64> &took, const char *extra)
+{
+	U64 total = 0;
+	U32 i;
+
+
+	std::sort(took.begin(), took.end());
+
+	for(i=0; i < took.size(); i++)
+		total += took[i];
+
+	printf("{\"metric\":\"%s\",\"size\":%u,\"samples\":%u,%s\"mean_us\":%.2f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f}\n",
+		   metric, size, (U32)took.size(), extra,
+		   took.empty() ? 0.0 : (double)total / took.size() / 1000.0,
+		   percentile(took, 50), percentile(took, 99),
+		   took.empty() ? 0.0 : took.back() / 1000.0);
+	fflush(stdout);
+}
+
+// the n'th server's address, as benchServer() makes it
+static void scaleAddress(U32 n, ServerAddress *addr)
+{
+	addr->addy[0]	= 10;
+	addr->addy[1]	= (n >> 16) & 0xFF;
+	addr->addy[2]	= (n >> 8) & 0xFF;
+	addr->addy[3]	= n & 0xFF;
+	addr->port		= 28000 + (n >> 24);
+}
+
+// change the info of the next server, its mission and players alternate
+static void scaleUpdate(tScale *sc)
+{
+	ServerAddress	addr;
+	ServerInfo		*info = &sc->update;
+	U32				*players;
+	U32				n, version, i;
+
+
+	n		= sc->updates % sc->size;
+	version	= (sc->updates / sc->size + 1) & 1;
+
+	benchServer(n, &addr, info, gm_GameTypes[n % 4], gm_MissionTypes[version]);
+
+	// the players stay the server's own so the buddy index doesn't grow lopsided
+	players = info->playerList.Get();
+	for(i=0; i < info->playerCount(); i++)
+		players[i] += version * 8;
+
+	sc->store->UpdateServer(&addr, info);
+	sc->updates++;
+
+	info->gameType		= NULL;
+	info->missionType	= NULL;
+}
+
+// let the store publish its pending snapshot, if it keeps any
+static void scalePublish(tScale *sc)
+{
+	if(gm_BenchConfig.storeSnapshotInterval)
+		usleep(gm_BenchConfig.storeSnapshotInterval * 1000);
+
+	sc->store->DoProcessing();
+}
+
+
+//=============================================================================
+// Measurements
+//=============================================================================
+
+static void scaleFill(tScale *sc)
+{
+	ServerAddress	addr;
+	ServerInfo		info;
+	S64				live;
+	U64				resident, allocs, start, took;
+	U32				n;
+
+
+	live		= gm_BenchLiveBytes.load(std::memory_order_relaxed);
+	resident	= benchResident();
+	allocs		= gm_BenchAllocs.load(std::memory_order_relaxed);
+	start		= benchNanoTime();
+
+	sc->store = new ServerStoreRAM();
+
+	for(n=0; n < sc->size; n++)
+	{
+		benchServer(n, &addr, &info, gm_GameTypes[n % 4], gm_MissionTypes[0]);
+		info.fingerprint = n +1;
+		sc->store->UpdateServer(&addr, &info);
+	}
+
+	info.gameType		= NULL;
+	info.missionType	= NULL;
+
+	took = benchNanoTime() - start;
+
+	printf("{\"metric\":\"fill\",\"size\":%u,\"ns_per_op\":%.2f}\n",
+		   sc->size, (double)took / sc->size);
+
+	// the snapshot of the servers counts too
+	scalePublish(sc);
+
+	printf("{\"metric\":\"memory\",\"size\":%u,\"heap_per_server\":%.1f,\"resident_per_server\":%.1f,\"allocs_per_server\":%.2f}\n",
+		   sc->size,
+		   (double)(gm_BenchLiveBytes.load(std::memory_order_relaxed) - live) / sc->size,
+		   (double)(S64)(benchResident() - resident) / sc->size,
+		   (double)(gm_BenchAllocs.load(std::memory_order_relaxed) - allocs) / sc->size);
+	fflush(stdout);
+}
+
+static void scaleQuery(tScale *sc, const char *metric)
+{
+	std::vector<U64>	took;
+	char				extra[32];
+	U64					start, end, budget;
+
+
+	budget = benchNanoTime() + gm_Budget;
+
+	do
+	{
+		sc->session.results.clear();
+
+		start = benchNanoTime();
+		sc->store->QueryServers(&sc->session, &sc->filter);
+		end = benchNanoTime();
+
+		took.push_back(end - start);
+	} while(took.size() < gm_Samples && end < budget);
+
+	snprintf(extra, sizeof(extra), "\"results\":%u,", (U32)sc->session.results.size());
+	printLatency(metric, sc->size, took, extra);
+}
+
+static void scaleQueries(tScale *sc)
+{
+	U32 buddies[4];
+	U32 j;
+
+
+	// everything, capped to what fits into the list packets
+	benchFilter(&sc->filter);
+	scaleQuery(sc, "query.any");
+
+	// a quarter of the servers
+	sc->filter.gameType = (char *)gm_GameTypes[1];
+	scaleQuery(sc, "query.game");
+
+	// a few percent of the servers
+	sc->filter.regions		= 2;
+	sc->filter.minPlayers	= 12;
+	scaleQuery(sc, "query.filtered");
+
+	// a type no server has
+	benchFilter(&sc->filter);
+	sc->filter.gameType = (char *)"NoSuchType";
+	scaleQuery(sc, "query.miss");
+
+	// players on four servers spread over the table
+	benchFilter(&sc->filter);
+	for(j=0; j < 4; j++)
+		buddies[j] = (((sc->size / 4) * j & ~15) + 5) * 16;
+	sc->filter.buddyCount	= 4;
+	sc->filter.buddyList	= buddies;
+	scaleQuery(sc, "query.buddy");
+
+	// the filter doesn't own any of it
+	benchFilter(&sc->filter);
+}
+
+static void scaleUpdates(tScale *sc)
+{
+	ServerAddress	addr;
+	U64				count, i, start, took;
+
+
+	count = sc->size < gm_MinUpdates ? gm_MinUpdates : sc->size;
+
+	// the info payload is the same as before, only its fingerprint is looked at
+	start = benchNanoTime();
+	for(i=0; i < count; i++)
+	{
+		scaleAddress(i % sc->size, &addr);
+		sc->store->RefreshServer(&addr, i % sc->size +1);
+	}
+	took = benchNanoTime() - start;
+
+	printf("{\"metric\":\"update.unchanged\",\"size\":%u,\"updates\":%llu,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f}\n",
+		   sc->size, (unsigned long long)count, (double)took / count, count * 1e9 / took);
+
+	// every update changes the server
+	start = benchNanoTime();
+	for(i=0; i < count; i++)
+		scaleUpdate(sc);
+	took = benchNanoTime() - start;
+
+	printf("{\"metric\":\"update\",\"size\":%u,\"updates\":%llu,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f}\n",
+		   sc->size, (unsigned long long)count, (double)took / count, count * 1e9 / took);
+	fflush(stdout);
+}
+
+/**
+ * @brief Time DoProcessing() calls the way the core loop makes them.
+ *
+ * Between calls a loop iteration's worth of servers is updated, so snapshots
+ * have changes to publish. With expire set every server is out of date, each
+ * call removes as many as it checks, which is the most work it does.
+ */
+static void scaleProcessing(tScale *sc, const char *metric, bool expire, U32 calls)
+{
+	std::vector<U64>	took;
+	U64					start, end, budget;
+	U32					i;
+
+
+	if(expire)
+		gm_BenchConfig.heartbeat = 0;
+
+	budget = benchNanoTime() + gm_Budget;
+
+	do
+	{
+		for(i=0; i < 64; i++)
+			scaleUpdate(sc);
+
+		start = benchNanoTime();
+		sc->store->DoProcessing();
+		end = benchNanoTime();
+
+		took.push_back(end - start);
+	} while(took.size() < calls && end < budget);
+
+	gm_BenchConfig.heartbeat = 180;
+
+	printLatency(metric, sc->size, took, "");
+}
+
+static void runScale(U32 size)
+{
+	tScale *sc = new tScale;
+
+
+	sc->size	= size;
+	sc->updates	= 0;
+
+	scaleFill(sc);
+	scaleQueries(sc);
+	scaleUpdates(sc);
+
+	// the updates between calls add back the servers that expired
+	scaleProcessing(sc, "doprocessing", false, gm_Samples * 10);
+	scaleProcessing(sc, "doprocessing.expire", true, gm_Samples * 10);
+
+	delete sc->store;
+	delete sc;
+}
+
+
+//=============================================================================
+// Main
+//=============================================================================
+
+static void usage(const char *name)
+{
+	printf("Usage: %s [options]\n"
+		   "  -s sizes    comma separated table sizes (default 1000,10000,100000,1000000)\n"
+		   "  -n count    most calls per latency measurement (default 200)\n"
+		   "  -t ms       most milliseconds per latency measurement (default 2000)\n"
+		   "  -u count    least updates per throughput measurement (default 100000)\n"
+		   "  -S ms       store::SnapshotInterval, 0 has queries read the list (default 0)\n"
+		   "  -q threads  query::Threads, needs -S (default 0)\n",
+		   name);
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<U32>	sizes;
+	U32					i;
+	int					opt;
+
+
+	benchParseSizes("1000,10000,100000,1000000", sizes);
+
+	while((opt = getopt(argc, argv, "s:n:t:u:S:q:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 's':
+				if(!benchParseSizes(optarg, sizes))
+				{
+					fprintf(stderr, "Bad table sizes \"%s\".\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'n':
+				gm_Samples = strtoul(optarg, NULL, 10);
+				if(!gm_Samples)
+					gm_Samples = 1;
+				break;
+
+			case 't':
+				gm_Budget = strtoull(optarg, NULL, 10) * 1000000ULL;
+				break;
+
+			case 'u':
+				gm_MinUpdates = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'S':
+				gm_BenchConfig.storeSnapshotInterval = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'q':
+				gm_BenchConfig.queryThreads = strtoul(optarg, NULL, 10);
+				break;
+
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	initNetworkLib();
+
+	printf("{\"metric\":\"config\",\"heartbeat\":%u,\"snapshot_interval\":%u,\"query_threads\":%u,\"query_parallel_threshold\":%u}\n",
+		   gm_BenchConfig.heartbeat, gm_BenchConfig.storeSnapshotInterval,
+		   gm_BenchConfig.queryThreads, gm_BenchConfig.queryParallelThreshold);
+
+	for(i=0; i < sizes.size(); i++)
+		runScale(sizes[i]);
+
+	return 0;
+}
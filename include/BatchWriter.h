@@ -0,0 +1,193 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _BATCHWRITER_H_
+#define _BATCHWRITER_H_
+
+#include "commonTypes.h"
+#include <pthread.h>
+
+
+/**
+ * @brief Thread that writes batches built by the core thread.
+ *
+ * There are two batches, the core thread fills one while the writer writes
+ * the other. Submit() swaps them and wakes the writer, which calls the write
+ * function on the batch without the lock held. Until Idle() says the writer
+ * is done the core thread must only touch Filling(), after that Written()
+ * holds what the write function left in the last batch.
+ *
+ * The lock is the writer's, the owner may use it for state it shares with
+ * the write function, such as counters. An owner whose writer didn't start
+ * would only pile up batches, it should count itself as not open.
+ */
+template <class T>
+class BatchWriter
+{
+public:
+	typedef void (*tWriteFunc)(T *batch, void *arg);
+
+private:
+	tWriteFunc			m_Write;
+	void				*m_Arg;
+
+	pthread_t			m_Thread;
+	bool				m_ThreadOK;
+	pthread_mutex_t		m_Lock;
+	pthread_cond_t		m_Wake;			// a batch is ready, or time to stop
+	pthread_cond_t		m_Idle;			// the batch was written
+	bool				m_Running;
+	bool				m_Busy;			// the writer has a batch
+	T					m_Batches[2];
+	T					*m_Filling;		// built by the core thread
+	T					*m_Writing;		// written by the writer thread
+
+	static void* ThreadMain(void *arg)
+	{
+		BatchWriter	*writer = (BatchWriter *)arg;
+
+
+		pthread_mutex_lock(&writer->m_Lock);
+
+		while(writer->m_Running || writer->m_Busy)
+		{
+			if(!writer->m_Busy)
+			{
+				pthread_cond_wait(&writer->m_Wake, &writer->m_Lock);
+				continue;
+			}
+
+			pthread_mutex_unlock(&writer->m_Lock);
+
+			writer->m_Write(writer->m_Writing, writer->m_Arg);
+
+			pthread_mutex_lock(&writer->m_Lock);
+			writer->m_Busy = false;
+			pthread_cond_signal(&writer->m_Idle);
+		}
+
+		pthread_mutex_unlock(&writer->m_Lock);
+
+		return NULL;
+	}
+
+public:
+	BatchWriter()
+	{
+		m_Write		= NULL;
+		m_Arg		= NULL;
+		m_ThreadOK	= false;
+		m_Running	= true;
+		m_Busy		= false;
+		m_Filling	= &m_Batches[0];
+		m_Writing	= &m_Batches[1];
+
+		pthread_mutex_init(&m_Lock, NULL);
+		pthread_cond_init(&m_Wake, NULL);
+		pthread_cond_init(&m_Idle, NULL);
+	}
+
+	~BatchWriter()
+	{
+		Stop();
+
+		pthread_cond_destroy(&m_Idle);
+		pthread_cond_destroy(&m_Wake);
+		pthread_mutex_destroy(&m_Lock);
+	}
+
+	// start the writer, it calls write(batch, arg) for each batch
+	bool	Start(tWriteFunc write, void *arg)
+	{
+		m_Write		= write;
+		m_Arg		= arg;
+		m_ThreadOK = !pthread_create(&m_Thread, NULL, ThreadMain, this);
+		return m_ThreadOK;
+	}
+
+	// write the batch the writer has and stop it
+	void	Stop()
+	{
+		if(!m_ThreadOK)
+			return;
+
+		pthread_mutex_lock(&m_Lock);
+		m_Running = false;
+		pthread_cond_signal(&m_Wake);
+		pthread_mutex_unlock(&m_Lock);
+
+		pthread_join(m_Thread, NULL);
+		m_ThreadOK = false;
+	}
+
+	bool	IsRunning()		{ return m_ThreadOK; }
+
+	void	Lock()			{ pthread_mutex_lock(&m_Lock); }
+	void	Unlock()		{ pthread_mutex_unlock(&m_Lock); }
+
+	T*		Filling()		{ return m_Filling; }
+	T*		Written()		{ return m_Writing; }
+
+	/**
+	 * @brief Check the writer is done with the last batch.
+	 *
+	 * @param	wait	Wait for it instead of returning false.
+	 */
+	bool	Idle(bool wait)
+	{
+		bool idle;
+
+
+		pthread_mutex_lock(&m_Lock);
+
+		while(m_Busy && wait)
+			pthread_cond_wait(&m_Idle, &m_Lock);
+
+		idle = !m_Busy;
+		pthread_mutex_unlock(&m_Lock);
+
+		return idle;
+	}
+
+	/**
+	 * @brief Hand the filled batch to the writer, the other one is filled next.
+	 *
+	 * The writer must be idle.
+	 *
+	 * @param	wait	Wait for the batch to be written.
+	 */
+	void	Submit(bool wait)
+	{
+		T *batch = m_Filling;
+
+
+		pthread_mutex_lock(&m_Lock);
+		m_Filling	= m_Writing;
+		m_Writing	= batch;
+		m_Busy		= true;
+		pthread_cond_signal(&m_Wake);
+
+		while(m_Busy && wait)
+			pthread_cond_wait(&m_Idle, &m_Lock);
+
+		pthread_mutex_unlock(&m_Lock);
+	}
+};
+
+#endif // _BATCHWRITER_H_
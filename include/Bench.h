@@ -0,0 +1,66 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include "masterd.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+
+Shared by the benchmark programs. They link the store and flood control
+sources of masterd without its core, these stand in for the core's
+globals and count the allocations made through operator new.
+
+*/
+
+
+// configuration the store and flood control read, masterd's defaults
+extern tDaemonConfig	gm_BenchConfig;
+
+// operator new calls and bytes since the program started, atomic because
+// the query pool's threads allocate too
+extern std::atomic<U64>	gm_BenchAllocs;
+extern std::atomic<U64>	gm_BenchAllocBytes;
+
+// heap bytes held by operator new allocations right now, as malloc sizes them
+extern std::atomic<S64>	gm_BenchLiveBytes;
+
+// keeps results the compiler would otherwise drop
+extern volatile U64		gm_BenchSink;
+
+// monotonic nanoseconds
+U64		benchNanoTime(void);
+
+// bytes of resident memory of the process, 0 if unknown
+U64		benchResident(void);
+
+// comma separated list of numbers
+bool	benchParseSizes(const char *list, std::vector<U32> &sizes);
+
+// synthetic server info, the n'th of a table of servers
+void	benchServer(U32 n, ServerAddress *addr, ServerInfo *info, const char *game, const char *mission);
+
+// a filter matching everything, the caller sets what it filters on
+void	benchFilter(ServerFilter *filter);
+
+#endif // _BENCH_H_
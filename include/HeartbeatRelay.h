@@ -0,0 +1,110 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _HEARTBEATRELAY_H_
+#define _HEARTBEATRELAY_H_
+
+#include "masterd.h"
+#include "RelayProtocol.h"
+#include <map>
+#include <vector>
+
+// milliseconds between info requests to the same game server
+#define RELAY_REQUEST_WINDOW	5000
+
+
+typedef struct tRelayedServer
+{
+	U64					lastHeart;		// when it last heartbeat us
+	U64					asked;			// when we last asked it for info, 0 if never
+	U64					forwarded;		// when its info was last forwarded, 0 if never
+	U64					fingerprint;	// hash of its info
+	U16					session;		// session and key of the last info request
+	U16					key;
+	bool				changed;		// info changed since it was last forwarded
+	std::vector<char>	info;			// info payload, empty until it answered
+} tRelayedServer;
+
+// by ((U64)address << 16) | port, same as the master's store
+typedef std::map<U64, tRelayedServer> tcRelayedServers;
+
+typedef struct tHeartbeatRelayStats
+{
+	U64		heartbeats;		// heartbeats received
+	U64		requests;		// info requests sent
+	U64		responses;		// info responses taken
+	U64		updates;		// updates sent to the master
+	U64		forwarded;		// servers they carried
+	U64		expired;		// servers that stopped heartbeating
+	U64		oversized;		// info too large to fit an update
+} tHeartbeatRelayStats;
+
+
+//=============================================================================
+// Heartbeat Relay
+//=============================================================================
+
+/**
+ * @brief Stands in for the master to the game servers of a hosting site.
+ *
+ * Game servers heartbeat the relay instead of the master, the relay asks them
+ * for their info the same way the master does. Once per interval the info of
+ * every server that changed, or wasn't forwarded in the refresh time, is sent
+ * on to the master in MasterRelayUpdates signed with the shared secret.
+ */
+class HeartbeatRelay
+{
+private:
+	MasterdTransport		*m_Transport;
+	ServerAddress			m_Master;
+	U8						m_Key[16];
+	U64						m_Interval;		// milliseconds between updates
+	U64						m_Refresh;		// milliseconds before unchanged info is forwarded again
+	U64						m_Expire;		// milliseconds without a heartbeat before a server is dropped
+	U64						m_NextUpdate;
+	U64						m_Sequence;
+	U32						m_Random;		// state of the session and key generator
+	tcRelayedServers		m_Servers;
+
+	// updates being built and sent
+	std::vector<char>		m_Buffers;
+	std::vector<tOutDatagram>	m_Out;
+
+	tHeartbeatRelayStats	m_Stats;
+
+	void	Heartbeat(ServerAddress *from, U64 slot, tPacketHeader &header, Packet *pack);
+	void	InfoResponse(U64 slot, tPacketHeader &header, Packet *pack);
+	void	TakeInfo(tRelayedServer *srv, Packet *pack);
+	void	Seal(size_t start, U8 count);
+	void	Forward(void);
+
+public:
+	HeartbeatRelay(MasterdTransport *transport, ServerAddress *master, const char *secret,
+				   U32 interval, U32 refresh, U32 expire);
+
+	void	Message(ServerAddress *from, Packet *pack);
+	void	DoProcessing(void);
+
+	U32		Count()		{ return m_Servers.size(); }
+
+	tHeartbeatRelayStats&	GetStats()	{ return m_Stats; }
+	void					Report(void);
+};
+
+#endif // _HEARTBEATRELAY_H_
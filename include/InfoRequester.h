@@ -0,0 +1,158 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _INFOREQUESTER_H_
+#define _INFOREQUESTER_H_
+
+#include "masterd.h"
+#include "Statistics.h"
+#include "TokenBucket.h"
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// number of queued info requests that are sent right away instead of at the
+// end of the loop iteration.
+#define INFO_REQUEST_BATCH		64
+
+// most times the refresh retry delay is doubled
+#define INFO_REFRESH_BACKOFF	6
+
+
+typedef struct tInfoRequest
+{
+	U64		sent;			// when the last info request was sent, 0 if never
+	U64		received;		// when info was last received, 0 if never
+	U64		refreshDue;		// when to ask for info again, 0 if not
+	U16		session;		// session and key of the last info request
+	U16		key;
+	U8		pending;		// queued to be sent
+	U8		outstanding;	// sent and not answered yet
+	U8		retries;		// refresh requests sent since info was received
+} tInfoRequest;
+
+typedef std::unordered_map<U64, tInfoRequest> tcInfoRequests;
+
+// a server's refresh, superseded if the server's refreshDue is different
+typedef struct tRefresh
+{
+	U64		due;
+	U64		slot;
+
+	bool operator>(const tRefresh &r) const	{ return due > r.due; }
+} tRefresh;
+
+typedef std::priority_queue<tRefresh, std::vector<tRefresh>, std::greater<tRefresh> > tcRefreshQueue;
+
+typedef struct tPendingRequest
+{
+	ServerAddress	addr;
+	tInfoRequest	*req;
+	char			data[PACKET_HEADER_SIZE];	// the GameMasterInfoRequest
+} tPendingRequest;
+
+typedef struct tInfoRequestStats
+{
+	U64			heartbeats;		// heartbeats received
+	U64			infoHeartbeats;	// heartbeats carrying info that went straight to the store
+	U64			badTokens;		// heartbeats carrying info under a token we didn't issue
+	U64			coalesced;		// heartbeats that didn't need an info request
+	U64			sent;			// info requests sent
+	U64			batches;		// batches they were sent in
+	U64			answered;		// info responses to an outstanding request
+	U64			unsolicited;	// info responses to no or another request
+	Histogram	responseTime;	// milliseconds from info request to response
+
+	U64			refreshes;		// refresh requests sent
+	U64			retries;		// of which were retries
+	U64			givenUp;		// servers that expired without answering
+	U64			rateLimited;	// times refreshes waited for the rate cap
+} tInfoRequestStats;
+
+
+//=============================================================================
+// Info Requests
+//=============================================================================
+
+/**
+ * @brief Sends the GameMasterInfoRequests heartbeats ask for.
+ *
+ * Heartbeats of a server within the request window of its last info request
+ * are coalesced, they only tell the store the server is still around. Info
+ * requests are queued and sent in batches at the end of the loop iteration.
+ * The last request sent to each server is tracked until it's answered, an
+ * unanswered request is asked again by the first heartbeat after the window.
+ *
+ * The session and key of an info request are a token only we can issue,
+ * derived from the server's address, our secret and the time. A heartbeat
+ * that carries the server's info along with a token we issued is as good as
+ * the info response, it's stored right away without a request.
+ *
+ * Servers are also asked for info once their info reaches the refresh age,
+ * instead of waiting on a heartbeat that may have been lost. Unanswered
+ * refreshes are retried at doubling intervals until the server expires.
+ * Refresh requests are sent in the order they're due, no faster than the
+ * refresh rate allows, so they're spread out over time.
+ */
+class InfoRequester
+{
+private:
+	tcInfoRequests					m_Requests;		// by server slot
+	std::vector<tPendingRequest>	m_Pending;		// info requests to send
+	std::vector<tOutDatagram>		m_Out;			// scratch list for the transport
+	U64								m_Window;		// milliseconds between info requests to a server
+	U64								m_NextSweep;	// when to forget old requests next
+	U8								m_Secret[16];	// key of the session and key tokens
+	U32								m_TokenLifetime;	// seconds a token is valid for, at least
+
+	// refreshes
+	tcRefreshQueue					m_Refreshes;	// by due time
+	U64								m_RefreshAge;	// milliseconds of info age to refresh at, 0 for none
+	U64								m_RefreshRetry;	// milliseconds before the first retry
+	U64								m_Expire;		// milliseconds of info age a server expires at
+	TokenBucket						m_RefreshRate;	// refreshes per second
+
+	tInfoRequestStats				m_Stats;
+
+	U32			Token(ServerAddress *addr, U32 epoch);
+	void		Queue(ServerAddress *addr, tInfoRequest *req);
+	void		Schedule(U64 slot, tInfoRequest *req, U64 due);
+	void		Refresh(U64 now);
+
+public:
+	InfoRequester(U32 window, U32 refreshAge, U32 refreshRate, U32 refreshRetry, U32 tokenLifetime);
+
+	void	Heartbeat(ServerAddress *addr);
+	bool	InfoHeartbeat(ServerAddress *addr, U16 session, U16 key);
+	void	Answered(ServerAddress *addr, U16 session, U16 key);
+	void	Received(ServerAddress *addr);
+	void	Relayed(ServerAddress *addr);
+
+	bool	Pending()	{ return !m_Pending.empty(); }
+	void	Flush(void);
+	void	DoProcessing(void);
+
+	tInfoRequestStats&	GetStats()	{ return m_Stats; }
+	void				Report(void);
+};
+
+extern InfoRequester	*gm_pInfoRequester;
+
+#endif // _INFOREQUESTER_H_
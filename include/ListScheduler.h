@@ -0,0 +1,102 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _LISTSCHEDULER_H_
+#define _LISTSCHEDULER_H_
+
+#include "commonTypes.h"
+#include "SessionHandler.h"
+#include "Statistics.h"
+
+// list packets per second a peer's rate grows by for every list it received
+// without asking for any packets again.
+#define LIST_RATE_STEP			50
+
+// a burst of resend requests comes from the same loss, don't decrease the
+// rate more than once within this many milliseconds.
+#define LIST_RATE_HOLD			250
+
+
+typedef struct tSchedulerStats
+{
+	U64		packets;		// list packets sent
+	U64		turns;			// turns given to sessions
+	U64		lists;			// lists sent completely
+	U32		active;			// sessions with packets left to send now
+	U32		activeMax;		// most sessions with packets left at once
+
+	U64		resends;		// list packets resent
+	U64		rateCuts;		// times a rate was decreased
+	Histogram	completeTime;	// milliseconds from query to last packet sent
+	Histogram	listBytes;		// bytes sent per list, resends included
+} tSchedulerStats;
+
+
+//=============================================================================
+// List Transmission Scheduler
+//=============================================================================
+
+/**
+ * @brief Interleaves the list packets of all sessions with lists to send.
+ *
+ * Sessions with packets left to send are kept in a ring which is served in
+ * round-robin order, each session sending up to a quantum of packets per
+ * turn. Every run sends no more than the budget of packets so a huge list
+ * can't hold up reading the next datagram. New sessions are inserted at the
+ * cursor, they're served on the next run and small lists complete right away
+ * no matter how many large ones are streaming.
+ *
+ * Each session is paced at the list rate of its peer, a quantum of packets
+ * goes out as a burst and the next burst waits until the rate allows it.
+ * The rate adapts to loss in additive-increase, multiplicative-decrease
+ * fashion: a resend request halves it, a list received without any resend
+ * requests raises it by LIST_RATE_STEP. Peers keep their rate between
+ * queries.
+ */
+class ListScheduler
+{
+private:
+	Session			*m_Cursor;		// session served next, NULL if none
+	U32				m_Quantum;		// packets per session turn
+	U32				m_Budget;		// packets per run
+	U64				m_Wake;			// when the next session may send
+	tSchedulerStats	m_Stats;
+
+	void	Finish(Session *ps);
+
+public:
+	ListScheduler(U32 quantum, U32 budget);
+
+	void	Add(Session *ps);
+	void	Remove(Session *ps);
+	void	Run(void);
+	void	Resent(Session *ps, U32 bytes);
+
+	bool				Pending()	{ return m_Cursor != NULL; }
+	int					Timeout(int timeout);
+	tSchedulerStats&	GetStats()	{ return m_Stats; }
+	void				Report(void);
+
+	// session pool free hook
+	static void	SessionFreed(Session *ps);
+};
+
+extern ListScheduler	*gm_pListScheduler;
+
+#endif // _LISTSCHEDULER_H_
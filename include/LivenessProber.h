@@ -0,0 +1,122 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _LIVENESSPROBER_H_
+#define _LIVENESSPROBER_H_
+
+#include "masterd.h"
+#include "TokenBucket.h"
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+
+typedef struct tProbe
+{
+	U64		due;			// when to probe next
+	U16		session;		// session and key of the last probe
+	U16		key;
+	U8		misses;			// probes sent since the server was last heard from
+	U8		suspect;		// store was told the server is suspect
+} tProbe;
+
+typedef std::unordered_map<U64, tProbe> tcProbes;
+
+// a server's probe, superseded if the server's due is different
+typedef struct tProbeTimer
+{
+	U64		due;
+	U64		slot;
+
+	bool operator>(const tProbeTimer &t) const	{ return due > t.due; }
+} tProbeTimer;
+
+typedef std::priority_queue<tProbeTimer, std::vector<tProbeTimer>, std::greater<tProbeTimer> > tcProbeQueue;
+
+typedef struct tOutProbe
+{
+	ServerAddress	addr;
+	char			data[PACKET_HEADER_SIZE];	// the GamePingRequest
+} tOutProbe;
+
+typedef struct tProbeStats
+{
+	U64		sent;			// probes sent
+	U64		answered;		// ping responses to an outstanding probe
+	U64		unsolicited;	// ping responses to no or another probe
+	U64		suspected;		// servers that missed a probe
+	U64		cleared;		// suspects heard from again
+	U64		evicted;		// servers dropped after missing every probe
+	U64		deferred;		// times probes waited for the rate cap or the socket
+} tProbeStats;
+
+
+//=============================================================================
+// Liveness Probes
+//=============================================================================
+
+/**
+ * @brief Pings game servers that have gone quiet.
+ *
+ * A server that hasn't been heard from in the quiet time is sent a
+ * GamePingRequest, and another each probe interval after. A server that
+ * misses a probe is marked suspect in the store, which lists it last or not
+ * at all. It's dropped from the store once it has missed the maximum number
+ * of probes, and cleared the moment it's heard from again.
+ *
+ * Probes are sent in the order they're due, no faster than the probe rate
+ * and only while the socket keeps up, at the lowest send priority.
+ */
+class LivenessProber
+{
+private:
+	tcProbes				m_Probes;		// by server slot
+	tcProbeQueue			m_Queue;		// by due time
+	std::vector<tOutProbe>	m_Pending;		// probes to send
+	std::vector<tOutDatagram>	m_Out;		// scratch list for the transport
+	U64						m_Quiet;		// milliseconds of silence before the first probe, 0 for none
+	U64						m_Interval;		// milliseconds between probes
+	U32						m_MaxMisses;	// probes missed before a server is dropped
+	TokenBucket				m_Rate;			// probes per second
+	U32						m_Random;		// state of the session and key generator
+	tProbeStats				m_Stats;
+
+	void		Schedule(U64 slot, tProbe *probe, U64 due);
+	void		Heard(U64 slot, tProbe *probe);
+	void		Send(void);
+
+public:
+	LivenessProber(U32 quiet, U32 interval, U32 maxMisses, U32 rate);
+
+	bool	Enabled()	{ return m_Quiet != 0; }
+
+	void	Track(ServerAddress *addr);
+	void	Heartbeat(ServerAddress *addr);
+	void	Relayed(ServerAddress *addr);
+	void	Answered(ServerAddress *addr, U16 session, U16 key);
+	void	DoProcessing(void);
+
+	tProbeStats&	GetStats()	{ return m_Stats; }
+	void			Report(void);
+};
+
+extern LivenessProber	*gm_pProber;
+
+#endif // _LIVENESSPROBER_H_
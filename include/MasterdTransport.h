@@ -22,10 +22,142 @@
 #define _MASTERDTRANSPORT_H_
 
 #include "network.h"
+#include "packetconf.h"
+#include "Statistics.h"
+#include "SPSCRing.h"
 #include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netinet/in.h>
 
 class netSocket;
 
+// most segments and bytes the kernel accepts in a single UDP GSO send
+#define GSO_MAX_SEGMENTS	64
+#define GSO_MAX_BYTES		63000
+
+// number of datagrams the outbound queue holds while the socket is busy
+#define SEND_QUEUE_SIZE		1024
+
+// number of datagrams sendBatched() hands to the kernel per sendmmsg call
+#define SEND_BATCH_SIZE		64
+
+// how long to wait before retrying the queue after the device ran out of
+// buffers, the socket stays writable then so POLLOUT is no use.
+#define SEND_RETRY_MS		1
+
+/**
+ * @brief Outbound datagram priorities.
+ *
+ * When the outbound queue is full the lowest priority datagrams are dropped
+ * first. Probes and info requests are cheap to lose as they're asked again,
+ * list resends are what clients are waiting on the longest.
+ */
+enum eSendPriority
+{
+	SEND_PRIORITY_PROBE = 0,		// GamePingRequest to quiet game servers
+	SEND_PRIORITY_INFOREQUEST,		// GameMasterInfoRequest to game servers
+	SEND_PRIORITY_NORMAL,			// single packet responses
+	SEND_PRIORITY_LIST,				// list responses
+	SEND_PRIORITY_LISTRESEND,		// list packets a client asked again for
+
+	SEND_PRIORITIES
+};
+
+/**
+ * @brief A datagram handed to sendBatched().
+ */
+typedef struct tOutDatagram
+{
+	ServerAddress	*to;		// destination
+	const char		*data;
+	U16				length;
+} tOutDatagram;
+
+typedef struct tTransportStats
+{
+	U64		gsoSends;		// segmented sends done by a single sendmsg
+	U64		gsoSegments;	// datagrams sent by segmented sends
+	U64		batchSends;		// sendmmsg calls made by sendBatched()
+	U64		batchDatagrams;	// datagrams sent by those calls
+
+	U64		queued;							// datagrams queued on a busy socket
+	U64		dropped[SEND_PRIORITIES];		// datagrams dropped on a full queue
+	U64		errors;							// datagrams lost to other send errors
+	U32		queueDepth;						// datagrams in queue now
+	U32		queueDepthMax;					// most datagrams in queue ever
+
+	U64		received;						// datagrams received
+	U32		rxDrops;						// datagrams the kernel dropped on a full receive buffer
+	U32		recvBufferSize;					// receive buffer size, as the kernel reports it
+	U32		sendBufferSize;					// send buffer size, as the kernel reports it
+	Histogram	queueDelay;					// microseconds from kernel receive to processing
+} tTransportStats;
+
+typedef struct tSendSlot
+{
+	struct sockaddr_in	to;						// destination
+	U16					length;					// datagram length
+	char				data[MAX_PACKET_SIZE];	// datagram
+} tSendSlot;
+
+typedef struct tSendRing
+{
+	tSendSlot	*slots[SEND_QUEUE_SIZE];
+	U32			head;		// oldest datagram
+	U32			count;		// number of datagrams
+} tSendRing;
+
+// largest datagram received
+#define RECV_BUFFER_SIZE	2500
+
+// pipelined mode, number of slots in each of the rings between the receive,
+// processing and send threads, must be a power of 2.
+#define PIPE_RING_SIZE		1024
+
+// most datagrams the receive and send threads move with a single syscall
+#define PIPE_RECV_BATCH		32
+#define PIPE_SEND_BATCH		128
+
+// how often, in milliseconds, idle pipeline threads check whether to stop
+#define PIPE_IDLE_MS		100
+
+typedef struct tPipeSlot
+{
+	struct sockaddr_in	addr;					// source or destination
+	struct timespec		stamp;					// kernel receive time
+	U32					rxDrops;				// kernel drop count at receive
+	U16					length;					// datagram length, 0 if dropped
+	char				data[RECV_BUFFER_SIZE];	// datagram
+} tPipeSlot;
+
+typedef SPSCRing<tPipeSlot, PIPE_RING_SIZE> tPipeRing;
+
+// pipelined mode statistics, written by the thread of the stage only
+typedef struct tPipelineStats
+{
+	std::atomic<U64>	rxBatches;		// receive syscalls that returned datagrams
+	std::atomic<U64>	rxDatagrams;	// datagrams received
+	std::atomic<U64>	rxStalls;		// receive thread found the ring full
+	std::atomic<U64>	procWaits;		// processing thread found the ring empty
+	std::atomic<U64>	procStalls;		// processing thread found the send ring full
+	std::atomic<U64>	txBatches;		// send syscalls
+	std::atomic<U64>	txDatagrams;	// datagrams sent
+	std::atomic<U64>	txSegments;		// datagrams sent as part of a GSO run
+	std::atomic<U64>	txErrors;		// datagrams lost to send errors
+	std::atomic<U64>	txWaits;		// send thread found the ring empty
+
+	tPipelineStats()
+	{
+		rxBatches = rxDatagrams = rxStalls = 0;
+		procWaits = procStalls = 0;
+		txBatches = txDatagrams = txSegments = txErrors = txWaits = 0;
+	}
+} tPipelineStats;
+
+// received datagram filter, returns false to have the datagram dropped
+typedef bool (*tPacketFilter)(const char *buff, int length);
+
 /**
  * @brief A simple wrapper class to abstract networking details.
  *
@@ -54,13 +186,77 @@ private:
 	struct pollfd pfdArray[1];	// we're only working with one socket
 	nfds_t pfdCount;			// poll() FD count
 
+	tPacketFilter	filter;		// drops datagrams before they're handed out
+
+	bool			gsoOK;		// kernel supports UDP generic segmentation offload
+	tTransportStats	stats;
+
+	// outbound queue, a ring per priority and the unused slots
+	tSendSlot		*sendSlots;
+	tSendSlot		*sendFree[SEND_QUEUE_SIZE];
+	U32				sendFreeCount;
+	tSendRing		sendQueue[SEND_PRIORITIES];
+	bool			sendWaitOut;	// waiting on POLLOUT to flush the queue
+
+	// kernel receive time of the datagram last handed out, zero if unknown
+	struct timespec	recvStamp;
+
+	// pipelined mode, receive and send threads connected to the processing
+	// thread (the one calling poll() and send*()) by rings.
+	bool				pipelined;
+	std::atomic<bool>	pipeRunning;
+	pthread_t			recvThread;
+	pthread_t			sendThread;
+	tPipeRing			*rxRing;		// receive thread -> processing thread
+	tPipeRing			*txRing;		// processing thread -> send thread
+	int					rxEvent;		// wakes the processing thread
+	int					txEvent;		// wakes the send thread
+	std::atomic<bool>	rxSleeping;		// processing thread waits on rxEvent
+	std::atomic<bool>	txSleeping;		// send thread waits on txEvent
+	tPipelineStats		pstats;
+
+	static void toSockAddr(ServerAddress *addr, struct sockaddr_in *sin);
+	static void wakeEvent(int event, std::atomic<bool> &sleeping);
+	static void waitEvent(int event, std::atomic<bool> &sleeping, tPipeRing *ring, int timeout);
+
+	static void* recvThreadMain(void *transport);
+	static void* sendThreadMain(void *transport);
+	void recvBatch(void);
+	void sendBatch(void);
+	bool pollPipeline(Packet **data, ServerAddress **from, int timeout);
+	void pipeDatagram(const char *buff, size_t length, struct sockaddr_in *to);
+	void pipeDatagrams(const char *buff, size_t length, U16 segSize, struct sockaddr_in *to);
+
+	bool sendDatagram(const char *buff, size_t length, struct sockaddr_in *to, U8 priority);
+	void queueDatagram(const char *buff, size_t length, struct sockaddr_in *to, U8 priority);
+	void flushQueue(void);
+	static bool isBusyError(int err);
+
 public:
 	MasterdTransport(char * host, short port);
 	~MasterdTransport();
 
 	bool GetStatus(void);
+	void SetFilter(tPacketFilter filter);
+	void SetBufferSizes(U32 recvSize, U32 sendSize);
+
+	// pipelined mode, receive and send on threads of their own
+	bool StartPipeline(void);
+	void StopPipeline(void);
+	bool IsPipelined(void)	{ return pipelined; }
+	void ReportPipeline(void);
+
+	// whether more datagrams would only pile up waiting for the socket
+	bool SendBusy(void);
 	bool poll(Packet ** data, ServerAddress ** from, int timeout);
-	void sendPacket(Packet * data, ServerAddress * to);
+	void sendPacket(Packet * data, ServerAddress * to, U8 priority = SEND_PRIORITY_NORMAL);
+	void sendSegmented(Packet * data, U16 segSize, ServerAddress * to, U8 priority = SEND_PRIORITY_LIST);
+	void sendBatched(const tOutDatagram *dgrams, U32 count, U8 priority = SEND_PRIORITY_NORMAL);
+
+	// account for the queueing delay of the datagram last handed out
+	void MessageStarted(void);
+
+	tTransportStats& GetStats(void)	{ return stats; }
 };
 
 #endif
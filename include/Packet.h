@@ -133,11 +133,14 @@ class Packet
 
 		// Helper funcs
 		size_t	getLength();
+		size_t	getSize();
 		char*	getBufferCopy();
 		char*	getBufferPtr();
 		
 		void	writeHeader(U8 type, U8 flags, U16 session, U16 key);
 		void	writeHeader(tPacketHeader &header);
+		void	rewriteHeader(U8 type, U8 flags, U16 session, U16 key);
+		void	reset();
 		void	readHeader(U8 &type, U8 &flags, U16 &session, U16 &key);
 		void	readHeader(tPacketHeader &header);
 
@@ -0,0 +1,115 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _PLAYERLIST_H_
+#define _PLAYERLIST_H_
+
+#include "commonTypes.h"
+#include <stddef.h>
+
+// number of player GUIDs stored inside of the PlayerList itself, this is
+// however many fit in the space of the block pointer it shares storage with.
+#define PLAYERLIST_INLINE		(sizeof(void *) / sizeof(U32))
+
+// number of slab size classes, class N holds (4 << (N-1)) GUIDs, class 0 is
+// the inline storage. Last class must be able to hold 255 players.
+#define PLAYERSLAB_CLASSES		8
+
+// size in bytes of each chunk the slab carves its blocks out of
+#define PLAYERSLAB_CHUNK_SIZE	65536
+
+
+//=============================================================================
+// Player GUID Slab Allocator
+//=============================================================================
+
+/**
+ * @brief Size-class allocator for player GUID arrays.
+ *
+ * Blocks are carved out of large chunks and returned to a per-class free list
+ * once released, they are never handed back to the heap. This keeps the
+ * steady state of servers updating their player lists free of any heap
+ * allocations and without the per-allocation malloc overhead.
+ */
+class PlayerSlab
+{
+private:
+	static U32		*m_FreeList[PLAYERSLAB_CLASSES];	// released blocks per class
+	static char		*m_Chunk;							// chunk currently being carved
+	static size_t	m_ChunkUsed;						// bytes carved from current chunk
+	static size_t	m_Reserved;							// total bytes of all chunks
+	static size_t	m_InUse[PLAYERSLAB_CLASSES];		// blocks handed out per class
+
+public:
+	static U8		ClassFor(U32 count);
+	static U32		ClassCapacity(U8 cls);
+
+	static U32*		Alloc(U8 cls);
+	static void		Free(U32 *block, U8 cls);
+
+	// statistics
+	static size_t	BytesReserved()	{ return m_Reserved; }
+	static size_t	BytesInUse();
+};
+
+
+//=============================================================================
+// Player GUID List
+//=============================================================================
+
+/**
+ * @brief Compact storage of a server's player GUIDs.
+ *
+ * Small lists live inline in the record, larger lists use a block from the
+ * PlayerSlab. Assigning a list that fits in the current capacity reuses the
+ * storage in place instead of reallocating it.
+ */
+class PlayerList
+{
+private:
+	union
+	{
+		U32		m_Inline[PLAYERLIST_INLINE];	// inline storage (class 0)
+		U32		*m_Block;						// slab block (class 1+)
+	};
+	U8		m_Count;		// number of GUIDs in list
+	U8		m_Class;		// storage size class
+
+public:
+	PlayerList()	{ m_Block = NULL; m_Count = 0; m_Class = 0; }
+	PlayerList(const PlayerList &list)	{ m_Block = NULL; m_Count = 0; m_Class = 0; Assign(list); }
+	~PlayerList()	{ Release(); }
+
+	PlayerList& operator=(const PlayerList &list)	{ Assign(list); return *this; }
+
+	U8			Count() const	{ return m_Count; }
+	U32			Capacity() const	{ return PlayerSlab::ClassCapacity(m_Class); }
+	U32*		Get()			{ return m_Class ? m_Block : m_Inline; }
+	const U32*	Get() const		{ return m_Class ? m_Block : m_Inline; }
+	U32			operator[](U32 i) const	{ return Get()[i]; }
+
+	// bytes used outside of the list itself
+	size_t		HeapBytes() const	{ return m_Class ? Capacity() * sizeof(U32) : 0; }
+
+	U32*		Reserve(U8 count);
+	void		Assign(const PlayerList &list);
+	void		Release();
+};
+
+#endif // _PLAYERLIST_H_
@@ -0,0 +1,89 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _QUERYPOOL_H_
+#define _QUERYPOOL_H_
+
+#include "StoreSnapshot.h"
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+// partitions per thread a scan is split into, more partitions than threads
+// evens out partitions that happen to hold more matches.
+#define QUERY_PARTITIONS_PER_THREAD		4
+
+
+typedef struct tQueryPoolStats
+{
+	U64		scans;			// scans split over the pool
+	U64		partitions;		// partitions scanned
+	U64		stolen;			// partitions scanned by the pool threads
+} tQueryPoolStats;
+
+
+//=============================================================================
+// Parallel Query Scan
+//=============================================================================
+
+/**
+ * @brief Pool of threads that scan snapshot partitions in parallel.
+ *
+ * A scan splits the snapshot's chunks into consecutive partitions which the
+ * pool threads and the calling thread take in turns. Each partition gathers
+ * its matches on its own, once all are done they're appended in partition
+ * order, so the result is the same as that of a scan on a single thread.
+ * The calling thread keeps its hold on the snapshot until the scan is done.
+ */
+class QueryPool
+{
+private:
+	std::vector<pthread_t>		m_Threads;
+	pthread_mutex_t				m_Lock;
+	pthread_cond_t				m_Start;		// signaled when a scan starts
+	pthread_cond_t				m_Done;			// signaled when the last thread is done
+	bool						m_Running;
+	U64							m_Scan;			// current scan, threads wait for it to change
+	U32							m_Busy;			// threads not done with the current scan
+
+	// current scan
+	const tSnapshot				*m_Snapshot;
+	const tSnapQuery			*m_Query;
+	U32							m_Partitions;
+	std::atomic<U32>			m_NextPartition;
+	std::atomic<U64>			m_Stolen;
+	std::vector<tcServerAddrVector>	m_Results;	// matches per partition
+
+	tQueryPoolStats				m_Stats;
+
+	void			Work(bool pool);
+	static void*	ThreadMain(void *arg);
+
+public:
+	QueryPool(U32 threads);
+	~QueryPool();
+
+	U32		Count()		{ return m_Threads.size(); }
+	void	Scan(const tSnapshot *snap, const tSnapQuery *query, tcServerAddrVector &results);
+
+	tQueryPoolStats&	GetStats()	{ return m_Stats; }
+	void				Report(void);
+};
+
+#endif // _QUERYPOOL_H_
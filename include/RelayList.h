@@ -0,0 +1,83 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _RELAYLIST_H_
+#define _RELAYLIST_H_
+
+#include "masterd.h"
+#include "RelayProtocol.h"
+#include <vector>
+
+
+typedef struct tRelay
+{
+	U32		address;		// relays are trusted by address, any port
+	U64		sequence;		// of the last update accepted
+	U64		updates;		// updates accepted
+	U64		servers;		// servers they carried
+} tRelay;
+
+typedef std::vector<tRelay> tcRelayVector;
+
+typedef struct tRelayStats
+{
+	U64		badMac;			// updates with a MAC that didn't check out
+	U64		replayed;		// updates with an old sequence number
+	U64		malformed;		// updates that couldn't be parsed
+} tRelayStats;
+
+
+//=============================================================================
+// Trusted Relays
+//=============================================================================
+
+/**
+ * @brief The pbms-relay instances we take batched server updates from.
+ *
+ * Relays run next to large numbers of game servers and forward their info,
+ * an update from a trusted relay address with a MAC under the shared secret
+ * skips flood control. Updates are only accepted with a sequence number
+ * above the last one accepted from the relay, so they can't be forged or
+ * replayed by someone spoofing the relay's address.
+ */
+class RelayList
+{
+private:
+	tcRelayVector	m_Relays;
+	U8				m_Key[16];
+	tRelayStats		m_Stats;
+
+	tRelay*	Find(ServerAddress *addr);
+
+public:
+	RelayList(const char *trusted, const char *secret);
+
+	U32		Count()		{ return m_Relays.size(); }
+	bool	Trusted(ServerAddress *addr)	{ return !m_Relays.empty() && Find(addr); }
+	bool	Authentic(ServerAddress *addr, Packet *pack);
+	tRelay*	Accept(ServerAddress *addr, Packet *pack);
+	void	Malformed()	{ m_Stats.malformed++; }
+
+	tRelayStats&	GetStats()	{ return m_Stats; }
+	void			Report(void);
+};
+
+extern RelayList	*gm_pRelays;
+
+#endif // _RELAYLIST_H_
@@ -0,0 +1,79 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _RELAYPROTOCOL_H_
+#define _RELAYPROTOCOL_H_
+
+#include "masterd.h"
+
+/*
+
+Format of a MasterRelayUpdate after the header:
+
+U64		sequence;			// higher than that of any earlier update of the relay
+U8		serverCount;
+struct
+{
+	U32		address;		// game server address and port
+	U16		port;
+	U16		infoSize;
+	U8		info[infoSize];	// same as a GameMasterInfoResponse after the header
+} servers[serverCount];
+U8		mac[RELAY_MAC_SIZE];	// siphash24() of all the above, header included
+
+The header's flags, session and key are 0. The MAC is keyed by the secret
+the relay and master share, see relayKey().
+
+*/
+
+// largest update datagram, stays clear of fragmentation on common links
+#define RELAY_UPDATE_MAX_SIZE	1400
+
+#define RELAY_MAC_SIZE			8
+#define RELAY_UPDATE_MIN_SIZE	(PACKET_HEADER_SIZE + 8 + 1 + RELAY_MAC_SIZE)
+#define RELAY_SERVER_HEADER		(4 + 2 + 2)
+
+/**
+ * @brief Turn the shared secret into the MAC key.
+ */
+inline void relayKey(const char *secret, U8 key[16])
+{
+	U8	zero[16];
+	U64	half;
+
+
+	memset(zero, 0, sizeof(zero));
+
+	half = siphash24(zero, secret, strlen(secret));
+	memcpy(key, &half, 8);
+
+	zero[0] = 1;
+	half = siphash24(zero, secret, strlen(secret));
+	memcpy(key + 8, &half, 8);
+}
+
+/**
+ * @brief MAC of an update, everything but the MAC itself.
+ */
+inline U64 relayMac(const U8 key[16], const char *buff, size_t length)
+{
+	return siphash24(key, buff, length - RELAY_MAC_SIZE);
+}
+
+#endif // _RELAYPROTOCOL_H_
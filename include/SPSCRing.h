@@ -0,0 +1,89 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _SPSCRING_H_
+#define _SPSCRING_H_
+
+#include "commonTypes.h"
+#include <atomic>
+
+// keep the producer and consumer positions on separate cache lines
+#define SPSCRING_CACHE_LINE		64
+
+
+/**
+ * @brief Lock-free ring of preallocated slots between two threads.
+ *
+ * Exactly one thread produces and one thread consumes. The producer fills
+ * free slots in place and publishes them, the consumer reads published slots
+ * in place and releases them, nothing is copied or allocated on the way.
+ * SIZE must be a power of 2.
+ */
+template <class T, U32 SIZE>
+class SPSCRing
+{
+private:
+	alignas(SPSCRING_CACHE_LINE) std::atomic<U32>	m_Head;		// next slot to consume
+	alignas(SPSCRING_CACHE_LINE) std::atomic<U32>	m_Tail;		// next slot to produce
+	alignas(SPSCRING_CACHE_LINE) U32				m_CountMax;	// most slots ever in use, producer only
+	T												m_Slots[SIZE];
+
+public:
+	SPSCRing()
+	{
+		m_Head.store(0, std::memory_order_relaxed);
+		m_Tail.store(0, std::memory_order_relaxed);
+		m_CountMax = 0;
+	}
+
+	U32		Capacity() const	{ return SIZE; }
+	U32		CountMax() const	{ return m_CountMax; }
+
+	// number of slots in use, exact only from the producer or consumer
+	U32		Count() const
+	{
+		return m_Tail.load() - m_Head.load();
+	}
+
+	// producer: number of free slots and the i-th of them
+	U32		Space() const		{ return SIZE - Count(); }
+	T&		Back(U32 i)			{ return m_Slots[(m_Tail.load(std::memory_order_relaxed) + i) & (SIZE -1)]; }
+
+	// producer: hand the first count free slots over to the consumer
+	void	Publish(U32 count)
+	{
+		U32 tail = m_Tail.load(std::memory_order_relaxed) + count;
+
+		m_Tail.store(tail, std::memory_order_seq_cst);
+
+		if(tail - m_Head.load(std::memory_order_relaxed) > m_CountMax)
+			m_CountMax = tail - m_Head.load(std::memory_order_relaxed);
+	}
+
+	// consumer: i-th of the published slots
+	T&		Front(U32 i)		{ return m_Slots[(m_Head.load(std::memory_order_relaxed) + i) & (SIZE -1)]; }
+
+	// consumer: give the first count published slots back to the producer
+	void	Release(U32 count)
+	{
+		m_Head.store(m_Head.load(std::memory_order_relaxed) + count, std::memory_order_seq_cst);
+	}
+};
+
+#endif // _SPSCRING_H_
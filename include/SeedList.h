@@ -0,0 +1,155 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _SEEDLIST_H_
+#define _SEEDLIST_H_
+
+#include "masterd.h"
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+/*
+
+Seed files come in two formats, told apart by the first bytes.
+
+Text, one server per line with optional game and mission types that it's
+listed under until it answers an info request itself:
+
+	# comment
+	192.168.1.10:28000
+	192.168.1.11:28000 TestGame CTF
+
+Binary, for lists too large to be bothered with text:
+
+	char	magic[8];		// "PBMSSEED"
+	U32		version;		// SEED_BINARY_VERSION
+	U32		count;
+	struct
+	{
+		U8		address[4];	// a.b.c.d
+		U16		port;
+		U16		reserved;	// 0
+	} servers[count];
+
+All values are little endian.
+
+*/
+
+#define SEED_BINARY_MAGIC		"PBMSSEED"
+#define SEED_BINARY_VERSION		1
+#define SEED_BINARY_HEADER		(8 + 4 + 4)
+#define SEED_BINARY_RECORD		(4 + 2 + 2)
+
+// type offset of a seed listed without one
+#define SEED_NO_TYPE			0xFFFFFFFF
+
+// bad lines of a text seed file that are warned about per load
+#define SEED_MAX_WARNINGS		10
+
+// reads of a seed file that keeps changing while it's read, per load
+#define SEED_READ_TRIES			3
+
+// seconds a changed seed file has to be left alone before it's loaded again
+#define SEED_SETTLE_TIME		2
+
+
+typedef struct tSeed
+{
+	U64		slot;			// ((U64)address << 16) | port, same as the store
+	U32		gameType;		// offsets into the type names, SEED_NO_TYPE if none
+	U32		missionType;
+} tSeed;
+
+typedef std::vector<tSeed> tcSeedVector;
+
+typedef struct tSeedStats
+{
+	U64		loads;			// times the file was loaded
+	U64		failed;			// loads that failed, the servers pinned before stay pinned
+	U32		badLines;		// lines of the last load that couldn't be parsed
+	U32		added;			// servers pinned by the last load
+	U32		removed;		// servers unpinned by the last load
+	U64		loadTime;		// milliseconds the last load took
+} tSeedStats;
+
+
+//=============================================================================
+// Server Seed List
+//=============================================================================
+
+/**
+ * @brief Servers listed in the seed file, pinned in the store.
+ *
+ * Pinned servers are listed whether they heartbeat or not, expiry and the
+ * liveness prober leave them alone. Once one answers an info request its
+ * info replaces whatever the seed file said.
+ *
+ * The file is read into a buffer that's kept between loads and parsed in
+ * place. It's checked for changes every so often and loaded again, servers
+ * no longer listed are unpinned and expire as usual. A file that fails to
+ * load leaves the servers pinned by the last one alone. A changed file is
+ * only loaded again once it's been left alone for a moment, and one whose
+ * size or modification time changes while it's read is read again. If it
+ * keeps changing the load is dropped and tried at the next check. That only
+ * catches a writer still at work, replace the file by renaming a new one
+ * over it.
+ */
+class SeedList
+{
+private:
+	std::string			m_Path;
+	U64					m_CheckInterval;	// milliseconds between checks for changes, 0 for never
+	U64					m_NextCheck;
+	bool				m_Missing;			// the file was missing at the last check
+
+	// identity of the file last loaded
+	dev_t				m_Device;
+	ino_t				m_Inode;
+	off_t				m_Size;
+	struct timespec		m_MTime;
+
+	tcSeedVector		m_Seeds;	// pinned, by slot
+	tcSeedVector		m_Next;		// being loaded
+	std::vector<char>	m_Types;	// type names of the seeds being loaded
+	std::vector<char>	m_Data;		// contents of the file being loaded
+
+	tSeedStats			m_Stats;
+
+	bool	Parse(const char *data, size_t size);
+	bool	ParseBinary(const char *data, size_t size);
+	bool	ParseText(const char *data, size_t size);
+	U32		AddType(const char *start, const char *end);
+	void	Apply(void);
+
+public:
+	SeedList(const char *path, U32 checkInterval);
+
+	bool	Load(void);
+	void	DoProcessing(void);
+
+	U32		Count()		{ return m_Seeds.size(); }
+
+	tSeedStats&	GetStats()	{ return m_Stats; }
+	void		Report(void);
+};
+
+extern SeedList		*gm_pSeeds;
+
+#endif // _SEEDLIST_H_
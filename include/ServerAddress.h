@@ -50,6 +50,15 @@ public:
 
 	bool equals(const ServerAddress * a);
 
+	/**
+	 * @brief Slot of the address, the key servers are kept by.
+	 *
+	 * 2 bytes unused, 4 bytes IPv4 address, 2 bytes UDP port.
+	 */
+	static U64 toSlot(U32 address, U16 port)	{ return ((U64)address << 16) | port; }
+	U64 toSlot() const							{ return toSlot(address, port); }
+	void fromSlot(U64 slot)						{ address = (U32)(slot >> 16); port = (U16)slot; }
+
 	/**
 	 * @brief Quads for addy.
 	 */
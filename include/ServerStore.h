@@ -24,7 +24,10 @@
 #include "masterd.h"
 #include "packetconf.h"
 #include "SessionHandler.h"
+#include "PlayerList.h"
 #include <deque>
+#include <vector>
+#include <unordered_set>
 #include <string.h>
 
 #if !defined(WIN32) && defined(__GNUC__)
@@ -50,10 +53,12 @@ class UniqueStringList
 public:
 	tcUniqueString	m_List;
 	U32				m_TotalSize;	// combined total size in bytes of all strings together
+	U32				m_Changes;		// count of strings created or dropped, ever
 	
 	UniqueStringList()
 	{
-		m_TotalSize = 0;
+		m_TotalSize	= 0;
+		m_Changes	= 0;
 	}
 	~UniqueStringList()
 	{
@@ -69,6 +74,7 @@ public:
 
 	U32 TotalSize()	{ return m_TotalSize;   }
 	U32 Count()		{ return m_List.size(); }
+	U32 Changes()	{ return m_Changes;     }
 
 
 	tUniqueString* GetMatch(const char *str)
@@ -138,6 +144,7 @@ public:
 		// store the unique string
 		m_List.push_back(record);
 		m_TotalSize += record.length;
+		m_Changes++;
 
 		// done
 		return record.str;
@@ -166,6 +173,7 @@ public:
 				m_TotalSize -= pRec->length;
 				delete[] pRec->str;
 				m_List.erase(it);
+				m_Changes++;
 			}
 
 			// done
@@ -254,37 +262,38 @@ public:
 /**
  * @brief Where we store actual data on a server.
  *
- * Even though it really gets stuffed into sqlite.
+ * Fields are ordered largest first so the record packs without padding gaps,
+ * the player GUIDs are kept inline or in a PlayerSlab block by playerList.
  */
 class ServerInfo
 {
 public:
-	ServerAddress	addr;
-	U16				session;
-	U16				key;
-
+	U64		fingerprint;	// hash of the info payload, 0 if unknown
 	char	*gameType;
 	char	*missionType;
-	U8		maxPlayers;
+	ServerAddress	addr;
+
 	U32		regions;
 	U32		version;
+
+	// Bookkeeping information
+	S32		last_heart;	// Last time we got a heart beat
+	S32		last_info;	// Last time we got info from them
+
+	U16		CPUSpeed;
+	U8		maxPlayers;
 	U8		infoFlags;
 	U8		numBots;
-	U16		CPUSpeed;
-	U8		playerCount;
-	U32		*playerList;	// players GUID array
+	U8		pinned;		// listed in the seed file, never expires
 
+	PlayerList	playerList;	// players GUID array
 
-	// Bookkeeping information
-	int  last_heart;	// Last time we got a heart beat
-	int  last_info;	// Last time we got info from them
-	bool m_DestroyPlayers;
 
-	ServerInfo(bool destroyPlayers = true)
+	ServerInfo()
 	{
+		fingerprint	= 0;
 		gameType	= NULL;
 		missionType	= NULL;
-		playerList	= NULL;
 		
 		maxPlayers	= 0;
 		regions		= 0;
@@ -292,28 +301,19 @@ public:
 		infoFlags	= 0;
 		numBots		= 0;
 		CPUSpeed	= 0;
-		playerCount	= 0;
+		pinned		= 0;
 		
 		last_heart	= 0;
 		last_info	= 0;
-		
-		m_DestroyPlayers = destroyPlayers;
 	}
 
 	~ServerInfo()
 	{
 		if(missionType)	delete[] missionType;
 		if(gameType)	delete[] gameType;
-
-		// only destroy players GUID array if requested to
-		if(m_DestroyPlayers && playerList)
-			delete[] playerList;
 	}
 
-	void setToDestroy(bool players)
-	{
-		m_DestroyPlayers = players;
-	}
+	U8 playerCount() const	{ return playerList.Count(); }
 };
 
 
@@ -337,20 +337,54 @@ class Server {
 };
 
 
+typedef std::vector<Packet *> tcPacketVector;
+
+// slots of servers that missed a liveness probe
+typedef std::unordered_set<U64> tcSuspectSet;
+
 class ServerStore
 {
+private:
+	tcPacketVector		m_TypesResponse;	// cached MasterServerGameTypesResponse packets
+	U32					m_TypesChanges;		// type list changes the cache was built at
+	bool				m_TypesBuilt;
+
+	void BuildTypesResponse(void);
+	void ClearTypesResponse(void);
+
+protected:
+	U64					m_Generation;		// changes made to the servers, ever
+	U64					m_Refreshes;		// info updates that changed nothing
+
+	void FinishQuery(Session *session, tcSuspectSet &suspects);
+
 public:
 	UniqueStringList	m_GameTypes;
 	UniqueStringList	m_MissionTypes;
+
+	ServerStore();
+	virtual ~ServerStore();
+
+	// game and mission types response, rebuilt only when the types change
+	tcPacketVector& GetTypesResponse(void);
 	
 	// Work functions
 	virtual void DoProcessing(int count = 5) = 0;
-	virtual void HeartbeatServer(ServerAddress *addr, U16 *session, U16 *key) = 0;
+	virtual void HeartbeatServer(ServerAddress *addr) = 0;
 	virtual void UpdateServer(ServerAddress *addr, ServerInfo *info) = 0;
+	virtual bool RefreshServer(ServerAddress *addr, U64 fingerprint) = 0;
+	virtual void SuspectServer(ServerAddress *addr, bool suspect) = 0;
+	virtual void DropServer(ServerAddress *addr) = 0;
+	virtual void PinServer(ServerAddress *addr, const char *gameType, const char *missionType) = 0;
+	virtual void UnpinServer(ServerAddress *addr) = 0;
 
 	virtual void QueryServers(Session *session, ServerFilter *filter) = 0;
 
 	virtual U32 getCount() = 0;
+	U64 Generation()	{ return m_Generation; }
+
+	// Statistics
+	virtual void ReportMemory(void) = 0;
 };
 
 
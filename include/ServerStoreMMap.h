@@ -0,0 +1,216 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _SERVERSTOREMMAP_H
+#define _SERVERSTOREMMAP_H
+
+#include "ServerStore.h"
+#include <string>
+#include <vector>
+
+/*
+
+Layout of the store file, all offsets are from the start of the file and all
+values are in host byte order. Tools may map it read-only while masterd runs,
+a record that's being written may be seen half updated.
+
+tMMapHeader		header;
+tMMapType		gameTypes[header.types];
+tMMapType		missionTypes[header.types];
+U32				index[header.buckets];		// first record of each hash bucket
+tMMapRecord		records[header.capacity];
+tMMapPlayers	players[header.blocks];
+
+A server is found by hashing its slot to a bucket and following the records'
+next links from there. Unused records and player blocks are linked into free
+lists through their next links too. Records refer to types by their index in
+the type tables, types are kept as long as a record refers to them.
+
+*/
+
+#define MMAP_MAGIC				"PBMSSTOR"
+#define MMAP_VERSION			1
+
+// end of a chain or free list, or no type
+#define MMAP_NONE				0xFFFFFFFF
+#define MMAP_NO_TYPE			0xFFFF
+
+// entries per type table
+#define MMAP_TYPES				1024
+
+// player GUIDs per player block, sized to fill 64 bytes
+#define MMAP_BLOCK_PLAYERS		15
+
+// player blocks per record, room for 30 players per server on average
+#define MMAP_BLOCKS_PER_RECORD	2
+
+// most records the expiry check looks at per call, used or not
+#define MMAP_EXPIRE_SCAN		256
+
+// record flags
+#define MMAP_RECORD_USED		0x0001
+
+
+typedef struct tMMapHeader
+{
+	char	magic[8];		// MMAP_MAGIC
+	U32		version;		// MMAP_VERSION
+	U32		recordSize;		// sizeof(tMMapRecord), catches layout changes
+	U32		capacity;		// records
+	U32		blocks;			// player blocks
+	U32		buckets;		// hash index buckets, a power of 2
+	U32		types;			// entries per type table
+	U32		count;			// records in use
+	U32		highWater;		// records past it were never used
+	U32		blocksUsed;		// player blocks in use
+	U32		freeRecord;		// first unused record, MMAP_NONE if none
+	U32		freeBlock;		// first unused player block, MMAP_NONE if none
+	U32		dirty;			// in use, or masterd didn't shut down cleanly
+	U64		generation;		// changes made to the servers, ever
+	U64		typesOffset;
+	U64		indexOffset;
+	U64		recordsOffset;
+	U64		blocksOffset;
+	U64		size;			// of the whole file
+} tMMapHeader;
+
+typedef struct tMMapType
+{
+	U32		refs;			// records of this type, unused if 0
+	U8		length;
+	char	name[256];		// terminated
+} tMMapType;
+
+typedef struct tMMapRecord
+{
+	U64		fingerprint;	// hash of the info payload, 0 if unknown
+	U32		address;		// as ServerAddress keeps it, a.b.c.d in memory order
+	U16		port;
+	U16		flags;			// MMAP_RECORD_*
+	U32		next;			// next record in the bucket, or on the free list
+	U32		regions;
+	U32		version;
+	S32		last_heart;		// last time we got a heartbeat
+	S32		last_info;		// last time we got info
+	U32		players;		// first player block, MMAP_NONE if none
+	U16		gameType;		// type table entries, MMAP_NO_TYPE if none
+	U16		missionType;
+	U16		CPUSpeed;
+	U8		maxPlayers;
+	U8		infoFlags;
+	U8		numBots;
+	U8		playerCount;
+	U8		reserved[2];
+} tMMapRecord;
+
+typedef struct tMMapPlayers
+{
+	U32		next;			// next block of the server, or on the free list
+	U32		guids[MMAP_BLOCK_PLAYERS];
+} tMMapPlayers;
+
+typedef struct tMMapStats
+{
+	U64		full;			// servers turned away, no records left
+	U64		lostPlayers;	// player GUIDs not stored, no player blocks left
+	U64		lostTypes;		// types not stored, the type table was full
+	bool	recovered;		// the file was rebuilt after an unclean shutdown
+	U64		openTime;		// milliseconds it took to open the file
+} tMMapStats;
+
+
+/**
+ * @brief Server store kept in a memory mapped file.
+ *
+ * Records have a fixed size and a fixed number of them fit in the file, set
+ * by store::MMapCapacity. The file survives restarts, once it's mapped the
+ * servers it holds are listed right away without being loaded first. Only a
+ * file that wasn't closed cleanly is gone over once to rebuild its index and
+ * free lists.
+ *
+ * Suspect and pinned servers are kept in memory, the liveness prober and the
+ * seed file start over after a restart anyway.
+ */
+class ServerStoreMMap : public ServerStore
+{
+private:
+	std::string			m_Path;
+	int					m_File;
+	char				*m_Map;
+	tMMapHeader			*m_Header;
+	tMMapType			*m_Types[2];	// game and mission types
+	U32					*m_Index;
+	tMMapRecord			*m_Records;
+	tMMapPlayers		*m_Blocks;
+	U32					m_BucketMask;
+	U32					m_TypeEnd[2];	// type table entries past it are unused
+	U32					m_ProcIndex;	// next record the expiry check looks at
+
+	tcSuspectSet		m_Suspects;
+	tcSuspectSet		m_Pinned;
+	std::vector<U32>	m_Buddies;		// scratch list of sorted buddy GUIDs
+
+	tMMapStats			m_Stats;
+
+	bool	Open(U32 capacity);
+	bool	Create(U32 capacity);
+	void	Attach(void);
+	void	Recover(void);
+	void	Close(void);
+
+	U32		Bucket(U64 slot);
+	U32		Find(ServerAddress *addr);
+	U32		Add(ServerAddress *addr);
+	void	Remove(U32 index);
+
+	U16		AcquireType(U8 table, const char *name);
+	void	ReleaseType(U8 table, U16 type);
+	U16		FindType(U8 table, const char *name);
+	const char*	TypeName(U8 table, U16 type)	{ return type == MMAP_NO_TYPE ? NULL : m_Types[table][type].name; }
+	UniqueStringList&	TypeList(U8 table)	{ return table ? m_MissionTypes : m_GameTypes; }
+
+	void	SetPlayers(tMMapRecord *rec, const PlayerList &players);
+	void	FreePlayers(tMMapRecord *rec);
+	bool	HasBuddy(tMMapRecord *rec);
+	void	SetInfo(tMMapRecord *rec, ServerInfo *info);
+	bool	MatchFilter(tMMapRecord *rec, ServerFilter *filter, U32 game, U32 mission);
+
+public:
+	ServerStoreMMap(const char *path, U32 capacity);
+	~ServerStoreMMap();
+
+	bool IsOpen()	{ return m_Map != NULL; }
+
+	void DoProcessing(int count = 5);
+	void HeartbeatServer(ServerAddress *addr);
+	void UpdateServer(ServerAddress *addr, ServerInfo *info);
+	bool RefreshServer(ServerAddress *addr, U64 fingerprint);
+	void SuspectServer(ServerAddress *addr, bool suspect);
+	void DropServer(ServerAddress *addr);
+	void PinServer(ServerAddress *addr, const char *gameType, const char *missionType);
+	void UnpinServer(ServerAddress *addr);
+
+	void QueryServers(Session *session, ServerFilter *filter);
+
+	U32 getCount()	{ return m_Header ? m_Header->count : 0; }
+
+	void ReportMemory(void);
+};
+
+#endif // _SERVERSTOREMMAP_H
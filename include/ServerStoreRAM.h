@@ -2,11 +2,23 @@
 #define _SERVERSTORERAM_H
 
 #include "ServerStore.h"
+#include "StoreSnapshot.h"
+#include "QueryPool.h"
 #include <map>
+#include <set>
+#include <vector>
 
 
 typedef std::map<U64, ServerInfo> tcServerMap;
 
+// player GUID to server slot reverse index, for buddy searches. Each GUID is
+// indexed once per server, ordered by GUID so a GUID's servers are a range.
+typedef std::pair<U32, U64>		tBuddyEntry;
+typedef std::set<tBuddyEntry>	tcBuddyIndex;
+
+// called for each server by VisitServers()
+typedef void (*tServerVisitor)(U64 slot, ServerInfo *info, void *arg);
+
 /**
  * Linked list server store implementation
  *
@@ -16,27 +28,56 @@ class ServerStoreRAM : public ServerStore
 private:
 	tcServerMap				m_Servers;
 	tcServerMap::iterator	m_ProcIT;
+	tcBuddyIndex			m_BuddyIndex;
+	tcSuspectSet			m_Suspects;
+	std::vector<U64>		m_BuddySlots;	// scratch list of buddy query candidates
+	std::vector<U32>		m_Buddies;		// scratch list of sorted buddy GUIDs
+	std::vector<U32>		m_OldPlayers;	// scratch lists of a server's sorted unique GUIDs
+	std::vector<U32>		m_NewPlayers;
+	StoreSnapshots			*m_Snapshots;	// snapshots queries read, NULL if queries read the map
+	U64						m_SnapshotTime;	// when the last snapshot was published
+	QueryPool				*m_QueryPool;	// threads scanning large snapshots, NULL if none
 
 	U64  AddrToSlot(ServerAddress *addr);
 	bool FindServer(ServerAddress *addr, tcServerMap::iterator &it);
-	bool FindServer(ServerAddress *addr, ServerInfo **serv);
 	void AddServer(ServerAddress *addr, ServerInfo *info);
 	void RemoveServer(tcServerMap::iterator &it);
 	void RemoveServer(ServerAddress *addr);
 
-	
+	static void SortPlayers(ServerInfo *info, std::vector<U32> &guids);
+	void IndexPlayers(U64 slot, ServerInfo *info);
+	void UnindexPlayers(U64 slot, ServerInfo *info);
+	void ReindexPlayers(U64 slot);
+	void FindBuddies(ServerFilter *filter);
+	bool MatchFilter(ServerInfo *info, ServerFilter *filter, char *game, char *mission);
+	void QuerySnapshot(Session *session, ServerFilter *filter);
+
+protected:
+	// a server was added, changed, refreshed or removed
+	virtual void Changed(U64 slot);
+
 public:
     ServerStoreRAM();
     ~ServerStoreRAM();
 	
 	void DoProcessing(int count = 5);
-	void HeartbeatServer(ServerAddress *addr, U16 *session, U16 *key);
+	void HeartbeatServer(ServerAddress *addr);
 	void UpdateServer(ServerAddress *addr, ServerInfo *info);
+	bool RefreshServer(ServerAddress *addr, U64 fingerprint);
+	void SuspectServer(ServerAddress *addr, bool suspect);
+	void DropServer(ServerAddress *addr);
+	void PinServer(ServerAddress *addr, const char *gameType, const char *missionType);
+	void UnpinServer(ServerAddress *addr);
 
 	void QueryServers(Session *session, ServerFilter *filter);
 
 	U32 getCount()	{ return m_Servers.size(); }
 
+	bool FindServer(ServerAddress *addr, ServerInfo **serv);
+	void VisitServers(tServerVisitor visit, void *arg);
+
+	void ReportMemory(void);
+
 };
 
 #endif // _SERVERSTORERAM_H
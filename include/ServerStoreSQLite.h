@@ -0,0 +1,146 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _SERVERSTORESQLITE_H
+#define _SERVERSTORESQLITE_H
+
+#include "ServerStoreRAM.h"
+#include "BatchWriter.h"
+#include <sqlite3.h>
+#include <vector>
+
+/*
+
+Schema of the servers table:
+
+CREATE TABLE servers (
+	slot		INTEGER PRIMARY KEY,	-- (address << 16) | port, address as ServerAddress keeps it
+	address		TEXT,					-- a.b.c.d, for people looking at the table
+	port		INTEGER,
+	game		TEXT,					-- NULL if none
+	mission		TEXT,
+	max_players	INTEGER,
+	regions		INTEGER,
+	version		INTEGER,
+	info_flags	INTEGER,
+	bots		INTEGER,
+	cpu_speed	INTEGER,
+	players		BLOB,					-- player GUIDs, U32s in host byte order
+	fingerprint	INTEGER,
+	last_heart	INTEGER,				-- unix time
+	last_info	INTEGER
+);
+
+*/
+
+// offset of no type in a batch's type names
+#define SQLITE_NO_TYPE		0xFFFFFFFF
+
+
+// a changed server, or one that's gone
+typedef struct tSQLiteRow
+{
+	U64		slot;
+	U64		fingerprint;
+	U32		gameType;		// offsets into the batch's type names, SQLITE_NO_TYPE if none
+	U32		missionType;
+	U32		players;		// offset into the batch's players
+	U32		regions;
+	U32		version;
+	S32		last_heart;
+	S32		last_info;
+	U16		CPUSpeed;
+	U8		maxPlayers;
+	U8		infoFlags;
+	U8		numBots;
+	U8		playerCount;
+	bool	removed;		// delete the row
+} tSQLiteRow;
+
+// changes written in one transaction
+typedef struct tSQLiteBatch
+{
+	std::vector<tSQLiteRow>	rows;
+	std::vector<char>		types;		// type names of the rows, terminated
+	std::vector<U32>		players;	// player GUIDs of the rows
+	std::vector<U64>		retry;		// slots of the rows that weren't written, they go into the next batch
+} tSQLiteBatch;
+
+typedef struct tSQLiteStats
+{
+	U64		batches;		// transactions committed
+	U64		written;		// rows inserted or replaced
+	U64		deleted;		// rows deleted
+	U64		deferred;		// flushes put off, the last batch was still being written
+	U64		errors;			// statements or transactions that failed
+	U64		maxCommit;		// milliseconds the slowest transaction took
+	U32		loaded;			// servers loaded at startup
+} tSQLiteStats;
+
+
+/**
+ * @brief RAM store that keeps a copy of its servers in an SQLite database.
+ *
+ * Queries and updates are served from RAM as usual. Changed servers are
+ * collected and once per flush interval copied into a batch, which a thread
+ * of its own writes to the database in one transaction, with the database in
+ * WAL mode. The core thread never waits on the database, if the last batch
+ * isn't written yet the changes wait for the next flush.
+ *
+ * The servers in the database are loaded at startup, except those that
+ * expired while masterd was down.
+ */
+class ServerStoreSQLite : public ServerStoreRAM
+{
+private:
+	sqlite3				*m_DB;
+	sqlite3_stmt		*m_Replace;
+	sqlite3_stmt		*m_Delete;
+	std::string			m_Path;
+
+	U64					m_FlushInterval;	// milliseconds between batches
+	U64					m_NextFlush;
+	std::vector<U64>	m_Dirty;			// slots changed since the last batch
+	bool				m_Loading;
+
+	BatchWriter<tSQLiteBatch>	m_Writer;	// owns the connection once started
+
+	tSQLiteStats		m_Stats;
+
+	bool	Open(void);
+	bool	Exec(const char *sql);
+	void	Load(void);
+	void	Flush(bool wait);
+	void	Write(tSQLiteBatch *batch);
+	static void	WriteBatch(tSQLiteBatch *batch, void *arg);
+
+protected:
+	void	Changed(U64 slot);
+
+public:
+	ServerStoreSQLite(const char *path, U32 flushInterval);
+	~ServerStoreSQLite();
+
+	bool	IsOpen()	{ return m_DB != NULL && m_Writer.IsRunning(); }
+
+	void	DoProcessing(int count = 5);
+	void	ReportMemory(void);
+};
+
+#endif // _SERVERSTORESQLITE_H
@@ -22,7 +22,6 @@
 #define _SESSION_HANDLER_H_
 
 #include <map>
-#include <list>
 #include <vector>
 #include "commonTypes.h"
 
@@ -32,6 +31,16 @@
 // maximum number of sessions per peer / remote host at the same time
 #define SESSION_MAX				10
 
+// maximum number of sessions of all peers at the same time
+#define SESSION_POOL_SIZE		4096
+
+// number of session index hash buckets, must be a power of 2
+#define SESSION_HASH_SIZE		(SESSION_POOL_SIZE * 2)
+
+// result storage of a released session is kept for reuse unless it grew
+// beyond this many servers, huge lists are given back to the heap.
+#define SESSION_RESULTS_KEEP	8192
+
 
 typedef struct tServerAddress
 {
@@ -41,6 +50,9 @@ typedef struct tServerAddress
 
 typedef std::vector<tServerAddress> tcServerAddrVector;
 
+class Session;
+typedef void (*tSessionHook)(Session *ps);
+
 
 class Session
 {
@@ -55,24 +67,101 @@ public:
 	U16						packNum;		// number of servers per packet
 	U16						packLast;		// number of servers on last packet
 
-	Session(U16 session, U16 key)
+	// session pool bookkeeping
+	U32						peer;			// address of the peer owning the session
+	S32						next;			// next session in hash bucket or free list
+
+	// list transmission, see ListScheduler
+	U16						port;			// port of the peer the list is sent to
+	U8						packSent;		// number of list packets sent so far
+	Session					*schedNext;		// next session with list packets to send
+	Session					*schedPrev;		// previous session with list packets to send
+
+	// list pacing, times are in milliseconds
+	U32						rate;			// list packets per second
+	U64						nextSend;		// when the next list packets may be sent
+	U64						rateCut;		// when the rate was last decreased
+	U64						started;		// when sending the list started, 0 if not
+	U64						lastSent;		// when a list packet was last sent
+	U32						bytesSent;		// list bytes sent, resends included
+	U16						resends;		// list packets resent
+
+	Session()
+	{
+		session		= 0;
+		key			= 0;
+		lastUsed	= 0;
+		total		= 0;
+		packTotal	= 0;
+		packNum		= 0;
+		packLast	= 0;
+		peer		= 0;
+		next		= -1;
+		port		= 0;
+		packSent	= 0;
+		schedNext	= NULL;
+		schedPrev	= NULL;
+		rate		= 0;
+		nextSend	= 0;
+		rateCut		= 0;
+		started		= 0;
+		lastSent	= 0;
+		bytesSent	= 0;
+		resends		= 0;
+	}
+
+	void Reset(U32 peer, U16 session, U16 key)
 	{
-//		printf("DEBUG: session object born: %X\n", this);
-		
+		this->peer		= peer;
 		this->session	= session;
 		this->key		= key;
 		this->lastUsed	= getAbsTime();
-	}
-	~Session()
-	{
-//		printf("DEBUG: session object dying: %X\n", this);
-		
-		// do nothing
-	}
 
+		// keep the results storage, only forget its contents
+		results.clear();
+		total		= 0;
+		packTotal	= 0;
+		packNum		= 0;
+		packLast	= 0;
+		packSent	= 0;
+	}
 };
 
-typedef std::list<Session *> tcSessionList;
+
+//=============================================================================
+// Session Pool
+//=============================================================================
+
+/**
+ * @brief Fixed capacity storage of all game client query sessions.
+ *
+ * Sessions are never allocated or destroyed while running, they are taken
+ * from and given back to a free list, including their results storage. An
+ * intrusive hash index keyed on peer address, session and key makes finding
+ * the session of a list resend request O(1).
+ */
+class SessionPool
+{
+private:
+	Session		m_Sessions[SESSION_POOL_SIZE];
+	S32			m_Buckets[SESSION_HASH_SIZE];	// first session index per bucket
+	S32			m_Free;							// first free session index
+	U32			m_InUse;						// count of sessions in use
+	tSessionHook	m_FreeHook;					// called before a session is freed
+
+	static U32	Hash(U32 peer, U16 session, U16 key);
+	void		Unlink(Session *ps);
+
+public:
+	SessionPool();
+
+	Session*	Alloc(U32 peer, U16 session, U16 key);
+	Session*	Find(U32 peer, U16 session, U16 key);
+	void		Free(Session *ps);
+
+	U32			InUse()		{ return m_InUse; }
+	void		SetFreeHook(tSessionHook hook)	{ m_FreeHook = hook; }
+};
 
 
 //=============================================================================
@@ -85,23 +174,29 @@ typedef std::list<Session *> tcSessionList;
 typedef struct tPeerRecord
 {
 	ServerAddress	peer;				// remote peer's address and port info
-	tcSessionList	sessions;			// sessions list of (game client) peer
+	Session			*sessions[SESSION_MAX];	// sessions of (game client) peer
+	U32				sessionCount;		// number of sessions in use
 	S32				tsCreated;			// when this record was created
 	S32				tsLastSeen;			// last time peer was seen
 	S32				tsLastReset;		// last time peer's tickets were reset
 	S32				tsBannedUntil;		// peer is banned until timestamp
 	S32				tickets;			// count of violations
 	U32				bans;				// count of times peer has been banned
+	U32				listRate;			// list packets per second peer can take
 } tPeerRecord;
 
 typedef std::map<U32, tPeerRecord> tcPeerRecordMap;
 
+// called for each banned peer by VisitBans()
+typedef void (*tBanVisitor)(tPeerRecord *peerrec, void *arg);
+
 
 class FloodControl
 {
 private:
 	tcPeerRecordMap				m_Records;
 	tcPeerRecordMap::iterator	m_ProcIT;
+	SessionPool					m_Sessions;
 
 	void GetPeerRecord(tPeerRecord **peerrec, ServerAddress &peer, bool createNoExist);
 	void CheckSessions(tPeerRecord *peerrec, bool forceExpire = false);
@@ -125,6 +220,14 @@ public:
 	// session management functions
 	void CreateSession(tPeerRecord *peerrec, tPacketHeader *header, Session **session);
 	bool GetSession(tPeerRecord *peerrec, tPacketHeader *header, Session **session);
+	void SetSessionFreeHook(tSessionHook hook)	{ m_Sessions.SetFreeHook(hook); }
+
+	// remember the list rate of a peer for its next queries
+	void SetListRate(U32 address, U32 rate);
+
+	// bans, kept by the store journal across restarts
+	void VisitBans(tBanVisitor visit, void *arg);
+	void RestoreBan(ServerAddress &peer, S32 until, U32 bans);
 };
 
 //extern SessionHandler	*gm_pSessions;
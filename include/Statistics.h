@@ -0,0 +1,59 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _STATISTICS_H_
+#define _STATISTICS_H_
+
+#include "commonTypes.h"
+
+// number of histogram buckets, bucket 0 counts zeros and bucket N counts
+// values from 2^(N-1) up to 2^N -1, the last bucket counts everything above.
+#define HISTOGRAM_BUCKETS		40
+
+
+/**
+ * @brief Power of two bucketed histogram.
+ *
+ * Cheap enough to record every sample of a hot path, percentiles are only
+ * accurate to their bucket which is good enough for spotting trouble.
+ */
+class Histogram
+{
+private:
+	U64		m_Buckets[HISTOGRAM_BUCKETS];
+	U64		m_Count;		// number of samples
+	U64		m_Sum;			// sum of all samples
+	U64		m_Max;			// largest sample
+
+public:
+	Histogram()		{ Clear(); }
+
+	void	Clear(void);
+	void	Add(U64 value);
+
+	U64		Count() const	{ return m_Count; }
+	U64		Mean() const	{ return m_Count ? m_Sum / m_Count : 0; }
+	U64		Max() const		{ return m_Max; }
+	U64		Percentile(U32 pct) const;
+
+	// print count, mean, percentiles and max on a single line
+	void	Report(const char *name, const char *unit) const;
+};
+
+#endif // _STATISTICS_H_
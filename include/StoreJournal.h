@@ -0,0 +1,219 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _STOREJOURNAL_H_
+#define _STOREJOURNAL_H_
+
+#include "masterd.h"
+#include "ServerStoreRAM.h"
+#include "SessionHandler.h"
+#include "BatchWriter.h"
+#include <string>
+#include <vector>
+
+/*
+
+The journal file holds the changes made since the snapshot of the same
+generation:
+
+	char	magic[8];		// "PBMSJRNL"
+	U32		version;		// JOURNAL_VERSION
+	U32		reserved;
+	U64		generation;
+	records...
+
+The snapshot file, the journal's name with ".snap" appended, holds every
+server and ban at the time it was taken, as the same records:
+
+	char	magic[8];		// "PBMSSNAP"
+	U32		version;
+	U32		reserved;
+	U64		generation;
+	records...
+
+Each record starts with a tJournalRecord and is padded to JOURNAL_ALIGN
+bytes, the check covers the rest of the record so a record torn by a crash
+ends the replay. A server record holds
+the whole server, added or updated, so only the last one of a server counts.
+All values are in host byte order.
+
+*/
+
+#define JOURNAL_MAGIC			"PBMSJRNL"
+#define JOURNAL_SNAP_MAGIC		"PBMSSNAP"
+#define JOURNAL_VERSION			1
+
+// record types
+#define JOURNAL_SERVER			1	// tJournalServer, server added or updated
+#define JOURNAL_REMOVE			2	// U64 slot, server removed
+#define JOURNAL_BAN				3	// tJournalBan, peer banned
+#define JOURNAL_UNBAN			4	// tJournalBan, ban lifted
+
+// type length of a server without that type
+#define JOURNAL_NO_TYPE			0xFFFF
+
+// records are padded to a multiple of this
+#define JOURNAL_ALIGN			8
+
+
+typedef struct tJournalHeader
+{
+	char	magic[8];
+	U32		version;
+	U32		reserved;
+	U64		generation;
+} tJournalHeader;
+
+typedef struct tJournalRecord
+{
+	U16		size;			// of the record, this header included
+	U8		type;
+	U8		reserved;
+	U32		check;			// lower half of fnv1a64() of the rest
+} tJournalRecord;
+
+// followed by the game and mission type names, unterminated, and the
+// player GUIDs
+typedef struct tJournalServer
+{
+	U64		slot;
+	U64		fingerprint;
+	U32		regions;
+	U32		version;
+	S32		last_heart;
+	S32		last_info;
+	U16		CPUSpeed;
+	U8		maxPlayers;
+	U8		infoFlags;
+	U8		numBots;
+	U8		playerCount;
+	U16		gameLength;		// JOURNAL_NO_TYPE if none
+	U16		missionLength;
+	U16		reserved[3];
+} tJournalServer;
+
+typedef struct tJournalBan
+{
+	U32		address;
+	S32		until;			// 0 when lifted
+	U32		bans;
+	U16		port;
+	U16		reserved;
+} tJournalBan;
+
+// records for the writer thread, and the snapshot to follow them
+typedef struct tJournalBatch
+{
+	std::vector<char>	records;
+	std::vector<char>	snapshot;	// empty if none
+	U64					generation;	// of the snapshot
+} tJournalBatch;
+
+typedef struct tJournalStats
+{
+	U64		commits;		// batches written and synced
+	U64		records;		// records written
+	U64		bytes;			// bytes written to the journal
+	U64		deferred;		// commits put off, the last batch was still being written
+	U64		snapshots;		// snapshots taken
+	U64		errors;			// writes that failed
+	U64		maxSync;		// milliseconds the slowest write and sync took
+	U64		snapshotTime;	// milliseconds the last snapshot took to build
+	U32		replayed;		// records replayed at startup
+	U32		restored;		// servers restored at startup
+	U32		bans;			// bans restored at startup
+} tJournalStats;
+
+
+//=============================================================================
+// Store Journal
+//=============================================================================
+
+/**
+ * @brief Journal of the RAM store's changes and the bans, for restarts.
+ *
+ * Changed servers are collected and once per commit interval written into
+ * a batch as records, bans as they happen. A thread of its own appends the
+ * batch to the journal and syncs it, so one sync covers all the changes of
+ * the interval and the core thread never waits on the disk. If the last
+ * batch is still being written the changes wait for the next commit.
+ *
+ * Once the journal grows past the compaction size a snapshot of the whole
+ * store is taken, the writer saves it and starts an empty journal on top of
+ * it. At startup the snapshot is loaded and the journal replayed over it,
+ * servers and bans that expired while masterd was down are left out.
+ */
+class StoreJournal
+{
+private:
+	std::string			m_Path;
+	std::string			m_SnapPath;
+	std::string			m_Dir;				// directory of both, synced after a rename
+	ServerStoreRAM		*m_Store;
+
+	U64					m_CommitInterval;	// milliseconds between commits
+	U64					m_NextCommit;
+	U64					m_CompactSize;		// journal bytes a snapshot is taken at
+	U64					m_Size;				// journal bytes since the last snapshot
+	U64					m_Generation;
+	std::vector<U64>	m_Dirty;			// slots changed since the last commit
+
+	// writer thread
+	int					m_FD;				// journal being appended to, -1 once journaling stopped
+	BatchWriter<tJournalBatch>	m_Writer;
+
+	tJournalStats		m_Stats;
+
+	static void	AddRecord(std::vector<char> &out, U8 type, const void *data, U16 size);
+	static void	AddServer(std::vector<char> &out, U64 slot, ServerInfo *info);
+	static void	AddHeader(std::vector<char> &out, const char *magic, U64 generation);
+	static void	SnapServer(U64 slot, ServerInfo *info, void *arg);
+	static void	SnapBan(tPeerRecord *peerrec, void *arg);
+
+	bool	ReadFile(const char *path, const char *magic, std::vector<char> &data, U64 &generation);
+	void	Replay(void);
+	bool	Prepare(U64 generation, int &fd);
+	bool	Install(int fd);
+	bool	Create(U64 generation);
+	bool	WriteAll(int fd, const char *data, size_t size);
+	void	Write(tJournalBatch *batch);
+	static void	WriteBatch(tJournalBatch *batch, void *arg);
+	void	Snapshot(void);
+	void	Commit(bool wait);
+
+public:
+	StoreJournal(ServerStoreRAM *store, const char *path, U32 commitInterval, U32 compactSize);
+	~StoreJournal();
+
+	bool	IsOpen()	{ return m_FD >= 0 && m_Writer.IsRunning(); }
+
+	// changes to journal
+	void	Changed(U64 slot);
+	void	Banned(tPeerRecord *peerrec);
+	void	Unbanned(tPeerRecord *peerrec);
+
+	void	DoProcessing(void);
+
+	tJournalStats&	GetStats()	{ return m_Stats; }
+	void			Report(void);
+};
+
+extern StoreJournal		*gm_pJournal;
+
+#endif // _STOREJOURNAL_H_
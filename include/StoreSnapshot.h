@@ -0,0 +1,199 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _STORESNAPSHOT_H_
+#define _STORESNAPSHOT_H_
+
+#include "ServerStore.h"
+#include "Statistics.h"
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// number of records per snapshot chunk, a chunk is what gets copied when
+// any of its records change.
+#define SNAPSHOT_CHUNK			256
+
+// number of threads that may read snapshots at once, reader 0 is the core
+#define SNAPSHOT_READERS		16
+#define SNAPSHOT_READER_CORE	0
+
+// keep the epoch of each reader on a cache line of its own
+#define SNAPSHOT_CACHE_LINE		64
+
+// type ids, a record without a type has SNAPSHOT_TYPE_NONE and a query
+// matching any type asks for SNAPSHOT_TYPE_ANY.
+#define SNAPSHOT_TYPE_ANY		0xFFFE
+#define SNAPSHOT_TYPE_NONE		0xFFFF
+
+
+/**
+ * @brief Query fields of a server record as kept in a snapshot.
+ *
+ * Game and mission types are ids into the snapshot's type tables, the
+ * player GUIDs are kept in the chunk's player array.
+ */
+typedef struct tSnapRecord
+{
+	U32		address;
+	U32		regions;
+	U32		version;
+	U32		players;		// offset of the GUIDs in the chunk's player array
+	U16		port;
+	U16		gameType;		// game type id
+	U16		missionType;	// mission type id
+	U16		CPUSpeed;
+	U8		used;			// position holds a server
+	U8		playerCount;
+	U8		maxPlayers;
+	U8		infoFlags;
+	U8		numBots;
+} tSnapRecord;
+
+typedef struct tSnapChunk
+{
+	U32					refs;		// snapshots sharing this chunk
+	U32					used;		// positions holding a server
+	std::vector<U32>	players;	// player GUIDs of all records
+	tSnapRecord			records[SNAPSHOT_CHUNK];
+} tSnapChunk;
+
+typedef struct tSnapTypes
+{
+	U32							refs;	// snapshots sharing this table
+	std::vector<std::string>	names;	// type names by id
+} tSnapTypes;
+
+typedef std::vector<tSnapChunk *> tcSnapChunks;
+
+/**
+ * @brief One immutable version of the server table.
+ */
+typedef struct tSnapshot
+{
+	U64				version;
+	U64				retired;		// version that replaced this one
+	U32				servers;		// number of servers
+	tcSnapChunks	chunks;
+	tSnapTypes		*gameTypes;
+	tSnapTypes		*missionTypes;
+} tSnapshot;
+
+typedef std::vector<tSnapshot *> tcSnapshots;
+
+/**
+ * @brief A query resolved against a snapshot.
+ */
+typedef struct tSnapQuery
+{
+	ServerFilter	*filter;
+	U16				gameType;		// game type id or SNAPSHOT_TYPE_ANY
+	U16				missionType;	// mission type id or SNAPSHOT_TYPE_ANY
+	const U32		*buddies;		// sorted buddy GUIDs, NULL for no buddy search
+	U32				buddyCount;
+} tSnapQuery;
+
+typedef struct tSnapshotStats
+{
+	U64			versions;		// versions published
+	U64			changes;		// record changes put into versions
+	U64			chunksCopied;	// chunks copied for a version
+	U64			chunksShared;	// chunks a version shared with the one before
+	U64			freed;			// versions freed once no reader used them
+	Histogram	delay;			// milliseconds from a version's first change until published
+} tSnapshotStats;
+
+
+//=============================================================================
+// Server Store Snapshots
+//=============================================================================
+
+/**
+ * @brief Immutable, versioned copies of the server table for lock-free readers.
+ *
+ * Each server keeps a fixed position in an array of chunks. The store writes
+ * its changes into the next version, which shares every chunk with the
+ * current version until one of its records changes, that chunk is copied
+ * once and then changed in place. Publishing the next version makes it the
+ * current one, so the cost of a version is the chunks it changed and not
+ * the size of the table.
+ *
+ * Readers announce the version they started at in a slot of their own and
+ * read the current version without taking any locks. A replaced version is
+ * freed once no reader slot is at a version before the one replacing it.
+ * Only one thread, the writer, may change and publish versions.
+ */
+class StoreSnapshots
+{
+private:
+	typedef struct tReaderSlot
+	{
+		alignas(SNAPSHOT_CACHE_LINE) std::atomic<U64>	version;	// version being read, 0 if none
+	} tReaderSlot;
+
+	std::atomic<tSnapshot *>	m_Current;		// version readers get
+	std::atomic<U64>			m_Version;		// version of m_Current
+	tReaderSlot					m_Readers[SNAPSHOT_READERS];
+
+	// writer only
+	tSnapshot					*m_Next;		// version being changed, NULL if no changes
+	tcSnapshots					m_Retired;		// replaced versions not yet freed
+	std::unordered_map<U64, U32>	m_Positions;	// server slot to position
+	std::vector<U32>			m_FreePositions;
+	U32							m_PositionCount;	// positions ever handed out
+	std::unordered_map<std::string, U16>	m_GameIds;
+	std::unordered_map<std::string, U16>	m_MissionIds;
+	U64							m_Changed;		// when m_Next got its first change
+	U32							m_Changes;		// record changes in m_Next
+	std::vector<U32>			m_Candidates;	// scratch list of positions to scan
+	tSnapshotStats				m_Stats;
+
+	tSnapshot*		NextVersion(void);
+	tSnapRecord*	WritableRecord(U32 position, tSnapChunk **chunk);
+	U16				TypeId(tSnapTypes **types, std::unordered_map<std::string, U16> &ids, const char *name);
+	void			FreeSnapshot(tSnapshot *snap);
+	void			Reclaim(void);
+
+	static bool		MatchRecord(const tSnapRecord *rec, const tSnapChunk *chunk, const tSnapQuery *query);
+
+public:
+	StoreSnapshots();
+	~StoreSnapshots();
+
+	// writer
+	void	Set(U64 slot, ServerInfo *info);
+	void	Remove(U64 slot);
+	bool	Publish(void);
+	bool	Pending()	{ return m_Next != NULL; }
+	void	ScanSlots(const tSnapshot *snap, const std::vector<U64> &slots, const tSnapQuery *query, tcServerAddrVector &results);
+
+	// readers
+	const tSnapshot*	Acquire(U32 reader);
+	void				Release(U32 reader);
+
+	static U16	FindType(const tSnapTypes *types, const char *name);
+	static void	Scan(const tSnapshot *snap, U32 first, U32 last, const tSnapQuery *query, tcServerAddrVector &results);
+
+	// statistics
+	tSnapshotStats&	GetStats()	{ return m_Stats; }
+	void			Report(void);
+};
+
+#endif // _STORESNAPSHOT_H_
@@ -0,0 +1,71 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef _TOKENBUCKET_H_
+#define _TOKENBUCKET_H_
+
+#include "commonTypes.h"
+
+
+/**
+ * @brief Caps how many times a second something is sent.
+ *
+ * Tokens are earned from the time passed at the rate and kept in thousandths.
+ * At most a tenth of a second's worth, and at least one, is saved up so what
+ * it caps doesn't bunch up after a quiet spell.
+ */
+class TokenBucket
+{
+private:
+	U64		m_Rate;			// tokens per second
+	U64		m_Tokens;		// in thousandths
+	U64		m_Time;			// when tokens were last added
+
+public:
+	TokenBucket()
+	{
+		m_Rate		= 1;
+		m_Tokens	= 0;
+		m_Time		= 0;
+	}
+
+	void	Init(U32 rate, U64 now)
+	{
+		m_Rate		= rate ? rate : 1;
+		m_Tokens	= 0;
+		m_Time		= now;
+	}
+
+	// add the tokens earned up to now, in milliseconds
+	void	Refill(U64 now)
+	{
+		U64 burst = m_Rate * 100 < 1000 ? 1000 : m_Rate * 100;
+
+
+		m_Tokens += (now - m_Time) * m_Rate;
+		if(m_Tokens > burst)
+			m_Tokens = burst;
+		m_Time = now;
+	}
+
+	bool	Available()		{ return m_Tokens >= 1000; }
+	void	Take()			{ m_Tokens -= 1000; }
+};
+
+#endif // _TOKENBUCKET_H_
@@ -24,6 +24,7 @@
 #include "masterd.h"
 #include "Packet.h"
 #include "SessionHandler.h"
+#include <atomic>
 
 typedef struct tMessageSession
 {
@@ -37,12 +38,33 @@ typedef struct tMessageSession
 } tMessageSession;
 
 
+// Pre-validation of received datagrams, drop reasons
+enum ePreFilterReason
+{
+	PREFILTER_SHORT = 0,	// shorter than the message type allows
+	PREFILTER_LONG,			// longer than the message type allows
+	PREFILTER_TYPE,			// unknown or unhandled message type
+
+	PREFILTER_REASONS
+};
+
+// datagrams dropped by the pre-filter, per reason, atomic as the pre-filter
+// runs on the receive thread in pipelined mode
+extern std::atomic<U64> gm_PreFilterDrops[PREFILTER_REASONS];
+
+bool preFilterMessage(const char *buff, int length);
+
 // Handlers
 bool handleListRequest (tMessageSession &msg);
 bool handleInfoRequest (tMessageSession &msg);
 bool handleTypesRequest(tMessageSession &msg);
 bool handleInfoResponse(tMessageSession &msg);
 bool handleHeartbeat   (tMessageSession &msg);
+bool handlePingResponse(tMessageSession &msg);
+bool handleRelayUpdate (tMessageSession &msg);
+
+// store the game server info after the header of a message
+bool storeInfo(tMessageSession &msg, bool relayed);
 
 // Senders
 class ServerResults; // We can't do this because it breaks delete
@@ -50,6 +72,7 @@ class ServerResults; // We can't do this because it breaks delete
 void sendTypesResponse	(tMessageSession &msg);
 void sendInfoResponse	(tMessageSession &msg);
 void sendListResponse	(tMessageSession &msg, U8 index);
+U32  sendListPackets	(Session *ps, U8 first, U8 count);
 void sendInfoRequest	(tMessageSession &msg);
 
 #endif
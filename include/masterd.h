@@ -24,7 +24,7 @@
 #include "commonTypes.h"
 
 // Some configuration
-#define HAVE_SQLITE
+// HAVE_SQLITE is defined by the build when SQLite 3 is found
 
 #include <stdlib.h>
 #include <string.h>
@@ -110,6 +110,9 @@ typedef struct tDaemonConfig
 	U32		port;				// local UDP listening port number to bind to
 	U32		heartbeat;			// amount of time without heartbeat response before server is delisted
 	U32		verbosity;			// verbosity logging level
+	U32		netRecvBufferSize;	// socket receive buffer size, 0 for default
+	U32		netSendBufferSize;	// socket send buffer size, 0 for default
+	U32		netPipeline;		// receive and send on threads of their own
 
 	// flood control settings
 	U32		floodResetTime;		// reset ticket count every X seconds
@@ -117,6 +120,48 @@ typedef struct tDaemonConfig
 	U32		floodBanTime;		// peer is banned for X seconds once reaching max tickets
 	U32		floodMaxTickets;	// ban peer once reaching X tickets
 	U32		floodBadMsgTicket;	// number of X tickets for receiving bad messages from peer
+
+	// list transmission settings
+	U32		listQuantum;		// packets per list per scheduler turn
+	U32		listSendBudget;		// list packets sent between reading messages
+	U32		listRate;			// list packets per second to start a peer at
+	U32		listMinRate;		// lowest list packets per second for a peer
+	U32		listMaxRate;		// highest list packets per second for a peer
+
+	// server store settings
+	char	storeBackend[256];		// "ram", "mmap" or "sqlite"
+	char	storeMMapFile[256];		// file the mmap store keeps its servers in
+	U32		storeMMapCapacity;		// most servers the mmap store holds
+	char	storeSQLiteFile[256];	// database the sqlite store keeps its servers in
+	U32		storeSQLiteFlush;		// milliseconds between writes to the database
+	U32		storeSnapshotInterval;	// milliseconds between store snapshots, 0 for none
+	char	storeSeedFile[256];		// file of servers that are always listed, "" for none
+	U32		storeSeedCheck;			// seconds between checks of the seed file for changes, 0 for never
+	char	storeJournal[256];		// journal of the RAM store and bans, "" for none
+	U32		storeJournalCommit;		// milliseconds between journal commits
+	U32		storeJournalCompact;	// megabytes of journal a snapshot is taken at
+
+	// query settings
+	U32		queryThreads;			// threads scanning large queries besides the core, 0 for none
+	U32		queryParallelThreshold;	// servers in the store before queries are scanned in parallel
+
+	// info request settings
+	U32		infoRequestWindow;		// seconds a server's heartbeats are answered by one info request
+	U32		infoRefreshAge;			// seconds of info age before a server is asked again, 0 for never
+	U32		infoRefreshRate;		// refresh requests per second
+	U32		infoRefreshRetry;		// seconds before an unanswered refresh is retried
+	U32		infoTokenLifetime;		// seconds an info request's token is good for info heartbeats
+
+	// liveness probe settings
+	U32		probeQuietTime;			// seconds without word from a server before it's pinged, 0 for never
+	U32		probeInterval;			// seconds between pings of a quiet server
+	U32		probeMaxMisses;			// pings missed in a row before a server is dropped
+	U32		probeRate;				// pings per second
+	U32		probeHideSuspects;		// leave suspect servers out of lists instead of last
+
+	// relay settings
+	char	relayTrusted[256];		// addresses of relays whose updates are taken
+	char	relaySecret[256];		// secret relay updates are signed with
 } tDaemonConfig;
 
 //=============================================================================
@@ -146,6 +191,7 @@ private:
 	tDaemonConfig	m_Prefs;
 	tConfigEntity	*m_ConfigEntities;
 	bool			m_RunThread;
+	bool			m_ReportStats;
 
 
 public:
@@ -156,6 +202,13 @@ public:
 	void RunThread(void);
 	void StopThread(void);
 
+	// statistics reporting, requested by SIGUSR1
+	void RequestReport(void);
+	void ReportStats(void);
+
+	// how long to block waiting for messages
+	int PollTimeout(void);
+
 	// message handler
 	void ProcMessage(ServerAddress *addr, Packet *data, tPeerRecord *peerrec);
 
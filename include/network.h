@@ -39,14 +39,23 @@
 #define	MasterServerListResponse		8		// !
 #define	GameMasterInfoRequest			10		// !
 #define	GameMasterInfoResponse			12		// *
-#define	GamePingRequest					14
-#define	GamePingResponse				16
+#define	GamePingRequest					14		// !
+#define	GamePingResponse				16		// *
 #define	GameInfoRequest					18
 #define	GameInfoResponse				20
 #define	GameHeartbeat					22		// *
 #define MasterServerInfoRequest         24		// *, Torque doesn't use this...
 #define MasterServerInfoResponse        26
 
+// Not a Torque message, batched server updates from pbms-relay, see
+// RelayProtocol.h
+#define	MasterRelayUpdate				40		// *
+
+// GameHeartbeat header flag, the heartbeat carries the game server's info the
+// same as a GameMasterInfoResponse does, and the session and key of the last
+// GameMasterInfoRequest it was sent.
+#define GameHeartbeatInfoFlag			0x80
+
 // Legend:
 //   * -- Implemented for Receive
 //   ! -- Implemented for Send
@@ -57,6 +66,10 @@ void killNetworkLib();	// Shut us down.
 
 // Reduce UL dependencies...
 int getAbsTime();
+U64 getMilliTime();
+U64 fnv1a64(const void *data, size_t length);
+U64 siphash24(const U8 key[16], const void *data, size_t length);
+U32 xorshift32(U32 &state);
 void millisleep(int delay);
 
 
@@ -72,6 +72,20 @@
  */
 #define LIST_PACKET_MAX_SERVERS	(LIST_PACKET_MAX_SERVERS_ > 254 ? 254 : LIST_PACKET_MAX_SERVERS_)
 
+/**
+ * @brief Maximum number of list packets in a list response.
+ *
+ * Packet index is a U8 and 255 is the initial request indicator.
+ */
+#define LIST_PACKETS_MAX		254
+
+/**
+ * @brief Size of a list response up to its servers.
+ *
+ * Packet header, packet index, packet total and server count.
+ */
+#define LIST_RESPONSE_HEADER	(PACKET_HEADER_SIZE + 1 + 1 + 2)
+
 // packet's header size in bytes
 #define PACKET_HEADER_SIZE	6
 
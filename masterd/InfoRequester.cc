@@ -0,0 +1,406 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "InfoRequester.h"
+#include <stdio.h>
+#include <string.h>
+
+
+InfoRequester	*gm_pInfoRequester = NULL;
+
+
+/**
+ * @param	window			Seconds between info requests to the same server.
+ * @param	refreshAge		Seconds of info age before a refresh, 0 for none.
+ * @param	refreshRate		Refreshes per second.
+ * @param	refreshRetry	Seconds before the first retry of a refresh.
+ * @param	tokenLifetime	Seconds a session and key token is valid for.
+ */
+InfoRequester::InfoRequester(U32 window, U32 refreshAge, U32 refreshRate, U32 refreshRetry, U32 tokenLifetime)
+{
+	FILE	*fp;
+	U64		seed;
+	U32		i;
+
+
+	m_Window	= (U64)window * 1000;
+	m_NextSweep	= 0;
+
+	// a fresh secret each run, tokens of the last run are of no use anyway
+	m_TokenLifetime = tokenLifetime ? tokenLifetime : 1;
+
+	fp = fopen("/dev/urandom", "rb");
+	if(!fp || fread(m_Secret, sizeof(m_Secret), 1, fp) != 1)
+	{
+		// no random device, the start time will have to do
+		seed = getMilliTime();
+		for(i=0; i < sizeof(m_Secret); i++)
+			m_Secret[i] = (U8)(fnv1a64(&seed, sizeof(seed)) >> ((i & 7) * 8)) ^ (U8)i;
+	}
+	if(fp)
+		fclose(fp);
+
+	m_RefreshAge	= (U64)refreshAge * 1000;
+	m_RefreshRate.Init(refreshRate, getMilliTime());
+	m_RefreshRetry	= (U64)(refreshRetry ? refreshRetry : 1) * 1000;
+	m_Expire		= (U64)gm_pConfig->heartbeat * 1000;
+
+	m_Pending.reserve(INFO_REQUEST_BATCH);
+	m_Out.reserve(INFO_REQUEST_BATCH);
+
+	m_Stats.heartbeats	= 0;
+	m_Stats.infoHeartbeats	= 0;
+	m_Stats.badTokens	= 0;
+	m_Stats.coalesced	= 0;
+	m_Stats.sent		= 0;
+	m_Stats.batches		= 0;
+	m_Stats.answered	= 0;
+	m_Stats.unsolicited	= 0;
+	m_Stats.refreshes	= 0;
+	m_Stats.retries		= 0;
+	m_Stats.givenUp		= 0;
+	m_Stats.rateLimited	= 0;
+}
+
+/**
+ * @brief Session and key token of a server for the given token epoch.
+ *
+ * Keyed by our secret, so it can't be made up by someone who didn't receive
+ * an info request sent to the server's address.
+ */
+U32 InfoRequester::Token(ServerAddress *addr, U32 epoch)
+{
+	U8 data[10];
+
+
+	memcpy(data,     &addr->address, sizeof(U32));
+	memcpy(data + 4, &addr->port,    sizeof(U16));
+	memcpy(data + 6, &epoch,         sizeof(U32));
+
+	return (U32)(siphash24(m_Secret, data, sizeof(data)) >> 32);
+}
+
+/**
+ * @brief Handle a heartbeat, queue an info request if the server needs one.
+ */
+void InfoRequester::Heartbeat(ServerAddress *addr)
+{
+	tInfoRequest	*req = &m_Requests[addr->toSlot()];
+	U64				now = getMilliTime();
+
+
+	m_Stats.heartbeats++;
+
+	// already asked for info recently, or about to
+	if(req->pending || (req->sent && now < req->sent + m_Window))
+	{
+		m_Stats.coalesced++;
+		gm_pStore->HeartbeatServer(addr);
+		return;
+	}
+
+	gm_pStore->HeartbeatServer(addr);
+
+	Queue(addr, req);
+}
+
+/**
+ * @brief Check the token of a heartbeat that carries the server's info.
+ *
+ * Tokens of the current and the previous epoch are good. A heartbeat with
+ * any other token is handled like one without info, the server is sent an
+ * info request with a current token.
+ *
+ * @return	True if the info is to be stored.
+ */
+bool InfoRequester::InfoHeartbeat(ServerAddress *addr, U16 session, U16 key)
+{
+	U32 token = ((U32)session << 16) | key;
+	U32 epoch = getAbsTime() / m_TokenLifetime;
+
+
+	if(token != Token(addr, epoch) && token != Token(addr, epoch -1))
+	{
+		m_Stats.badTokens++;
+		Heartbeat(addr);
+		return false;
+	}
+
+	m_Stats.heartbeats++;
+	m_Stats.infoHeartbeats++;
+	gm_pStore->HeartbeatServer(addr);
+
+	return true;
+}
+
+/**
+ * @brief Queue an info request under a current token.
+ */
+void InfoRequester::Queue(ServerAddress *addr, tInfoRequest *req)
+{
+	tPendingRequest	*pr;
+	U32				token;
+
+
+	token			= Token(addr, getAbsTime() / m_TokenLifetime);
+	req->session	= (U16)(token >> 16);
+	req->key		= (U16)token;
+
+	m_Pending.resize(m_Pending.size() +1);
+	pr = &m_Pending.back();
+	pr->addr	= *addr;
+	pr->req		= req;
+
+	// GameMasterInfoRequest is just a header
+	pr->data[0] = GameMasterInfoRequest;
+	pr->data[1] = 0;
+	memcpy(pr->data +2, &req->session, sizeof(U16));
+	memcpy(pr->data +4, &req->key,     sizeof(U16));
+
+	req->pending = 1;
+
+	// don't let a long run of messages hold them up
+	if(m_Pending.size() >= INFO_REQUEST_BATCH)
+		Flush();
+}
+
+/**
+ * @brief Account for an info response and schedule the server's refresh.
+ *
+ * Responses are handled whether they answer a request or not, the tracking
+ * is only there to tell how they compare.
+ */
+void InfoRequester::Answered(ServerAddress *addr, U16 session, U16 key)
+{
+	tInfoRequest *req = &m_Requests[addr->toSlot()];
+
+
+	if(req->outstanding && req->session == session && req->key == key)
+	{
+		req->outstanding = 0;
+
+		m_Stats.answered++;
+		m_Stats.responseTime.Add(getMilliTime() - req->sent);
+	}
+	else
+		m_Stats.unsolicited++;
+
+	Received(addr);
+}
+
+/**
+ * @brief The server's info was stored, schedule its refresh.
+ */
+void InfoRequester::Received(ServerAddress *addr)
+{
+	U64				slot = addr->toSlot();
+	tInfoRequest	*req = &m_Requests[slot];
+	U64				now = getMilliTime();
+
+
+	req->received	= now;
+	req->retries	= 0;
+
+	if(m_RefreshAge)
+		Schedule(slot, req, now + m_RefreshAge);
+}
+
+/**
+ * @brief A relay sent the server's info, it's the relay that asks for it.
+ *
+ * Refreshes scheduled from earlier word from the server itself are dropped.
+ */
+void InfoRequester::Relayed(ServerAddress *addr)
+{
+	tcInfoRequests::iterator it;
+
+
+	it = m_Requests.find(addr->toSlot());
+	if(it != m_Requests.end())
+	{
+		it->second.refreshDue	= 0;
+		it->second.retries		= 0;
+	}
+}
+
+/**
+ * @brief Have a server refreshed at due, replacing its earlier refresh.
+ */
+void InfoRequester::Schedule(U64 slot, tInfoRequest *req, U64 due)
+{
+	tRefresh	refresh;
+
+
+	req->refreshDue	= due;
+
+	refresh.due		= due;
+	refresh.slot	= slot;
+	m_Refreshes.push(refresh);
+}
+
+/**
+ * @brief Send all queued info requests.
+ */
+void InfoRequester::Flush(void)
+{
+	std::vector<tPendingRequest>::iterator	it;
+	tOutDatagram							out;
+	U64										now;
+
+
+	if(m_Pending.empty())
+		return;
+
+	now = getMilliTime();
+
+	m_Out.clear();
+	for(it = m_Pending.begin(); it != m_Pending.end(); it++)
+	{
+		out.to		= &it->addr;
+		out.data	= it->data;
+		out.length	= PACKET_HEADER_SIZE;
+		m_Out.push_back(out);
+
+		it->req->sent			= now;
+		it->req->pending		= 0;
+		it->req->outstanding	= 1;
+	}
+
+	gm_pTransport->sendBatched(&m_Out[0], m_Out.size(), SEND_PRIORITY_INFOREQUEST);
+
+	m_Stats.sent += m_Out.size();
+	m_Stats.batches++;
+
+	m_Pending.clear();
+}
+
+/**
+ * @brief Send the refreshes that are due, as far as the rate cap allows.
+ */
+void InfoRequester::Refresh(U64 now)
+{
+	tcInfoRequests::iterator	it;
+	tRefresh					refresh;
+	ServerAddress				addr;
+	U32							backoff;
+
+
+	m_RefreshRate.Refill(now);
+
+	while(!m_Refreshes.empty() && m_Refreshes.top().due <= now)
+	{
+		refresh = m_Refreshes.top();
+
+		// skip those superseded by a response or forgotten
+		it = m_Requests.find(refresh.slot);
+		if(it == m_Requests.end() || it->second.refreshDue != refresh.due)
+		{
+			m_Refreshes.pop();
+			continue;
+		}
+
+		// the rest waits for more tokens
+		if(!m_RefreshRate.Available())
+		{
+			m_Stats.rateLimited++;
+			break;
+		}
+
+		m_Refreshes.pop();
+
+		// expired by now, the store drops it
+		if(now >= it->second.received + m_Expire)
+		{
+			it->second.refreshDue = 0;
+			m_Stats.givenUp++;
+			continue;
+		}
+
+		// a heartbeat may have asked already
+		if(!it->second.pending)
+		{
+			addr.fromSlot(refresh.slot);
+			Queue(&addr, &it->second);
+
+			m_RefreshRate.Take();
+
+			if(it->second.retries)
+				m_Stats.retries++;
+			m_Stats.refreshes++;
+		}
+
+		// retry at doubling intervals until it answers
+		backoff = it->second.retries < INFO_REFRESH_BACKOFF ? it->second.retries : INFO_REFRESH_BACKOFF;
+		it->second.retries++;
+
+		Schedule(refresh.slot, &it->second, now + (m_RefreshRetry << backoff));
+	}
+}
+
+/**
+ * @brief Send due refreshes and forget the requests of servers that haven't
+ *        heartbeat in a window.
+ */
+void InfoRequester::DoProcessing(void)
+{
+	tcInfoRequests::iterator	it;
+	U64							now = getMilliTime();
+
+
+	if(m_RefreshAge)
+		Refresh(now);
+
+	if(now < m_NextSweep)
+		return;
+
+	// the whole table once per window, at most once a second
+	m_NextSweep = now + (m_Window > 1000 ? m_Window : 1000);
+
+	for(it = m_Requests.begin(); it != m_Requests.end();)
+	{
+		if(it->second.pending || it->second.refreshDue || now < it->second.sent + m_Window)
+		{
+			it++;
+			continue;
+		}
+
+		it = m_Requests.erase(it);
+	}
+}
+
+void InfoRequester::Report(void)
+{
+	debugPrintf(DPRINT_INFO, " - Heartbeats: %llu received, %llu coalesced, %lu servers tracked\n",
+				(unsigned long long)m_Stats.heartbeats, (unsigned long long)m_Stats.coalesced,
+				(unsigned long)m_Requests.size());
+	debugPrintf(DPRINT_INFO, " - Heartbeats: %llu carried info, %llu with a bad token\n",
+				(unsigned long long)m_Stats.infoHeartbeats, (unsigned long long)m_Stats.badTokens);
+	debugPrintf(DPRINT_INFO, " - Info requests: %llu sent in %llu batches, %llu answered, %llu unsolicited responses\n",
+				(unsigned long long)m_Stats.sent, (unsigned long long)m_Stats.batches,
+				(unsigned long long)m_Stats.answered, (unsigned long long)m_Stats.unsolicited);
+
+	m_Stats.responseTime.Report("response time", "ms");
+
+	if(m_RefreshAge)
+		debugPrintf(DPRINT_INFO, " - Info refreshes: %llu sent, %llu retries, %llu servers gave up on, %lu scheduled, %llu waits for the rate cap\n",
+					(unsigned long long)m_Stats.refreshes, (unsigned long long)m_Stats.retries,
+					(unsigned long long)m_Stats.givenUp, (unsigned long)m_Refreshes.size(),
+					(unsigned long long)m_Stats.rateLimited);
+}
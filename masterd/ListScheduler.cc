@@ -0,0 +1,303 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "TorqueIO.h"
+#include "ListScheduler.h"
+#include <string.h>
+
+
+ListScheduler	*gm_pListScheduler = NULL;
+
+
+ListScheduler::ListScheduler(U32 quantum, U32 budget)
+{
+	m_Cursor	= NULL;
+	m_Quantum	= quantum ? quantum : 1;
+	m_Budget	= budget  ? budget  : 1;
+	m_Wake		= 0;
+
+	m_Stats.packets		= 0;
+	m_Stats.turns		= 0;
+	m_Stats.lists		= 0;
+	m_Stats.active		= 0;
+	m_Stats.activeMax	= 0;
+	m_Stats.resends		= 0;
+	m_Stats.rateCuts	= 0;
+}
+
+/**
+ * @brief Schedule the list packets of a session for sending.
+ *
+ * The session is inserted at the cursor so it is served first on the next
+ * run. A session that is already scheduled, because it repeated its query
+ * under the same session and key, simply starts over with its new results.
+ * The session's rate must be set beforehand.
+ */
+void ListScheduler::Add(Session *ps)
+{
+	// account for the list the session was used for before
+	Finish(ps);
+
+	ps->packSent	= 0;
+	ps->nextSend	= 0;
+	ps->started		= getMilliTime();
+	ps->lastSent	= ps->started;
+	ps->bytesSent	= 0;
+	ps->resends		= 0;
+
+	if(!ps->rate)
+		ps->rate	= gm_pConfig->listRate;
+
+	// something to send right away
+	m_Wake = 0;
+
+	// already in the ring
+	if(ps->schedNext)
+		return;
+
+	if(!m_Cursor)
+	{
+		// only session in the ring
+		ps->schedNext = ps;
+		ps->schedPrev = ps;
+	}
+	else
+	{
+		// link in before the cursor
+		ps->schedNext = m_Cursor;
+		ps->schedPrev = m_Cursor->schedPrev;
+		m_Cursor->schedPrev->schedNext = ps;
+		m_Cursor->schedPrev = ps;
+	}
+
+	m_Cursor = ps;
+
+	m_Stats.active++;
+	if(m_Stats.active > m_Stats.activeMax)
+		m_Stats.activeMax = m_Stats.active;
+}
+
+/**
+ * @brief Take a session out of the ring, whether it's done or not.
+ */
+void ListScheduler::Remove(Session *ps)
+{
+	// not in the ring
+	if(!ps->schedNext)
+		return;
+
+	if(ps->schedNext == ps)
+	{
+		// was the only session
+		m_Cursor = NULL;
+	}
+	else
+	{
+		ps->schedPrev->schedNext = ps->schedNext;
+		ps->schedNext->schedPrev = ps->schedPrev;
+
+		if(m_Cursor == ps)
+			m_Cursor = ps->schedNext;
+	}
+
+	ps->schedNext = NULL;
+	ps->schedPrev = NULL;
+
+	m_Stats.active--;
+}
+
+/**
+ * @brief Send up to the budget of list packets, a quantum per session turn.
+ *
+ * Sessions whose pacing doesn't allow sending yet are passed over. Nothing is
+ * sent while the transport has datagrams waiting for the socket, there's no
+ * point in piling more onto a socket that can't keep up.
+ */
+void ListScheduler::Run(void)
+{
+	Session	*ps;
+	U64		now;
+	U32		budget = m_Budget;
+	U32		count, idle = 0;
+
+
+	if(!m_Cursor)
+		return;
+
+	now		= getMilliTime();
+	m_Wake	= (U64)-1;
+
+	// stop once every session was passed over without anything being sent
+	while(m_Cursor && budget && idle < m_Stats.active && !gm_pTransport->SendBusy())
+	{
+		ps = m_Cursor;
+		m_Cursor = ps->schedNext;
+
+		// not this session's time yet
+		if(ps->nextSend > now)
+		{
+			if(ps->nextSend < m_Wake)
+				m_Wake = ps->nextSend;
+
+			idle++;
+			continue;
+		}
+
+		// packets this turn, limited by what's left of list and budget
+		count = ps->packTotal - ps->packSent;
+		if(count > m_Quantum)	count = m_Quantum;
+		if(count > budget)		count = budget;
+
+		ps->bytesSent	+= sendListPackets(ps, ps->packSent, (U8)count);
+		ps->packSent	+= count;
+		ps->lastSent	 = now;
+
+		// the burst has to pass at the session's rate before the next one
+		if(ps->rate)
+			ps->nextSend = now + (count * 1000) / ps->rate;
+
+		budget	-= count;
+		idle	 = 0;
+
+		m_Stats.packets += count;
+		m_Stats.turns++;
+
+		// done with this list
+		if(ps->packSent >= ps->packTotal)
+		{
+			Remove(ps);
+			m_Stats.lists++;
+		}
+		else if(ps->nextSend < m_Wake)
+			m_Wake = ps->nextSend;
+	}
+
+	// ran out of budget or the transport is busy, go again next time
+	if(budget == 0 || idle < m_Stats.active)
+		m_Wake = 0;
+}
+
+/**
+ * @brief Account for a list packet the client asked for again.
+ *
+ * A resend request means the packet was lost, so the session's rate, and
+ * the rate of its peer, is halved. Requests following closely upon each
+ * other are taken to be from the same loss.
+ */
+void ListScheduler::Resent(Session *ps, U32 bytes)
+{
+	U64 now = getMilliTime();
+
+
+	ps->bytesSent	+= bytes;
+	ps->lastSent	 = now;
+	ps->resends++;
+	m_Stats.resends++;
+
+	if(now < ps->rateCut + LIST_RATE_HOLD)
+		return;
+
+	ps->rate /= 2;
+	if(ps->rate < gm_pConfig->listMinRate)
+		ps->rate = gm_pConfig->listMinRate;
+
+	ps->rateCut = now;
+	m_Stats.rateCuts++;
+
+	gm_pFloodControl->SetListRate(ps->peer, ps->rate);
+}
+
+/**
+ * @brief Account for a session's list once the session is done with it.
+ *
+ * This is when the session is reused or freed, by then the client had all
+ * the time it needed to ask for lost packets again. A list that didn't need
+ * any resends raises the rate of the peer.
+ */
+void ListScheduler::Finish(Session *ps)
+{
+	U32 rate;
+
+
+	if(!ps->started)
+		return;
+
+	m_Stats.completeTime.Add(ps->lastSent - ps->started);
+	m_Stats.listBytes.Add(ps->bytesSent);
+
+	// only a list sent completely tells anything about the rate
+	if(!ps->resends && ps->packSent >= ps->packTotal)
+	{
+		rate = ps->rate + LIST_RATE_STEP;
+		if(rate > gm_pConfig->listMaxRate)
+			rate = gm_pConfig->listMaxRate;
+
+		gm_pFloodControl->SetListRate(ps->peer, rate);
+	}
+
+	ps->started = 0;
+}
+
+/**
+ * @brief Get how long the core may block waiting for messages.
+ *
+ * @param	timeout	Longest wait in milliseconds.
+ */
+int ListScheduler::Timeout(int timeout)
+{
+	U64 now;
+
+
+	if(!m_Cursor)
+		return timeout;
+
+	if(!m_Wake)
+		return 0;
+
+	now = getMilliTime();
+	if(m_Wake <= now)
+		return 0;
+
+	if(m_Wake - now < (U64)timeout)
+		return (int)(m_Wake - now);
+
+	return timeout;
+}
+
+void ListScheduler::Report(void)
+{
+	debugPrintf(DPRINT_INFO, " - Lists: %llu sent in %llu packets over %llu turns, %u sending, %u at most\n",
+				(unsigned long long)m_Stats.lists, (unsigned long long)m_Stats.packets,
+				(unsigned long long)m_Stats.turns, m_Stats.active, m_Stats.activeMax);
+	debugPrintf(DPRINT_INFO, " - Lists: %llu packets resent, %llu rate decreases\n",
+				(unsigned long long)m_Stats.resends, (unsigned long long)m_Stats.rateCuts);
+
+	m_Stats.completeTime.Report("time to complete", "ms");
+	m_Stats.listBytes.Report("bytes per list", "");
+}
+
+void ListScheduler::SessionFreed(Session *ps)
+{
+	if(gm_pListScheduler)
+	{
+		gm_pListScheduler->Remove(ps);
+		gm_pListScheduler->Finish(ps);
+	}
+}
@@ -0,0 +1,276 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "LivenessProber.h"
+#include <string.h>
+
+
+LivenessProber	*gm_pProber = NULL;
+
+
+/**
+ * @param	quiet		Seconds without word from a server before it's probed,
+ *						0 to not probe at all.
+ * @param	interval	Seconds between probes of the same server.
+ * @param	maxMisses	Probes a server may miss before it's dropped.
+ * @param	rate		Probes per second.
+ */
+LivenessProber::LivenessProber(U32 quiet, U32 interval, U32 maxMisses, U32 rate)
+{
+	m_Quiet		= (U64)quiet * 1000;
+	m_Interval	= (U64)(interval ? interval : 1) * 1000;
+	m_MaxMisses	= maxMisses ? maxMisses : 1;
+	m_Rate.Init(rate, getMilliTime());
+	m_Random	= (U32)getMilliTime() | 1;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+/**
+ * @brief Have a server probed at due, replacing its earlier probe.
+ */
+void LivenessProber::Schedule(U64 slot, tProbe *probe, U64 due)
+{
+	tProbeTimer	timer;
+
+
+	probe->due	= due;
+
+	timer.due	= due;
+	timer.slot	= slot;
+	m_Queue.push(timer);
+}
+
+/**
+ * @brief The server is alive, clear its misses and wait for it to go quiet.
+ */
+void LivenessProber::Heard(U64 slot, tProbe *probe)
+{
+	ServerAddress addr;
+
+
+	probe->misses = 0;
+
+	if(probe->suspect)
+	{
+		probe->suspect = 0;
+
+		addr.fromSlot(slot);
+		gm_pStore->SuspectServer(&addr, false);
+		m_Stats.cleared++;
+	}
+
+	Schedule(slot, probe, getMilliTime() + m_Quiet);
+}
+
+/**
+ * @brief Start or keep watching a server that just sent its info.
+ */
+void LivenessProber::Track(ServerAddress *addr)
+{
+	U64 slot = addr->toSlot();
+
+
+	if(!m_Quiet)
+		return;
+
+	Heard(slot, &m_Probes[slot]);
+}
+
+/**
+ * @brief A heartbeat of a watched server counts as word from it.
+ */
+void LivenessProber::Heartbeat(ServerAddress *addr)
+{
+	tcProbes::iterator it;
+
+
+	if(!m_Quiet)
+		return;
+
+	it = m_Probes.find(addr->toSlot());
+	if(it != m_Probes.end())
+		Heard(it->first, &it->second);
+}
+
+/**
+ * @brief A relay sent the server's info, the relay watches it instead.
+ */
+void LivenessProber::Relayed(ServerAddress *addr)
+{
+	tcProbes::iterator it;
+
+
+	it = m_Probes.find(addr->toSlot());
+	if(it == m_Probes.end())
+		return;
+
+	if(it->second.suspect)
+	{
+		gm_pStore->SuspectServer(addr, false);
+		m_Stats.cleared++;
+	}
+
+	// its queued probe is skipped once it's due
+	m_Probes.erase(it);
+}
+
+/**
+ * @brief Handle a GamePingResponse.
+ */
+void LivenessProber::Answered(ServerAddress *addr, U16 session, U16 key)
+{
+	tcProbes::iterator it;
+
+
+	it = m_Probes.find(addr->toSlot());
+	if(it == m_Probes.end() || !it->second.misses ||
+	   it->second.session != session || it->second.key != key)
+	{
+		m_Stats.unsolicited++;
+		return;
+	}
+
+	m_Stats.answered++;
+	Heard(it->first, &it->second);
+}
+
+/**
+ * @brief Probe the servers that are due, as far as the rate cap allows.
+ */
+void LivenessProber::DoProcessing(void)
+{
+	tcProbes::iterator	it;
+	tProbeTimer			timer;
+	tOutProbe			*op;
+	ServerAddress		addr;
+	U64					now;
+	U32					r;
+
+
+	if(!m_Quiet)
+		return;
+
+	now = getMilliTime();
+	m_Rate.Refill(now);
+
+	while(!m_Queue.empty() && m_Queue.top().due <= now)
+	{
+		timer = m_Queue.top();
+
+		// skip those superseded by word from the server or forgotten
+		it = m_Probes.find(timer.slot);
+		if(it == m_Probes.end() || it->second.due != timer.due)
+		{
+			m_Queue.pop();
+			continue;
+		}
+
+		// clients come first, wait while the socket can't keep up with them
+		if(!m_Rate.Available() || gm_pTransport->SendBusy())
+		{
+			m_Stats.deferred++;
+			break;
+		}
+
+		m_Queue.pop();
+		addr.fromSlot(timer.slot);
+
+		// missed every probe, drop it
+		if(it->second.misses >= m_MaxMisses)
+		{
+			gm_pStore->DropServer(&addr);
+			m_Probes.erase(it);
+			m_Stats.evicted++;
+			continue;
+		}
+
+		// missed the last probe
+		if(it->second.misses && !it->second.suspect)
+		{
+			it->second.suspect = 1;
+			gm_pStore->SuspectServer(&addr, true);
+			m_Stats.suspected++;
+		}
+
+		// random session and key, they only match the response to the probe
+		r = xorshift32(m_Random);
+
+		it->second.session	= (U16)(r >> 16);
+		it->second.key		= (U16)r;
+		it->second.misses++;
+
+		// GamePingRequest is just a header
+		m_Pending.resize(m_Pending.size() +1);
+		op = &m_Pending.back();
+		op->addr	= addr;
+		op->data[0]	= GamePingRequest;
+		op->data[1]	= 0;
+		memcpy(op->data +2, &it->second.session, sizeof(U16));
+		memcpy(op->data +4, &it->second.key,     sizeof(U16));
+
+		m_Rate.Take();
+
+		Schedule(timer.slot, &it->second, now + m_Interval);
+	}
+
+	Send();
+}
+
+/**
+ * @brief Send the queued probes in one batch.
+ */
+void LivenessProber::Send(void)
+{
+	std::vector<tOutProbe>::iterator	it;
+	tOutDatagram						out;
+
+
+	if(m_Pending.empty())
+		return;
+
+	m_Out.clear();
+	for(it = m_Pending.begin(); it != m_Pending.end(); it++)
+	{
+		out.to		= &it->addr;
+		out.data	= it->data;
+		out.length	= PACKET_HEADER_SIZE;
+		m_Out.push_back(out);
+	}
+
+	gm_pTransport->sendBatched(&m_Out[0], m_Out.size(), SEND_PRIORITY_PROBE);
+
+	m_Stats.sent += m_Out.size();
+	m_Pending.clear();
+}
+
+void LivenessProber::Report(void)
+{
+	if(!m_Quiet)
+		return;
+
+	debugPrintf(DPRINT_INFO, " - Probes: %llu sent, %llu answered, %llu unsolicited responses, %llu waits, %lu servers watched\n",
+				(unsigned long long)m_Stats.sent, (unsigned long long)m_Stats.answered,
+				(unsigned long long)m_Stats.unsolicited, (unsigned long long)m_Stats.deferred,
+				(unsigned long)m_Probes.size());
+	debugPrintf(DPRINT_INFO, " - Probes: %llu servers suspected, %llu cleared, %llu dropped\n",
+				(unsigned long long)m_Stats.suspected, (unsigned long long)m_Stats.cleared,
+				(unsigned long long)m_Stats.evicted);
+}
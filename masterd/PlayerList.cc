@@ -0,0 +1,172 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "PlayerList.h"
+#include <string.h>
+
+
+U32		*PlayerSlab::m_FreeList[PLAYERSLAB_CLASSES];
+char	*PlayerSlab::m_Chunk		= NULL;
+size_t	PlayerSlab::m_ChunkUsed		= 0;
+size_t	PlayerSlab::m_Reserved		= 0;
+size_t	PlayerSlab::m_InUse[PLAYERSLAB_CLASSES];
+
+
+//=============================================================================
+// Player GUID Slab Allocator
+//=============================================================================
+
+U8 PlayerSlab::ClassFor(U32 count)
+{
+	U8 cls;
+
+	// small enough to be stored inline
+	if(count <= PLAYERLIST_INLINE)
+		return 0;
+
+	// find the smallest class that holds count
+	for(cls = 1; cls < PLAYERSLAB_CLASSES -1; cls++)
+	{
+		if(ClassCapacity(cls) >= count)
+			break;
+	}
+
+	return cls;
+}
+
+U32 PlayerSlab::ClassCapacity(U8 cls)
+{
+	if(!cls)
+		return PLAYERLIST_INLINE;
+
+	return 4 << (cls -1);
+}
+
+U32* PlayerSlab::Alloc(U8 cls)
+{
+	U32		*block;
+	size_t	size;
+
+
+	// inline storage isn't allocated from us
+	if(!cls || cls >= PLAYERSLAB_CLASSES)
+		return NULL;
+
+	m_InUse[cls]++;
+
+	// reuse a released block of this class if we have one
+	if(m_FreeList[cls])
+	{
+		block			= m_FreeList[cls];
+		m_FreeList[cls]	= *(U32 **)block;
+		return block;
+	}
+
+	// carve a new block from the current chunk, start a new chunk when the
+	// current one doesn't have enough space left. The tail of the old chunk is
+	// simply abandoned, it is at most the size of the largest class.
+	size = ClassCapacity(cls) * sizeof(U32);
+
+	if(!m_Chunk || (m_ChunkUsed + size > PLAYERSLAB_CHUNK_SIZE))
+	{
+		m_Chunk		= new char[PLAYERSLAB_CHUNK_SIZE];
+		m_ChunkUsed	= 0;
+		m_Reserved	+= PLAYERSLAB_CHUNK_SIZE;
+	}
+
+	block		 = (U32 *)(m_Chunk + m_ChunkUsed);
+	m_ChunkUsed	+= size;
+
+	// done
+	return block;
+}
+
+void PlayerSlab::Free(U32 *block, U8 cls)
+{
+	// abort on NULL or inline storage
+	if(!block || !cls || cls >= PLAYERSLAB_CLASSES)
+		return;
+
+	m_InUse[cls]--;
+
+	// push block onto the class free list
+	*(U32 **)block	= m_FreeList[cls];
+	m_FreeList[cls]	= block;
+}
+
+size_t PlayerSlab::BytesInUse()
+{
+	size_t	bytes = 0;
+	U8		cls;
+
+	for(cls = 1; cls < PLAYERSLAB_CLASSES; cls++)
+		bytes += m_InUse[cls] * ClassCapacity(cls) * sizeof(U32);
+
+	return bytes;
+}
+
+
+//=============================================================================
+// Player GUID List
+//=============================================================================
+
+/**
+ * @brief Make room for count GUIDs and return the storage to write them to.
+ *
+ * Existing storage is reused if it is large enough, else a block of the
+ * required size class is taken from the slab. Previous contents are lost.
+ */
+U32* PlayerList::Reserve(U8 count)
+{
+	U8 cls;
+
+
+	// grow the storage if the new count doesn't fit
+	if(count > Capacity())
+	{
+		cls = PlayerSlab::ClassFor(count);
+
+		Release();
+		m_Block	= PlayerSlab::Alloc(cls);
+		m_Class	= cls;
+	}
+
+	m_Count = count;
+
+	return Get();
+}
+
+void PlayerList::Assign(const PlayerList &list)
+{
+	if(&list == this)
+		return;
+
+	memcpy(Reserve(list.m_Count), list.Get(), list.m_Count * sizeof(U32));
+}
+
+void PlayerList::Release()
+{
+	// give the block back to the slab
+	if(m_Class)
+		PlayerSlab::Free(m_Block, m_Class);
+
+	m_Block	= NULL;
+	m_Count	= 0;
+	m_Class	= 0;
+}
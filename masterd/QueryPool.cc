@@ -0,0 +1,188 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "QueryPool.h"
+
+
+QueryPool::QueryPool(U32 threads)
+{
+	pthread_t	thread;
+	U32			i;
+
+
+	pthread_mutex_init(&m_Lock, NULL);
+	pthread_cond_init(&m_Start, NULL);
+	pthread_cond_init(&m_Done, NULL);
+
+	m_Running		= true;
+	m_Scan			= 0;
+	m_Busy			= 0;
+	m_Snapshot		= NULL;
+	m_Query			= NULL;
+	m_Partitions	= 0;
+	m_NextPartition.store(0);
+	m_Stolen.store(0);
+
+	m_Stats.scans		= 0;
+	m_Stats.partitions	= 0;
+	m_Stats.stolen		= 0;
+
+	for(i=0; i < threads; i++)
+	{
+		if(pthread_create(&thread, NULL, ThreadMain, this))
+		{
+			debugPrintf(DPRINT_ERROR, "   Failed to start query thread %u\n", i);
+			break;
+		}
+
+		m_Threads.push_back(thread);
+	}
+
+	// one set of results per partition, storage is kept between scans
+	m_Results.resize((m_Threads.size() +1) * QUERY_PARTITIONS_PER_THREAD);
+}
+
+QueryPool::~QueryPool()
+{
+	U32 i;
+
+
+	pthread_mutex_lock(&m_Lock);
+	m_Running = false;
+	pthread_cond_broadcast(&m_Start);
+	pthread_mutex_unlock(&m_Lock);
+
+	for(i=0; i < m_Threads.size(); i++)
+		pthread_join(m_Threads[i], NULL);
+
+	pthread_cond_destroy(&m_Done);
+	pthread_cond_destroy(&m_Start);
+	pthread_mutex_destroy(&m_Lock);
+}
+
+/**
+ * @brief Scan a snapshot for the servers matching a query.
+ *
+ * Matches are appended to results in snapshot position order.
+ */
+void QueryPool::Scan(const tSnapshot *snap, const tSnapQuery *query, tcServerAddrVector &results)
+{
+	U32 i;
+
+
+	// fewer partitions than chunks would leave partitions empty
+	m_Partitions = m_Results.size();
+	if(m_Partitions > snap->chunks.size())
+		m_Partitions = snap->chunks.size();
+
+	m_Snapshot	= snap;
+	m_Query		= query;
+	m_NextPartition.store(0);
+
+	// start the pool threads on it
+	pthread_mutex_lock(&m_Lock);
+	m_Busy = m_Threads.size();
+	m_Scan++;
+	pthread_cond_broadcast(&m_Start);
+	pthread_mutex_unlock(&m_Lock);
+
+	// and do our share
+	Work(false);
+
+	// wait for the rest
+	pthread_mutex_lock(&m_Lock);
+	while(m_Busy)
+		pthread_cond_wait(&m_Done, &m_Lock);
+	pthread_mutex_unlock(&m_Lock);
+
+	// merge in partition order
+	for(i=0; i < m_Partitions; i++)
+	{
+		results.insert(results.end(), m_Results[i].begin(), m_Results[i].end());
+		m_Results[i].clear();
+	}
+
+	m_Stats.scans++;
+	m_Stats.partitions += m_Partitions;
+}
+
+/**
+ * @brief Scan partitions until there are none left.
+ *
+ * @param	pool	Called on a pool thread.
+ */
+void QueryPool::Work(bool pool)
+{
+	U32 part, chunks = m_Snapshot->chunks.size();
+
+
+	while((part = m_NextPartition.fetch_add(1)) < m_Partitions)
+	{
+		StoreSnapshots::Scan(m_Snapshot,
+							 (U64)part * chunks / m_Partitions,
+							 (U64)(part +1) * chunks / m_Partitions,
+							 m_Query, m_Results[part]);
+
+		if(pool)
+			m_Stolen.fetch_add(1);
+	}
+}
+
+void* QueryPool::ThreadMain(void *arg)
+{
+	QueryPool	*pool = (QueryPool *)arg;
+	U64			seen = 0;
+
+
+	pthread_mutex_lock(&pool->m_Lock);
+
+	while(pool->m_Running)
+	{
+		// wait for a new scan
+		if(pool->m_Scan == seen)
+		{
+			pthread_cond_wait(&pool->m_Start, &pool->m_Lock);
+			continue;
+		}
+
+		seen = pool->m_Scan;
+		pthread_mutex_unlock(&pool->m_Lock);
+
+		pool->Work(true);
+
+		// last one done wakes up the scanning thread
+		pthread_mutex_lock(&pool->m_Lock);
+		if(!--pool->m_Busy)
+			pthread_cond_signal(&pool->m_Done);
+	}
+
+	pthread_mutex_unlock(&pool->m_Lock);
+
+	return NULL;
+}
+
+void QueryPool::Report(void)
+{
+	m_Stats.stolen = m_Stolen.load();
+
+	debugPrintf(DPRINT_INFO, " - Queries: %llu scans split over %u threads, %llu partitions, %llu scanned by pool threads\n",
+				(unsigned long long)m_Stats.scans, (U32)m_Threads.size() +1,
+				(unsigned long long)m_Stats.partitions, (unsigned long long)m_Stats.stolen);
+}
@@ -0,0 +1,174 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "RelayList.h"
+
+
+RelayList	*gm_pRelays = NULL;
+
+
+/**
+ * @param	trusted	Addresses of the relays, separated by spaces or commas.
+ * @param	secret	Secret shared with the relays.
+ */
+RelayList::RelayList(const char *trusted, const char *secret)
+{
+	ServerAddress	addr;
+	tRelay			relay;
+	char			host[64];
+	const char		*p = trusted;
+	size_t			len;
+	U32				q[4];
+
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+	relayKey(secret, m_Key);
+
+	while(*p)
+	{
+		// next address
+		len = strcspn(p, " ,\t");
+		if(len && len < sizeof(host))
+		{
+			memcpy(host, p, len);
+			host[len] = 0;
+
+			if(sscanf(host, "%u.%u.%u.%u", &q[0], &q[1], &q[2], &q[3]) != 4 ||
+			   q[0] > 255 || q[1] > 255 || q[2] > 255 || q[3] > 255)
+			{
+				debugPrintf(DPRINT_WARN, " - Warning: relay address %s isn't an IPv4 address, ignored.\n", host);
+				goto NextAddress;
+			}
+
+			addr.set(host, 0);
+
+			memset(&relay, 0, sizeof(relay));
+			relay.address = addr.address;
+			m_Relays.push_back(relay);
+
+			debugPrintf(DPRINT_INFO, " - Trusting relay %s\n", host);
+		}
+
+NextAddress:
+		p += len;
+		p += strspn(p, " ,\t");
+	}
+
+	if(!m_Relays.empty() && !*secret)
+		debugPrintf(DPRINT_WARN, " - Warning: relays are trusted without a relay::Secret.\n");
+}
+
+tRelay* RelayList::Find(ServerAddress *addr)
+{
+	tcRelayVector::iterator it;
+
+
+	for(it = m_Relays.begin(); it != m_Relays.end(); it++)
+	{
+		if(it->address == addr->address)
+			return &*it;
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Check an update is from a trusted relay and carries its MAC.
+ */
+bool RelayList::Authentic(ServerAddress *addr, Packet *pack)
+{
+	U64 mac;
+
+
+	if(m_Relays.empty() || !Find(addr))
+		return false;
+
+	if(pack->getSize() < RELAY_UPDATE_MIN_SIZE)
+	{
+		m_Stats.malformed++;
+		return false;
+	}
+
+	// the MAC is the last bytes of the datagram
+	memcpy(&mac, pack->getBufferPtr() + pack->getSize() - RELAY_MAC_SIZE, RELAY_MAC_SIZE);
+	if(mac != relayMac(m_Key, pack->getBufferPtr(), pack->getSize()))
+	{
+		m_Stats.badMac++;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Check an authentic update isn't a replay.
+ *
+ * Leaves the packet at the first server of the update.
+ *
+ * @return	The relay it's from, NULL if it's to be dropped.
+ */
+tRelay* RelayList::Accept(ServerAddress *addr, Packet *pack)
+{
+	tRelay	*relay;
+	U64		sequence;
+
+
+	relay = Find(addr);
+	if(!relay)
+		return NULL;
+
+	sequence = pack->readU64();
+	if(sequence <= relay->sequence)
+	{
+		m_Stats.replayed++;
+		return NULL;
+	}
+
+	relay->sequence = sequence;
+	relay->updates++;
+
+	return relay;
+}
+
+void RelayList::Report(void)
+{
+	tcRelayVector::iterator	it;
+	char					*str;
+	ServerAddress			addr;
+
+
+	if(m_Relays.empty())
+		return;
+
+	for(it = m_Relays.begin(); it != m_Relays.end(); it++)
+	{
+		addr.address	= it->address;
+		addr.port		= 0;
+
+		debugPrintf(DPRINT_INFO, " - Relay %s: %llu updates carrying %llu servers\n",
+					str = addr.toString(), (unsigned long long)it->updates,
+					(unsigned long long)it->servers);
+		delete[] str;
+	}
+
+	debugPrintf(DPRINT_INFO, " - Relay updates dropped: %llu bad MAC, %llu replayed, %llu malformed\n",
+				(unsigned long long)m_Stats.badMac, (unsigned long long)m_Stats.replayed,
+				(unsigned long long)m_Stats.malformed);
+}
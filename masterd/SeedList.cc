@@ -0,0 +1,424 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "SeedList.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+
+SeedList	*gm_pSeeds = NULL;
+
+
+static bool SeedBySlot(const tSeed &a, const tSeed &b)
+{
+	return a.slot < b.slot;
+}
+
+static bool SameSlot(const tSeed &a, const tSeed &b)
+{
+	return a.slot == b.slot;
+}
+
+
+/**
+ * @param	path			Seed file to load.
+ * @param	checkInterval	Seconds between checks of the file for changes, 0 for never.
+ */
+SeedList::SeedList(const char *path, U32 checkInterval)
+{
+	m_Path			= path;
+	m_CheckInterval	= (U64)checkInterval * 1000;
+	m_NextCheck		= getMilliTime() + m_CheckInterval;
+	m_Missing		= false;
+
+	m_Device		= 0;
+	m_Inode			= 0;
+	m_Size			= 0;
+	memset(&m_MTime, 0, sizeof(m_MTime));
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	Load();
+}
+
+/**
+ * @brief Load the seed file and pin what it lists in place of the last one.
+ *
+ * @return	False if the file couldn't be loaded, nothing was changed then.
+ */
+bool SeedList::Load(void)
+{
+	struct stat	st, after;
+	U64			start = getMilliTime();
+	size_t		size;
+	ssize_t		got;
+	bool		ok, changed;
+	U32			tries = 0;
+	int			fd;
+
+
+	do
+	{
+		fd = open(m_Path.c_str(), O_RDONLY);
+		if(fd < 0 || fstat(fd, &st))
+		{
+			debugPrintf(DPRINT_ERROR, " - Failed to open seed file %s: %s\n", m_Path.c_str(), strerror(errno));
+			if(fd >= 0)
+				close(fd);
+
+			m_Stats.failed++;
+			return false;
+		}
+
+		// whether it loads or not, it's not tried again until it changes
+		m_Device	= st.st_dev;
+		m_Inode		= st.st_ino;
+		m_Size		= st.st_size;
+		m_MTime		= st.st_mtim;
+
+		// read it all into the buffer, a mapping of the file would fault once
+		// the file is truncated under it. The file may have grown since fstat().
+		if(m_Data.size() < (size_t)st.st_size +1)
+			m_Data.resize(st.st_size +1);
+
+		size = 0;
+		for(;;)
+		{
+			got = read(fd, &m_Data[size], m_Data.size() - size);
+			if(got < 0 && errno == EINTR)
+				continue;
+			if(got <= 0)
+				break;
+
+			size += got;
+			if(size == m_Data.size())
+				m_Data.resize(size * 2);
+		}
+
+		if(got < 0)
+		{
+			debugPrintf(DPRINT_ERROR, " - Failed to read seed file %s: %s\n", m_Path.c_str(), strerror(errno));
+			close(fd);
+
+			m_Stats.failed++;
+			return false;
+		}
+
+		// a writer at work, what was read may be half old and half new
+		changed = fstat(fd, &after) || size != (size_t)st.st_size || after.st_size != st.st_size ||
+				  after.st_mtim.tv_sec != st.st_mtim.tv_sec || after.st_mtim.tv_nsec != st.st_mtim.tv_nsec;
+
+		close(fd);
+	} while(changed && ++tries < SEED_READ_TRIES);
+
+	if(changed)
+	{
+		debugPrintf(DPRINT_WARN, " - Seed file %s changed while it was read, trying again at the next check.\n",
+					m_Path.c_str());
+
+		// doesn't match the file at the next check
+		m_Size = -1;
+
+		m_Stats.failed++;
+		return false;
+	}
+
+	ok = Parse(&m_Data[0], size);
+
+	// pin the new seeds while their type names are still around
+	if(ok)
+		Apply();
+
+	if(!ok)
+	{
+		m_Stats.failed++;
+		return false;
+	}
+
+	m_Stats.loads++;
+	m_Stats.loadTime = getMilliTime() - start;
+
+	debugPrintf(DPRINT_INFO, " - Seed file %s: %u servers pinned, %u added, %u removed, %u bad lines, %llu ms\n",
+				m_Path.c_str(), (U32)m_Seeds.size(), m_Stats.added, m_Stats.removed, m_Stats.badLines,
+				(unsigned long long)m_Stats.loadTime);
+
+	return true;
+}
+
+/**
+ * @brief Load the seed file again if it changed.
+ */
+void SeedList::DoProcessing(void)
+{
+	struct stat st;
+
+
+	if(!m_CheckInterval || getMilliTime() < m_NextCheck)
+		return;
+
+	m_NextCheck = getMilliTime() + m_CheckInterval;
+
+	// a missing file keeps the servers pinned, it's probably being replaced
+	if(stat(m_Path.c_str(), &st))
+	{
+		if(!m_Missing)
+			debugPrintf(DPRINT_WARN, " - Seed file %s is missing, keeping %u servers pinned.\n",
+						m_Path.c_str(), (U32)m_Seeds.size());
+
+		m_Missing = true;
+		return;
+	}
+
+	m_Missing = false;
+
+	if(st.st_dev == m_Device && st.st_ino == m_Inode && st.st_size == m_Size &&
+	   st.st_mtim.tv_sec == m_MTime.tv_sec && st.st_mtim.tv_nsec == m_MTime.tv_nsec)
+		return;
+
+	// may still be being written, wait for it to settle
+	if(time(NULL) - st.st_mtim.tv_sec < SEED_SETTLE_TIME)
+		return;
+
+	Load();
+}
+
+/**
+ * @brief Parse a seed file read into memory into m_Next.
+ */
+bool SeedList::Parse(const char *data, size_t size)
+{
+	m_Next.clear();
+	m_Types.clear();
+	m_Stats.badLines = 0;
+
+	if(size >= SEED_BINARY_HEADER && !memcmp(data, SEED_BINARY_MAGIC, 8))
+	{
+		if(!ParseBinary(data, size))
+			return false;
+	}
+	else if(!ParseText(data, size))
+		return false;
+
+	// list each server once, the first line it's on wins
+	std::stable_sort(m_Next.begin(), m_Next.end(), SeedBySlot);
+	m_Next.erase(std::unique(m_Next.begin(), m_Next.end(), SameSlot), m_Next.end());
+
+	return true;
+}
+
+bool SeedList::ParseBinary(const char *data, size_t size)
+{
+	const char	*rec;
+	ServerAddress addr;
+	tSeed		seed;
+	U32			version, count, i;
+	U16			port;
+
+
+	memcpy(&version, data + 8, sizeof(U32));
+	memcpy(&count,   data + 12, sizeof(U32));
+
+	if(version != SEED_BINARY_VERSION)
+	{
+		debugPrintf(DPRINT_ERROR, " - Seed file %s is version %u, only %u is understood.\n",
+					m_Path.c_str(), version, SEED_BINARY_VERSION);
+		return false;
+	}
+
+	// a truncated file would unpin whatever it's missing
+	if((size - SEED_BINARY_HEADER) / SEED_BINARY_RECORD < count)
+	{
+		debugPrintf(DPRINT_ERROR, " - Seed file %s is truncated, %u servers in %lu bytes.\n",
+					m_Path.c_str(), count, (unsigned long)size);
+		return false;
+	}
+
+	m_Next.reserve(count);
+	seed.gameType		= SEED_NO_TYPE;
+	seed.missionType	= SEED_NO_TYPE;
+
+	for(i=0, rec = data + SEED_BINARY_HEADER; i < count; i++, rec += SEED_BINARY_RECORD)
+	{
+		memcpy(addr.addy, rec, 4);
+		memcpy(&port, rec + 4, sizeof(U16));
+
+		seed.slot = ServerAddress::toSlot(addr.address, port);
+		m_Next.push_back(seed);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Parse the text format, the lines are read in place.
+ */
+bool SeedList::ParseText(const char *data, size_t size)
+{
+	const char		*p = data, *end = data + size, *eol, *c, *token;
+	ServerAddress	addr;
+	tSeed			seed;
+	U32				line = 0, octet, port, i;
+
+
+	// guess at a line per 20 bytes so the list isn't grown over and over
+	m_Next.reserve(size / 20);
+
+	for(; p < end; p = eol +1)
+	{
+		eol = (const char *)memchr(p, '\n', end - p);
+		if(!eol)
+			eol = end;
+		line++;
+
+		// skip leading whitespace, blank lines and comments
+		for(c = p; c < eol && (*c == ' ' || *c == '\t' || *c == '\r'); c++);
+		if(c == eol || *c == '#')
+			continue;
+
+		// a.b.c.d:port
+		for(i=0; i < 4; i++)
+		{
+			for(octet = 0, token = c; c < eol && *c >= '0' && *c <= '9' && c - token < 3; c++)
+				octet = octet * 10 + (*c - '0');
+
+			if(c == token || octet > 255 || c == eol || *c != (i < 3 ? '.' : ':'))
+				goto BadLine;
+
+			addr.addy[i] = octet;
+			c++;
+		}
+
+		for(port = 0, token = c; c < eol && *c >= '0' && *c <= '9' && c - token < 5; c++)
+			port = port * 10 + (*c - '0');
+
+		if(c == token || !port || port > 0xFFFF)
+			goto BadLine;
+
+		seed.slot			= ServerAddress::toSlot(addr.address, port);
+		seed.gameType		= SEED_NO_TYPE;
+		seed.missionType	= SEED_NO_TYPE;
+
+		// optional game and mission types
+		for(i=0; i < 2; i++)
+		{
+			for(; c < eol && (*c == ' ' || *c == '\t' || *c == '\r'); c++);
+			if(c == eol || *c == '#')
+				break;
+
+			for(token = c; c < eol && *c != ' ' && *c != '\t' && *c != '\r' && *c != '#'; c++);
+			if(c - token > 0xFF)
+				goto BadLine;
+
+			if(!i)
+				seed.gameType		= AddType(token, c);
+			else
+				seed.missionType	= AddType(token, c);
+		}
+
+		// anything left over is a mistake
+		for(; c < eol && (*c == ' ' || *c == '\t' || *c == '\r'); c++);
+		if(c != eol && *c != '#')
+			goto BadLine;
+
+		m_Next.push_back(seed);
+		continue;
+
+BadLine:
+		if(++m_Stats.badLines <= SEED_MAX_WARNINGS)
+			debugPrintf(DPRINT_WARN, " - Warning: seed file %s line %u isn't \"a.b.c.d:port [game [mission]]\", ignored.\n",
+						m_Path.c_str(), line);
+	}
+
+	return true;
+}
+
+/**
+ * @brief Copy a type name to the type names, terminated.
+ *
+ * @return	Offset of the name.
+ */
+U32 SeedList::AddType(const char *start, const char *end)
+{
+	U32 offset = m_Types.size();
+
+
+	m_Types.insert(m_Types.end(), start, end);
+	m_Types.push_back(0);
+
+	return offset;
+}
+
+/**
+ * @brief Pin the seeds just loaded and unpin those no longer listed.
+ *
+ * Both lists are sorted by slot, one pass over them finds the differences.
+ * Everything happens between two messages, queries see either the old seeds
+ * or the new ones.
+ */
+void SeedList::Apply(void)
+{
+	tcSeedVector::iterator	old = m_Seeds.begin(), seed;
+	ServerAddress			addr;
+
+
+	m_Stats.added	= 0;
+	m_Stats.removed	= 0;
+
+	for(seed = m_Next.begin(); seed != m_Next.end(); seed++)
+	{
+		// unpin the old seeds that come before this one
+		for(; old != m_Seeds.end() && old->slot < seed->slot; old++)
+		{
+			addr.fromSlot(old->slot);
+			gm_pStore->UnpinServer(&addr);
+			m_Stats.removed++;
+		}
+
+		if(old != m_Seeds.end() && old->slot == seed->slot)
+			old++;
+		else
+			m_Stats.added++;
+
+		addr.fromSlot(seed->slot);
+		gm_pStore->PinServer(&addr,
+							 seed->gameType    == SEED_NO_TYPE ? NULL : &m_Types[seed->gameType],
+							 seed->missionType == SEED_NO_TYPE ? NULL : &m_Types[seed->missionType]);
+	}
+
+	for(; old != m_Seeds.end(); old++)
+	{
+		addr.fromSlot(old->slot);
+		gm_pStore->UnpinServer(&addr);
+		m_Stats.removed++;
+	}
+
+	// keep the storage of both for the next load
+	m_Seeds.swap(m_Next);
+	m_Next.clear();
+}
+
+void SeedList::Report(void)
+{
+	debugPrintf(DPRINT_INFO, " - Seeds: %u servers pinned from %s, %llu loads, %llu failed, last took %llu ms\n",
+				(U32)m_Seeds.size(), m_Path.c_str(), (unsigned long long)m_Stats.loads,
+				(unsigned long long)m_Stats.failed, (unsigned long long)m_Stats.loadTime);
+}
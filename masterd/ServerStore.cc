@@ -0,0 +1,206 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "ServerStore.h"
+
+
+//==============================================================================
+// Server Store common functionality
+//==============================================================================
+
+ServerStore::ServerStore()
+{
+	m_TypesChanges	= 0;
+	m_TypesBuilt	= false;
+	m_Generation	= 0;
+	m_Refreshes		= 0;
+}
+
+ServerStore::~ServerStore()
+{
+	ClearTypesResponse();
+}
+
+
+/**
+ * @brief Get the game and mission types response packets.
+ *
+ * The packets are serialized once and kept until a unique game or mission
+ * type is either created or dropped. Callers only need to rewrite the header
+ * with their session and key before sending them.
+ */
+tcPacketVector& ServerStore::GetTypesResponse(void)
+{
+	U32 changes = m_GameTypes.Changes() + m_MissionTypes.Changes();
+
+	// rebuild the response if types have changed since last time
+	if(!m_TypesBuilt || changes != m_TypesChanges)
+	{
+		BuildTypesResponse();
+
+		m_TypesChanges	= changes;
+		m_TypesBuilt	= true;
+	}
+
+	return m_TypesResponse;
+}
+
+void ServerStore::ClearTypesResponse(void)
+{
+	tcPacketVector::iterator it;
+
+	for(it = m_TypesResponse.begin(); it != m_TypesResponse.end(); it++)
+		delete *it;
+
+	m_TypesResponse.clear();
+}
+
+/**
+ * @brief Serialize the game and mission types into response packets.
+ *
+ * Format of response after header:
+ *
+ *	U8		gameTypesCount;
+ *	char	gameTypes[gameTypesCount];
+ *
+ *	U8		missionTypesCount;
+ *	char	missionTypes[missionTypesCount];
+ *
+ * When both lists don't fit into a single packet, or either list has more than
+ * 255 entries, they are continued in as many more packets as it takes. Each
+ * packet is a complete response of its own carrying the next part of the
+ * lists, game types are sent first and then mission types.
+ */
+void ServerStore::BuildTypesResponse(void)
+{
+	tcUniqueString::iterator	it;
+	Packet						*pack;
+	size_t						countPos;
+	U32							count;
+
+
+	ClearTypesResponse();
+
+	/// game types
+
+	// start the first packet
+	pack		= new Packet(MAX_PACKET_SIZE);
+	pack->writeHeader(MasterServerGameTypesResponse, 0, 0, 0);
+	countPos	= pack->getLength();
+	count		= 0;
+	pack->writeU8(0);
+
+	for(it = m_GameTypes.m_List.begin(); it != m_GameTypes.m_List.end(); it++)
+	{
+		// continue in a new packet when this string and the mission types count
+		// don't fit anymore, or the count byte is maxed out.
+		if((count == 0xFF) || (pack->getLength() + it->length + 1 + 1 > MAX_PACKET_SIZE))
+		{
+			// finish current packet with no mission types
+			pack->writeU8(0);
+			m_TypesResponse.push_back(pack);
+
+			pack		= new Packet(MAX_PACKET_SIZE);
+			pack->writeHeader(MasterServerGameTypesResponse, 0, 0, 0);
+			countPos	= pack->getLength();
+			count		= 0;
+			pack->writeU8(0);
+		}
+
+		pack->writeCString(it->str, it->length);
+		pack->getBufferPtr()[countPos] = ++count;
+	}
+
+	/// mission types
+	countPos	= pack->getLength();
+	count		= 0;
+	pack->writeU8(0);
+
+	for(it = m_MissionTypes.m_List.begin(); it != m_MissionTypes.m_List.end(); it++)
+	{
+		// continue in a new packet when this string doesn't fit anymore
+		if((count == 0xFF) || (pack->getLength() + it->length + 1 > MAX_PACKET_SIZE))
+		{
+			m_TypesResponse.push_back(pack);
+
+			// no game types in this packet
+			pack		= new Packet(MAX_PACKET_SIZE);
+			pack->writeHeader(MasterServerGameTypesResponse, 0, 0, 0);
+			pack->writeU8(0);
+			countPos	= pack->getLength();
+			count		= 0;
+			pack->writeU8(0);
+		}
+
+		pack->writeCString(it->str, it->length);
+		pack->getBufferPtr()[countPos] = ++count;
+	}
+
+	// store the last packet
+	m_TypesResponse.push_back(pack);
+
+	debugPrintf(DPRINT_VERBOSE, "Rebuilt types response, %lu game and %lu mission types in %lu packets\n",
+				(unsigned long)m_GameTypes.Count(), (unsigned long)m_MissionTypes.Count(),
+				(unsigned long)m_TypesResponse.size());
+}
+
+/**
+ * @brief Order and cap the results of a query and work out its packets.
+ *
+ * Servers that missed a liveness probe go after the rest, or aren't listed
+ * at all if probe::HideSuspects is set. The order of the rest is kept.
+ */
+void ServerStore::FinishQuery(Session *session, tcSuspectSet &suspects)
+{
+	tcServerAddrVector	&results = session->results;
+	tcServerAddrVector	last;
+	size_t				i, n;
+
+
+	if(!suspects.empty())
+	{
+		// close up the gaps the suspects leave
+		for(i = n = 0; i < results.size(); i++)
+		{
+			if(!suspects.count(ServerAddress::toSlot(results[i].address, results[i].port)))
+			{
+				results[n++] = results[i];
+				continue;
+			}
+
+			if(!gm_pConfig->probeHideSuspects)
+				last.push_back(results[i]);
+		}
+
+		results.resize(n);
+		results.insert(results.end(), last.begin(), last.end());
+	}
+
+	// we can't list more servers than fit into the maximum number of packets
+	if(results.size() > LIST_PACKETS_MAX * LIST_PACKET_MAX_SERVERS)
+		results.resize(LIST_PACKETS_MAX * LIST_PACKET_MAX_SERVERS);
+
+	// now we have our server list result and need to figure out how many
+	// packets are required, there's always at least one even if it's empty.
+	session->total		= results.size();
+	session->packNum	= LIST_PACKET_MAX_SERVERS;
+	session->packTotal	= session->total ? (session->total + session->packNum -1) / session->packNum : 1;
+	session->packLast	= session->total - (session->packTotal -1) * session->packNum;
+}
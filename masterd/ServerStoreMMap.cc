@@ -0,0 +1,917 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "ServerStoreMMap.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// sections of the file start on cache lines
+#define MMAP_ALIGN(x)	(((x) + 63) & ~(U64)63)
+
+
+/**
+ * @param	path		Store file, created if it doesn't exist.
+ * @param	capacity	Most servers the file holds.
+ */
+ServerStoreMMap::ServerStoreMMap(const char *path, U32 capacity)
+{
+	U64 start = getMilliTime();
+
+
+	m_Path		= path;
+	m_File		= -1;
+	m_Map		= NULL;
+	m_Header	= NULL;
+	m_ProcIndex	= 0;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	if(!capacity)
+		capacity = 1;
+
+	if(!Open(capacity))
+	{
+		Close();
+		return;
+	}
+
+	m_Stats.openTime = getMilliTime() - start;
+
+	debugPrintf(DPRINT_INFO, " - Store file %s: %u servers, room for %u, opened in %llu ms%s\n",
+				m_Path.c_str(), m_Header->count, m_Header->capacity,
+				(unsigned long long)m_Stats.openTime,
+				m_Stats.recovered ? " after rebuilding it" : "");
+}
+
+ServerStoreMMap::~ServerStoreMMap()
+{
+	Close();
+}
+
+
+//==============================================================================
+// Store file
+//==============================================================================
+
+/**
+ * @brief Map the store file, it's created over if it doesn't fit capacity.
+ */
+bool ServerStoreMMap::Open(U32 capacity)
+{
+	tMMapHeader	header;
+	struct stat	st;
+	U16			i;
+	U8			t;
+
+
+	m_File = open(m_Path.c_str(), O_RDWR | O_CREAT, 0644);
+	if(m_File < 0 || fstat(m_File, &st))
+	{
+		debugPrintf(DPRINT_ERROR, " - Failed to open store file %s: %s\n", m_Path.c_str(), strerror(errno));
+		return false;
+	}
+
+	// a file of another layout or capacity is started over, the servers in it
+	// heartbeat again soon enough.
+	if(pread(m_File, &header, sizeof(header), 0) != sizeof(header) ||
+	   memcmp(header.magic, MMAP_MAGIC, 8) || header.version != MMAP_VERSION ||
+	   header.recordSize != sizeof(tMMapRecord) || header.types != MMAP_TYPES ||
+	   header.capacity != capacity || header.size != (U64)st.st_size)
+	{
+		if(st.st_size)
+			debugPrintf(DPRINT_WARN, " - Store file %s doesn't match store::MMapCapacity, starting it over.\n",
+						m_Path.c_str());
+
+		if(!Create(capacity))
+			return false;
+	}
+	else
+	{
+		m_Map = (char *)mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+		if(m_Map == MAP_FAILED)
+		{
+			m_Map = NULL;
+			debugPrintf(DPRINT_ERROR, " - Failed to map store file %s: %s\n", m_Path.c_str(), strerror(errno));
+			return false;
+		}
+
+		Attach();
+
+		// it may have been left halfway through a change
+		if(m_Header->dirty)
+			Recover();
+	}
+
+	m_Header->dirty	= 1;
+	m_Generation	= m_Header->generation;
+
+	// the types response is built from the unique type lists, they hold a
+	// reference per type while records use it.
+	for(t=0; t < 2; t++)
+	{
+		for(i=0; i < m_TypeEnd[t]; i++)
+		{
+			if(m_Types[t][i].refs)
+				TypeList(t).Push(m_Types[t][i].name);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * @brief Lay out an empty store file.
+ */
+bool ServerStoreMMap::Create(U32 capacity)
+{
+	tMMapHeader	header;
+	U32			i;
+
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MMAP_MAGIC, 8);
+	header.version		= MMAP_VERSION;
+	header.recordSize	= sizeof(tMMapRecord);
+	header.capacity		= capacity;
+	header.blocks		= capacity * MMAP_BLOCKS_PER_RECORD;
+	header.types		= MMAP_TYPES;
+
+	// at least a bucket per record keeps the chains short
+	for(header.buckets = 1; header.buckets < capacity; header.buckets <<= 1);
+
+	header.typesOffset		= MMAP_ALIGN(sizeof(tMMapHeader));
+	header.indexOffset		= MMAP_ALIGN(header.typesOffset + 2 * MMAP_TYPES * sizeof(tMMapType));
+	header.recordsOffset	= MMAP_ALIGN(header.indexOffset + (U64)header.buckets * sizeof(U32));
+	header.blocksOffset		= MMAP_ALIGN(header.recordsOffset + (U64)capacity * sizeof(tMMapRecord));
+	header.size				= MMAP_ALIGN(header.blocksOffset + (U64)header.blocks * sizeof(tMMapPlayers));
+
+	// grown back with zeroes
+	if(ftruncate(m_File, 0) || ftruncate(m_File, header.size))
+	{
+		debugPrintf(DPRINT_ERROR, " - Failed to size store file %s: %s\n", m_Path.c_str(), strerror(errno));
+		return false;
+	}
+
+	m_Map = (char *)mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_File, 0);
+	if(m_Map == MAP_FAILED)
+	{
+		m_Map = NULL;
+		debugPrintf(DPRINT_ERROR, " - Failed to map store file %s: %s\n", m_Path.c_str(), strerror(errno));
+		return false;
+	}
+
+	memcpy(m_Map, &header, sizeof(header));
+	Attach();
+
+	// every bucket empty, every record and player block free
+	memset(m_Index, 0xFF, (size_t)header.buckets * sizeof(U32));
+
+	for(i=0; i < capacity; i++)
+		m_Records[i].next = i +1 < capacity ? i +1 : MMAP_NONE;
+	for(i=0; i < header.blocks; i++)
+		m_Blocks[i].next = i +1 < header.blocks ? i +1 : MMAP_NONE;
+
+	m_Header->freeRecord	= 0;
+	m_Header->freeBlock		= header.blocks ? 0 : MMAP_NONE;
+
+	return true;
+}
+
+/**
+ * @brief Point at the sections of the mapped file.
+ */
+void ServerStoreMMap::Attach(void)
+{
+	U16	i;
+	U8	t;
+
+
+	m_Header		= (tMMapHeader *)m_Map;
+	m_Types[0]		= (tMMapType *)(m_Map + m_Header->typesOffset);
+	m_Types[1]		= m_Types[0] + MMAP_TYPES;
+	m_Index			= (U32 *)(m_Map + m_Header->indexOffset);
+	m_Records		= (tMMapRecord *)(m_Map + m_Header->recordsOffset);
+	m_Blocks		= (tMMapPlayers *)(m_Map + m_Header->blocksOffset);
+	m_BucketMask	= m_Header->buckets -1;
+
+	for(t=0; t < 2; t++)
+	{
+		for(m_TypeEnd[t] = 0, i = 0; i < MMAP_TYPES; i++)
+		{
+			if(m_Types[t][i].refs)
+				m_TypeEnd[t] = i +1;
+		}
+	}
+}
+
+/**
+ * @brief Rebuild the index, free lists and type references from the records.
+ *
+ * Only needed when masterd didn't shut down cleanly, a change may have been
+ * cut short. Records marked used are kept.
+ */
+void ServerStoreMMap::Recover(void)
+{
+	std::vector<bool>	blockUsed(m_Header->blocks, false);
+	tMMapRecord			*rec;
+	U32					i, b, *link, kept;
+	U16					t;
+
+
+	debugPrintf(DPRINT_WARN, " - Store file %s wasn't closed cleanly, rebuilding it.\n", m_Path.c_str());
+
+	memset(m_Index, 0xFF, (size_t)m_Header->buckets * sizeof(U32));
+	for(t=0; t < MMAP_TYPES; t++)
+	{
+		m_Types[0][t].refs = 0;
+		m_Types[1][t].refs = 0;
+	}
+
+	m_Header->count			= 0;
+	m_Header->highWater		= 0;
+	m_Header->blocksUsed	= 0;
+	m_Header->freeRecord	= MMAP_NONE;
+	m_Header->freeBlock		= MMAP_NONE;
+
+	// backwards, so the free list hands out the lowest records first
+	for(i = m_Header->capacity; i--;)
+	{
+		rec = &m_Records[i];
+
+		if(!(rec->flags & MMAP_RECORD_USED))
+		{
+			rec->next				= m_Header->freeRecord;
+			m_Header->freeRecord	= i;
+			continue;
+		}
+
+		if(rec->gameType != MMAP_NO_TYPE && (rec->gameType >= MMAP_TYPES || !m_Types[0][rec->gameType].length))
+			rec->gameType = MMAP_NO_TYPE;
+		if(rec->missionType != MMAP_NO_TYPE && (rec->missionType >= MMAP_TYPES || !m_Types[1][rec->missionType].length))
+			rec->missionType = MMAP_NO_TYPE;
+
+		if(rec->gameType != MMAP_NO_TYPE)		m_Types[0][rec->gameType].refs++;
+		if(rec->missionType != MMAP_NO_TYPE)	m_Types[1][rec->missionType].refs++;
+
+		// keep the player blocks up to the first one that's out of place
+		for(link = &rec->players, kept = 0; *link != MMAP_NONE; link = &m_Blocks[b].next, kept++)
+		{
+			b = *link;
+			if(b >= m_Header->blocks || blockUsed[b] || kept * MMAP_BLOCK_PLAYERS >= rec->playerCount)
+			{
+				*link = MMAP_NONE;
+				break;
+			}
+
+			blockUsed[b] = true;
+			m_Header->blocksUsed++;
+		}
+
+		if(rec->playerCount > kept * MMAP_BLOCK_PLAYERS)
+			rec->playerCount = kept * MMAP_BLOCK_PLAYERS;
+
+		b			= Bucket(ServerAddress::toSlot(rec->address, rec->port));
+		rec->next	= m_Index[b];
+		m_Index[b]	= i;
+
+		m_Header->count++;
+		if(!m_Header->highWater)
+			m_Header->highWater = i +1;
+	}
+
+	for(b = m_Header->blocks; b--;)
+	{
+		if(blockUsed[b])
+			continue;
+
+		m_Blocks[b].next	= m_Header->freeBlock;
+		m_Header->freeBlock	= b;
+	}
+
+	// types no record refers to anymore
+	for(t=0; t < MMAP_TYPES; t++)
+	{
+		if(!m_Types[0][t].refs)	m_Types[0][t].length = m_Types[0][t].name[0] = 0;
+		if(!m_Types[1][t].refs)	m_Types[1][t].length = m_Types[1][t].name[0] = 0;
+	}
+
+	Attach();
+	m_Stats.recovered = true;
+}
+
+void ServerStoreMMap::Close(void)
+{
+	if(m_Map)
+	{
+		// mark it closed cleanly once everything else is on disk
+		m_Header->generation = m_Generation;
+		msync(m_Map, m_Header->size, MS_SYNC);
+		m_Header->dirty = 0;
+		msync(m_Map, sizeof(tMMapHeader), MS_SYNC);
+
+		munmap(m_Map, m_Header->size);
+		m_Map		= NULL;
+		m_Header	= NULL;
+	}
+
+	if(m_File >= 0)
+		close(m_File);
+	m_File = -1;
+}
+
+
+//==============================================================================
+// Records
+//==============================================================================
+
+U32 ServerStoreMMap::Bucket(U64 slot)
+{
+	// fibonacci hashing, spreads sequential addresses and ports
+	return (U32)((slot * 0x9E3779B97F4A7C15ULL) >> 32) & m_BucketMask;
+}
+
+/**
+ * @return	Record of the server, MMAP_NONE if it isn't known.
+ */
+U32 ServerStoreMMap::Find(ServerAddress *addr)
+{
+	U32 i;
+
+
+	for(i = m_Index[Bucket(addr->toSlot())]; i != MMAP_NONE; i = m_Records[i].next)
+	{
+		if(m_Records[i].address == addr->address && m_Records[i].port == addr->port)
+			return i;
+	}
+
+	return MMAP_NONE;
+}
+
+/**
+ * @brief Take a free record for a server, it's empty but indexed.
+ *
+ * @return	The record, MMAP_NONE if the file is full.
+ */
+U32 ServerStoreMMap::Add(ServerAddress *addr)
+{
+	tMMapRecord	*rec;
+	U32			i, b;
+
+
+	i = m_Header->freeRecord;
+	if(i == MMAP_NONE)
+	{
+		if(!m_Stats.full++)
+			debugPrintf(DPRINT_WARN, " - Store file is full, raise store::MMapCapacity.\n");
+		return MMAP_NONE;
+	}
+
+	rec						= &m_Records[i];
+	m_Header->freeRecord	= rec->next;
+
+	// fill it in before it's found through the index
+	memset(rec, 0, sizeof(tMMapRecord));
+	rec->address		= addr->address;
+	rec->port			= addr->port;
+	rec->flags			= MMAP_RECORD_USED;
+	rec->players		= MMAP_NONE;
+	rec->gameType		= MMAP_NO_TYPE;
+	rec->missionType	= MMAP_NO_TYPE;
+
+	b			= Bucket(addr->toSlot());
+	rec->next	= m_Index[b];
+	m_Index[b]	= i;
+
+	m_Header->count++;
+	if(i >= m_Header->highWater)
+		m_Header->highWater = i +1;
+
+	m_Generation++;
+
+	return i;
+}
+
+void ServerStoreMMap::Remove(U32 index)
+{
+	tMMapRecord	*rec = &m_Records[index];
+	U64			slot = ServerAddress::toSlot(rec->address, rec->port);
+	U32			*link;
+
+
+	debugPrintf(DPRINT_VERBOSE, "Remove Server [%u.%u.%u.%u:%hu] Game:\"%s\", Mission:\"%s\"\n",
+				((U8 *)&rec->address)[0], ((U8 *)&rec->address)[1], ((U8 *)&rec->address)[2],
+				((U8 *)&rec->address)[3], rec->port,
+				TypeName(0, rec->gameType), TypeName(1, rec->missionType));
+
+	// take it out of its bucket
+	for(link = &m_Index[Bucket(slot)]; *link != MMAP_NONE; link = &m_Records[*link].next)
+	{
+		if(*link == index)
+		{
+			*link = rec->next;
+			break;
+		}
+	}
+
+	ReleaseType(0, rec->gameType);
+	ReleaseType(1, rec->missionType);
+	FreePlayers(rec);
+
+	m_Suspects.erase(slot);
+	m_Pinned.erase(slot);
+
+	rec->flags				= 0;
+	rec->next				= m_Header->freeRecord;
+	m_Header->freeRecord	= index;
+	m_Header->count--;
+
+	m_Generation++;
+}
+
+
+//==============================================================================
+// Types
+//==============================================================================
+
+U16 ServerStoreMMap::FindType(U8 table, const char *name)
+{
+	tMMapType	*type;
+	size_t		len = strlen(name);
+	U16			i;
+
+
+	for(i=0; i < m_TypeEnd[table]; i++)
+	{
+		type = &m_Types[table][i];
+		if(type->refs && type->length == len && !stricmp(type->name, name))
+			return i;
+	}
+
+	return MMAP_NO_TYPE;
+}
+
+/**
+ * @brief Take a reference to a type, it's added if it isn't known.
+ *
+ * @return	The type, MMAP_NO_TYPE for NULL or if the table is full.
+ */
+U16 ServerStoreMMap::AcquireType(U8 table, const char *name)
+{
+	tMMapType	*type;
+	size_t		len;
+	U16			i;
+
+
+	if(!name)
+		return MMAP_NO_TYPE;
+
+	i = FindType(table, name);
+	if(i != MMAP_NO_TYPE)
+	{
+		m_Types[table][i].refs++;
+		return i;
+	}
+
+	// first unused entry
+	for(i=0; i < MMAP_TYPES && m_Types[table][i].refs; i++);
+	if(i == MMAP_TYPES)
+	{
+		m_Stats.lostTypes++;
+		return MMAP_NO_TYPE;
+	}
+
+	// types are C strings in the protocol, they can't be any longer
+	len = strlen(name);
+	if(len > 0xFF)
+		len = 0xFF;
+
+	type = &m_Types[table][i];
+	memcpy(type->name, name, len);
+	type->name[len]	= 0;
+	type->length	= len;
+	type->refs		= 1;
+
+	if(i >= m_TypeEnd[table])
+		m_TypeEnd[table] = i +1;
+
+	TypeList(table).Push(type->name);
+
+	return i;
+}
+
+void ServerStoreMMap::ReleaseType(U8 table, U16 id)
+{
+	tMMapType *type;
+
+
+	if(id == MMAP_NO_TYPE)
+		return;
+
+	type = &m_Types[table][id];
+	if(--type->refs)
+		return;
+
+	TypeList(table).PopRef(TypeList(table).GetRef(type->name));
+	type->length	= 0;
+	type->name[0]	= 0;
+}
+
+
+//==============================================================================
+// Players
+//==============================================================================
+
+/**
+ * @brief Store a server's player GUIDs in player blocks.
+ *
+ * Players that don't fit the blocks left are counted and dropped.
+ */
+void ServerStoreMMap::SetPlayers(tMMapRecord *rec, const PlayerList &players)
+{
+	U32		*link = &rec->players, b, i, n;
+	U8		count = players.Count();
+
+
+	FreePlayers(rec);
+
+	for(i=0; i < count; i += n)
+	{
+		b = m_Header->freeBlock;
+		if(b == MMAP_NONE)
+		{
+			m_Stats.lostPlayers += count - i;
+			count = i;
+			break;
+		}
+
+		m_Header->freeBlock = m_Blocks[b].next;
+		m_Header->blocksUsed++;
+
+		n = count - i;
+		if(n > MMAP_BLOCK_PLAYERS)
+			n = MMAP_BLOCK_PLAYERS;
+
+		memcpy(m_Blocks[b].guids, players.Get() + i, n * sizeof(U32));
+		m_Blocks[b].next	= MMAP_NONE;
+		*link				= b;
+		link				= &m_Blocks[b].next;
+	}
+
+	rec->playerCount = count;
+}
+
+void ServerStoreMMap::FreePlayers(tMMapRecord *rec)
+{
+	U32 b, next;
+
+
+	for(b = rec->players; b != MMAP_NONE; b = next)
+	{
+		next				= m_Blocks[b].next;
+		m_Blocks[b].next	= m_Header->freeBlock;
+		m_Header->freeBlock	= b;
+		m_Header->blocksUsed--;
+	}
+
+	rec->players		= MMAP_NONE;
+	rec->playerCount	= 0;
+}
+
+/**
+ * @brief Whether one of the buddies in m_Buddies is on the server.
+ */
+bool ServerStoreMMap::HasBuddy(tMMapRecord *rec)
+{
+	U32 b, i, left = rec->playerCount;
+
+
+	for(b = rec->players; b != MMAP_NONE && left; b = m_Blocks[b].next)
+	{
+		for(i=0; i < MMAP_BLOCK_PLAYERS && left; i++, left--)
+		{
+			if(std::binary_search(m_Buddies.begin(), m_Buddies.end(), m_Blocks[b].guids[i]))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+//==============================================================================
+// Server Store
+//==============================================================================
+
+void ServerStoreMMap::DoProcessing(int count)
+{
+	tMMapRecord	*rec;
+	S32			now = getAbsTime();
+	U32			scanned;
+
+
+	// check for out of date records, a few at a time
+	for(scanned = 0; scanned < MMAP_EXPIRE_SCAN && count > 0 && m_Header->count; scanned++)
+	{
+		if(m_ProcIndex >= m_Header->highWater)
+			m_ProcIndex = 0;
+
+		rec = &m_Records[m_ProcIndex++];
+		if(!(rec->flags & MMAP_RECORD_USED))
+			continue;
+
+		count--;
+
+		// has server record expired? pinned ones never do
+		if(rec->last_info + (int)gm_pConfig->heartbeat > now ||
+		   m_Pinned.count(ServerAddress::toSlot(rec->address, rec->port)))
+			continue;
+
+		Remove(m_ProcIndex -1);
+	}
+
+	// readers of the file can tell it changed
+	m_Header->generation = m_Generation;
+}
+
+void ServerStoreMMap::HeartbeatServer(ServerAddress *addr)
+{
+	U32 i = Find(addr);
+
+
+	if(i != MMAP_NONE)
+		m_Records[i].last_heart = getAbsTime();
+}
+
+/**
+ * @brief Copy a server's info into its record.
+ */
+void ServerStoreMMap::SetInfo(tMMapRecord *rec, ServerInfo *info)
+{
+	U16 game, mission;
+
+
+	rec->fingerprint	= info->fingerprint;
+	rec->maxPlayers		= info->maxPlayers;
+	rec->regions		= info->regions;
+	rec->version		= info->version;
+	rec->infoFlags		= info->infoFlags;
+	rec->numBots		= info->numBots;
+	rec->CPUSpeed		= info->CPUSpeed;
+
+	// take the new types before letting go of the old, a type that stays
+	// doesn't drop out of the table in between.
+	game	= AcquireType(0, info->gameType);
+	mission	= AcquireType(1, info->missionType);
+	ReleaseType(0, rec->gameType);
+	ReleaseType(1, rec->missionType);
+	rec->gameType		= game;
+	rec->missionType	= mission;
+
+	SetPlayers(rec, info->playerList);
+
+	rec->last_info = getAbsTime();
+}
+
+void ServerStoreMMap::UpdateServer(ServerAddress *addr, ServerInfo *info)
+{
+	tMMapRecord	*rec;
+	U32			i;
+	char		*str;
+	bool		added = false;
+
+
+	i = Find(addr);
+	if(i == MMAP_NONE)
+	{
+		i = Add(addr);
+		if(i == MMAP_NONE)
+			return;
+
+		added = true;
+	}
+
+	rec = &m_Records[i];
+
+	// nothing changed, the server only told us it's still there
+	if(!added && info->fingerprint && info->fingerprint == rec->fingerprint)
+	{
+		rec->last_info = getAbsTime();
+		m_Refreshes++;
+		return;
+	}
+
+	SetInfo(rec, info);
+	m_Generation++;
+
+	debugPrintf(DPRINT_VERBOSE, "%s Server [%s:%hu] Game:\"%s\", Mission:\"%s\"\n",
+				added ? "New" : "Updated", str = addr->toString(), addr->port,
+				TypeName(0, rec->gameType), TypeName(1, rec->missionType));
+	delete[] str;
+}
+
+bool ServerStoreMMap::RefreshServer(ServerAddress *addr, U64 fingerprint)
+{
+	U32 i;
+
+
+	if(!fingerprint)
+		return false;
+
+	i = Find(addr);
+	if(i == MMAP_NONE || m_Records[i].fingerprint != fingerprint)
+		return false;
+
+	m_Records[i].last_info = getAbsTime();
+	m_Refreshes++;
+
+	return true;
+}
+
+void ServerStoreMMap::SuspectServer(ServerAddress *addr, bool suspect)
+{
+	if(Find(addr) == MMAP_NONE)
+		return;
+
+	if(suspect)
+		m_Suspects.insert(addr->toSlot());
+	else
+		m_Suspects.erase(addr->toSlot());
+
+	// changes what queries list
+	m_Generation++;
+}
+
+void ServerStoreMMap::DropServer(ServerAddress *addr)
+{
+	U32 i = Find(addr);
+
+
+	if(i == MMAP_NONE)
+		return;
+
+	// pinned servers stay, the prober stops watching them so they're listed
+	// like the rest again.
+	if(m_Pinned.count(addr->toSlot()))
+	{
+		if(m_Suspects.erase(addr->toSlot()))
+			m_Generation++;
+		return;
+	}
+
+	Remove(i);
+}
+
+void ServerStoreMMap::PinServer(ServerAddress *addr, const char *gameType, const char *missionType)
+{
+	tMMapRecord	*rec;
+	U32			i;
+
+
+	m_Pinned.insert(addr->toSlot());
+
+	// a known server keeps its info
+	if(Find(addr) != MMAP_NONE)
+		return;
+
+	i = Add(addr);
+	if(i == MMAP_NONE)
+	{
+		m_Pinned.erase(addr->toSlot());
+		return;
+	}
+
+	rec					= &m_Records[i];
+	rec->gameType		= AcquireType(0, gameType);
+	rec->missionType	= AcquireType(1, missionType);
+	rec->last_info		= getAbsTime();
+}
+
+void ServerStoreMMap::UnpinServer(ServerAddress *addr)
+{
+	m_Pinned.erase(addr->toSlot());
+}
+
+void ServerStoreMMap::QueryServers(Session *session, ServerFilter *filter)
+{
+	tMMapRecord		*rec;
+	tServerAddress	addr;
+	U32				game = MMAP_NONE, mission = MMAP_NONE, i;
+
+
+	debugPrintf(DPRINT_VERBOSE, "Query for Game:\"%s\", Mission:\"%s\"\n",
+				filter->gameType, filter->missionType);
+
+	// a type we don't have can't match any servers
+	if(filter->gameType && strlen(filter->gameType) && stricmp(filter->gameType, "any"))
+	{
+		game = FindType(0, filter->gameType);
+		if(game == MMAP_NO_TYPE)
+			goto Done;
+	}
+	if(filter->missionType && strlen(filter->missionType) && stricmp(filter->missionType, "any"))
+	{
+		mission = FindType(1, filter->missionType);
+		if(mission == MMAP_NO_TYPE)
+			goto Done;
+	}
+
+	// buddies are looked up in each server's players
+	m_Buddies.clear();
+	for(i=0; i < filter->buddyCount; i++)
+		m_Buddies.push_back(filter->buddyList[i]);
+	std::sort(m_Buddies.begin(), m_Buddies.end());
+
+	for(i=0; i < m_Header->highWater; i++)
+	{
+		rec = &m_Records[i];
+
+		if(!(rec->flags & MMAP_RECORD_USED) || !MatchFilter(rec, filter, game, mission))
+			continue;
+
+		if(filter->buddyCount && !HasBuddy(rec))
+			continue;
+
+		addr.address	= rec->address;
+		addr.port		= rec->port;
+		session->results.push_back(addr);
+	}
+
+Done:
+	FinishQuery(session, m_Suspects);
+}
+
+/**
+ * @brief Check a record against a query filter.
+ *
+ * Game and mission types are passed in already resolved to our type table
+ * entries, MMAP_NONE for any.
+ */
+bool ServerStoreMMap::MatchFilter(tMMapRecord *rec, ServerFilter *filter, U32 game, U32 mission)
+{
+	if(game != MMAP_NONE && game != rec->gameType)
+		return false;
+
+	if(mission != MMAP_NONE && mission != rec->missionType)
+		return false;
+
+	if(filter->minPlayers && (rec->playerCount < filter->minPlayers))
+		return false;
+
+	if(filter->maxPlayers && (rec->playerCount > filter->maxPlayers))
+		return false;
+
+	if(filter->regions && !(rec->regions & filter->regions))
+		return false;
+
+	if(filter->version && (rec->version < filter->version))
+		return false;
+
+	if(filter->filterFlags && !(rec->infoFlags & filter->filterFlags))
+		return false;
+
+	if(filter->maxBots && (rec->numBots > filter->maxBots))
+		return false;
+
+	if(filter->minCPUSpeed && (rec->CPUSpeed < filter->minCPUSpeed))
+		return false;
+
+	return true;
+}
+
+void ServerStoreMMap::ReportMemory(void)
+{
+	debugPrintf(DPRINT_INFO, " - Store file %s, %u servers:\n", m_Path.c_str(), m_Header->count);
+	debugPrintf(DPRINT_INFO, "     records: %u of %u in use, %lu bytes each\n",
+				m_Header->count, m_Header->capacity, (unsigned long)sizeof(tMMapRecord));
+	debugPrintf(DPRINT_INFO, "     players: %u of %u blocks in use, %u GUIDs each\n",
+				m_Header->blocksUsed, m_Header->blocks, MMAP_BLOCK_PLAYERS);
+	debugPrintf(DPRINT_INFO, "     types:   %u game, %u mission\n",
+				m_GameTypes.Count(), m_MissionTypes.Count());
+	debugPrintf(DPRINT_INFO, "     file:    %llu bytes mapped, %u pinned, %u suspect\n",
+				(unsigned long long)m_Header->size, (U32)m_Pinned.size(), (U32)m_Suspects.size());
+
+	if(m_Stats.full || m_Stats.lostPlayers || m_Stats.lostTypes)
+		debugPrintf(DPRINT_INFO, "     turned away %llu servers, dropped %llu player GUIDs and %llu types\n",
+					(unsigned long long)m_Stats.full, (unsigned long long)m_Stats.lostPlayers,
+					(unsigned long long)m_Stats.lostTypes);
+}
@@ -21,7 +21,6 @@
 */
 
 #include "masterd.h"
-#include <stdlib.h>
 
 
 // Trick to allow conditional compilation of sqlite.
@@ -35,6 +34,8 @@
 #define _SERVERSTORERAM_CPP_
 
 #include "ServerStoreRAM.h"
+#include "StoreJournal.h"
+#include <algorithm>
 
 /**
  * @brief Initialize server db to use filename.
@@ -44,11 +45,38 @@
 ServerStoreRAM::ServerStoreRAM()
 {
 	m_ProcIT = m_Servers.begin();
-	
+
+	// queries read snapshots if they're published
+	m_Snapshots		= gm_pConfig->storeSnapshotInterval ? new StoreSnapshots() : NULL;
+	m_SnapshotTime	= 0;
+	m_QueryPool		= NULL;
+
+	// scanning snapshots in parallel, the threads can't read the map itself
+	if(gm_pConfig->queryThreads)
+	{
+		if(m_Snapshots)
+			m_QueryPool = new QueryPool(gm_pConfig->queryThreads);
+		else
+			debugPrintf(DPRINT_WARN, " - query::Threads needs store::SnapshotInterval, queries run on the core thread.\n");
+	}
 }
 ServerStoreRAM::~ServerStoreRAM()
 {
-	
+	tcServerMap::iterator	it;
+
+	// type strings belong to the unique type managers, don't let the server
+	// records destroy them.
+	for(it = m_Servers.begin(); it != m_Servers.end(); it++)
+	{
+		it->second.gameType		= NULL;
+		it->second.missionType	= NULL;
+	}
+
+	if(m_QueryPool)
+		delete m_QueryPool;
+
+	if(m_Snapshots)
+		delete m_Snapshots;
 }
 
 
@@ -65,10 +93,7 @@ U64 ServerStoreRAM::AddrToSlot(ServerAddress *addr)
 	if(!addr)
 		return 0;
 
-	// 2 bytes: unused / 0x0000
-	// 4 bytes: IPv4 address
-	// 2 bytes: UDP port number
-	slot = (addr->address << 16) | (addr->port & 0xFFFF);
+	slot = addr->toSlot();
 
 	// done
 	return slot;
@@ -105,6 +130,22 @@ bool ServerStoreRAM::FindServer(ServerAddress *addr, ServerInfo **serv)
 	return (*serv != NULL);
 }
 
+void ServerStoreRAM::VisitServers(tServerVisitor visit, void *arg)
+{
+	tcServerMap::iterator	it;
+
+
+	for(it = m_Servers.begin(); it != m_Servers.end(); it++)
+		visit(it->first, &it->second, arg);
+}
+
+void ServerStoreRAM::Changed(U64 slot)
+{
+	// the journal is only set once it's done restoring the servers
+	if(gm_pJournal)
+		gm_pJournal->Changed(slot);
+}
+
 void ServerStoreRAM::AddServer(ServerAddress *addr, ServerInfo *info)
 {
 	U64			slot = AddrToSlot(addr);
@@ -126,6 +167,13 @@ void ServerStoreRAM::AddServer(ServerAddress *addr, ServerInfo *info)
 
 	// insert new server record
 	m_Servers[slot]		= *info;
+	IndexPlayers(slot, info);
+	m_Generation++;
+
+	if(m_Snapshots)
+		m_Snapshots->Set(slot, &m_Servers[slot]);
+
+	Changed(slot);
 
 	debugPrintf(DPRINT_VERBOSE, "New Server [%s:%hu] Game:\"%s\", Mission:\"%s\"\n",
 				str = addr->toString(), addr->port, info->gameType, info->missionType);
@@ -134,9 +182,6 @@ void ServerStoreRAM::AddServer(ServerAddress *addr, ServerInfo *info)
 	// give back the old string references to the stack serverinfo
 	info->gameType		= oldGame;
 	info->missionType	= oldMission;
-
-	// don't destroy player list, we're using it
-	info->setToDestroy(false);
 	
 	// done
 }
@@ -156,12 +201,22 @@ void ServerStoreRAM::RemoveServer(tcServerMap::iterator &it)
 	m_GameTypes.PopRef(info->gameType);
 	m_MissionTypes.PopRef(info->missionType);
 
+	// drop its players from the buddy index
+	UnindexPlayers(it->first, info);
+
+	if(m_Snapshots)
+		m_Snapshots->Remove(it->first);
+
+	m_Suspects.erase(it->first);
+	Changed(it->first);
+
 	// invalid the type pointers
 	info->gameType		= NULL;
 	info->missionType	= NULL;
 
 	// delete the record
 	m_Servers.erase(it);
+	m_Generation++;
 
 	// done
 }
@@ -177,6 +232,67 @@ void ServerStoreRAM::RemoveServer(ServerAddress *addr)
 	// done
 }
 
+/**
+ * @brief The GUIDs of a server's players, sorted and each listed once.
+ *
+ * Servers list whatever GUIDs they like, as often as they like, the buddy
+ * index only needs to know a GUID is on a server at all.
+ */
+void ServerStoreRAM::SortPlayers(ServerInfo *info, std::vector<U32> &guids)
+{
+	U32 *players = info->playerList.Get();
+
+
+	guids.assign(players, players + info->playerCount());
+	std::sort(guids.begin(), guids.end());
+	guids.erase(std::unique(guids.begin(), guids.end()), guids.end());
+}
+
+void ServerStoreRAM::IndexPlayers(U64 slot, ServerInfo *info)
+{
+	U32 i;
+
+	// map each player on the server back to the server
+	SortPlayers(info, m_NewPlayers);
+	for(i=0; i < m_NewPlayers.size(); i++)
+		m_BuddyIndex.insert(tBuddyEntry(m_NewPlayers[i], slot));
+}
+
+void ServerStoreRAM::UnindexPlayers(U64 slot, ServerInfo *info)
+{
+	U32 i;
+
+	SortPlayers(info, m_OldPlayers);
+	for(i=0; i < m_OldPlayers.size(); i++)
+		m_BuddyIndex.erase(tBuddyEntry(m_OldPlayers[i], slot));
+}
+
+/**
+ * @brief Swap a server's old players in the buddy index for its new ones.
+ *
+ * m_OldPlayers holds the old players as SortPlayers() lists them, only the
+ * players that joined or left are touched.
+ */
+void ServerStoreRAM::ReindexPlayers(U64 slot)
+{
+	std::vector<U32>::iterator	o = m_OldPlayers.begin(), n = m_NewPlayers.begin();
+
+
+	while(o != m_OldPlayers.end() || n != m_NewPlayers.end())
+	{
+		if(n == m_NewPlayers.end() || (o != m_OldPlayers.end() && *o < *n))
+			m_BuddyIndex.erase(tBuddyEntry(*o++, slot));
+		else if(o == m_OldPlayers.end() || *n < *o)
+			m_BuddyIndex.insert(tBuddyEntry(*n++, slot));
+		else
+		{
+			// still there
+			o++;
+			n++;
+		}
+	}
+}
+
 
 
 void ServerStoreRAM::DoProcessing(int count)
@@ -191,8 +307,8 @@ void ServerStoreRAM::DoProcessing(int count)
 	{
 		rec = &m_ProcIT->second;
 
-		// has server record expired?
-		if(rec->last_info + (int)gm_pConfig->heartbeat > getAbsTime())
+		// has server record expired? pinned ones never do
+		if(rec->pinned || rec->last_info + (int)gm_pConfig->heartbeat > getAbsTime())
 		{
 			// nope, next...
 			m_ProcIT++;
@@ -217,48 +333,65 @@ void ServerStoreRAM::DoProcessing(int count)
 //	if(count && (count < m_Servers.size()))
 //		goto CheckMoreServers;
 
+	// publish the changes made since the last snapshot, no more often than
+	// the snapshot interval.
+	if(m_Snapshots && m_Snapshots->Pending() &&
+	   getMilliTime() >= m_SnapshotTime + gm_pConfig->storeSnapshotInterval)
+	{
+		m_Snapshots->Publish();
+		m_SnapshotTime = getMilliTime();
+	}
+
 	// done
 }
 
-void ServerStoreRAM::HeartbeatServer(ServerAddress *addr, U16 *session, U16 *key)
+void ServerStoreRAM::HeartbeatServer(ServerAddress *addr)
 {
-	// generate a random session and key to use to send an info request from the
-	// server that just hearbeat us. We really don't care about the session and
-	// key details so we don't save them because we track servers based on the
-	// IP address and port anyway. Other than that this function does nothing
-	// special.
-
-	// seed the random generator
-	srand(getAbsTime() + addr->address + addr->port);
-	
-	if(session)	*session	= (U16)rand();
-	if(key)		*key		= (U16)rand();
+	ServerInfo	*rec;
+
+
+	// remember when a server we know of last heartbeat us, the session and
+	// key of the info request are issued by the info requester.
+	if(FindServer(addr, &rec))
+		rec->last_heart = getAbsTime();
 
 	// done
 }
 
 void ServerStoreRAM::UpdateServer(ServerAddress *addr, ServerInfo *info)
 {
-	ServerInfo	*rec;
-	char		*oldGame, *oldMission, *str;
+	tcServerMap::iterator	it;
+	ServerInfo				*rec;
+	char					*oldGame, *oldMission, *str;
 
 
 	// find the existing server record
-	if(!FindServer(addr, &rec))
+	if(!FindServer(addr, it))
 	{
 		// not found, add server to our list and abort
 		AddServer(addr, info);
 		return;
 	}
 
+	rec = &it->second;
+
+	// nothing changed, the server only told us it's still there
+	if(info->fingerprint && info->fingerprint == rec->fingerprint)
+	{
+		rec->last_info = getAbsTime();
+		m_Refreshes++;
+		Changed(it->first);
+		return;
+	}
+
 	// update an existing server record
+	rec->fingerprint	= info->fingerprint;
 	rec->maxPlayers 	= info->maxPlayers;
 	rec->regions		= info->regions;
 	rec->version		= info->version;
 	rec->infoFlags		= info->infoFlags;
 	rec->numBots		= info->numBots;
 	rec->CPUSpeed		= info->CPUSpeed;
-	rec->playerCount	= info->playerCount;
 
 	// special handling of game and mission type,
 	// remember current type references.
@@ -274,15 +407,21 @@ void ServerStoreRAM::UpdateServer(ServerAddress *addr, ServerInfo *info)
 	if(oldMission != rec->missionType)	m_MissionTypes.PopRef(oldMission);
 
 
-	// destroy existing player GUID list and point to the new one
-	if(rec->playerList)
-		delete[] rec->playerList;
-
-	rec->playerList = info->playerList;
-	info->setToDestroy(false);			// don't destroy list, we're using it
+	// copy the player GUID list, storage is reused in place if it fits,
+	// and swap the old players in the buddy index for the new ones.
+	SortPlayers(rec, m_OldPlayers);
+	rec->playerList		= info->playerList;
+	SortPlayers(rec, m_NewPlayers);
+	ReindexPlayers(it->first);
 
 	// update last information update time
 	rec->last_info		= getAbsTime();
+	m_Generation++;
+
+	if(m_Snapshots)
+		m_Snapshots->Set(it->first, rec);
+
+	Changed(it->first);
 
 	debugPrintf(DPRINT_VERBOSE, "Updated Server [%s:%hu] Game:\"%s\", Mission:\"%s\"\n",
 				str = addr->toString(), addr->port, rec->gameType, rec->missionType);
@@ -291,19 +430,166 @@ void ServerStoreRAM::UpdateServer(ServerAddress *addr, ServerInfo *info)
 	// done
 }
 
+/**
+ * @brief Refresh a server whose info payload didn't change.
+ *
+ * Saves parsing the payload and updating the record with the same values.
+ *
+ * @param	fingerprint	Hash of the info payload.
+ * @return	True if the server is known with the same payload.
+ */
+bool ServerStoreRAM::RefreshServer(ServerAddress *addr, U64 fingerprint)
+{
+	ServerInfo *rec;
+
+
+	if(!fingerprint || !FindServer(addr, &rec) || rec->fingerprint != fingerprint)
+		return false;
+
+	rec->last_info = getAbsTime();
+	m_Refreshes++;
+	Changed(AddrToSlot(addr));
+
+	return true;
+}
+
+/**
+ * @brief Mark a server that missed a liveness probe, or clear it.
+ *
+ * Suspect servers are listed after the rest, or not at all if
+ * probe::HideSuspects is set.
+ */
+void ServerStoreRAM::SuspectServer(ServerAddress *addr, bool suspect)
+{
+	ServerInfo *rec;
+
+
+	if(!FindServer(addr, &rec))
+		return;
+
+	if(suspect)
+		m_Suspects.insert(AddrToSlot(addr));
+	else
+		m_Suspects.erase(AddrToSlot(addr));
+
+	// changes what queries list
+	m_Generation++;
+}
+
+/**
+ * @brief Remove a server before it expires, it's known to be gone.
+ */
+void ServerStoreRAM::DropServer(ServerAddress *addr)
+{
+	tcServerMap::iterator it;
+
+
+	if(!FindServer(addr, it))
+		return;
+
+	// pinned servers stay, the prober stops watching them so they're listed
+	// like the rest again.
+	if(it->second.pinned)
+	{
+		if(m_Suspects.erase(it->first))
+			m_Generation++;
+		return;
+	}
+
+	// don't leave the expiry check on a removed record
+	if(it == m_ProcIT)
+		m_ProcIT++;
+
+	RemoveServer(it);
+}
+
+/**
+ * @brief Pin a server listed in the seed file, it's added if it isn't known.
+ *
+ * The types are only used for a server that's added, NULL for none. A known
+ * server keeps its info.
+ */
+void ServerStoreRAM::PinServer(ServerAddress *addr, const char *gameType, const char *missionType)
+{
+	ServerInfo	*rec, info;
+
+
+	if(FindServer(addr, &rec))
+	{
+		rec->pinned = 1;
+		return;
+	}
+
+	info.gameType		= (char *)gameType;
+	info.missionType	= (char *)missionType;
+	info.pinned			= 1;
+
+	AddServer(addr, &info);
+
+	// the type names aren't ours to delete
+	info.gameType		= NULL;
+	info.missionType	= NULL;
+}
+
+/**
+ * @brief Unpin a server no longer in the seed file, it expires as usual.
+ */
+void ServerStoreRAM::UnpinServer(ServerAddress *addr)
+{
+	ServerInfo *rec;
+
+
+	if(FindServer(addr, &rec))
+		rec->pinned = 0;
+}
+
+/**
+ * @brief Put the slots of the servers any of the buddies are on into m_BuddySlots.
+ *
+ * Each server is listed once, in slot order.
+ */
+void ServerStoreRAM::FindBuddies(ServerFilter *filter)
+{
+	tcBuddyIndex::iterator	bit;
+	U32						n;
+
+
+	m_BuddySlots.clear();
+
+	// look up the servers of each buddy in the buddy index
+	for(n=0; n < filter->buddyCount; n++)
+	{
+		bit = m_BuddyIndex.lower_bound(tBuddyEntry(filter->buddyList[n], 0));
+
+		for(; bit != m_BuddyIndex.end() && bit->first == filter->buddyList[n]; bit++)
+			m_BuddySlots.push_back(bit->second);
+	}
+
+	// several buddies may be on the same server, list each server once and
+	// in the same order a full table scan would produce them.
+	std::sort(m_BuddySlots.begin(), m_BuddySlots.end());
+	m_BuddySlots.erase(std::unique(m_BuddySlots.begin(), m_BuddySlots.end()), m_BuddySlots.end());
+}
+
 void ServerStoreRAM::QueryServers(Session *session, ServerFilter *filter)
 {
-	tcServerMap::iterator	it;
-	ServerInfo				*info;
-	tServerAddress			addr;
-	char					*game = NULL, *mission = NULL;
-	bool					buddyFound;
-	U32						i, n;
+	tcServerMap::iterator					it;
+	std::vector<U64>::iterator				sit;
+	ServerInfo								*info;
+	tServerAddress							addr;
+	char									*game = NULL, *mission = NULL;
 
 
 	debugPrintf(DPRINT_VERBOSE, "Query for Game:\"%s\", Mission:\"%s\"\n",
 				filter->gameType, filter->missionType);
 
+	// snapshots are read instead of the map if they're published
+	if(m_Snapshots)
+	{
+		QuerySnapshot(session, filter);
+		goto SkipFilterTests;
+	}
+
 	// special handling of game and mission types
 	if(filter->gameType && strlen(filter->gameType))
 	{
@@ -331,6 +617,38 @@ void ServerStoreRAM::QueryServers(Session *session, ServerFilter *filter)
 				goto SkipFilterTests; // no match found, no servers will satify filter
 		}
 	}
+
+	// this part we check on our buddies, but I don't know if we're suppose
+	// to exclude servers of which client's buddies aren't on them just like
+	// an explicit filter, or any servers that have our buddies on them will
+	// be an exception to the filters above, but for now we're doing the former.
+	// --TRON
+
+	// buddy search, only the servers our buddies are on are candidates
+	if(filter->buddyCount)
+	{
+		FindBuddies(filter);
+
+		// now filter the candidate servers
+		for(sit = m_BuddySlots.begin(); sit != m_BuddySlots.end(); sit++)
+		{
+			it = m_Servers.find(*sit);
+			if(it == m_Servers.end())
+				continue; // shouldn't happen, index is kept in sync
+
+			info = &it->second;
+			if(!MatchFilter(info, filter, game, mission))
+				continue; // skip
+
+			// server passed the filter test, add it to the list
+			addr.address	= info->addr.address;
+			addr.port		= info->addr.port;
+
+			session->results.push_back(addr);
+		}
+
+		goto SkipFilterTests;
+	}
 	
 	
 	// build server list matching the query filter
@@ -339,90 +657,227 @@ void ServerStoreRAM::QueryServers(Session *session, ServerFilter *filter)
 		// get server record
 		info = &it->second;
 
-		// check the game type
-		if(game && (game != info->gameType))
+		if(!MatchFilter(info, filter, game, mission))
 			continue; // skip
 
-		// check the mission type
-		if(mission && (mission != info->missionType))
-			continue; // skip
+		// server passed the filter test, add it to the list
+		addr.address	= info->addr.address;
+		addr.port		= info->addr.port;
+		
+		session->results.push_back(addr);
+	}
 
-		// check minimum player count
-		if(filter->minPlayers && (info->playerCount < filter->minPlayers))
-			continue; // skip
+SkipFilterTests:
+	FinishQuery(session, m_Suspects);
 
-		// check maximum player count
-		if(filter->maxPlayers && (info->playerCount > filter->maxPlayers))
-			continue; // skip
+	// done
+}
 
-		// check regions mask
-		if(filter->regions && !(info->regions & filter->regions))
-			continue; // skip
 
-		// check minimum version
-		if(filter->version && (info->version < filter->version))
-			continue; // skip
+/**
+ * @brief Query the latest published snapshot.
+ *
+ * Same as a query of the map, except that servers are listed in the order
+ * of their snapshot positions and changes show up once they're published.
+ */
+void ServerStoreRAM::QuerySnapshot(Session *session, ServerFilter *filter)
+{
+	const tSnapshot	*snap;
+	tSnapQuery		query;
+	U32				n;
 
-		// check information bit flag mask
-		if(filter->filterFlags && !(info->infoFlags & filter->filterFlags))
-			continue; // skip
 
-		// check maximum bot count
-		if(filter->maxBots && (info->numBots > filter->maxBots))
-			continue; // skip
+	snap = m_Snapshots->Acquire(SNAPSHOT_READER_CORE);
 
-		// check minimum processor speed
-		if(filter->minCPUSpeed && (info->CPUSpeed < filter->minCPUSpeed))
-			continue;
+	query.filter		= filter;
+	query.gameType		= SNAPSHOT_TYPE_ANY;
+	query.missionType	= SNAPSHOT_TYPE_ANY;
+	query.buddies		= NULL;
+	query.buddyCount	= 0;
 
-		// this part we check on our buddies, but I don't know if we're suppose
-		// to exclude servers of which client's buddies aren't on them just like
-		// an explicit filter, or any servers that have our buddies on them will
-		// be an exception to the filters above, but for now we're doing the former.
-		// --TRON
+	// resolve game and mission types to the snapshot's type ids, a type it
+	// doesn't have can't match any servers.
+	if(filter->gameType && strlen(filter->gameType) && stricmp(filter->gameType, "any"))
+	{
+		query.gameType = StoreSnapshots::FindType(snap->gameTypes, filter->gameType);
+		if(query.gameType == SNAPSHOT_TYPE_NONE)
+			goto Done;
+	}
+	if(filter->missionType && strlen(filter->missionType) && stricmp(filter->missionType, "any"))
+	{
+		query.missionType = StoreSnapshots::FindType(snap->missionTypes, filter->missionType);
+		if(query.missionType == SNAPSHOT_TYPE_NONE)
+			goto Done;
+	}
 
-		// check buddies list
-		if(filter->buddyCount)
-		{
-			buddyFound = false;
-			
-			// see if any of our buddies are on this server
-			for(i=0; (i < info->playerCount) && !buddyFound; i++)
-			{
-				for(n=0; n < filter->buddyCount; n++)
-				{
-					// does buddy match?
-					if(filter->buddyList[n] == info->playerList[i])
-					{
-						// yep, server is acceptable
-						buddyFound = true;
-						break;
-					}
-				}
-			}
-
-			// was any of the client's buddies on this server
-			if(!buddyFound)
-				continue; // nope, skip
-		}
-		
+	// buddies are looked up in each server's players
+	if(filter->buddyCount)
+	{
+		m_Buddies.clear();
+		for(n=0; n < filter->buddyCount; n++)
+			m_Buddies.push_back(filter->buddyList[n]);
 
-		// server passed the filter test, add it to the list
-		addr.address	= info->addr.address;
-		addr.port		= info->addr.port;
-		
-		session->results.push_back(addr);
+		std::sort(m_Buddies.begin(), m_Buddies.end());
+
+		query.buddies		= &m_Buddies[0];
+		query.buddyCount	= m_Buddies.size();
 	}
 
-SkipFilterTests:
-	// now we have our server list result and need to figure out how many
-	// packets are required.
-	session->total		= session->results.size();
-	session->packTotal	= (session->total / LIST_PACKET_MAX_SERVERS) +1;
-	session->packNum	= session->total / LIST_PACKET_MAX_SERVERS;
-	session->packLast	= session->total % LIST_PACKET_MAX_SERVERS;
+	// only the servers the buddy index has the buddies on are candidates,
+	// the snapshot decides whether they were on them when it was taken.
+	if(query.buddies)
+	{
+		FindBuddies(filter);
+		m_Snapshots->ScanSlots(snap, m_BuddySlots, &query, session->results);
+	}
+	// split large tables over the query threads
+	else if(m_QueryPool && snap->servers >= gm_pConfig->queryParallelThreshold)
+		m_QueryPool->Scan(snap, &query, session->results);
+	else
+		StoreSnapshots::Scan(snap, 0, snap->chunks.size(), &query, session->results);
 
-	// done
+Done:
+	m_Snapshots->Release(SNAPSHOT_READER_CORE);
+}
+
+
+/**
+ * @brief Check a server record against a query filter.
+ *
+ * Game and mission types are passed in already resolved to our unique type
+ * references, NULL for any. Buddies aren't checked here, buddy searches only
+ * pass servers from the buddy index to us.
+ */
+bool ServerStoreRAM::MatchFilter(ServerInfo *info, ServerFilter *filter, char *game, char *mission)
+{
+	// check the game type
+	if(game && (game != info->gameType))
+		return false;
+
+	// check the mission type
+	if(mission && (mission != info->missionType))
+		return false;
+
+	// check minimum player count
+	if(filter->minPlayers && (info->playerCount() < filter->minPlayers))
+		return false;
+
+	// check maximum player count
+	if(filter->maxPlayers && (info->playerCount() > filter->maxPlayers))
+		return false;
+
+	// check regions mask
+	if(filter->regions && !(info->regions & filter->regions))
+		return false;
+
+	// check minimum version
+	if(filter->version && (info->version < filter->version))
+		return false;
+
+	// check information bit flag mask
+	if(filter->filterFlags && !(info->infoFlags & filter->filterFlags))
+		return false;
+
+	// check maximum bot count
+	if(filter->maxBots && (info->numBots > filter->maxBots))
+		return false;
+
+	// check minimum processor speed
+	if(filter->minCPUSpeed && (info->CPUSpeed < filter->minCPUSpeed))
+		return false;
+
+	// server passed the filter
+	return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Memory report
+//------------------------------------------------------------------------------
+
+// size of a std::map node before its value (color, parent, left and right)
+#define MAP_NODE_OVERHEAD	(4 * sizeof(void *))
+
+// ServerInfo layout prior to the compact record with inline player storage,
+// only kept around so the memory report can show what it used to cost.
+typedef struct tLegacyServerInfo
+{
+	ServerAddress	addr;
+	U16				session;
+	U16				key;
+	char			*gameType;
+	char			*missionType;
+	U8				maxPlayers;
+	U32				regions;
+	U32				version;
+	U8				infoFlags;
+	U8				numBots;
+	U16				CPUSpeed;
+	U8				playerCount;
+	U32				*playerList;
+	int				last_heart;
+	int				last_info;
+	bool			m_DestroyPlayers;
+} tLegacyServerInfo;
+
+/**
+ * @brief Estimate the heap cost of an allocation.
+ *
+ * Models glibc malloc, a size_t of chunk overhead rounded up to 16 bytes with
+ * a minimum chunk size of 32 bytes.
+ */
+static size_t HeapChunkSize(size_t bytes)
+{
+	size_t size = (bytes + sizeof(size_t) + 15) & ~(size_t)15;
+
+	return (size < 32) ? 32 : size;
+}
+
+void ServerStoreRAM::ReportMemory(void)
+{
+	tcServerMap::iterator	it;
+	size_t					count, records, players, legacy;
+
+
+	count	= m_Servers.size();
+	records	= count * HeapChunkSize(MAP_NODE_OVERHEAD + sizeof(tcServerMap::value_type));
+	legacy	= count * HeapChunkSize(MAP_NODE_OVERHEAD + sizeof(U64) + sizeof(tLegacyServerInfo));
+	players	= 0;
+
+	// player lists are the only variable sized part of a record
+	for(it = m_Servers.begin(); it != m_Servers.end(); it++)
+	{
+		players += it->second.playerList.HeapBytes();
+
+		if(it->second.playerCount())
+			legacy += HeapChunkSize(it->second.playerCount() * sizeof(U32));
+	}
+
+	debugPrintf(DPRINT_INFO, " - Store memory report, %lu servers:\n", (unsigned long)count);
+	debugPrintf(DPRINT_INFO, "     generation %llu, %llu info updates without changes\n",
+				(unsigned long long)m_Generation, (unsigned long long)m_Refreshes);
+	debugPrintf(DPRINT_INFO, "     records: %lu bytes, %lu bytes per record\n",
+				(unsigned long)records,
+				(unsigned long)HeapChunkSize(MAP_NODE_OVERHEAD + sizeof(tcServerMap::value_type)));
+	debugPrintf(DPRINT_INFO, "     players: %lu bytes in use, %lu bytes reserved by slab\n",
+				(unsigned long)players, (unsigned long)PlayerSlab::BytesReserved());
+	debugPrintf(DPRINT_INFO, "     buddy index: %lu players\n", (unsigned long)m_BuddyIndex.size());
+	debugPrintf(DPRINT_INFO, "     types:   %lu game (%lu bytes), %lu mission (%lu bytes)\n",
+				(unsigned long)m_GameTypes.Count(),    (unsigned long)m_GameTypes.TotalSize(),
+				(unsigned long)m_MissionTypes.Count(), (unsigned long)m_MissionTypes.TotalSize());
+
+	if(m_Snapshots)
+		m_Snapshots->Report();
+
+	if(m_QueryPool)
+		m_QueryPool->Report();
+
+	// per server average of now and of the previous layout
+	if(count)
+	{
+		debugPrintf(DPRINT_INFO, "     per server: %lu bytes (previous layout: %lu bytes)\n",
+					(unsigned long)((records + players) / count), (unsigned long)(legacy / count));
+	}
 }
 
 
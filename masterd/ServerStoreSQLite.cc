@@ -0,0 +1,448 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "masterd.h"
+#include "ServerStoreSQLite.h"
+#include <algorithm>
+
+
+//==============================================================================
+// Server Store in RAM, kept in SQLite
+//==============================================================================
+
+ServerStoreSQLite::ServerStoreSQLite(const char *path, U32 flushInterval)
+{
+	m_DB			= NULL;
+	m_Replace		= NULL;
+	m_Delete		= NULL;
+	m_Path			= path;
+	m_FlushInterval	= flushInterval;
+	m_NextFlush		= getMilliTime() + m_FlushInterval;
+	m_Loading		= false;
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	if(!Open())
+	{
+		if(m_DB)
+			sqlite3_close(m_DB);
+
+		m_DB = NULL;
+		return;
+	}
+
+	Load();
+
+	// the connection is the writer's from here on, the store isn't open
+	// without it.
+	if(!m_Writer.Start(WriteBatch, this))
+		debugPrintf(DPRINT_ERROR, " - Failed to start the store writer thread.\n");
+}
+
+ServerStoreSQLite::~ServerStoreSQLite()
+{
+	// write what's left and stop the writer
+	if(m_Writer.IsRunning())
+	{
+		Flush(true);
+		m_Writer.Stop();
+	}
+
+	if(m_Replace)	sqlite3_finalize(m_Replace);
+	if(m_Delete)	sqlite3_finalize(m_Delete);
+	if(m_DB)		sqlite3_close(m_DB);
+}
+
+bool ServerStoreSQLite::Exec(const char *sql)
+{
+	char *error = NULL;
+
+
+	if(sqlite3_exec(m_DB, sql, NULL, NULL, &error) == SQLITE_OK)
+		return true;
+
+	debugPrintf(DPRINT_ERROR, " - SQLite: %s\n", error ? error : sqlite3_errmsg(m_DB));
+	sqlite3_free(error);
+
+	return false;
+}
+
+/**
+ * @brief Open the database, creating the servers table if it's new.
+ */
+bool ServerStoreSQLite::Open(void)
+{
+	if(sqlite3_open(m_Path.c_str(), &m_DB) != SQLITE_OK)
+	{
+		debugPrintf(DPRINT_ERROR, " - Failed to open the store database \"%s\": %s\n",
+					m_Path.c_str(), m_DB ? sqlite3_errmsg(m_DB) : "out of memory");
+		return false;
+	}
+
+	// readers don't block the writer, and a commit only syncs at checkpoints
+	if(!Exec("PRAGMA journal_mode=WAL;") ||
+	   !Exec("PRAGMA synchronous=NORMAL;") ||
+	   !Exec("CREATE TABLE IF NOT EXISTS servers ("
+				"slot INTEGER PRIMARY KEY, address TEXT, port INTEGER, "
+				"game TEXT, mission TEXT, max_players INTEGER, regions INTEGER, "
+				"version INTEGER, info_flags INTEGER, bots INTEGER, cpu_speed INTEGER, "
+				"players BLOB, fingerprint INTEGER, last_heart INTEGER, last_info INTEGER);"))
+		return false;
+
+	if(sqlite3_prepare_v2(m_DB,
+			"INSERT OR REPLACE INTO servers VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+			-1, &m_Replace, NULL) != SQLITE_OK ||
+	   sqlite3_prepare_v2(m_DB, "DELETE FROM servers WHERE slot = ?;", -1, &m_Delete, NULL) != SQLITE_OK)
+	{
+		debugPrintf(DPRINT_ERROR, " - SQLite: %s\n", sqlite3_errmsg(m_DB));
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Load the servers in the database into RAM.
+ *
+ * Servers that expired while we were down are deleted by the first flush.
+ */
+void ServerStoreSQLite::Load(void)
+{
+	sqlite3_stmt	*stmt;
+	ServerAddress	addr;
+	ServerInfo		info, *rec;
+	const U32		*players;
+	U64				slot;
+	S32				now = getAbsTime();
+	U32				count;
+	S32				last_info;
+
+
+	if(sqlite3_prepare_v2(m_DB,
+			"SELECT slot, game, mission, max_players, regions, version, info_flags, "
+			"bots, cpu_speed, players, fingerprint, last_heart, last_info FROM servers;",
+			-1, &stmt, NULL) != SQLITE_OK)
+	{
+		debugPrintf(DPRINT_ERROR, " - SQLite: %s\n", sqlite3_errmsg(m_DB));
+		return;
+	}
+
+	// the servers are put back as they were, not changed
+	m_Loading = true;
+
+	while(sqlite3_step(stmt) == SQLITE_ROW)
+	{
+		slot		= sqlite3_column_int64(stmt, 0);
+		last_info	= sqlite3_column_int(stmt, 12);
+
+		if(last_info + (int)gm_pConfig->heartbeat <= now)
+		{
+			m_Dirty.push_back(slot);
+			continue;
+		}
+
+		addr.fromSlot(slot);
+
+		// the type managers copy the type names, the column text only has to
+		// last until then.
+		info.gameType		= (char *)sqlite3_column_text(stmt, 1);
+		info.missionType	= (char *)sqlite3_column_text(stmt, 2);
+		info.maxPlayers		= sqlite3_column_int(stmt, 3);
+		info.regions		= sqlite3_column_int(stmt, 4);
+		info.version		= sqlite3_column_int(stmt, 5);
+		info.infoFlags		= sqlite3_column_int(stmt, 6);
+		info.numBots		= sqlite3_column_int(stmt, 7);
+		info.CPUSpeed		= sqlite3_column_int(stmt, 8);
+		info.fingerprint	= sqlite3_column_int64(stmt, 10);
+
+		players	= (const U32 *)sqlite3_column_blob(stmt, 9);
+		count	= sqlite3_column_bytes(stmt, 9) / sizeof(U32);
+		if(count > 255)
+			count = 255;
+
+		info.playerList.Reserve(count);
+		if(count)
+			memcpy(info.playerList.Get(), players, count * sizeof(U32));
+
+		ServerStoreRAM::UpdateServer(&addr, &info);
+
+		info.gameType		= NULL;
+		info.missionType	= NULL;
+
+		// keep the times it was stored with
+		if(FindServer(&addr, &rec))
+		{
+			rec->last_heart	= sqlite3_column_int(stmt, 11);
+			rec->last_info	= last_info;
+		}
+
+		m_Stats.loaded++;
+	}
+
+	sqlite3_finalize(stmt);
+	m_Loading = false;
+
+	debugPrintf(DPRINT_INFO, " - Loaded %u servers from \"%s\", %u expired.\n",
+				m_Stats.loaded, m_Path.c_str(), (U32)m_Dirty.size());
+}
+
+void ServerStoreSQLite::Changed(U64 slot)
+{
+	if(!m_Loading)
+		m_Dirty.push_back(slot);
+}
+
+void ServerStoreSQLite::DoProcessing(int count)
+{
+	ServerStoreRAM::DoProcessing(count);
+
+	if(m_Writer.IsRunning() && getMilliTime() >= m_NextFlush)
+	{
+		Flush(false);
+		m_NextFlush = getMilliTime() + m_FlushInterval;
+	}
+}
+
+/**
+ * @brief Copy the changed servers into a batch for the writer thread.
+ *
+ * @param	wait	Wait for the last batch to be written instead of putting
+ *					the changes off until the next flush.
+ */
+void ServerStoreSQLite::Flush(bool wait)
+{
+	tSQLiteBatch	*batch, *written;
+	tSQLiteRow		row;
+	ServerAddress	addr;
+	ServerInfo		*rec;
+	size_t			len;
+	U32				i;
+
+
+	if(!m_Writer.Idle(wait))
+	{
+		if(!m_Dirty.empty())
+			m_Stats.deferred++;
+
+		return;
+	}
+
+	// rows of the last batch that didn't make it, their servers are written
+	// again as they are now.
+	written = m_Writer.Written();
+	m_Dirty.insert(m_Dirty.end(), written->retry.begin(), written->retry.end());
+	written->retry.clear();
+
+	if(m_Dirty.empty())
+		return;
+
+	// a server changed several times is written once
+	std::sort(m_Dirty.begin(), m_Dirty.end());
+	m_Dirty.erase(std::unique(m_Dirty.begin(), m_Dirty.end()), m_Dirty.end());
+
+	batch = m_Writer.Filling();
+	batch->rows.clear();
+	batch->types.clear();
+	batch->players.clear();
+
+	for(i=0; i < m_Dirty.size(); i++)
+	{
+		memset(&row, 0, sizeof(row));
+		row.slot = m_Dirty[i];
+
+		addr.fromSlot(row.slot);
+
+		if(!FindServer(&addr, &rec))
+		{
+			row.removed = true;
+			batch->rows.push_back(row);
+			continue;
+		}
+
+		row.fingerprint	= rec->fingerprint;
+		row.regions		= rec->regions;
+		row.version		= rec->version;
+		row.last_heart	= rec->last_heart;
+		row.last_info	= rec->last_info;
+		row.CPUSpeed	= rec->CPUSpeed;
+		row.maxPlayers	= rec->maxPlayers;
+		row.infoFlags	= rec->infoFlags;
+		row.numBots		= rec->numBots;
+		row.playerCount	= rec->playerCount();
+
+		// the type names may be gone by the time the writer gets to them
+		row.gameType = row.missionType = SQLITE_NO_TYPE;
+		if(rec->gameType)
+		{
+			row.gameType = batch->types.size();
+			len = strlen(rec->gameType) +1;
+			batch->types.insert(batch->types.end(), rec->gameType, rec->gameType + len);
+		}
+		if(rec->missionType)
+		{
+			row.missionType = batch->types.size();
+			len = strlen(rec->missionType) +1;
+			batch->types.insert(batch->types.end(), rec->missionType, rec->missionType + len);
+		}
+
+		row.players = batch->players.size();
+		batch->players.insert(batch->players.end(), rec->playerList.Get(), rec->playerList.Get() + row.playerCount);
+
+		batch->rows.push_back(row);
+	}
+
+	m_Dirty.clear();
+
+	m_Writer.Submit(wait);
+}
+
+/**
+ * @brief Write a batch in one transaction, on the writer thread.
+ */
+void ServerStoreSQLite::Write(tSQLiteBatch *batch)
+{
+	tSQLiteRow		*row;
+	ServerAddress	addr;
+	char			ip[16];
+	U64				start = getMilliTime(), took;
+	U32				i, written = 0, deleted = 0, errors = 0;
+	int				result;
+
+
+	if(!Exec("BEGIN;"))
+	{
+		m_Writer.Lock();
+		m_Stats.errors++;
+		m_Writer.Unlock();
+
+		for(i=0; i < batch->rows.size(); i++)
+			batch->retry.push_back(batch->rows[i].slot);
+		return;
+	}
+
+	for(i=0; i < batch->rows.size(); i++)
+	{
+		row = &batch->rows[i];
+
+		if(row->removed)
+		{
+			sqlite3_bind_int64(m_Delete, 1, row->slot);
+			result = sqlite3_step(m_Delete);
+			sqlite3_reset(m_Delete);
+			deleted++;
+		}
+		else
+		{
+			addr.address = (U32)(row->slot >> 16);
+			snprintf(ip, sizeof(ip), "%u.%u.%u.%u", addr.addy[0], addr.addy[1], addr.addy[2], addr.addy[3]);
+
+			sqlite3_bind_int64(m_Replace, 1, row->slot);
+			sqlite3_bind_text(m_Replace, 2, ip, -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int(m_Replace, 3, (U16)row->slot);
+
+			if(row->gameType != SQLITE_NO_TYPE)
+				sqlite3_bind_text(m_Replace, 4, &batch->types[row->gameType], -1, SQLITE_STATIC);
+			else
+				sqlite3_bind_null(m_Replace, 4);
+
+			if(row->missionType != SQLITE_NO_TYPE)
+				sqlite3_bind_text(m_Replace, 5, &batch->types[row->missionType], -1, SQLITE_STATIC);
+			else
+				sqlite3_bind_null(m_Replace, 5);
+
+			sqlite3_bind_int(m_Replace, 6, row->maxPlayers);
+			sqlite3_bind_int64(m_Replace, 7, row->regions);
+			sqlite3_bind_int64(m_Replace, 8, row->version);
+			sqlite3_bind_int(m_Replace, 9, row->infoFlags);
+			sqlite3_bind_int(m_Replace, 10, row->numBots);
+			sqlite3_bind_int(m_Replace, 11, row->CPUSpeed);
+
+			if(row->playerCount)
+				sqlite3_bind_blob(m_Replace, 12, &batch->players[row->players], row->playerCount * sizeof(U32), SQLITE_STATIC);
+			else
+				sqlite3_bind_zeroblob(m_Replace, 12, 0);
+
+			sqlite3_bind_int64(m_Replace, 13, (sqlite3_int64)row->fingerprint);
+			sqlite3_bind_int(m_Replace, 14, row->last_heart);
+			sqlite3_bind_int(m_Replace, 15, row->last_info);
+
+			result = sqlite3_step(m_Replace);
+			sqlite3_reset(m_Replace);
+			written++;
+		}
+
+		if(result != SQLITE_DONE)
+		{
+			debugPrintf(DPRINT_ERROR, " - SQLite: %s\n", sqlite3_errmsg(m_DB));
+			batch->retry.push_back(row->slot);
+			errors++;
+		}
+	}
+
+	if(!Exec("COMMIT;"))
+	{
+		Exec("ROLLBACK;");
+
+		m_Writer.Lock();
+		m_Stats.errors += errors +1;
+		m_Writer.Unlock();
+
+		// none of the rows were written
+		batch->retry.clear();
+		for(i=0; i < batch->rows.size(); i++)
+			batch->retry.push_back(batch->rows[i].slot);
+		return;
+	}
+
+	took = getMilliTime() - start;
+
+	// the core thread reads these under the lock
+	m_Writer.Lock();
+	m_Stats.errors	+= errors;
+	m_Stats.batches++;
+	m_Stats.written	+= written;
+	m_Stats.deleted	+= deleted;
+	if(took > m_Stats.maxCommit)
+		m_Stats.maxCommit = took;
+	m_Writer.Unlock();
+}
+
+void ServerStoreSQLite::WriteBatch(tSQLiteBatch *batch, void *arg)
+{
+	((ServerStoreSQLite *)arg)->Write(batch);
+}
+
+void ServerStoreSQLite::ReportMemory(void)
+{
+	tSQLiteStats	stats;
+
+
+	ServerStoreRAM::ReportMemory();
+
+	// the writer updates the counters between batches
+	m_Writer.Lock();
+	stats = m_Stats;
+	m_Writer.Unlock();
+
+	debugPrintf(DPRINT_INFO, " - SQLite: %u servers loaded, %llu batches, %llu rows written, %llu deleted, %llu flushes deferred, %llu errors, slowest commit %llu ms\n",
+				stats.loaded, (unsigned long long)stats.batches, (unsigned long long)stats.written,
+				(unsigned long long)stats.deleted, (unsigned long long)stats.deferred,
+				(unsigned long long)stats.errors, (unsigned long long)stats.maxCommit);
+}
@@ -20,6 +20,7 @@
 */
 #include "masterd.h"
 #include "SessionHandler.h"
+#include "StoreJournal.h"
 #include "TorqueIO.h"
 
 /**
@@ -73,6 +74,124 @@ FloodControl	*gm_pFloodControl;
  * 
  */
 
+//=============================================================================
+// Session Pool
+//=============================================================================
+
+SessionPool::SessionPool()
+{
+	S32 i;
+
+	// no sessions indexed
+	for(i=0; i < SESSION_HASH_SIZE; i++)
+		m_Buckets[i] = -1;
+
+	// chain all sessions into the free list
+	for(i=0; i < SESSION_POOL_SIZE; i++)
+		m_Sessions[i].next = (i +1 < SESSION_POOL_SIZE) ? i +1 : -1;
+
+	m_Free		= 0;
+	m_InUse		= 0;
+	m_FreeHook	= NULL;
+}
+
+U32 SessionPool::Hash(U32 peer, U16 session, U16 key)
+{
+	U32 hash;
+
+	// mix the peer address with the session and key
+	hash  = peer * 0x9E3779B1;
+	hash ^= ((U32)session << 16 | key) * 0x85EBCA6B;
+	hash ^= hash >> 15;
+
+	return hash & (SESSION_HASH_SIZE -1);
+}
+
+Session* SessionPool::Alloc(U32 peer, U16 session, U16 key)
+{
+	Session	*ps;
+	U32		bucket;
+
+
+	// abort when all sessions are in use
+	if(m_Free < 0)
+		return NULL;
+
+	// take session off the free list
+	ps		= &m_Sessions[m_Free];
+	m_Free	= ps->next;
+	m_InUse++;
+
+	ps->Reset(peer, session, key);
+
+	// index the session
+	bucket				= Hash(peer, session, key);
+	ps->next			= m_Buckets[bucket];
+	m_Buckets[bucket]	= ps - m_Sessions;
+
+	// done
+	return ps;
+}
+
+Session* SessionPool::Find(U32 peer, U16 session, U16 key)
+{
+	S32 i;
+
+	// walk the hash bucket chain for the session
+	for(i = m_Buckets[Hash(peer, session, key)]; i >= 0; i = m_Sessions[i].next)
+	{
+		if(	m_Sessions[i].peer    == peer    &&
+			m_Sessions[i].session == session &&
+			m_Sessions[i].key     == key)
+		{
+			return &m_Sessions[i];
+		}
+	}
+
+	// not found
+	return NULL;
+}
+
+void SessionPool::Unlink(Session *ps)
+{
+	S32 *link;
+	S32 index = ps - m_Sessions;
+
+	// find the link pointing at the session and point it past the session
+	for(link = &m_Buckets[Hash(ps->peer, ps->session, ps->key)]; *link >= 0; link = &m_Sessions[*link].next)
+	{
+		if(*link == index)
+		{
+			*link = ps->next;
+			break;
+		}
+	}
+}
+
+void SessionPool::Free(Session *ps)
+{
+	// abort on NULL
+	if(!ps)
+		return;
+
+	// let whoever else refers to the session know it's going away
+	if(m_FreeHook)
+		m_FreeHook(ps);
+
+	Unlink(ps);
+
+	// keep the results storage for the next session unless it's huge
+	ps->results.clear();
+	if(ps->results.capacity() > SESSION_RESULTS_KEEP)
+		tcServerAddrVector().swap(ps->results);
+
+	// put session back on the free list
+	ps->next	= m_Free;
+	m_Free		= ps - m_Sessions;
+	m_InUse--;
+}
+
+
 //=============================================================================
 // Flood Control Manager
 //=============================================================================
@@ -111,19 +230,18 @@ void FloodControl::GetPeerRecord(tPeerRecord **peerrec, ServerAddress &peer, boo
 		// create record if allowed to create non-existant records
 		if(createNoExist)
 		{
-			*peerrec = &m_Records[peer.address];
-			pr		 = new tPeerRecord();
+			*peerrec = pr = &m_Records[peer.address];
 
 			// set peer address, creation and last seen time
 			pr->peer			= peer;
+			pr->sessionCount	= 0;	// no sessions
 			pr->tsCreated		= getAbsTime();
-			pr->tsLastSeen		= (*peerrec)->tsCreated;
-			pr->tsLastReset		= (*peerrec)->tsCreated;
+			pr->tsLastSeen		= pr->tsCreated;
+			pr->tsLastReset		= pr->tsCreated;
 			pr->tsBannedUntil	= 0;	// not banned
 			pr->tickets			= 0;	// no tickets yet
 			pr->bans			= 0;	// no previous bans
-
-			**peerrec = *pr;
+			pr->listRate		= gm_pConfig->listRate;	// start lists at default rate
 
 			// report record creation
 			debugPrintf(DPRINT_VERBOSE, "FloodControl: Record created for %s\n",
@@ -140,42 +258,33 @@ void FloodControl::GetPeerRecord(tPeerRecord **peerrec, ServerAddress &peer, boo
 
 void FloodControl::CheckSessions(tPeerRecord *peerrec, bool forceExpire)
 {
-	tcSessionList::iterator	it, next;
-	Session					*ps;
-	S32						ts;
+	Session	*ps;
+	S32		ts;
+	U32		i, n;
 
 	// get current timestamp
 	ts = getAbsTime();
 
-	// iterate through peer's game client query sessions
-	for(it = peerrec->sessions.begin(); it != peerrec->sessions.end();)
+	// iterate through peer's game client query sessions, keeping the live
+	// sessions packed at the start of the array.
+	for(i = n = 0; i < peerrec->sessionCount; i++)
 	{
 		// get session
-		ps = *it;
+		ps = peerrec->sessions[i];
 		
-		if(forceExpire)
-		{
-			// we are to destry all existing sessions, force it to be expired
-			ps->lastUsed = 0;
-		}
-
-		// move on to next session if current one hasn't expired yet
-		if(ps->lastUsed + SESSION_EXPIRE_TIME > ts)
+		// keep session if it hasn't expired yet, unless we are to destroy
+		// all existing sessions.
+		if(!forceExpire && (ps->lastUsed + SESSION_EXPIRE_TIME > ts))
 		{
-			it++;
+			peerrec->sessions[n++] = ps;
 			continue;
 		}
 
-		next = it;
-		next++;
-
-		// destroy expired session
-		delete ps;
-		peerrec->sessions.erase(it);
-
-		// iterator is now invalid, figure out how to move on to the next
-		it = next;
+		// give expired session back to the pool
+		m_Sessions.Free(ps);
 	}
+
+	peerrec->sessionCount = n;
 }
 
 
@@ -289,6 +398,8 @@ bool FloodControl::CheckPeer(tPeerRecord *peerrec, bool effectRep)
 	{
 		// clear the ban
 		peerrec->tsBannedUntil	= 0;
+		if(gm_pJournal)
+			gm_pJournal->Unbanned(peerrec);
 
 		// update last seen even though we haven't heard from peer in order to
 		// prevent record from expiring and forgetting about them so soon.
@@ -354,6 +465,9 @@ void FloodControl::RepPeer(tPeerRecord *peerrec, S32 tickets)
 	// destroy any sessions in the peer record
 	CheckSessions(peerrec, true);
 
+	if(gm_pJournal)
+		gm_pJournal->Banned(peerrec);
+
 	// report ban
 	str = peerrec->peer.toString();
 	debugPrintf(DPRINT_INFO, "FloodControl: Banned %s:%u [banned %lu times]\n",
@@ -368,48 +482,75 @@ void FloodControl::RepPeer(tPeerRecord *peerrec, S32 tickets)
 //-----------------------------------------------------------------------------
 void FloodControl::CreateSession(tPeerRecord *peerrec, tPacketHeader *header, Session **session)
 {	
-	// don't allow more than SESSION_MAX sessions at the same time
-	if(peerrec->sessions.size() >= SESSION_MAX)
+	// a repeated query under the same session and key replaces its results
+	*session = m_Sessions.Find(peerrec->peer.address, header->session, header->key);
+	if(*session)
 	{
-		*session = NULL;
-		return; // peer has reached session limit
+		(*session)->Reset(peerrec->peer.address, header->session, header->key);
+		return;
 	}
 
-	// create new session
-	*session = new Session(header->session, header->key);
+	// don't allow more than SESSION_MAX sessions at the same time
+	if(peerrec->sessionCount >= SESSION_MAX)
+		return; // peer has reached session limit
+
+	// take a new session from the pool
+	*session = m_Sessions.Alloc(peerrec->peer.address, header->session, header->key);
+	if(!*session)
+		return; // all sessions are in use
 
 	// keep track of session
-	peerrec->sessions.push_back(*session);
+	peerrec->sessions[peerrec->sessionCount++] = *session;
 
 	// done
 }
 
-bool FloodControl::GetSession(tPeerRecord *peerrec, tPacketHeader *header, Session **session)
+void FloodControl::SetListRate(U32 address, U32 rate)
 {
-	tcSessionList::iterator it;
-	Session					*ps;
+	tcPeerRecordMap::iterator it;
 
+	it = m_Records.find(address);
+	if(it != m_Records.end())
+		it->second.listRate = rate;
+}
 
-	// default to session not found
-	*session = NULL;
-	
-	// find the requested session
-	for(it = peerrec->sessions.begin(); it != peerrec->sessions.end(); it++)
-	{
-		// get pointer to session
-		ps = *it;
 
-		// is this the session we're looking for?
-		if(ps->session == header->session && ps->key == header->key)
-		{
-			// found it
-			ps->lastUsed	= getAbsTime();	
-			*session		= ps;
-			break;
-		}
+//-----------------------------------------------------------------------------
+// Bans kept across restarts
+//-----------------------------------------------------------------------------
+void FloodControl::VisitBans(tBanVisitor visit, void *arg)
+{
+	tcPeerRecordMap::iterator it;
+
+	for(it = m_Records.begin(); it != m_Records.end(); it++)
+	{
+		if(it->second.tsBannedUntil)
+			visit(&it->second, arg);
 	}
+}
 
-	// done
-	return (*session == NULL);
+void FloodControl::RestoreBan(ServerAddress &peer, S32 until, U32 bans)
+{
+	tPeerRecord *peerrec;
+
+
+	// the ban ran out while we were down
+	if(until <= getAbsTime())
+		return;
+
+	GetPeerRecord(&peerrec, peer, true);
+
+	peerrec->tsBannedUntil	= until;
+	peerrec->bans			= bans;
 }
 
+bool FloodControl::GetSession(tPeerRecord *peerrec, tPacketHeader *header, Session **session)
+{
+	// find the requested session
+	*session = m_Sessions.Find(peerrec->peer.address, header->session, header->key);
+	if(*session)
+		(*session)->lastUsed = getAbsTime();
+
+	// done
+	return (*session != NULL);
+}
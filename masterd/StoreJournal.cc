@@ -0,0 +1,783 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "masterd.h"
+#include "StoreJournal.h"
+#include <algorithm>
+#include <unordered_map>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+StoreJournal	*gm_pJournal = NULL;
+
+
+//=============================================================================
+// Store Journal
+//=============================================================================
+
+StoreJournal::StoreJournal(ServerStoreRAM *store, const char *path, U32 commitInterval, U32 compactSize)
+{
+	size_t slash;
+
+
+	m_Path				= path;
+	m_SnapPath			= m_Path + ".snap";
+	m_Store				= store;
+	m_CommitInterval	= commitInterval;
+	m_NextCommit		= getMilliTime() + m_CommitInterval;
+	m_CompactSize		= (U64)compactSize << 20;
+	m_Size				= 0;
+	m_Generation		= 0;
+	m_FD				= -1;
+
+	slash = m_Path.rfind('/');
+	m_Dir = (slash == std::string::npos) ? "." : m_Path.substr(0, slash +1);
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+
+	Replay();
+
+	if(m_FD < 0)
+		return;
+
+	// IsOpen() is false without the writer
+	if(!m_Writer.Start(WriteBatch, this))
+		debugPrintf(DPRINT_ERROR, " - Failed to start the journal thread.\n");
+}
+
+StoreJournal::~StoreJournal()
+{
+	// write what's left and stop the writer
+	if(m_Writer.IsRunning())
+	{
+		Commit(true);
+		m_Writer.Stop();
+	}
+
+	if(m_FD >= 0)
+		close(m_FD);
+}
+
+
+//-----------------------------------------------------------------------------
+// Records
+//-----------------------------------------------------------------------------
+void StoreJournal::AddRecord(std::vector<char> &out, U8 type, const void *data, U16 size)
+{
+	tJournalRecord	rec;
+	size_t			at = out.size();
+
+
+	// records are padded so the ones after them are aligned
+	rec.size		= (sizeof(rec) + size + JOURNAL_ALIGN -1) & ~(JOURNAL_ALIGN -1);
+	rec.type		= type;
+	rec.reserved	= 0;
+
+	out.resize(at + rec.size, 0);
+	memcpy(&out[at + sizeof(rec)], data, size);
+
+	rec.check		= (U32)fnv1a64(&out[at + sizeof(rec)], rec.size - sizeof(rec));
+	memcpy(&out[at], &rec, sizeof(rec));
+}
+
+void StoreJournal::AddServer(std::vector<char> &out, U64 slot, ServerInfo *info)
+{
+	char			data[sizeof(tJournalServer) + 2 * 255 + 255 * sizeof(U32)];
+	tJournalServer	*rec = (tJournalServer *)data;
+	char			*pos = data + sizeof(tJournalServer);
+	size_t			len;
+
+
+	memset(rec, 0, sizeof(tJournalServer));
+	rec->slot			= slot;
+	rec->fingerprint	= info->fingerprint;
+	rec->regions		= info->regions;
+	rec->version		= info->version;
+	rec->last_heart		= info->last_heart;
+	rec->last_info		= info->last_info;
+	rec->CPUSpeed		= info->CPUSpeed;
+	rec->maxPlayers		= info->maxPlayers;
+	rec->infoFlags		= info->infoFlags;
+	rec->numBots		= info->numBots;
+	rec->playerCount	= info->playerCount();
+	rec->gameLength		= JOURNAL_NO_TYPE;
+	rec->missionLength	= JOURNAL_NO_TYPE;
+
+	// type names come from packets, no longer than 255
+	if(info->gameType)
+	{
+		len = std::min(strlen(info->gameType), (size_t)255);
+		memcpy(pos, info->gameType, len);
+		rec->gameLength = len;
+		pos += len;
+	}
+	if(info->missionType)
+	{
+		len = std::min(strlen(info->missionType), (size_t)255);
+		memcpy(pos, info->missionType, len);
+		rec->missionLength = len;
+		pos += len;
+	}
+
+	len = rec->playerCount * sizeof(U32);
+	memcpy(pos, info->playerList.Get(), len);
+	pos += len;
+
+	AddRecord(out, JOURNAL_SERVER, data, pos - data);
+}
+
+void StoreJournal::AddHeader(std::vector<char> &out, const char *magic, U64 generation)
+{
+	tJournalHeader header;
+
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, magic, sizeof(header.magic));
+	header.version		= JOURNAL_VERSION;
+	header.generation	= generation;
+
+	out.insert(out.end(), (char *)&header, (char *)&header + sizeof(header));
+}
+
+void StoreJournal::Changed(U64 slot)
+{
+	m_Dirty.push_back(slot);
+}
+
+void StoreJournal::Banned(tPeerRecord *peerrec)
+{
+	tJournalBan ban;
+
+
+	memset(&ban, 0, sizeof(ban));
+	ban.address	= peerrec->peer.address;
+	ban.port	= peerrec->peer.port;
+	ban.until	= peerrec->tsBannedUntil;
+	ban.bans	= peerrec->bans;
+
+	AddRecord(m_Writer.Filling()->records, JOURNAL_BAN, &ban, sizeof(ban));
+}
+
+void StoreJournal::Unbanned(tPeerRecord *peerrec)
+{
+	tJournalBan ban;
+
+
+	memset(&ban, 0, sizeof(ban));
+	ban.address	= peerrec->peer.address;
+	ban.port	= peerrec->peer.port;
+	ban.bans	= peerrec->bans;
+
+	AddRecord(m_Writer.Filling()->records, JOURNAL_UNBAN, &ban, sizeof(ban));
+}
+
+
+//-----------------------------------------------------------------------------
+// Replay at startup
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Read a journal or snapshot file.
+ *
+ * @return	False if the file is missing or isn't one.
+ */
+bool StoreJournal::ReadFile(const char *path, const char *magic, std::vector<char> &data, U64 &generation)
+{
+	tJournalHeader	header;
+	struct stat		st;
+	ssize_t			got;
+	size_t			done = 0;
+	int				fd;
+
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(header))
+	{
+		close(fd);
+		return false;
+	}
+
+	data.resize(st.st_size);
+	while(done < data.size())
+	{
+		got = read(fd, &data[done], data.size() - done);
+		if(got <= 0)
+			break;
+
+		done += got;
+	}
+
+	close(fd);
+	data.resize(done);
+
+	if(done < sizeof(header))
+		return false;
+
+	memcpy(&header, &data[0], sizeof(header));
+	if(memcmp(header.magic, magic, sizeof(header.magic)) || header.version != JOURNAL_VERSION)
+	{
+		debugPrintf(DPRINT_WARN, " - %s isn't a journal file this version of masterd reads, ignored.\n", path);
+		return false;
+	}
+
+	generation = header.generation;
+
+	return true;
+}
+
+/**
+ * @brief Restore the snapshot and the journal on top of it into the store.
+ *
+ * Leaves the journal open for appending, with a torn tail cut off.
+ */
+void StoreJournal::Replay(void)
+{
+	typedef std::unordered_map<U64, const tJournalServer *>	tcServers;
+	typedef std::unordered_map<U32, tJournalBan>				tcBans;
+
+	std::vector<char>	snap, journal;
+	std::vector<char>	*files[2] = { &snap, &journal };
+	tcServers			servers;
+	tcServers::iterator	it;
+	tcBans				bans;
+	tcBans::iterator	bit;
+	const tJournalRecord	*rec;
+	const tJournalServer	*serv;
+	const char			*data, *pos;
+	ServerAddress		addr;
+	ServerInfo			info, *stored;
+	std::string			game, mission;
+	tJournalBan			ban;
+	U64					snapGeneration = 0, generation = 0, slot;
+	size_t				at, end = 0;
+	S32					now = getAbsTime();
+	bool				haveSnap, haveJournal;
+	U32					i;
+
+
+	haveSnap	= ReadFile(m_SnapPath.c_str(), JOURNAL_SNAP_MAGIC, snap, snapGeneration);
+	haveJournal	= ReadFile(m_Path.c_str(), JOURNAL_MAGIC, journal, generation);
+
+	// a journal older than the snapshot was already folded into it
+	if(haveJournal && haveSnap && generation < snapGeneration)
+	{
+		haveJournal = false;
+		journal.clear();
+	}
+
+	if(!haveSnap)
+		snap.clear();
+
+	m_Generation = haveJournal ? generation : snapGeneration;
+
+	// the last record of each server and ban wins
+	for(i=0; i < 2; i++)
+	{
+		if(files[i]->empty())
+			continue;
+
+		data	= &(*files[i])[0];
+		at		= sizeof(tJournalHeader);
+
+		while(at + sizeof(tJournalRecord) <= files[i]->size())
+		{
+			rec = (const tJournalRecord *)(data + at);
+
+			if(rec->size < sizeof(tJournalRecord) || at + rec->size > files[i]->size() ||
+			   rec->check != (U32)fnv1a64(rec +1, rec->size - sizeof(tJournalRecord)))
+				break;
+
+			pos = (const char *)(rec +1);
+
+			switch(rec->type)
+			{
+				case JOURNAL_SERVER:
+					if(rec->size < sizeof(tJournalRecord) + sizeof(tJournalServer))
+						break;
+
+					serv = (const tJournalServer *)pos;
+					if(sizeof(tJournalRecord) + sizeof(tJournalServer) + serv->playerCount * sizeof(U32) +
+					   (serv->gameLength    != JOURNAL_NO_TYPE ? serv->gameLength    : 0) +
+					   (serv->missionLength != JOURNAL_NO_TYPE ? serv->missionLength : 0) > rec->size)
+						break;
+
+					servers[serv->slot] = serv;
+					break;
+
+				case JOURNAL_REMOVE:
+					if(rec->size < sizeof(tJournalRecord) + sizeof(U64))
+						break;
+
+					memcpy(&slot, pos, sizeof(slot));
+					servers.erase(slot);
+					break;
+
+				case JOURNAL_BAN:
+				case JOURNAL_UNBAN:
+					if(rec->size < sizeof(tJournalRecord) + sizeof(tJournalBan))
+						break;
+
+					memcpy(&ban, pos, sizeof(ban));
+					if(rec->type == JOURNAL_BAN)
+						bans[ban.address] = ban;
+					else
+						bans.erase(ban.address);
+					break;
+			}
+
+			m_Stats.replayed++;
+			at += rec->size;
+		}
+
+		if(files[i] == &journal)
+		{
+			end = at;
+			if(at < journal.size())
+				debugPrintf(DPRINT_WARN, " - Journal %s ends in a torn record, %u bytes dropped.\n",
+							m_Path.c_str(), (U32)(journal.size() - at));
+		}
+	}
+
+	// put the servers that haven't expired back in the store
+	for(it = servers.begin(); it != servers.end(); it++)
+	{
+		serv = it->second;
+		if(serv->last_info + (int)gm_pConfig->heartbeat <= now)
+			continue;
+
+		pos = (const char *)(serv +1);
+
+		addr.fromSlot(serv->slot);
+
+		info.fingerprint	= serv->fingerprint;
+		info.regions		= serv->regions;
+		info.version		= serv->version;
+		info.CPUSpeed		= serv->CPUSpeed;
+		info.maxPlayers		= serv->maxPlayers;
+		info.infoFlags		= serv->infoFlags;
+		info.numBots		= serv->numBots;
+
+		// the type managers copy the type names
+		info.gameType = info.missionType = NULL;
+		if(serv->gameLength != JOURNAL_NO_TYPE)
+		{
+			game.assign(pos, serv->gameLength);
+			info.gameType = (char *)game.c_str();
+			pos += serv->gameLength;
+		}
+		if(serv->missionLength != JOURNAL_NO_TYPE)
+		{
+			mission.assign(pos, serv->missionLength);
+			info.missionType = (char *)mission.c_str();
+			pos += serv->missionLength;
+		}
+
+		info.playerList.Reserve(serv->playerCount);
+		memcpy(info.playerList.Get(), pos, serv->playerCount * sizeof(U32));
+
+		m_Store->UpdateServer(&addr, &info);
+
+		info.gameType		= NULL;
+		info.missionType	= NULL;
+
+		// keep the times it was journaled with
+		if(m_Store->FindServer(&addr, &stored))
+		{
+			stored->last_heart	= serv->last_heart;
+			stored->last_info	= serv->last_info;
+		}
+
+		m_Stats.restored++;
+	}
+
+	// and the bans that are still on
+	for(bit = bans.begin(); bit != bans.end(); bit++)
+	{
+		if(bit->second.until <= now)
+			continue;
+
+		addr.address	= bit->second.address;
+		addr.port		= bit->second.port;
+		gm_pFloodControl->RestoreBan(addr, bit->second.until, bit->second.bans);
+		m_Stats.bans++;
+	}
+
+	if(haveSnap || haveJournal)
+		debugPrintf(DPRINT_INFO, " - Journal: %u servers and %u bans restored from %u records.\n",
+					m_Stats.restored, m_Stats.bans, m_Stats.replayed);
+
+	// keep appending to the journal, without its torn tail
+	if(haveJournal)
+	{
+		m_FD = open(m_Path.c_str(), O_WRONLY);
+		if(m_FD >= 0 && (ftruncate(m_FD, end) || lseek(m_FD, end, SEEK_SET) < 0))
+		{
+			close(m_FD);
+			m_FD = -1;
+		}
+
+		m_Size = end;
+	}
+
+	if(m_FD < 0 && !Create(m_Generation))
+		debugPrintf(DPRINT_ERROR, " - Failed to open the journal %s: %s\n", m_Path.c_str(), strerror(errno));
+}
+
+
+//-----------------------------------------------------------------------------
+// Writer thread
+//-----------------------------------------------------------------------------
+
+/**
+ * @brief Write an empty journal on top of a snapshot's generation.
+ *
+ * It's left beside the journal, Install() puts it in place.
+ */
+bool StoreJournal::Prepare(U64 generation, int &fd)
+{
+	std::vector<char>	header;
+	std::string			temp = m_Path + ".tmp";
+
+
+	AddHeader(header, JOURNAL_MAGIC, generation);
+
+	fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return false;
+
+	if(!WriteAll(fd, &header[0], header.size()) || fdatasync(fd))
+	{
+		close(fd);
+		unlink(temp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Replace the journal with one Prepare() wrote, and append to it.
+ */
+bool StoreJournal::Install(int fd)
+{
+	std::string	temp = m_Path + ".tmp";
+	int			dir;
+
+
+	if(rename(temp.c_str(), m_Path.c_str()))
+	{
+		close(fd);
+		unlink(temp.c_str());
+		return false;
+	}
+
+	// make the rename stick
+	dir = open(m_Dir.c_str(), O_RDONLY);
+	if(dir >= 0)
+	{
+		fsync(dir);
+		close(dir);
+	}
+
+	if(m_FD >= 0)
+		close(m_FD);
+
+	m_FD = fd;
+
+	return true;
+}
+
+/**
+ * @brief Start an empty journal on top of a snapshot's generation.
+ */
+bool StoreJournal::Create(U64 generation)
+{
+	int fd;
+
+
+	return Prepare(generation, fd) && Install(fd);
+}
+
+bool StoreJournal::WriteAll(int fd, const char *data, size_t size)
+{
+	ssize_t wrote;
+
+
+	while(size)
+	{
+		wrote = write(fd, data, size);
+		if(wrote < 0 && errno == EINTR)
+			continue;
+
+		if(wrote <= 0)
+			return false;
+
+		data += wrote;
+		size -= wrote;
+	}
+
+	return true;
+}
+
+/**
+ * @brief Append a batch to the journal and sync it, on the writer thread.
+ *
+ * A snapshot that comes with it is saved next, together with an empty
+ * journal on top of it. Both are written before either is renamed into
+ * place, as replay throws away a journal older than the snapshot. If that
+ * fails the old journal is kept, the records that follow hold whole servers
+ * and are as good on it. Should the new journal fail to go in after the
+ * snapshot did, journaling stops until the next snapshot.
+ */
+void StoreJournal::Write(tJournalBatch *batch)
+{
+	std::string	temp = m_SnapPath + ".tmp";
+	U64			start = getMilliTime(), took;
+	U32			records = 0, errors = 0, snapshots = 0;
+	size_t		at;
+	int			fd, journal, dir;
+
+
+	if(!batch->records.empty())
+	{
+		if(m_FD < 0)
+			errors++;
+		else if(WriteAll(m_FD, &batch->records[0], batch->records.size()) && !fdatasync(m_FD))
+		{
+			for(at = 0; at < batch->records.size(); at += ((tJournalRecord *)&batch->records[at])->size)
+				records++;
+		}
+		else
+		{
+			debugPrintf(DPRINT_ERROR, " - Failed to write the journal: %s\n", strerror(errno));
+			errors++;
+		}
+	}
+
+	took = getMilliTime() - start;
+
+	if(!batch->snapshot.empty())
+	{
+		fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if(fd >= 0 && WriteAll(fd, &batch->snapshot[0], batch->snapshot.size()) &&
+		   !fdatasync(fd) && !close(fd))
+		{
+			fd = -1;
+
+			if(!Prepare(batch->generation, journal))
+			{
+				debugPrintf(DPRINT_ERROR, " - Failed to start a new journal, snapshot dropped: %s\n", strerror(errno));
+				unlink(temp.c_str());
+				errors++;
+			}
+			else if(rename(temp.c_str(), m_SnapPath.c_str()))
+			{
+				debugPrintf(DPRINT_ERROR, " - Failed to save the snapshot %s: %s\n", m_SnapPath.c_str(), strerror(errno));
+				close(journal);
+				unlink((m_Path + ".tmp").c_str());
+				unlink(temp.c_str());
+				errors++;
+			}
+			else
+			{
+				dir = open(m_Dir.c_str(), O_RDONLY);
+				if(dir >= 0)
+				{
+					fsync(dir);
+					close(dir);
+				}
+
+				if(Install(journal))
+					snapshots++;
+				else
+				{
+					// replay would throw the old journal away, don't append to it
+					debugPrintf(DPRINT_ERROR, " - Failed to start a new journal, journaling stopped: %s\n", strerror(errno));
+					if(m_FD >= 0)
+						close(m_FD);
+
+					m_FD = -1;
+					errors++;
+				}
+			}
+		}
+		else
+		{
+			debugPrintf(DPRINT_ERROR, " - Failed to save the snapshot %s: %s\n", m_SnapPath.c_str(), strerror(errno));
+			if(fd >= 0)
+				close(fd);
+
+			unlink(temp.c_str());
+			errors++;
+		}
+	}
+
+	// the core thread reads these under the lock
+	m_Writer.Lock();
+	m_Stats.commits++;
+	m_Stats.records		+= records;
+	m_Stats.bytes		+= batch->records.size();
+	m_Stats.snapshots	+= snapshots;
+	m_Stats.errors		+= errors;
+	if(took > m_Stats.maxSync)
+		m_Stats.maxSync = took;
+	m_Writer.Unlock();
+}
+
+void StoreJournal::WriteBatch(tJournalBatch *batch, void *arg)
+{
+	((StoreJournal *)arg)->Write(batch);
+}
+
+
+//-----------------------------------------------------------------------------
+// Commits and snapshots
+//-----------------------------------------------------------------------------
+void StoreJournal::SnapServer(U64 slot, ServerInfo *info, void *arg)
+{
+	AddServer(*(std::vector<char> *)arg, slot, info);
+}
+
+void StoreJournal::SnapBan(tPeerRecord *peerrec, void *arg)
+{
+	tJournalBan ban;
+
+
+	memset(&ban, 0, sizeof(ban));
+	ban.address	= peerrec->peer.address;
+	ban.port	= peerrec->peer.port;
+	ban.until	= peerrec->tsBannedUntil;
+	ban.bans	= peerrec->bans;
+
+	AddRecord(*(std::vector<char> *)arg, JOURNAL_BAN, &ban, sizeof(ban));
+}
+
+/**
+ * @brief Write the whole store and the bans into the next batch.
+ *
+ * The snapshot holds the changed servers too, they aren't journaled again.
+ */
+void StoreJournal::Snapshot(void)
+{
+	tJournalBatch		*batch = m_Writer.Filling();
+	std::vector<char>	&out = batch->snapshot;
+	U64					start = getMilliTime();
+
+
+	m_Generation++;
+
+	out.clear();
+	AddHeader(out, JOURNAL_SNAP_MAGIC, m_Generation);
+	m_Store->VisitServers(SnapServer, &out);
+	gm_pFloodControl->VisitBans(SnapBan, &out);
+
+	batch->generation = m_Generation;
+	m_Dirty.clear();
+	m_Size = sizeof(tJournalHeader);
+
+	m_Stats.snapshotTime = getMilliTime() - start;
+}
+
+/**
+ * @brief Hand the changes since the last commit to the writer thread.
+ *
+ * @param	wait	Wait for the last batch to be written instead of putting
+ *					the changes off until the next commit.
+ */
+void StoreJournal::Commit(bool wait)
+{
+	tJournalBatch	*batch = m_Writer.Filling();
+	ServerAddress	addr;
+	ServerInfo		*info;
+	U64				slot;
+	U32				i;
+
+
+	if(m_Dirty.empty() && batch->records.empty())
+		return;
+
+	if(!m_Writer.Idle(wait))
+	{
+		m_Stats.deferred++;
+		return;
+	}
+
+	// a server changed several times is journaled once, as it is now
+	std::sort(m_Dirty.begin(), m_Dirty.end());
+	m_Dirty.erase(std::unique(m_Dirty.begin(), m_Dirty.end()), m_Dirty.end());
+
+	for(i=0; i < m_Dirty.size(); i++)
+	{
+		slot			= m_Dirty[i];
+		addr.fromSlot(slot);
+
+		if(m_Store->FindServer(&addr, &info))
+			AddServer(batch->records, slot, info);
+		else
+			AddRecord(batch->records, JOURNAL_REMOVE, &slot, sizeof(slot));
+	}
+
+	m_Dirty.clear();
+	m_Size += batch->records.size();
+
+	// fold the journal into a snapshot once it's grown enough
+	if(m_CompactSize && m_Size >= m_CompactSize)
+		Snapshot();
+
+	m_Writer.Submit(wait);
+
+	// storage of the batch written before is reused
+	batch = m_Writer.Filling();
+	batch->records.clear();
+	batch->snapshot.clear();
+}
+
+void StoreJournal::DoProcessing(void)
+{
+	if(m_Writer.IsRunning() && getMilliTime() >= m_NextCommit)
+	{
+		Commit(false);
+		m_NextCommit = getMilliTime() + m_CommitInterval;
+	}
+}
+
+void StoreJournal::Report(void)
+{
+	tJournalStats	stats;
+
+
+	m_Writer.Lock();
+	stats = m_Stats;
+	m_Writer.Unlock();
+
+	debugPrintf(DPRINT_INFO, " - Journal: %llu commits, %llu records, %llu bytes, %llu commits deferred, %llu errors, slowest sync %llu ms\n",
+				(unsigned long long)stats.commits, (unsigned long long)stats.records,
+				(unsigned long long)stats.bytes, (unsigned long long)stats.deferred,
+				(unsigned long long)stats.errors, (unsigned long long)stats.maxSync);
+	debugPrintf(DPRINT_INFO, " - Journal: %llu snapshots, last took %llu ms to build, generation %llu, %llu bytes since\n",
+				(unsigned long long)stats.snapshots, (unsigned long long)stats.snapshotTime,
+				(unsigned long long)m_Generation, (unsigned long long)m_Size);
+}
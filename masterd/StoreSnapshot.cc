@@ -0,0 +1,615 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "StoreSnapshot.h"
+#include <algorithm>
+#include <ctype.h>
+
+
+StoreSnapshots::StoreSnapshots()
+{
+	tSnapshot	*snap;
+	U32			i;
+
+
+	// start out with an empty version 1, version 0 means not reading
+	snap = new tSnapshot();
+	snap->version		= 1;
+	snap->gameTypes		= new tSnapTypes();
+	snap->missionTypes	= new tSnapTypes();
+	snap->gameTypes->refs		= 1;
+	snap->missionTypes->refs	= 1;
+
+	m_Current.store(snap);
+	m_Version.store(snap->version);
+
+	for(i=0; i < SNAPSHOT_READERS; i++)
+		m_Readers[i].version.store(0);
+
+	m_Next			= NULL;
+	m_PositionCount	= 0;
+	m_Changed		= 0;
+	m_Changes		= 0;
+
+	m_Stats.versions		= 0;
+	m_Stats.changes			= 0;
+	m_Stats.chunksCopied	= 0;
+	m_Stats.chunksShared	= 0;
+	m_Stats.freed			= 0;
+}
+
+StoreSnapshots::~StoreSnapshots()
+{
+	tcSnapshots::iterator	it;
+
+
+	// nobody may be reading anymore by now
+	if(m_Next)
+		FreeSnapshot(m_Next);
+
+	for(it = m_Retired.begin(); it != m_Retired.end(); it++)
+		FreeSnapshot(*it);
+
+	FreeSnapshot(m_Current.load());
+}
+
+
+//------------------------------------------------------------------------------
+// Writer
+//------------------------------------------------------------------------------
+
+/**
+ * @brief Get the version changes go into, start one if there is none.
+ *
+ * A new version starts out sharing all chunks and type tables with the
+ * current version.
+ */
+tSnapshot* StoreSnapshots::NextVersion(void)
+{
+	tcSnapChunks::iterator	it;
+	tSnapshot				*cur;
+
+
+	if(m_Next)
+		return m_Next;
+
+	cur = m_Current.load();
+
+	m_Next = new tSnapshot(*cur);
+	m_Next->version	= cur->version +1;
+	m_Next->retired	= 0;
+
+	for(it = m_Next->chunks.begin(); it != m_Next->chunks.end(); it++)
+		(*it)->refs++;
+
+	m_Next->gameTypes->refs++;
+	m_Next->missionTypes->refs++;
+
+	m_Changed = getMilliTime();
+
+	return m_Next;
+}
+
+/**
+ * @brief Get a record of the next version that may be changed.
+ *
+ * The record's chunk is copied first if it's still shared with other
+ * versions, players of servers that went away are left behind on the way.
+ */
+tSnapRecord* StoreSnapshots::WritableRecord(U32 position, tSnapChunk **chunk)
+{
+	tSnapshot	*next = NextVersion();
+	tSnapChunk	*old, *copy;
+	U32			index = position / SNAPSHOT_CHUNK;
+	U32			i;
+
+
+	// a chunk of new positions
+	while(index >= next->chunks.size())
+	{
+		copy = new tSnapChunk();
+		copy->refs = 1;
+		next->chunks.push_back(copy);
+	}
+
+	old = next->chunks[index];
+	if(old->refs > 1)
+	{
+		copy = new tSnapChunk();
+		copy->refs	= 1;
+		copy->used	= old->used;
+		copy->players.reserve(old->players.size());
+
+		for(i=0; i < SNAPSHOT_CHUNK; i++)
+		{
+			copy->records[i] = old->records[i];
+			if(!old->records[i].used)
+				continue;
+
+			copy->records[i].players = copy->players.size();
+			copy->players.insert(copy->players.end(),
+								 old->players.begin() + old->records[i].players,
+								 old->players.begin() + old->records[i].players + old->records[i].playerCount);
+		}
+
+		old->refs--;
+		next->chunks[index] = copy;
+		m_Stats.chunksCopied++;
+	}
+
+	*chunk = next->chunks[index];
+	return &(*chunk)->records[position % SNAPSHOT_CHUNK];
+}
+
+/**
+ * @brief Get the id of a type name, the name is added if it's new.
+ *
+ * Ids are never reused so records of older versions keep their meaning,
+ * there are only ever a handful of game and mission types anyway.
+ */
+U16 StoreSnapshots::TypeId(tSnapTypes **types, std::unordered_map<std::string, U16> &ids, const char *name)
+{
+	std::unordered_map<std::string, U16>::iterator	it;
+	std::string										key;
+	tSnapTypes										*copy;
+	const char										*c;
+	U16												id;
+
+
+	if(!name)
+		return SNAPSHOT_TYPE_NONE;
+
+	// types are matched without regard to case
+	for(c = name; *c; c++)
+		key += (char)tolower((unsigned char)*c);
+
+	it = ids.find(key);
+	if(it != ids.end())
+		return it->second;
+
+	// out of ids
+	if((*types)->names.size() >= SNAPSHOT_TYPE_ANY)
+		return SNAPSHOT_TYPE_NONE;
+
+	// copy the table if other versions still use it
+	if((*types)->refs > 1)
+	{
+		copy = new tSnapTypes();
+		copy->refs	= 1;
+		copy->names	= (*types)->names;
+
+		(*types)->refs--;
+		*types = copy;
+	}
+
+	id = (U16)(*types)->names.size();
+	(*types)->names.push_back(name);
+	ids[key] = id;
+
+	return id;
+}
+
+/**
+ * @brief Put the query fields of a server into the next version.
+ */
+void StoreSnapshots::Set(U64 slot, ServerInfo *info)
+{
+	std::unordered_map<U64, U32>::iterator	it;
+	tSnapshot								*next = NextVersion();
+	tSnapRecord								*rec;
+	tSnapChunk								*chunk;
+	U32										position, i;
+
+
+	// find the position of the server, give it one if it has none
+	it = m_Positions.find(slot);
+	if(it != m_Positions.end())
+		position = it->second;
+	else
+	{
+		if(m_FreePositions.size())
+		{
+			position = m_FreePositions.back();
+			m_FreePositions.pop_back();
+		}
+		else
+			position = m_PositionCount++;
+
+		m_Positions[slot] = position;
+	}
+
+	rec = WritableRecord(position, &chunk);
+	if(!rec->used)
+	{
+		rec->used		= 1;
+		rec->playerCount	= 0;
+		chunk->used++;
+		next->servers++;
+	}
+
+	rec->address		= info->addr.address;
+	rec->port			= info->addr.port;
+	rec->regions		= info->regions;
+	rec->version		= info->version;
+	rec->CPUSpeed		= info->CPUSpeed;
+	rec->maxPlayers		= info->maxPlayers;
+	rec->infoFlags		= info->infoFlags;
+	rec->numBots		= info->numBots;
+	rec->gameType		= TypeId(&next->gameTypes,    m_GameIds,    info->gameType);
+	rec->missionType	= TypeId(&next->missionTypes, m_MissionIds, info->missionType);
+
+	// players are written over the old ones if they fit, else appended
+	if(info->playerCount() > rec->playerCount)
+	{
+		rec->players = chunk->players.size();
+		chunk->players.resize(chunk->players.size() + info->playerCount());
+	}
+
+	rec->playerCount = info->playerCount();
+	for(i=0; i < rec->playerCount; i++)
+		chunk->players[rec->players + i] = info->playerList[i];
+
+	m_Changes++;
+}
+
+/**
+ * @brief Take a server out of the next version.
+ */
+void StoreSnapshots::Remove(U64 slot)
+{
+	std::unordered_map<U64, U32>::iterator	it;
+	tSnapRecord								*rec;
+	tSnapChunk								*chunk;
+
+
+	it = m_Positions.find(slot);
+	if(it == m_Positions.end())
+		return;
+
+	rec = WritableRecord(it->second, &chunk);
+	if(rec->used)
+	{
+		rec->used = 0;
+		chunk->used--;
+		m_Next->servers--;
+	}
+
+	m_FreePositions.push_back(it->second);
+	m_Positions.erase(it);
+
+	m_Changes++;
+}
+
+/**
+ * @brief Add the servers of a list of slots that match a query.
+ *
+ * Only the writer knows the positions of the servers. A server that got its
+ * position after the snapshot was taken, or took over the position of one
+ * that's gone since, isn't in the snapshot and is left out. Servers are
+ * added in position order, the same as Scan() adds them.
+ *
+ * @param	slots	Sorted server slots.
+ */
+void StoreSnapshots::ScanSlots(const tSnapshot *snap, const std::vector<U64> &slots, const tSnapQuery *query, tcServerAddrVector &results)
+{
+	std::unordered_map<U64, U32>::iterator	it;
+	const tSnapChunk						*chunk;
+	const tSnapRecord						*rec;
+	tServerAddress							addr;
+	U32										i;
+
+
+	m_Candidates.clear();
+	for(i=0; i < slots.size(); i++)
+	{
+		it = m_Positions.find(slots[i]);
+		if(it != m_Positions.end())
+			m_Candidates.push_back(it->second);
+	}
+
+	std::sort(m_Candidates.begin(), m_Candidates.end());
+
+	for(i=0; i < m_Candidates.size(); i++)
+	{
+		if(m_Candidates[i] / SNAPSHOT_CHUNK >= snap->chunks.size())
+			break;
+
+		chunk	= snap->chunks[m_Candidates[i] / SNAPSHOT_CHUNK];
+		rec		= &chunk->records[m_Candidates[i] % SNAPSHOT_CHUNK];
+
+		if(!rec->used ||
+		   !std::binary_search(slots.begin(), slots.end(), ServerAddress::toSlot(rec->address, rec->port)) ||
+		   !MatchRecord(rec, chunk, query))
+			continue;
+
+		addr.address	= rec->address;
+		addr.port		= rec->port;
+
+		results.push_back(addr);
+	}
+}
+
+/**
+ * @brief Make the next version the one readers get.
+ *
+ * @return	True if there were changes to publish.
+ */
+bool StoreSnapshots::Publish(void)
+{
+	tcSnapChunks::iterator	it;
+	tSnapshot				*old;
+
+
+	if(!m_Next)
+		return false;
+
+	for(it = m_Next->chunks.begin(); it != m_Next->chunks.end(); it++)
+	{
+		if((*it)->refs > 1)
+			m_Stats.chunksShared++;
+	}
+
+	// readers that start from here on get the new version
+	old = m_Current.load();
+	m_Current.store(m_Next);
+	m_Version.store(m_Next->version);
+
+	old->retired = m_Next->version;
+	m_Retired.push_back(old);
+
+	m_Stats.versions++;
+	m_Stats.changes += m_Changes;
+	m_Stats.delay.Add(getMilliTime() - m_Changed);
+
+	m_Next		= NULL;
+	m_Changes	= 0;
+
+	// free what readers are done with
+	Reclaim();
+
+	return true;
+}
+
+/**
+ * @brief Free the replaced versions no reader can still be using.
+ *
+ * A reader at a version before the one that replaced a version may still
+ * hold it, any reader that started later got a newer version.
+ */
+void StoreSnapshots::Reclaim(void)
+{
+	tcSnapshots::iterator	it;
+	U64						oldest = (U64)-1, version;
+	U32						i;
+
+
+	for(i=0; i < SNAPSHOT_READERS; i++)
+	{
+		version = m_Readers[i].version.load();
+		if(version && version < oldest)
+			oldest = version;
+	}
+
+	for(it = m_Retired.begin(); it != m_Retired.end();)
+	{
+		if((*it)->retired > oldest)
+		{
+			it++;
+			continue;
+		}
+
+		FreeSnapshot(*it);
+		it = m_Retired.erase(it);
+		m_Stats.freed++;
+	}
+}
+
+void StoreSnapshots::FreeSnapshot(tSnapshot *snap)
+{
+	tcSnapChunks::iterator	it;
+
+
+	for(it = snap->chunks.begin(); it != snap->chunks.end(); it++)
+	{
+		if(!--(*it)->refs)
+			delete *it;
+	}
+
+	if(!--snap->gameTypes->refs)	delete snap->gameTypes;
+	if(!--snap->missionTypes->refs)	delete snap->missionTypes;
+
+	delete snap;
+}
+
+
+//------------------------------------------------------------------------------
+// Readers
+//------------------------------------------------------------------------------
+
+/**
+ * @brief Start reading the current version.
+ *
+ * The version stays valid until the reader releases it.
+ *
+ * @param	reader	Reader slot of the calling thread.
+ */
+const tSnapshot* StoreSnapshots::Acquire(U32 reader)
+{
+	U64 version;
+
+
+	// announce the version we're at, and make sure it still is current once
+	// the writer can see our announcement.
+	do
+	{
+		version = m_Version.load();
+		m_Readers[reader].version.store(version);
+	} while(m_Version.load() != version);
+
+	return m_Current.load();
+}
+
+void StoreSnapshots::Release(U32 reader)
+{
+	m_Readers[reader].version.store(0);
+}
+
+/**
+ * @brief Get the id of a type name in a version's type table.
+ *
+ * @return	Type id, SNAPSHOT_TYPE_NONE if the version has no such type.
+ */
+U16 StoreSnapshots::FindType(const tSnapTypes *types, const char *name)
+{
+	U32 i;
+
+
+	for(i=0; i < types->names.size(); i++)
+	{
+		if(!stricmp(types->names[i].c_str(), name))
+			return (U16)i;
+	}
+
+	return SNAPSHOT_TYPE_NONE;
+}
+
+/**
+ * @brief Add the servers of a range of chunks that match a query.
+ *
+ * Servers are added in position order.
+ *
+ * @param	first	First chunk to look at.
+ * @param	last	Chunk to stop at.
+ */
+void StoreSnapshots::Scan(const tSnapshot *snap, U32 first, U32 last, const tSnapQuery *query, tcServerAddrVector &results)
+{
+	const tSnapChunk	*chunk;
+	const tSnapRecord	*rec;
+	tServerAddress		addr;
+	U32					c, i;
+
+
+	for(c = first; c < last && c < snap->chunks.size(); c++)
+	{
+		chunk = snap->chunks[c];
+		if(!chunk->used)
+			continue;
+
+		for(i=0; i < SNAPSHOT_CHUNK; i++)
+		{
+			rec = &chunk->records[i];
+			if(!rec->used || !MatchRecord(rec, chunk, query))
+				continue;
+
+			addr.address	= rec->address;
+			addr.port		= rec->port;
+
+			results.push_back(addr);
+		}
+	}
+}
+
+/**
+ * @brief Check a snapshot record against a query, same as MatchFilter does.
+ */
+bool StoreSnapshots::MatchRecord(const tSnapRecord *rec, const tSnapChunk *chunk, const tSnapQuery *query)
+{
+	ServerFilter	*filter = query->filter;
+	U32				i;
+
+
+	// check the game type
+	if(query->gameType != SNAPSHOT_TYPE_ANY && query->gameType != rec->gameType)
+		return false;
+
+	// check the mission type
+	if(query->missionType != SNAPSHOT_TYPE_ANY && query->missionType != rec->missionType)
+		return false;
+
+	// check minimum player count
+	if(filter->minPlayers && (rec->playerCount < filter->minPlayers))
+		return false;
+
+	// check maximum player count
+	if(filter->maxPlayers && (rec->playerCount > filter->maxPlayers))
+		return false;
+
+	// check regions mask
+	if(filter->regions && !(rec->regions & filter->regions))
+		return false;
+
+	// check minimum version
+	if(filter->version && (rec->version < filter->version))
+		return false;
+
+	// check information bit flag mask
+	if(filter->filterFlags && !(rec->infoFlags & filter->filterFlags))
+		return false;
+
+	// check maximum bot count
+	if(filter->maxBots && (rec->numBots > filter->maxBots))
+		return false;
+
+	// check minimum processor speed
+	if(filter->minCPUSpeed && (rec->CPUSpeed < filter->minCPUSpeed))
+		return false;
+
+	// buddy search, one of the buddies has to be on the server
+	if(query->buddies)
+	{
+		for(i=0; i < rec->playerCount; i++)
+		{
+			if(std::binary_search(query->buddies, query->buddies + query->buddyCount,
+								  chunk->players[rec->players + i]))
+				return true;
+		}
+
+		return false;
+	}
+
+	// server passed the filter
+	return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Statistics
+//------------------------------------------------------------------------------
+
+void StoreSnapshots::Report(void)
+{
+	const tSnapshot	*snap = m_Current.load();
+	size_t			bytes = 0;
+	U32				i;
+
+
+	// memory of the current version, chunks shared with others included
+	for(i=0; i < snap->chunks.size(); i++)
+		bytes += sizeof(tSnapChunk) + snap->chunks[i]->players.capacity() * sizeof(U32);
+
+	debugPrintf(DPRINT_INFO, "     snapshots: version %llu, %u servers in %lu chunks (%lu bytes), %lu waiting to be freed\n",
+				(unsigned long long)snap->version, snap->servers, (unsigned long)snap->chunks.size(),
+				(unsigned long)bytes, (unsigned long)m_Retired.size());
+	debugPrintf(DPRINT_INFO, "     snapshots: %llu published with %llu changes, %llu chunks copied, %llu shared\n",
+				(unsigned long long)m_Stats.versions, (unsigned long long)m_Stats.changes,
+				(unsigned long long)m_Stats.chunksCopied, (unsigned long long)m_Stats.chunksShared);
+
+	m_Stats.delay.Report("publish delay", "ms");
+}
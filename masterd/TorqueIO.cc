@@ -21,6 +21,102 @@
 */
 #include "masterd.h"
 #include "TorqueIO.h"
+#include "ListScheduler.h"
+#include "InfoRequester.h"
+#include "LivenessProber.h"
+#include "RelayList.h"
+
+
+//-----------------------------------------------------------------------------
+// Datagram pre-filter
+//-----------------------------------------------------------------------------
+
+// largest possible length indicated string, length byte included
+#define CSTRING_MAX_SIZE		(1 + 0xFF)
+
+// MasterServerListRequest, a resend request only carries the packet index
+#define LIST_REQUEST_MIN_SIZE	(PACKET_HEADER_SIZE + 1)
+#define LIST_REQUEST_MAX_SIZE	(PACKET_HEADER_SIZE + 1 + CSTRING_MAX_SIZE*2 + 1+1+4+4+1+1+2 + 1 + 0xFF*4)
+
+// GameMasterInfoResponse
+#define INFO_RESPONSE_MIN_SIZE	(PACKET_HEADER_SIZE + 1*2 + 1+4+4+1+1+4 + 1)
+#define INFO_RESPONSE_MAX_SIZE	(PACKET_HEADER_SIZE + CSTRING_MAX_SIZE*2 + 1+4+4+1+1+4 + 1 + 0xFF*4)
+
+// GamePingResponse, only the header is read, the version strings and numbers
+// and the server name after it aren't of use to us.
+#define PING_RESPONSE_MAX_SIZE	(PACKET_HEADER_SIZE + CSTRING_MAX_SIZE + 4+4+4 + CSTRING_MAX_SIZE)
+
+typedef struct tMessageLimits
+{
+	U8		type;		// message type identifier
+	U16		minLength;	// minimum datagram length
+	U16		maxLength;	// maximum datagram length
+} tMessageLimits;
+
+// datagram length bounds of the message types we handle, anything not in
+// here is of no use to us.
+static const tMessageLimits messageLimits[] =
+{
+	{ MasterServerGameTypesRequest,	PACKET_HEADER_SIZE,		PACKET_HEADER_SIZE		},
+	{ MasterServerListRequest,		LIST_REQUEST_MIN_SIZE,	LIST_REQUEST_MAX_SIZE	},
+	{ GameMasterInfoResponse,		INFO_RESPONSE_MIN_SIZE,	INFO_RESPONSE_MAX_SIZE	},
+	{ GameHeartbeat,				PACKET_HEADER_SIZE,		INFO_RESPONSE_MAX_SIZE	},
+	{ MasterServerInfoRequest,		PACKET_HEADER_SIZE,		PACKET_HEADER_SIZE		},
+	{ GamePingResponse,				PACKET_HEADER_SIZE,		PING_RESPONSE_MAX_SIZE	},
+	{ MasterRelayUpdate,			RELAY_UPDATE_MIN_SIZE,	RELAY_UPDATE_MAX_SIZE	},
+
+	{ 0, 0, 0 } // End of limits
+};
+
+std::atomic<U64> gm_PreFilterDrops[PREFILTER_REASONS];
+
+/**
+ * @brief Cheap stateless check of a received datagram.
+ *
+ * This runs before the peer is looked up or created by flood control, so
+ * random junk and spoofed garbage doesn't get to allocate any state. Only
+ * the header and datagram length are checked, the handlers do the rest.
+ *
+ * @return true if the datagram is plausibly a message we handle.
+ */
+bool preFilterMessage(const char *buff, int length)
+{
+	const tMessageLimits *pml;
+
+
+	// must at least carry a full header
+	if(length < PACKET_HEADER_SIZE)
+	{
+		gm_PreFilterDrops[PREFILTER_SHORT].fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	// find the limits of the message type
+	for(pml = messageLimits; pml->type; pml++)
+	{
+		if(pml->type != (U8)buff[0])
+			continue;
+
+		if(length < pml->minLength)
+		{
+			gm_PreFilterDrops[PREFILTER_SHORT].fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if(length > pml->maxLength)
+		{
+			gm_PreFilterDrops[PREFILTER_LONG].fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// plausibly valid
+		return true;
+	}
+
+	// message type isn't one we handle
+	gm_PreFilterDrops[PREFILTER_TYPE].fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
 
 
 bool isPrintableString(const char *str)
@@ -162,9 +258,11 @@ bool handleListRequest(tMessageSession &msg)
 	
 	debugPrintf(DPRINT_VERBOSE, "Got %d results from a queryServers.\n", ps->total);
 
-	// send the results
-	for(i=0; i<ps->packTotal; i++)
-		sendListResponse(msg, i);
+	// queue the results for sending, they go out interleaved with those of
+	// other sessions in between reading messages.
+	ps->port = msg.addr->port;
+	ps->rate = msg.peerrec->listRate;
+	gm_pListScheduler->Add(ps);
 
 	// received packet OK
 	return true;
@@ -196,11 +294,20 @@ bool handleInfoRequest(tMessageSession &msg)
 }
 
 /**
- * @brief Handle an InfoResponse packet.
+ * @brief Store the game server info a message carries.
+ *
+ * Shared by info responses and heartbeats carrying info, the info follows
+ * the header in both.
+ *
+ * @param	relayed	The info came through a relay, the server isn't probed.
+ * @return	False if the info is malformed.
  */
-bool handleInfoResponse(tMessageSession &msg)
+bool storeInfo(tMessageSession &msg, bool relayed)
 {
-	ServerInfo info;
+	ServerInfo	info;
+	U32			*players;
+	U8			playerCount;
+	U64			fingerprint;
 
 	/*
 
@@ -220,10 +327,21 @@ bool handleInfoResponse(tMessageSession &msg)
 	U32		playersGuiList[numPlayers];
 
 	*/
-	
+
+	// a payload the same as last time only tells us the server is still
+	// there, there's no need to parse it again.
+	fingerprint = fnv1a64(msg.pack->getBufferPtr() + msg.pack->getLength(),
+						  msg.pack->getSize() - msg.pack->getLength());
+
+	if(gm_pStore->RefreshServer(msg.addr, fingerprint))
+	{
+		if(!relayed)
+			gm_pProber->Track(msg.addr);
+		return true;
+	}
+
+	info.fingerprint	= fingerprint;
 	info.addr			= *msg.addr;
-	info.session		= msg.header->session;
-	info.key			= msg.header->key;
 
 	info.gameType		= msg.pack->readCString();
 	info.missionType	= msg.pack->readCString();
@@ -233,8 +351,7 @@ bool handleInfoResponse(tMessageSession &msg)
 	info.infoFlags		= msg.pack->readU8();
 	info.numBots		= msg.pack->readU8();
 	info.CPUSpeed		= msg.pack->readU32();
-	info.playerCount	= msg.pack->readU8();
-	info.playerList		= NULL;
+	playerCount			= msg.pack->readU8();
 
 	// go ahead and make sure the strings aren't garbage
 	if(!isPrintableString(info.gameType) || !isPrintableString(info.missionType))
@@ -244,14 +361,10 @@ bool handleInfoResponse(tMessageSession &msg)
 	if(!msg.pack->getStatus())
 		return false; // packet was malformed
 	
-	if(info.playerCount)
-	{
-		info.playerList = new U32[info.playerCount];
-
-		// Read in players
-		for(int i=0; i< info.playerCount; i++)
-			info.playerList[i] = msg.pack->readU32();
-	}
+	// Read in players
+	players = info.playerList.Reserve(playerCount);
+	for(int i=0; i< playerCount; i++)
+		players[i] = msg.pack->readU32();
 
 //	// check packet parser status
 //	if(!msg.pack->getStatus())
@@ -259,6 +372,22 @@ bool handleInfoResponse(tMessageSession &msg)
 
 	// Ok, all done! - store
 	gm_pStore->UpdateServer(msg.addr, &info);
+	if(!relayed)
+		gm_pProber->Track(msg.addr);
+
+	// received packet OK
+	return true;
+}
+
+/**
+ * @brief Handle an InfoResponse packet.
+ */
+bool handleInfoResponse(tMessageSession &msg)
+{
+	if(!storeInfo(msg, false))
+		return false;
+
+	gm_pInfoRequester->Answered(msg.addr, msg.header->session, msg.header->key);
 
 	// received packet OK
 	return true;
@@ -269,134 +398,170 @@ bool handleInfoResponse(tMessageSession &msg)
  */
 bool handleHeartbeat(tMessageSession &msg)
 {
-	U16 session, key;
-	
-	///	No Format of request after header.
-	
-	// get session and key from server store manager
-	gm_pStore->HeartbeatServer(msg.addr, &session, &key);
+	/*
 
-	// The response to a heartbeat (in addition) is to request info from the server.
-	Packet *reply  = new Packet(64); // Is 64 a good size?
+	No format of request after header, unless GameHeartbeatInfoFlag is set.
+	The heartbeat then carries the same info an InfoResponse does, and the
+	session and key of the last InfoRequest the server was sent. It saves the
+	InfoRequest and InfoResponse round trip for servers that support it.
 
-	// Prep and send packet
-	reply->writeHeader(GameMasterInfoRequest, 0, session, key);
-	gm_pTransport->sendPacket(reply, msg.addr);
+	*/
 
-	delete reply;
+	gm_pProber->Heartbeat(msg.addr);
+
+	if(msg.header->flags & GameHeartbeatInfoFlag)
+	{
+		// too short to carry info
+		if(msg.pack->getSize() < INFO_RESPONSE_MIN_SIZE)
+			return false;
+
+		// store the info if the token checks out, otherwise the server is
+		// asked for its info the usual way.
+		if(gm_pInfoRequester->InfoHeartbeat(msg.addr, msg.header->session, msg.header->key))
+		{
+			if(!storeInfo(msg, false))
+				return false;
+
+			gm_pInfoRequester->Received(msg.addr);
+		}
+
+		// received packet OK
+		return true;
+	}
+
+	// a plain heartbeat is just the header
+	if(msg.pack->getSize() > PACKET_HEADER_SIZE)
+		return false;
+
+	// The response to a heartbeat (in addition) is to request info from the
+	// server, unless we did so just now. Requests go out in batches.
+	gm_pInfoRequester->Heartbeat(msg.addr);
 
 	// received packet OK
 	return true;
 }
 
-
 /**
- * @brief Send a response to a TypesRequest.
+ * @brief Store the servers of a trusted relay's update.
+ *
+ * Each server's info is handled as if it came in an info response from the
+ * server itself, see RelayProtocol.h for the format. The relay keeps asking
+ * its servers for info, they aren't refreshed or probed by us.
  */
-void sendTypesResponse(tMessageSession &msg)
+bool handleRelayUpdate(tMessageSession &msg)
 {
-	U32 i, num, limit, gameCount, missionCount;
-	tcUniqueString::iterator it;
+	tMessageSession	server;
+	ServerAddress	addr;
+	tRelay			*relay;
+	Packet			*info;
+	char			buff[RELAY_UPDATE_MAX_SIZE];
+	size_t			left;
+	U16				size;
+	U8				count, i;
 
 
-	// create the reply packet
-	Packet *reply = new Packet(MAX_PACKET_SIZE);
-	reply->writeHeader(MasterServerGameTypesResponse, 0, msg.header->session, msg.header->key);
+	// updates that didn't authenticate went through flood control, they're
+	// dropped and ticketed like any other bad message.
+	if(msg.peerrec)
+		return false;
 
-	/*
-	
-	This is a leftover and forgotten feature of Tribes 2 where the master server
-	would send the client the unique list of game types and mission types that
-	were available for filtering.
+	// replayed
+	relay = gm_pRelays->Accept(msg.addr, msg.pack);
+	if(!relay)
+		return false;
 
-	Format of response after header:
+	count	= msg.pack->readU8();
+	left	= msg.pack->getSize() - msg.pack->getLength() - RELAY_MAC_SIZE;
 
-	U8		gameTypesCount;
-	char	gameTypes[gameTypesCount];
+	server		= msg;
+	server.addr	= &addr;
 
-	U8		missionTypesCount;
-	char	missionTypes[missionTypesCount];
+	for(i=0; i < count; i++)
+	{
+		if(left < RELAY_SERVER_HEADER)
+			break;
 
-	*/
+		addr.address	= msg.pack->readU32();
+		addr.port		= msg.pack->readU16();
+		size			= msg.pack->readU16();
+		left -= RELAY_SERVER_HEADER;
 
-	// TODO: this all really should belong in the ServerStore handler and when
-	// collective types size exceeds allowed packet size then the results should
-	// then be cached until either of the types' entries are changed. --TRON
+		if(size > left)
+			break;
 
-	/// figure out the best way to send the types
+		msg.pack->readBytes(buff, size);
+		left -= size;
 
-	// test to see if all both game and mission types will fit into a single packet
-	gameCount		= msg.store->m_GameTypes.Count();
-	missionCount	= msg.store->m_MissionTypes.Count();
-	
-	num  = msg.store->m_GameTypes.TotalSize()    + gameCount;
-	num += msg.store->m_MissionTypes.TotalSize() + missionCount;
-	num += 2; // one byte per type count
+		// same as an info response from the server
+		info		= new Packet(buff, size);
+		server.pack	= info;
 
-	if((num > PACKET_PAYLOAD_SIZE) || (gameCount > 0xFF) || (missionCount > 0xFF))
-	{
-		// can't send all game and mission types, will need to divide space into
-		// two. Iterate through the entire types and stop once reaching the limit.
+		if(addr.address && addr.port && storeInfo(server, true))
+		{
+			gm_pStore->HeartbeatServer(&addr);
+			gm_pInfoRequester->Relayed(&addr);
+			gm_pProber->Relayed(&addr);
+			relay->servers++;
+		}
 
-		// set byte limit per type list
-		limit = PACKET_PAYLOAD_SIZE / 2;
+		delete info;
+	}
 
-		// zero the type counts
-		gameCount		= 0;
-		missionCount	= 0;
+	// the MAC checked out, it's the relay's bug not an attack
+	if(i < count)
+		gm_pRelays->Malformed();
 
-		// figure out the count for game type
-		for(num = 0,
-			it  = msg.store->m_GameTypes.m_List.begin();
-			it != msg.store->m_GameTypes.m_List.end(); it++)
-		{
-			// stop when limit reached
-			if(num + it->length + 1 > limit)
-				break;
+	// received packet OK
+	return true;
+}
 
-			// update working size
-			num += it->length + 1;
-			gameCount++;
-		}
+/**
+ * @brief Deal with a game server's reply to a liveness probe.
+ */
+bool handlePingResponse(tMessageSession &msg)
+{
+	/*
 
-		// figure out the count for mission type
-		for(num = 0,
-			it  = msg.store->m_MissionTypes.m_List.begin();
-			it != msg.store->m_MissionTypes.m_List.end(); it++)
-		{
-			// stop when limit reached
-			if(num + it->length + 1 > limit)
-				break;
+	Format of response after header:
+
+	char	versionString[];
+	U32		protocolVersion;
+	U32		minProtocolVersion;
+	U32		buildVersion;
+	char	serverName[];
+
+	Only the session and key in the header are of interest, they match the
+	response to the probe.
+
+	*/
+
+	gm_pProber->Answered(msg.addr, msg.header->session, msg.header->key);
+
+	// received packet OK
+	return true;
+}
+
+
+/**
+ * @brief Send a response to a TypesRequest.
+ *
+ * This is a leftover and forgotten feature of Tribes 2 where the master server
+ * would send the client the unique list of game types and mission types that
+ * were available for filtering. The response packets are cached by the server
+ * store, see ServerStore::BuildTypesResponse() for the format.
+ */
+void sendTypesResponse(tMessageSession &msg)
+{
+	tcPacketVector				&packets = msg.store->GetTypesResponse();
+	tcPacketVector::iterator	it;
 
-			// update working size
-			num += it->length + 1;
-			missionCount++;
-		}
-	}
-	
-	/// send game types
-	reply->writeU8(gameCount);
-	for(i=0,
-		it  = msg.store->m_GameTypes.m_List.begin();
-		it != msg.store->m_GameTypes.m_List.end() && (i < gameCount);
-		it++, i++)
-	{
-		reply->writeCString(it->str);
-	}
 
-	/// send mission types
-	reply->writeU8(missionCount);
-	for(i=0,
-		it  = msg.store->m_MissionTypes.m_List.begin();
-		it != msg.store->m_MissionTypes.m_List.end() && (i < missionCount);
-		it++, i++)
+	// send each packet of the response under the requester's session and key
+	for(it = packets.begin(); it != packets.end(); it++)
 	{
-		reply->writeCString(it->str);
+		(*it)->rewriteHeader(MasterServerGameTypesResponse, 0, msg.header->session, msg.header->key);
+		gm_pTransport->sendPacket(*it, msg.addr);
 	}
-
-	// send response
-	gm_pTransport->sendPacket(reply, msg.addr);
-	delete reply;
 }
 
 /**
@@ -439,16 +604,16 @@ void sendInfoResponse(tMessageSession &msg)
  * 	We never want to send more than 254 packets
  *  Because 255 == FF == the initial request indicator
  *
- *	So we can never give more than 62992 servers as a result. Note that this is quite
+ *	So we can never give more than LIST_PACKETS_MAX * LIST_PACKET_MAX_SERVERS
+ *	servers as a result. Note that this is quite
  *	a lot of servers; if we plan on more, then we can just make the packet index a
  *	U16 and issue an upgrade.
  *
  *	We customize all this behaviour with defines.
  */
-void sendListResponse(tMessageSession &msg, U8 index)
+static void writeListResponse(Packet *reply, Session *ps, U8 index)
 {
-	Packet			*reply = new Packet(LIST_PACKET_SIZE);
-	tServerAddress	addr;
+	tServerAddress	*addr;
 	U16				count;	// number of servers to place into packet
 	U16				start;	// start position in servers list result
 	U16				i;
@@ -468,41 +633,104 @@ void sendListResponse(tMessageSession &msg, U8 index)
 
 	*/
 
-	// first thing is to make sure requested index is within server results range
-	if(index >= msg.session->packTotal)
-		return; // abort, invalid packet index
-	
 	// figure out how many servers are going into this packet
-	if(index == msg.session->packTotal -1)
-		count = msg.session->packLast;	// number of servers on last packet
+	if(index == ps->packTotal -1)
+		count = ps->packLast;	// number of servers on last packet
 	else
-		count = msg.session->packNum;	// number of servers per packet
+		count = ps->packNum;	// number of servers per packet
 
 	// figure out our start position for this packet to iterate through the list
-	start = msg.session->packNum * index;
+	start = ps->packNum * index;
 	
 
 	// write packet header and the list details
-	reply->writeHeader(MasterServerListResponse, 0, msg.header->session, msg.header->key);
-	reply->writeU8(index);						// packet index
-	reply->writeU8(msg.session->packTotal);		// total packets
-	reply->writeU16(count);						// server count in this packet
+	reply->writeHeader(MasterServerListResponse, 0, ps->session, ps->key);
+	reply->writeU8(index);				// packet index
+	reply->writeU8(ps->packTotal);		// total packets
+	reply->writeU16(count);				// server count in this packet
 
 	// now populate the server list
-	for(i=0; i<count; i++)
+	for(i=0, addr = ps->results.data() + start; i<count; i++, addr++)
 	{
-		// get server address record
-		addr = msg.session->results[start + i];
-
 		// write server address and port
-		reply->writeU32(addr.address);
-		reply->writeU16(addr.port);
+		reply->writeU32(addr->address);
+		reply->writeU16(addr->port);
 	}
+}
+
+/**
+ * @brief Send a single list packet, used for resend requests.
+ *
+ * Only packets the list scheduler sent already are sent again.
+ */
+void sendListResponse(tMessageSession &msg, U8 index)
+{
+	static Packet	*reply = NULL;
+
+
+	// first thing is to make sure requested index is within server results range
+	if(index >= msg.session->packTotal)
+		return; // abort, invalid packet index
+
+	// not sent yet, the list scheduler gets to it in its turn
+	if(index >= msg.session->packSent)
+		return;
+
+	// the reply packet is kept around between calls
+	if(!reply)
+		reply = new Packet(LIST_PACKET_SIZE);
+
+	reply->reset();
+	writeListResponse(reply, msg.session, index);
 
 	// All done, send.
-	gm_pTransport->sendPacket(reply, msg.addr);
-	delete reply;
+	gm_pTransport->sendPacket(reply, msg.addr, SEND_PRIORITY_LISTRESEND);
+
+	// asking for a packet that was sent already means it got lost
+	gm_pListScheduler->Resent(msg.session, reply->getLength());
 
 	// done
 }
 
+/**
+ * @brief Send a run of list packets of a session, used by the ListScheduler.
+ *
+ * Every packet but the last has the same number of servers and therefore the
+ * same size, so they are written back to back into one buffer and handed to
+ * the transport as a segmented send. On kernels with UDP segmentation offload
+ * that's a single syscall for every GSO_MAX_SEGMENTS packets.
+ *
+ * @return	number of bytes sent.
+ */
+U32 sendListPackets(Session *ps, U8 first, U8 count)
+{
+	static Packet	*replies = NULL;
+	ServerAddress	to;
+	U16				segSize;
+	U8				i;
+
+
+	// the reply buffer is kept around between calls, it can hold the maximum
+	// number of list packets.
+	if(!replies)
+		replies = new Packet(LIST_PACKET_SIZE * LIST_PACKETS_MAX);
+
+	replies->reset();
+
+	// write the packets
+	for(i=first; i<first + count && i<ps->packTotal; i++)
+		writeListResponse(replies, ps, i);
+
+	// size of a full packet, also the size of the only packet if just one
+	segSize = LIST_RESPONSE_HEADER + ps->packNum * LIST_PACKET_SERVER_SIZE;
+	if(count == 1)
+		segSize = replies->getLength();
+
+	to.address	= ps->peer;
+	to.port		= ps->port;
+
+	gm_pTransport->sendSegmented(replies, segSize, &to, SEND_PRIORITY_LIST);
+
+	// done
+	return replies->getLength();
+}
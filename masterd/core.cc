@@ -24,6 +24,16 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "masterd.h"
 #include "TorqueIO.h"
 #include "SessionHandler.h"
+#include "ListScheduler.h"
+#include "InfoRequester.h"
+#include "LivenessProber.h"
+#include "RelayList.h"
+#include "SeedList.h"
+#include "ServerStoreMMap.h"
+#include "StoreJournal.h"
+#ifdef HAVE_SQLITE
+	#include "ServerStoreSQLite.h"
+#endif
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -57,7 +67,7 @@ void clearpid(void);
 //-----------------------------------------------------------------------------
 int main(int argc, char**argv)
 {
-	int sigs[] = { SIGHUP, SIGINT, SIGTERM };	// signal types array
+	int sigs[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1 };	// signal types array
 	int i, count = sizeof(sigs) / sizeof(int);
 
 	
@@ -107,6 +117,13 @@ void sigproc(int sig)
 				coreMan->StopThread();
 			break;
 		}
+		case SIGUSR1:
+		{
+			// report is printed by the core thread, not from in here
+			if(coreMan)
+				coreMan->RequestReport();
+			break;
+		}
 	}
 	
 }
@@ -249,7 +266,8 @@ void strprocfieldvalue(char *str)
 //-----------------------------------------------------------------------------
 MasterdCore::MasterdCore()
 {
-	m_RunThread = false;
+	m_RunThread		= false;
+	m_ReportStats	= false;
 	
 	// initialize configuration entities array
 	InitPrefs();
@@ -273,6 +291,7 @@ void MasterdCore::RunThread(void)
 	ServerAddress *addr;
 	Packet *data;
 	tPeerRecord *peerrec;
+	ServerStoreRAM *ramStore = NULL;
 	
 	
 	// print welcome message
@@ -300,14 +319,99 @@ void MasterdCore::RunThread(void)
 		goto ShutDown;
 	}
 
+	// drop garbage before it gets to flood control
+	gm_pTransport->SetFilter(preFilterMessage);
+
+	// size socket buffers, a receive buffer too small for bursts of heartbeats
+	// shows up as kernel drops in the statistics report.
+	gm_pTransport->SetBufferSizes(m_Prefs.netRecvBufferSize, m_Prefs.netSendBufferSize);
+	debugPrintf(DPRINT_INFO, " - Socket buffers: %u bytes receive, %u bytes send\n",
+				gm_pTransport->GetStats().recvBufferSize, gm_pTransport->GetStats().sendBufferSize);
+
+	// receive and send on threads of their own if asked to
+	if(m_Prefs.netPipeline)
+	{
+		debugPrintf(DPRINT_INFO, " - Starting receive and send threads.\n");
+		if(!gm_pTransport->StartPipeline())
+			debugPrintf(DPRINT_WARN, " - Pipelined mode unavailable, continuing without.\n");
+	}
+
 	// ready the server database
 	debugPrintf(DPRINT_INFO, " - Loading server database.\n");
-	gm_pStore = new ServerStoreRAM();
+	if(!stricmp(m_Prefs.storeBackend, "mmap"))
+	{
+		gm_pStore = new ServerStoreMMap(m_Prefs.storeMMapFile, m_Prefs.storeMMapCapacity);
+		if(!((ServerStoreMMap *)gm_pStore)->IsOpen())
+		{
+			debugPrintf(DPRINT_WARN, " - Store file unavailable, keeping servers in RAM instead.\n");
+			delete gm_pStore;
+			gm_pStore = NULL;
+		}
+		else if(m_Prefs.storeSnapshotInterval)
+			debugPrintf(DPRINT_WARN, " - store::SnapshotInterval only applies to the RAM store, ignored.\n");
+	}
+	else if(!stricmp(m_Prefs.storeBackend, "sqlite"))
+	{
+#ifdef HAVE_SQLITE
+		gm_pStore = new ServerStoreSQLite(m_Prefs.storeSQLiteFile, m_Prefs.storeSQLiteFlush);
+		if(!((ServerStoreSQLite *)gm_pStore)->IsOpen())
+		{
+			debugPrintf(DPRINT_WARN, " - Store database unavailable, keeping servers in RAM instead.\n");
+			delete gm_pStore;
+			gm_pStore = NULL;
+		}
+#else
+		debugPrintf(DPRINT_WARN, " - Built without SQLite, keeping servers in RAM instead.\n");
+#endif
+	}
+	else if(stricmp(m_Prefs.storeBackend, "ram"))
+		debugPrintf(DPRINT_WARN, " - Unknown store::Backend \"%s\", keeping servers in RAM.\n", m_Prefs.storeBackend);
+
+	if(!gm_pStore)
+		gm_pStore = ramStore = new ServerStoreRAM();
+
+	// pin the servers that are always listed
+	if(m_Prefs.storeSeedFile[0])
+		gm_pSeeds = new SeedList(m_Prefs.storeSeedFile, m_Prefs.storeSeedCheck);
 
 	// setup session tracking
 	debugPrintf(DPRINT_INFO, " - Initializing session handler.\n");
 	gm_pFloodControl = new FloodControl();	// FloodControl is now also the session manager
 
+	// journal the servers and bans, they're restored from it
+	if(m_Prefs.storeJournal[0])
+	{
+		if(ramStore)
+		{
+			gm_pJournal = new StoreJournal(ramStore, m_Prefs.storeJournal,
+										   m_Prefs.storeJournalCommit, m_Prefs.storeJournalCompact);
+			if(!gm_pJournal->IsOpen())
+			{
+				debugPrintf(DPRINT_WARN, " - Journal unavailable, continuing without.\n");
+				delete gm_pJournal;
+				gm_pJournal = NULL;
+			}
+		}
+		else
+			debugPrintf(DPRINT_WARN, " - store::Journal only applies to the RAM store, ignored.\n");
+	}
+
+	// setup list transmission, it must hear of sessions going away
+	gm_pListScheduler = new ListScheduler(m_Prefs.listQuantum, m_Prefs.listSendBudget);
+	gm_pFloodControl->SetSessionFreeHook(ListScheduler::SessionFreed);
+
+	// setup info requests to heartbeating servers
+	gm_pInfoRequester = new InfoRequester(m_Prefs.infoRequestWindow, m_Prefs.infoRefreshAge,
+										  m_Prefs.infoRefreshRate, m_Prefs.infoRefreshRetry,
+										  m_Prefs.infoTokenLifetime);
+
+	// setup the relays we take server updates from
+	gm_pRelays = new RelayList(m_Prefs.relayTrusted, m_Prefs.relaySecret);
+
+	// setup pings of servers that have gone quiet
+	gm_pProber = new LivenessProber(m_Prefs.probeQuietTime, m_Prefs.probeInterval,
+									m_Prefs.probeMaxMisses, m_Prefs.probeRate);
+
 	// report we're starting the core loop
 	debugPrintf(DPRINT_INFO, " - Entering core loop.\n");
 
@@ -318,11 +422,38 @@ void MasterdCore::RunThread(void)
 		// expire old sessions
 		gm_pFloodControl->DoProcessing();
 		gm_pStore->DoProcessing();
+		if(gm_pJournal)
+			gm_pJournal->DoProcessing();
+		if(gm_pSeeds)
+			gm_pSeeds->DoProcessing();
+		gm_pInfoRequester->DoProcessing();
+
+		// probe quiet servers while there are no messages waiting
+		gm_pProber->DoProcessing();
+
+		// print statistics if they were asked for
+		if(m_ReportStats)
+		{
+			m_ReportStats = false;
+			ReportStats();
+		}
 
 		// check for messages, don't stop until there are none left, and block
 		// for up to 10 milliseconds when no messages (same as millisleep()).
-		while(gm_pTransport->poll(&data, &addr, 10))
+		// Don't block while list packets are waiting to be sent, unless the
+		// transport itself is waiting for the socket.
+		while(gm_pTransport->poll(&data, &addr, PollTimeout()))
 		{
+			// trusted relays carry the updates of many servers, they'd run
+			// out of tickets in no time. Only updates with a valid MAC skip
+			// flood control, the rest are ticketed like any other peer's.
+			if(data->getSize() && data->getBufferPtr()[0] == MasterRelayUpdate &&
+			   gm_pRelays->Authentic(addr, data))
+			{
+				ProcMessage(addr, data, NULL);
+				goto SkipPeerMsg;
+			}
+
 			// check on reputation of peer
 			if(!gm_pFloodControl->CheckPeer(*addr, &peerrec, true))
 			{
@@ -337,13 +468,33 @@ SkipPeerMsg:
 			// destroy temporary instances
 			delete data;
 			delete addr;
+
+			// send some list packets in between messages
+			gm_pListScheduler->Run();
 		}
+
+		// send the info requests the heartbeats asked for
+		gm_pInfoRequester->Flush();
+
+		gm_pListScheduler->Run();
 	}
 
 ShutDown:
 	debugPrintf(DPRINT_INFO, " - Shutting down...\n");
 
 	// shut it all down
+	if(gm_pProber)			delete gm_pProber;
+	gm_pProber = NULL;
+	if(gm_pRelays)			delete gm_pRelays;
+	gm_pRelays = NULL;
+	if(gm_pSeeds)			delete gm_pSeeds;
+	gm_pSeeds = NULL;
+	if(gm_pInfoRequester)	delete gm_pInfoRequester;
+	gm_pInfoRequester = NULL;
+	if(gm_pListScheduler)	delete gm_pListScheduler;
+	gm_pListScheduler = NULL;
+	if(gm_pJournal)			delete gm_pJournal;
+	gm_pJournal = NULL;
 	if(gm_pFloodControl)	delete gm_pFloodControl;
 	if(gm_pStore)			delete gm_pStore;
 	if(gm_pTransport)		delete gm_pTransport;
@@ -359,6 +510,90 @@ void MasterdCore::StopThread(void)
 	m_RunThread = false;
 }
 
+void MasterdCore::RequestReport(void)
+{
+	m_ReportStats = true;
+}
+
+int MasterdCore::PollTimeout(void)
+{
+	// transport is waiting on the socket, list packets have to wait too
+	if(gm_pTransport->SendBusy())
+		return 10;
+
+	// info requests are sent once no messages are waiting
+	if(gm_pInfoRequester->Pending())
+		return 0;
+
+	// wake up in time for the next paced list packets
+	return gm_pListScheduler->Timeout(10);
+}
+
+//-----------------------------------------------------------------------------
+// Statistics Report
+//-----------------------------------------------------------------------------
+void MasterdCore::ReportStats(void)
+{
+	debugPrintf(DPRINT_INFO, " - Statistics report:\n");
+
+	// datagrams dropped before flood control
+	debugPrintf(DPRINT_INFO, " - Pre-filter drops: %llu short, %llu long, %llu unknown type\n",
+				(unsigned long long)gm_PreFilterDrops[PREFILTER_SHORT].load(std::memory_order_relaxed),
+				(unsigned long long)gm_PreFilterDrops[PREFILTER_LONG].load(std::memory_order_relaxed),
+				(unsigned long long)gm_PreFilterDrops[PREFILTER_TYPE].load(std::memory_order_relaxed));
+
+	// transport
+	if(gm_pTransport)
+	{
+		tTransportStats &ts = gm_pTransport->GetStats();
+
+		debugPrintf(DPRINT_INFO, " - Transport: %llu segmented sends carrying %llu datagrams\n",
+					(unsigned long long)ts.gsoSends, (unsigned long long)ts.gsoSegments);
+		debugPrintf(DPRINT_INFO, " - Transport: %llu batched sends carrying %llu datagrams\n",
+					(unsigned long long)ts.batchSends, (unsigned long long)ts.batchDatagrams);
+		debugPrintf(DPRINT_INFO, " - Transport: %llu datagrams queued, %u in queue, %u at most, %llu send errors\n",
+					(unsigned long long)ts.queued, ts.queueDepth, ts.queueDepthMax,
+					(unsigned long long)ts.errors);
+		debugPrintf(DPRINT_INFO, " - Transport: dropped %llu probes, %llu info requests, %llu responses, %llu lists, %llu list resends\n",
+					(unsigned long long)ts.dropped[SEND_PRIORITY_PROBE],
+					(unsigned long long)ts.dropped[SEND_PRIORITY_INFOREQUEST],
+					(unsigned long long)ts.dropped[SEND_PRIORITY_NORMAL],
+					(unsigned long long)ts.dropped[SEND_PRIORITY_LIST],
+					(unsigned long long)ts.dropped[SEND_PRIORITY_LISTRESEND]);
+		debugPrintf(DPRINT_INFO, " - Transport: %llu datagrams received, %u dropped by kernel, %u bytes receive buffer\n",
+					(unsigned long long)ts.received, ts.rxDrops, ts.recvBufferSize);
+		ts.queueDelay.Report("queueing delay", "us");
+
+		gm_pTransport->ReportPipeline();
+	}
+
+	// heartbeats and info requests
+	if(gm_pInfoRequester)
+		gm_pInfoRequester->Report();
+
+	// liveness probes
+	if(gm_pProber)
+		gm_pProber->Report();
+
+	// relay updates
+	if(gm_pRelays)
+		gm_pRelays->Report();
+
+	// pinned servers
+	if(gm_pSeeds)
+		gm_pSeeds->Report();
+
+	// list transmission
+	if(gm_pListScheduler)
+		gm_pListScheduler->Report();
+
+	if(gm_pStore)
+		gm_pStore->ReportMemory();
+
+	if(gm_pJournal)
+		gm_pJournal->Report();
+}
+
 
 //-----------------------------------------------------------------------------
 // Message Processing
@@ -384,6 +619,9 @@ void MasterdCore::ProcMessage(ServerAddress *addr, Packet *data, tPeerRecord *pe
 	message.session	= NULL;
 	message.store	= gm_pStore;
 
+	// how long the message waited for us
+	gm_pTransport->MessageStarted();
+
 
 	// get packet header
 	data->readHeader(header);
@@ -435,6 +673,20 @@ BadRepPeer:
 			break;
 		}
 
+		case GamePingResponse:
+		{
+			debugPrintf(DPRINT_VERBOSE, "Received GamePingResponse\n");
+			result = handlePingResponse(message);
+			break;
+		}
+
+		case MasterRelayUpdate:
+		{
+			debugPrintf(DPRINT_VERBOSE, "Received MasterRelayUpdate\n");
+			result = handleRelayUpdate(message);
+			break;
+		}
+
 		case MasterServerInfoRequest:
 		{
 			debugPrintf(DPRINT_VERBOSE, "Received MasterServerInfoRequest\n");
@@ -498,6 +750,21 @@ void MasterdCore::InitPrefs(void)
 			"* Indicates it includes all the message types above it.\n"
 		},
 
+		{	CONFIG_TYPE_U32,	&m_Prefs.netRecvBufferSize,	"net::RecvBufferSize",
+			"Size in bytes of the socket receive buffer, 0 for system default.\n"
+			"Raise it when the statistics report (SIGUSR1) shows kernel drops.\n"
+			"Default: 0"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.netSendBufferSize,	"net::SendBufferSize",
+			"Size in bytes of the socket send buffer, 0 for system default.\n"
+			"Default: 0"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.netPipeline,		"net::Pipeline",
+			"Receive and send on threads of their own, leaving the main thread with\n"
+			"processing messages only. 1 to enable, 0 to disable.\n"
+			"Default: 0"
+		},
+
 		{	CONFIG_SECTION,		NULL,	NULL,
 			"Flood Control Settings\n\n"
 			"Flood control uses a ticket based approach to deal with remote hosts\n"
@@ -538,6 +805,204 @@ void MasterdCore::InitPrefs(void)
 			"Default: 50"
 		},
 
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"List Transmission Settings\n\n"
+			"Server list responses are sent in between reading messages, the packets of\n"
+			"all lists being sent take turns so a large list doesn't hold up small ones."
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.listQuantum,		"list::Quantum",
+			"Number of packets a list may send per turn.\n"
+			"Default: 8"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.listSendBudget,	"list::SendBudget",
+			"Number of list packets sent, of all lists, between reading two messages.\n"
+			"Default: 32"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.listRate,			"list::Rate",
+			"Number of list packets per second a remote host is first sent lists at.\n"
+			"The rate is halved whenever a remote host asks for list packets again\n"
+			"and raised a bit for every list it received without doing so.\n"
+			"Default: 500"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.listMinRate,		"list::MinRate",
+			"Lowest number of list packets per second a remote host is sent.\n"
+			"Default: 50"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.listMaxRate,		"list::MaxRate",
+			"Highest number of list packets per second a remote host is sent.\n"
+			"Default: 5000"
+		},
+
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"Server Store Settings"
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.storeBackend,		"store::Backend",
+			"Where servers are kept. \"ram\" keeps them in memory, they're gone after a\n"
+			"restart. \"mmap\" keeps them in a memory mapped file, store::MMapFile, a\n"
+			"restart lists them again right away. \"sqlite\" keeps them in RAM and\n"
+			"writes the changes to an SQLite database, store::SQLiteFile, which is\n"
+			"loaded again after a restart. Only if masterd was built with SQLite.\n"
+			"Default: \"ram\""
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.storeMMapFile,		"store::MMapFile",
+			"File the mmap store keeps its servers in. Tools can map it read-only to\n"
+			"look at the servers while masterd runs, the layout is described in\n"
+			"ServerStoreMMap.h.\n"
+			"Default: \"masterd.store\""
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeMMapCapacity,	"store::MMapCapacity",
+			"Most servers the mmap store holds, the file is sized for them. Changing it\n"
+			"starts the file over.\n"
+			"Default: 65536"
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.storeSQLiteFile,	"store::SQLiteFile",
+			"Database the sqlite store keeps its servers in, in the servers table.\n"
+			"Other programs can read it while masterd runs.\n"
+			"Default: \"masterd.db\""
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeSQLiteFlush,	"store::SQLiteFlush",
+			"Number of milliseconds between writes of the changed servers to the\n"
+			"database, they're written in one transaction on a thread of their own.\n"
+			"Changes made since the last write are lost if masterd crashes.\n"
+			"Default: 1000"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeSnapshotInterval,	"store::SnapshotInterval",
+			"Number of milliseconds between snapshots of the server list. Queries read\n"
+			"the latest snapshot instead of the list itself, changes to the list are\n"
+			"collected and show up in queries once per interval. 250 publishes four\n"
+			"snapshots a second. 0 has queries read the list itself.\n"
+			"Default: 0"
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.storeSeedFile,		"store::SeedFile",
+			"File of servers that are always listed, whether they heartbeat or not.\n"
+			"One a.b.c.d:port per line, optionally followed by the game and mission\n"
+			"types to list it under until it answers an info request. Large lists can\n"
+			"be given in the binary format described in SeedList.h instead.\n"
+			"Default: \"\""
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeSeedCheck,	"store::SeedCheck",
+			"Number of seconds between checks of the seed file for changes, it's\n"
+			"loaded again once it changed and was left alone for two seconds. Replace\n"
+			"the file by renaming a new one over it, a file rewritten in place can\n"
+			"still be caught half written. 0 only loads it at startup.\n"
+			"Default: 10"
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.storeJournal,		"store::Journal",
+			"File the changes to the RAM store and the bans are journaled to, they're\n"
+			"restored from it after a restart or crash. A snapshot of the store is\n"
+			"kept next to it, the file name with \".snap\" appended. \"\" for none.\n"
+			"Default: \"\""
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeJournalCommit,	"store::JournalCommit",
+			"Number of milliseconds between journal commits. The changes made in\n"
+			"between are written and synced at once on a thread of their own, those\n"
+			"not yet committed are lost if masterd crashes.\n"
+			"Default: 100"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.storeJournalCompact,	"store::JournalCompact",
+			"Number of megabytes the journal grows to before a snapshot of the store\n"
+			"is taken and the journal started over. 0 never takes one.\n"
+			"Default: 64"
+		},
+
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"Query Settings\n\n"
+			"Queries of a large server list can be split over several threads, this\n"
+			"needs store::SnapshotInterval to be set."
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.queryThreads,		"query::Threads",
+			"Number of threads, besides the core thread, scanning the server list for\n"
+			"a query. 0 scans on the core thread only.\n"
+			"Default: 0"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.queryParallelThreshold,	"query::ParallelThreshold",
+			"Number of servers in the list before queries are split over the threads,\n"
+			"smaller lists are scanned quicker than the threads can be started on them.\n"
+			"Default: 20000"
+		},
+
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"Info Request Settings\n\n"
+			"Game servers are sent an info request in reply to their heartbeat, the\n"
+			"requests are sent in batches once all waiting messages are handled.\n"
+			"Servers whose info gets old are asked again on their own, in case their\n"
+			"heartbeats get lost on the way. Servers may send their info along with\n"
+			"their heartbeat instead, which saves the info request and response."
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.infoRequestWindow,	"info::RequestWindow",
+			"Number of seconds after an info request to a server during which its\n"
+			"heartbeats don't ask for info again. 0 asks on every heartbeat.\n"
+			"Default: 10"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.infoRefreshAge,	"info::RefreshAge",
+			"Number of seconds old a server's info gets before it's asked for info\n"
+			"without waiting for a heartbeat. Should be well below heartbeat so there's\n"
+			"time to retry before the server expires. 0 only asks on heartbeats.\n"
+			"Default: 120"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.infoRefreshRate,	"info::RefreshRate",
+			"Highest number of refresh info requests sent per second, refreshes that\n"
+			"come due quicker are sent late.\n"
+			"Default: 200"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.infoRefreshRetry,	"info::RefreshRetry",
+			"Number of seconds before an unanswered refresh is sent again, doubled on\n"
+			"each retry until the server expires.\n"
+			"Default: 5"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.infoTokenLifetime,	"info::TokenLifetime",
+			"Number of seconds the session and key of an info request stay good for\n"
+			"heartbeats that carry the server's info, they're good for up to twice as\n"
+			"long. Once they're stale the server is asked for its info the usual way.\n"
+			"Default: 3600"
+		},
+
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"Liveness Probe Settings\n\n"
+			"Game servers that have gone quiet are pinged to tell whether they're still\n"
+			"up. A server that misses a ping is suspect until it's heard from again, and\n"
+			"is dropped from the list once it misses probe::MaxMisses pings in a row."
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.probeQuietTime,	"probe::QuietTime",
+			"Number of seconds without word from a server before it's pinged. 0 doesn't\n"
+			"ping servers, they're dropped once heartbeat runs out.\n"
+			"Default: 0"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.probeInterval,		"probe::Interval",
+			"Number of seconds between pings of a quiet server.\n"
+			"Default: 10"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.probeMaxMisses,	"probe::MaxMisses",
+			"Number of pings in a row a server may miss before it's dropped.\n"
+			"Default: 3"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.probeRate,			"probe::Rate",
+			"Highest number of pings sent per second. Pings are only sent while no\n"
+			"messages are waiting and the socket keeps up.\n"
+			"Default: 50"
+		},
+		{	CONFIG_TYPE_U32,	&m_Prefs.probeHideSuspects,	"probe::HideSuspects",
+			"Set to 1 to leave suspect servers out of lists, 0 lists them after the\n"
+			"rest.\n"
+			"Default: 0"
+		},
+
+		{	CONFIG_SECTION,		NULL,	NULL,
+			"Relay Settings\n\n"
+			"Sites hosting many game servers behind a few addresses can run pbms-relay\n"
+			"next to them. The relay takes their heartbeats and info and forwards it to\n"
+			"us in batches, which skip flood control once their signature checks out.\n"
+			"Servers behind a relay are kept fresh by it, we don't refresh or probe them."
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.relayTrusted,	"relay::Trusted",
+			"IPv4 addresses of the relays to take updates from, separated by spaces or\n"
+			"commas. Default: \"\" for none"
+		},
+		{	CONFIG_TYPE_STR,	&m_Prefs.relaySecret,	"relay::Secret",
+			"Secret shared with the relays, updates are signed with it. Must be the same\n"
+			"as the relays' -s option. Default: \"\""
+		},
+
 		{ CONFIG_TYPE_NOTSET, NULL, NULL } // End of entities
 	};
 	
@@ -556,11 +1021,40 @@ void MasterdCore::InitPrefs(void)
 	m_Prefs.port				= 28002;		// set bind UDP port to standard
 	m_Prefs.heartbeat			= 180;			// set heartbeat to 3 minutes
 	m_Prefs.verbosity			= 4;			// set verbosity to All Messages
+	m_Prefs.netRecvBufferSize	= 0;			// system default socket receive buffer
+	m_Prefs.netSendBufferSize	= 0;			// system default socket send buffer
+	m_Prefs.netPipeline			= 0;			// receive, process and send on one thread
 	m_Prefs.floodResetTime		= 60;			// reset peer ticket count every 60 seconds
 	m_Prefs.floodForgetTime		= 900;			// forget/delete peer record after 15 minutes
 	m_Prefs.floodBanTime		= 600;			// peer is banned for 10 minutes once reaching max tickets
 	m_Prefs.floodMaxTickets		= 300;			// ban peer once reaching 300 tickets
 	m_Prefs.floodBadMsgTicket	= 50;			// 50 tickets on peer per bad message sent from the peer
+	m_Prefs.listQuantum			= 8;			// 8 packets per list per turn
+	m_Prefs.listSendBudget		= 32;			// 32 list packets between messages
+	m_Prefs.listRate			= 500;			// start lists at 500 packets per second
+	m_Prefs.listMinRate			= 50;			// never go below 50 packets per second
+	m_Prefs.listMaxRate			= 5000;			// never go above 5000 packets per second
+	strcpy(m_Prefs.storeBackend,	"ram");				// servers are kept in memory
+	strcpy(m_Prefs.storeMMapFile,	"masterd.store");	// in the working directory
+	m_Prefs.storeMMapCapacity		= 65536;	// room for 65536 servers in the store file
+	strcpy(m_Prefs.storeSQLiteFile,	"masterd.db");		// in the working directory
+	m_Prefs.storeSQLiteFlush		= 1000;		// write the changes once a second
+	m_Prefs.storeSnapshotInterval	= 0;		// queries read the server list itself
+	m_Prefs.storeSeedCheck			= 10;		// look for seed file changes every 10 seconds
+	m_Prefs.storeJournalCommit		= 100;		// commit ten times a second
+	m_Prefs.storeJournalCompact		= 64;		// snapshot every 64 MB of journal
+	m_Prefs.queryThreads			= 0;		// queries are scanned on the core thread
+	m_Prefs.queryParallelThreshold	= 20000;	// split queries of 20000 servers and more
+	m_Prefs.infoRequestWindow		= 10;		// one info request per server per 10 seconds
+	m_Prefs.infoRefreshAge			= 120;		// ask for info 2 minutes after the last
+	m_Prefs.infoRefreshRate			= 200;		// at most 200 refreshes per second
+	m_Prefs.infoRefreshRetry		= 5;		// retry refreshes after 5, 10, 20... seconds
+	m_Prefs.infoTokenLifetime		= 3600;		// info heartbeat tokens are good for an hour
+	m_Prefs.probeQuietTime			= 0;		// don't ping quiet servers
+	m_Prefs.probeInterval			= 10;		// ping quiet servers every 10 seconds
+	m_Prefs.probeMaxMisses			= 3;		// drop them after 3 missed pings
+	m_Prefs.probeRate				= 50;		// at most 50 pings per second
+	m_Prefs.probeHideSuspects		= 0;		// list suspect servers last
 
 	// set the global daemon configuration pointer to ours
 	gm_pConfig = &m_Prefs;
@@ -21,6 +21,15 @@
 #include "internal.h"
 #include "MasterdTransport.h"
 #include "masterd.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(UDP_SEGMENT)
+	#define UDP_SEGMENT	103
+#endif
 
 
 /**
@@ -39,6 +48,33 @@ MasterdTransport::MasterdTransport( char * host, short port)
 	
 	pfdCount = 0;
 	sockOK   = false;
+	filter   = NULL;
+	stats    = tTransportStats();
+	memset(&recvStamp, 0, sizeof(recvStamp));
+
+	// not pipelined until asked to
+	pipelined = false;
+	pipeRunning.store(false);
+	rxRing    = NULL;
+	txRing    = NULL;
+	rxEvent   = -1;
+	txEvent   = -1;
+	rxSleeping.store(false);
+	txSleeping.store(false);
+
+	// preallocate the outbound queue so a busy socket never costs allocations
+	sendSlots     = new tSendSlot[SEND_QUEUE_SIZE];
+	for(sendFreeCount = 0; sendFreeCount < SEND_QUEUE_SIZE; sendFreeCount++)
+		sendFree[sendFreeCount] = &sendSlots[sendFreeCount];
+	memset(sendQueue, 0, sizeof(sendQueue));
+	sendWaitOut   = false;
+
+	// assume segmentation offload works until the kernel says otherwise
+#ifdef UDP_SEGMENT
+	gsoOK    = true;
+#else
+	gsoOK    = false;
+#endif
 	
 	this->sock = new netSocket();
 	this->sock->open(false);
@@ -51,6 +87,20 @@ MasterdTransport::MasterdTransport( char * host, short port)
 		return;
 	}
 
+	// have the kernel tell us about the datagrams it had to drop because
+	// we're too slow to read them, and when each datagram was received.
+	int one = 1;
+#ifdef SO_RXQ_OVFL
+	if(setsockopt(sock->getHandle(), SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+		debugPrintf(DPRINT_WARN, "   Socket drop counter unavailable, error: [%d] %s\n",
+					errno, strerror(errno));
+#endif
+#ifdef SO_TIMESTAMPNS
+	if(setsockopt(sock->getHandle(), SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0)
+		debugPrintf(DPRINT_WARN, "   Socket receive timestamps unavailable, error: [%d] %s\n",
+					errno, strerror(errno));
+#endif
+
 	// prepare the poll file descriptor test array
 	pfdArray[pfdCount].fd     = this->sock->getHandle();	// assign our socket to polling array entity
 	pfdArray[pfdCount].events = POLLIN;						// we want only the recvfrom() ready event
@@ -69,7 +119,10 @@ MasterdTransport::MasterdTransport( char * host, short port)
  */
 MasterdTransport::~MasterdTransport()
 {
+	StopPipeline();
+
 	delete this->sock;
+	delete [] sendSlots;
 }
 
 
@@ -78,6 +131,93 @@ bool MasterdTransport::GetStatus(void)
 	return sockOK;
 }
 
+/**
+ * @brief Set a filter that received datagrams must pass.
+ *
+ * Datagrams the filter rejects are dropped right after being received,
+ * before anything is allocated for them.
+ *
+ * @param	filter	Filter function, NULL to accept everything.
+ */
+void MasterdTransport::SetFilter(tPacketFilter filter)
+{
+	this->filter = filter;
+}
+
+/**
+ * @brief Set the socket's receive and send buffer sizes.
+ *
+ * Sizes beyond what the system allows unprivileged processes are forced when
+ * we're allowed to, else the kernel limits them. The sizes the kernel ends up
+ * using are kept in the transport statistics.
+ *
+ * @param	recvSize	Receive buffer size in bytes, 0 for system default.
+ * @param	sendSize	Send buffer size in bytes, 0 for system default.
+ */
+void MasterdTransport::SetBufferSizes(U32 recvSize, U32 sendSize)
+{
+	int			fd = sock->getHandle();
+	int			size;
+	socklen_t	len;
+
+
+	if(recvSize)
+	{
+		size = recvSize;
+#ifdef SO_RCVBUFFORCE
+		if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+#endif
+			setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+
+	if(sendSize)
+	{
+		size = sendSize;
+#ifdef SO_SNDBUFFORCE
+		if(setsockopt(fd, SOL_SOCKET, SO_SNDBUFFORCE, &size, sizeof(size)) < 0)
+#endif
+			setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	}
+
+	// see what we got
+	len = sizeof(size);
+	if(getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0)
+		stats.recvBufferSize = size;
+
+	len = sizeof(size);
+	if(getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0)
+		stats.sendBufferSize = size;
+}
+
+/**
+ * @brief Account for the queueing delay of the datagram poll() handed out last.
+ *
+ * Call this when processing of the datagram starts, the delay is the time
+ * since the kernel received it.
+ */
+void MasterdTransport::MessageStarted(void)
+{
+	struct timespec	now;
+	S64				delay;
+
+
+	// kernel didn't tell us when
+	if(!recvStamp.tv_sec)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	delay = (S64)(now.tv_sec - recvStamp.tv_sec) * 1000000 +
+			(now.tv_nsec - recvStamp.tv_nsec) / 1000;
+
+	// system time stepped back
+	if(delay < 0)
+		delay = 0;
+
+	stats.queueDelay.Add(delay);
+	recvStamp.tv_sec = 0;
+}
+
 /**
  * @brief Poll for packets.
  *
@@ -101,8 +241,12 @@ bool MasterdTransport::poll(Packet **data, ServerAddress **from, int timeout)
 {
 	// Check for packets
 
-	char buff[2500];
-	netAddress from_x;
+	char buff[RECV_BUFFER_SIZE];
+	struct sockaddr_in sin;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(U32))];
 	int len, result;
 
 
@@ -110,17 +254,74 @@ bool MasterdTransport::poll(Packet **data, ServerAddress **from, int timeout)
 	// next section of code will use UNIX poll() to know when the
 	// socket actually has anything. --TRON
 
+	// datagrams come from the receive thread
+	if(pipelined)
+		return pollPipeline(data, from, timeout);
+
+	// while datagrams are queued also wait for the socket to become writable,
+	// unless the device is out of buffers and then retry after a short while.
+	if(stats.queueDepth)
+	{
+		if(sendWaitOut)
+			pfdArray[0].events = POLLIN | POLLOUT;
+		else if(timeout < 0 || timeout > SEND_RETRY_MS)
+			timeout = SEND_RETRY_MS;
+	}
+
 	// perform the actual polling with a blocking timeout
 	result = ::poll(&pfdArray[0], pfdCount, timeout);
+	pfdArray[0].events = POLLIN;
+
+	// send what was queued before anything else
+	if(stats.queueDepth && (!sendWaitOut || (result > 0 && (pfdArray[0].revents & POLLOUT))))
+		flushQueue();
+
 	if((result > 0) && (pfdArray[0].revents & POLLIN))
 	{
 		
-		// Read in a packet.... if we have one.
-		if(
-			(len=this->sock->recvfrom(buff, 2500, 0, &from_x))
-			> 0)
+		// Read in a packet.... if we have one. Skip over any that don't
+		// pass the filter for as long as there are more waiting.
+		for(;;)
 		{
-			*from = new ServerAddress(from_x.getHost(), from_x.getPort());
+			iov.iov_base		= buff;
+			iov.iov_len			= sizeof(buff);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name		= &sin;
+			msg.msg_namelen		= sizeof(sin);
+			msg.msg_iov			= &iov;
+			msg.msg_iovlen		= 1;
+			msg.msg_control		= control;
+			msg.msg_controllen	= sizeof(control);
+
+			len = recvmsg(sock->getHandle(), &msg, MSG_DONTWAIT);
+			if(len <= 0)
+				break;
+
+			stats.received++;
+
+			// pick up the receive time and the kernel's drop count
+			memset(&recvStamp, 0, sizeof(recvStamp));
+			for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+			{
+				if(cm->cmsg_level != SOL_SOCKET)
+					continue;
+#ifdef SCM_TIMESTAMPNS
+				if(cm->cmsg_type == SCM_TIMESTAMPNS)
+					memcpy(&recvStamp, CMSG_DATA(cm), sizeof(recvStamp));
+#endif
+#ifdef SO_RXQ_OVFL
+				if(cm->cmsg_type == SO_RXQ_OVFL)
+					memcpy(&stats.rxDrops, CMSG_DATA(cm), sizeof(U32));
+#endif
+			}
+
+			if(filter && !filter(buff, len))
+				continue;
+
+			*from = new ServerAddress();
+			(*from)->address	= sin.sin_addr.s_addr;
+			(*from)->port		= ntohs(sin.sin_port);
 			*data = new Packet(buff, len);
 
 			return true;
@@ -137,17 +338,910 @@ bool MasterdTransport::poll(Packet **data, ServerAddress **from, int timeout)
 /**
  * @brief Send a packet through this transport.
  *
- * @param	data	Packet containing data to send.
- * @param	to		Address to which to send this data.
+ * The send never blocks, when the socket can't take the datagram right now it
+ * is queued and sent once the socket is writable again.
+ *
+ * @param	data		Packet containing data to send.
+ * @param	to			Address to which to send this data.
+ * @param	priority	eSendPriority of the datagram should it need queueing.
+ */
+void MasterdTransport::sendPacket(Packet * data, ServerAddress * to, U8 priority)
+{
+	struct sockaddr_in	sin;
+
+
+	toSockAddr(to, &sin);
+	sendDatagram(data->getBufferPtr(), data->getLength(), &sin, priority);
+}
+
+
+/**
+ * @brief Send a buffer of equally sized datagrams to one destination.
+ *
+ * The packet holds datagrams of segSize bytes back to back, only the last one
+ * may be shorter. Where the kernel supports UDP generic segmentation offload
+ * (UDP_SEGMENT) they go out in as few sendmsg calls as the GSO limits allow,
+ * otherwise each datagram is sent on its own.
+ *
+ * Datagrams the socket can't take right now are queued like sendPacket does.
+ *
+ * @param	data		Packet containing the datagrams.
+ * @param	segSize		Size of each datagram.
+ * @param	to			Address to which to send this data.
+ * @param	priority	eSendPriority of the datagrams should they need queueing.
+ */
+void MasterdTransport::sendSegmented(Packet * data, U16 segSize, ServerAddress * to, U8 priority)
+{
+	struct sockaddr_in	sin;
+	char				*buff = data->getBufferPtr();
+	size_t				length = data->getLength();
+	size_t				len, chunk;
+
+
+	if(!segSize)
+		return;
+
+	toSockAddr(to, &sin);
+
+	// send thread gathers the datagrams into segmented sends again
+	if(pipelined)
+	{
+		pipeDatagrams(buff, length, segSize, &sin);
+		return;
+	}
+
+#ifdef UDP_SEGMENT
+	struct msghdr		msg;
+	struct iovec		iov;
+	struct cmsghdr		*cm;
+	char				control[CMSG_SPACE(sizeof(U16))];
+
+	// largest run of datagrams a single send may carry
+	chunk = GSO_MAX_BYTES / segSize;
+	if(chunk > GSO_MAX_SEGMENTS)
+		chunk = GSO_MAX_SEGMENTS;
+	chunk *= segSize;
+
+	// nothing skips the queue while it holds datagrams
+	while(gsoOK && !stats.queueDepth && length > segSize)
+	{
+		len = (length < chunk) ? length : chunk;
+
+		iov.iov_base		= buff;
+		iov.iov_len			= len;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name		= &sin;
+		msg.msg_namelen		= sizeof(sin);
+		msg.msg_iov			= &iov;
+		msg.msg_iovlen		= 1;
+		msg.msg_control		= control;
+		msg.msg_controllen	= sizeof(control);
+
+		// tell the kernel the size to segment the buffer into
+		cm					= CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level		= SOL_UDP;
+		cm->cmsg_type		= UDP_SEGMENT;
+		cm->cmsg_len		= CMSG_LEN(sizeof(U16));
+		memcpy(CMSG_DATA(cm), &segSize, sizeof(U16));
+
+		if(sendmsg(sock->getHandle(), &msg, MSG_DONTWAIT) < 0)
+		{
+			// socket is busy, queue the rest below
+			if(isBusyError(errno))
+			{
+				sendWaitOut = (errno != ENOBUFS);
+				break;
+			}
+
+			// kernel or device can't do it, don't try it again
+			if(errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EIO)
+			{
+				debugPrintf(DPRINT_WARN, " - UDP segmentation offload unavailable, error: [%d] %s\n",
+							errno, strerror(errno));
+				gsoOK = false;
+				break;
+			}
+
+			// anything else means the datagrams are lost, like a failed sendto
+			stats.errors += (length + segSize -1) / segSize;
+			return;
+		}
+
+		stats.gsoSends++;
+		stats.gsoSegments += (len + segSize -1) / segSize;
+
+		buff	+= len;
+		length	-= len;
+	}
+#endif
+
+	// send or queue whatever remains one datagram at a time
+	while(length)
+	{
+		len = (length < segSize) ? length : segSize;
+
+		sendDatagram(buff, len, &sin, priority);
+
+		buff	+= len;
+		length	-= len;
+	}
+}
+
+/**
+ * @brief Send a number of datagrams, to any destinations, at once.
+ *
+ * The datagrams are handed to the kernel SEND_BATCH_SIZE at a time with
+ * sendmmsg, saving a system call per datagram. Datagrams the socket can't
+ * take right now are queued like sendPacket does.
+ *
+ * @param	dgrams		Datagrams to send.
+ * @param	count		Number of datagrams.
+ * @param	priority	eSendPriority of the datagrams should they need queueing.
+ */
+void MasterdTransport::sendBatched(const tOutDatagram *dgrams, U32 count, U8 priority)
+{
+	struct mmsghdr		msgs[SEND_BATCH_SIZE];
+	struct iovec		iovs[SEND_BATCH_SIZE];
+	struct sockaddr_in	sins[SEND_BATCH_SIZE];
+	U32					i, n;
+	int					result;
+
+
+	while(count)
+	{
+		n = (count < SEND_BATCH_SIZE) ? count : SEND_BATCH_SIZE;
+
+		for(i=0; i < n; i++)
+			toSockAddr(dgrams[i].to, &sins[i]);
+
+		// send thread batches them itself, and queued datagrams go first
+		if(pipelined || stats.queueDepth)
+		{
+			for(i=0; i < n; i++)
+				sendDatagram(dgrams[i].data, dgrams[i].length, &sins[i], priority);
+
+			dgrams	+= n;
+			count	-= n;
+			continue;
+		}
+
+		memset(msgs, 0, n * sizeof(msgs[0]));
+		for(i=0; i < n; i++)
+		{
+			iovs[i].iov_base			= (void *)dgrams[i].data;
+			iovs[i].iov_len				= dgrams[i].length;
+			msgs[i].msg_hdr.msg_name	= &sins[i];
+			msgs[i].msg_hdr.msg_namelen	= sizeof(sins[i]);
+			msgs[i].msg_hdr.msg_iov		= &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen	= 1;
+		}
+
+		for(i=0; i < n;)
+		{
+			result = sendmmsg(sock->getHandle(), &msgs[i], n - i, MSG_DONTWAIT);
+			if(result > 0)
+			{
+				stats.batchSends++;
+				stats.batchDatagrams += result;
+				i += result;
+				continue;
+			}
+
+			// socket is busy, queue the rest
+			if(isBusyError(errno))
+			{
+				sendWaitOut = (errno != ENOBUFS);
+
+				for(; i < n; i++)
+					queueDatagram(dgrams[i].data, dgrams[i].length, &sins[i], priority);
+				break;
+			}
+
+			// the first datagram is lost, like a failed sendto
+			stats.errors++;
+			i++;
+		}
+
+		dgrams	+= n;
+		count	-= n;
+	}
+}
+
+/**
+ * @brief Fill a socket address from a ServerAddress.
+ *
+ * ServerAddress keeps the address in network byte order already, this avoids
+ * the string round trip netAddress would need.
+ */
+void MasterdTransport::toSockAddr(ServerAddress *addr, struct sockaddr_in *sin)
+{
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family			= AF_INET;
+	sin->sin_port			= htons(addr->port);
+	sin->sin_addr.s_addr	= addr->address;
+}
+
+/**
+ * @brief Send a single datagram, or queue it when the socket is busy.
+ *
+ * Once anything is queued further datagrams go to the queue too, so none
+ * skips it. The queue is sent highest priority first, datagrams of the same
+ * priority leave in the order they were sent.
+ *
+ * @return	true if the datagram was handed to the kernel.
+ */
+bool MasterdTransport::sendDatagram(const char *buff, size_t length, struct sockaddr_in *to, U8 priority)
+{
+	// send thread takes care of it
+	if(pipelined)
+	{
+		pipeDatagram(buff, length, to);
+		return true;
+	}
+
+	if(!stats.queueDepth)
+	{
+		if(::sendto(sock->getHandle(), buff, length, MSG_DONTWAIT,
+					(struct sockaddr *)to, sizeof(*to)) >= 0)
+			return true;
+
+		// anything but a busy socket means the datagram is lost
+		if(!isBusyError(errno))
+		{
+			stats.errors++;
+			return false;
+		}
+
+		// a full socket buffer becomes writable again, the device running
+		// out of buffers doesn't tell us when it recovers.
+		sendWaitOut = (errno != ENOBUFS);
+	}
+
+	queueDatagram(buff, length, to, priority);
+	return false;
+}
+
+/**
+ * @brief Add a datagram to the outbound queue.
+ *
+ * When the queue is full the oldest datagram of the lowest priority is
+ * dropped to make room, unless that is above the new datagram's priority in
+ * which case the new one is dropped instead.
+ */
+void MasterdTransport::queueDatagram(const char *buff, size_t length, struct sockaddr_in *to, U8 priority)
+{
+	tSendSlot	*slot;
+	tSendRing	*ring;
+	U8			p;
+
+
+	if(priority >= SEND_PRIORITIES)
+		priority = SEND_PRIORITIES -1;
+
+	if(length > MAX_PACKET_SIZE)
+	{
+		stats.errors++;
+		return;
+	}
+
+	if(!sendFreeCount)
+	{
+		// find lowest priority with anything queued
+		for(p = 0; p < priority; p++)
+			if(sendQueue[p].count)
+				break;
+
+		// nothing less important queued, drop the new one
+		if(p >= priority)
+		{
+			stats.dropped[priority]++;
+			return;
+		}
+
+		// drop the oldest of the lowest priority
+		ring = &sendQueue[p];
+		sendFree[sendFreeCount++] = ring->slots[ring->head];
+		ring->head = (ring->head +1) % SEND_QUEUE_SIZE;
+		ring->count--;
+		stats.queueDepth--;
+		stats.dropped[p]++;
+	}
+
+	slot			= sendFree[--sendFreeCount];
+	slot->to		= *to;
+	slot->length	= (U16)length;
+	memcpy(slot->data, buff, length);
+
+	ring = &sendQueue[priority];
+	ring->slots[(ring->head + ring->count) % SEND_QUEUE_SIZE] = slot;
+	ring->count++;
+
+	stats.queued++;
+	stats.queueDepth++;
+	if(stats.queueDepth > stats.queueDepthMax)
+		stats.queueDepthMax = stats.queueDepth;
+}
+
+/**
+ * @brief Send queued datagrams, highest priority first, until the socket is
+ * busy again or the queue is empty.
+ */
+void MasterdTransport::flushQueue(void)
+{
+	tSendSlot	*slot;
+	tSendRing	*ring;
+	int			p;
+
+
+	for(p = SEND_PRIORITIES -1; p >= 0; p--)
+	{
+		ring = &sendQueue[p];
+
+		while(ring->count)
+		{
+			slot = ring->slots[ring->head];
+
+			if(::sendto(sock->getHandle(), slot->data, slot->length, MSG_DONTWAIT,
+						(struct sockaddr *)&slot->to, sizeof(slot->to)) < 0)
+			{
+				// still busy, try again later
+				if(isBusyError(errno))
+				{
+					sendWaitOut = (errno != ENOBUFS);
+					return;
+				}
+
+				stats.errors++;
+			}
+
+			sendFree[sendFreeCount++] = slot;
+			ring->head = (ring->head +1) % SEND_QUEUE_SIZE;
+			ring->count--;
+			stats.queueDepth--;
+		}
+	}
+
+	sendWaitOut = false;
+}
+
+/**
+ * @brief Whether a send error only means the socket can't take it right now.
+ */
+bool MasterdTransport::isBusyError(int err)
+{
+	return (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS);
+}
+
+/**
+ * @brief Whether more datagrams would only pile up waiting for the socket.
+ */
+bool MasterdTransport::SendBusy(void)
+{
+	if(pipelined)
+		return txRing->Count() > PIPE_RING_SIZE / 2;
+
+	return stats.queueDepth != 0;
+}
+
+
+//=============================================================================
+// Pipelined mode
+//=============================================================================
+
+/**
+ * @brief Move receiving and sending to threads of their own.
+ *
+ * The receive thread reads datagrams in batches, runs them through the filter
+ * and hands them to the thread calling poll() through a ring. Datagrams sent
+ * through the transport go through another ring to the send thread which
+ * sends them in batches, gathering datagrams to the same destination into
+ * segmented sends. The thread calling poll() and send*() is left with
+ * processing messages, it's the only one touching anything outside of the
+ * transport. In pipelined mode the outbound queue isn't used, backpressure
+ * comes from the send ring.
+ *
+ * The filter is called on the receive thread, it must not touch anything the
+ * processing thread does.
+ *
+ * @return	true if the pipeline is running.
+ */
+bool MasterdTransport::StartPipeline(void)
+{
+	if(pipelined)
+		return true;
+
+	rxEvent = eventfd(0, EFD_NONBLOCK);
+	txEvent = eventfd(0, EFD_NONBLOCK);
+	if(rxEvent < 0 || txEvent < 0)
+	{
+		debugPrintf(DPRINT_ERROR, "   Failed to create pipeline events, error: [%d] %s\n",
+					errno, strerror(errno));
+		StopPipeline();
+		return false;
+	}
+
+	rxRing = new tPipeRing();
+	txRing = new tPipeRing();
+
+	pipeRunning.store(true);
+
+	if(pthread_create(&recvThread, NULL, recvThreadMain, this))
+	{
+		debugPrintf(DPRINT_ERROR, "   Failed to start receive thread\n");
+		pipeRunning.store(false);
+		StopPipeline();
+		return false;
+	}
+
+	if(pthread_create(&sendThread, NULL, sendThreadMain, this))
+	{
+		debugPrintf(DPRINT_ERROR, "   Failed to start send thread\n");
+		pipeRunning.store(false);
+		pthread_join(recvThread, NULL);
+		StopPipeline();
+		return false;
+	}
+
+	pipelined = true;
+	return true;
+}
+
+/**
+ * @brief Stop the pipeline threads, datagrams still waiting to be sent are
+ * sent first.
+ */
+void MasterdTransport::StopPipeline(void)
+{
+	if(pipelined)
+	{
+		pipeRunning.store(false);
+
+		// wake the threads so they notice right away
+		wakeEvent(txEvent, txSleeping);
+
+		pthread_join(recvThread, NULL);
+		pthread_join(sendThread, NULL);
+
+		pipelined = false;
+	}
+
+	if(rxEvent >= 0)	close(rxEvent);
+	if(txEvent >= 0)	close(txEvent);
+	rxEvent = txEvent = -1;
+
+	delete rxRing;
+	delete txRing;
+	rxRing = txRing = NULL;
+}
+
+void MasterdTransport::ReportPipeline(void)
+{
+	if(!pipelined)
+		return;
+
+	debugPrintf(DPRINT_INFO, " - Pipeline receive: %llu datagrams in %llu batches, ring %u/%u (%u at most), %llu stalls\n",
+				(unsigned long long)pstats.rxDatagrams.load(), (unsigned long long)pstats.rxBatches.load(),
+				rxRing->Count(), rxRing->Capacity(), rxRing->CountMax(),
+				(unsigned long long)pstats.rxStalls.load());
+	debugPrintf(DPRINT_INFO, " - Pipeline process: %llu waits on receive, %llu stalls on send\n",
+				(unsigned long long)pstats.procWaits.load(), (unsigned long long)pstats.procStalls.load());
+	debugPrintf(DPRINT_INFO, " - Pipeline send: %llu datagrams in %llu batches, %llu segmented, ring %u/%u (%u at most), %llu waits, %llu errors\n",
+				(unsigned long long)pstats.txDatagrams.load(), (unsigned long long)pstats.txBatches.load(),
+				(unsigned long long)pstats.txSegments.load(),
+				txRing->Count(), txRing->Capacity(), txRing->CountMax(),
+				(unsigned long long)pstats.txWaits.load(), (unsigned long long)pstats.txErrors.load());
+}
+
+/**
+ * @brief Wake a thread waiting on an event, if it is waiting.
+ */
+void MasterdTransport::wakeEvent(int event, std::atomic<bool> &sleeping)
+{
+	U64 one = 1;
+
+	if(event >= 0 && sleeping.load())
+	{
+		if(write(event, &one, sizeof(one)) < 0)
+			return; // counter is full, it's awake anyway
+	}
+}
+
+/**
+ * @brief Wait up to timeout milliseconds on an event, unless the ring has
+ * slots to consume already.
+ *
+ * The sleeping flag is raised before checking the ring one last time, so a
+ * producer publishing in between sees it and wakes us.
  */
-void MasterdTransport::sendPacket(Packet * data, ServerAddress * to)
+void MasterdTransport::waitEvent(int event, std::atomic<bool> &sleeping, tPipeRing *ring, int timeout)
+{
+	struct pollfd	pfd;
+	U64				value;
+
+
+	sleeping.store(true);
+
+	if(!ring->Count())
+	{
+		pfd.fd		= event;
+		pfd.events	= POLLIN;
+
+		if(::poll(&pfd, 1, timeout) > 0)
+		{
+			if(read(event, &value, sizeof(value)) < 0)
+				value = 0;
+		}
+	}
+
+	sleeping.store(false);
+}
+
+void* MasterdTransport::recvThreadMain(void *transport)
 {
-//	char * buff = data->getBuffer();
-	netAddress *a = new netAddress();
-	to->putInto(a);
-//	this->sock->sendto(buff, (int)data->getLength(), 0, a);
-	this->sock->sendto(data->getBufferPtr(), (int)data->getLength(), 0, a);
-	delete a;
-//	delete buff;
+	MasterdTransport	*t = (MasterdTransport *)transport;
+	struct pollfd		pfd;
+
+
+	pfd.fd		= t->sock->getHandle();
+	pfd.events	= POLLIN;
+
+	while(t->pipeRunning.load())
+	{
+		if(::poll(&pfd, 1, PIPE_IDLE_MS) > 0)
+			t->recvBatch();
+	}
+
+	return NULL;
+}
+
+void* MasterdTransport::sendThreadMain(void *transport)
+{
+	MasterdTransport *t = (MasterdTransport *)transport;
+
+
+	while(t->pipeRunning.load())
+	{
+		if(!t->txRing->Count())
+		{
+			t->pstats.txWaits++;
+			waitEvent(t->txEvent, t->txSleeping, t->txRing, PIPE_IDLE_MS);
+			continue;
+		}
+
+		t->sendBatch();
+	}
+
+	// send what's left
+	while(t->txRing->Count())
+		t->sendBatch();
+
+	return NULL;
 }
 
+/**
+ * @brief Receive thread, read all waiting datagrams straight into the ring.
+ */
+void MasterdTransport::recvBatch(void)
+{
+	struct mmsghdr	msgs[PIPE_RECV_BATCH];
+	struct iovec	iovs[PIPE_RECV_BATCH];
+	char			control[PIPE_RECV_BATCH][CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(U32))];
+	struct cmsghdr	*cm;
+	tPipeSlot		*slot;
+	U32				count, i;
+	int				result;
+
+
+	for(;;)
+	{
+		count = rxRing->Space();
+		if(!count)
+		{
+			// processing can't keep up, leave the datagrams in the socket
+			pstats.rxStalls++;
+			wakeEvent(rxEvent, rxSleeping);
+			millisleep(1);
+			return;
+		}
+
+		if(count > PIPE_RECV_BATCH)
+			count = PIPE_RECV_BATCH;
+
+		for(i=0; i < count; i++)
+		{
+			slot = &rxRing->Back(i);
+
+			iovs[i].iov_base	= slot->data;
+			iovs[i].iov_len		= sizeof(slot->data);
+
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name		= &slot->addr;
+			msgs[i].msg_hdr.msg_namelen		= sizeof(slot->addr);
+			msgs[i].msg_hdr.msg_iov			= &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen		= 1;
+			msgs[i].msg_hdr.msg_control		= control[i];
+			msgs[i].msg_hdr.msg_controllen	= sizeof(control[i]);
+		}
+
+		result = recvmmsg(sock->getHandle(), msgs, count, MSG_DONTWAIT, NULL);
+		if(result <= 0)
+			return;
+
+		for(i=0; i < (U32)result; i++)
+		{
+			slot			= &rxRing->Back(i);
+			slot->length	= msgs[i].msg_len;
+			slot->rxDrops	= 0;
+			memset(&slot->stamp, 0, sizeof(slot->stamp));
+
+			// pick up the receive time and the kernel's drop count
+			for(cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm))
+			{
+				if(cm->cmsg_level != SOL_SOCKET)
+					continue;
+#ifdef SCM_TIMESTAMPNS
+				if(cm->cmsg_type == SCM_TIMESTAMPNS)
+					memcpy(&slot->stamp, CMSG_DATA(cm), sizeof(slot->stamp));
+#endif
+#ifdef SO_RXQ_OVFL
+				if(cm->cmsg_type == SO_RXQ_OVFL)
+					memcpy(&slot->rxDrops, CMSG_DATA(cm), sizeof(U32));
+#endif
+			}
+
+			// dropped datagrams keep their slot, the drop count still counts
+			if(!slot->length || (filter && !filter(slot->data, slot->length)))
+				slot->length = 0;
+		}
+
+		rxRing->Publish(result);
+		wakeEvent(rxEvent, rxSleeping);
+
+		pstats.rxBatches++;
+		pstats.rxDatagrams += result;
+
+		// got everything there was
+		if((U32)result < count)
+			return;
+	}
+}
+
+/**
+ * @brief Processing thread, hand out the next datagram from the receive ring.
+ */
+bool MasterdTransport::pollPipeline(Packet **data, ServerAddress **from, int timeout)
+{
+	tPipeSlot *slot;
+
+
+	for(;;)
+	{
+		while(rxRing->Count())
+		{
+			slot = &rxRing->Front(0);
+
+			stats.received++;
+			if(slot->rxDrops)
+				stats.rxDrops = slot->rxDrops;
+
+			// filtered out by the receive thread
+			if(!slot->length)
+			{
+				rxRing->Release(1);
+				continue;
+			}
+
+			*from = new ServerAddress();
+			(*from)->address	= slot->addr.sin_addr.s_addr;
+			(*from)->port		= ntohs(slot->addr.sin_port);
+			*data = new Packet(slot->data, slot->length);
+			recvStamp = slot->stamp;
+
+			rxRing->Release(1);
+			return true;
+		}
+
+		if(timeout <= 0)
+			break;
+
+		// wait for the receive thread, just once
+		pstats.procWaits++;
+		waitEvent(rxEvent, rxSleeping, rxRing, timeout);
+		timeout = 0;
+	}
+
+	*from = NULL;
+	*data = NULL;
+
+	return false;
+}
+
+/**
+ * @brief Processing thread, hand a datagram to the send thread.
+ */
+void MasterdTransport::pipeDatagram(const char *buff, size_t length, struct sockaddr_in *to)
+{
+	if(length > RECV_BUFFER_SIZE)
+	{
+		stats.errors++;
+		return;
+	}
+
+	pipeDatagrams(buff, length, length, to);
+}
+
+/**
+ * @brief Processing thread, hand a buffer of equally sized datagrams to the
+ * send thread.
+ *
+ * The datagrams are published together when they fit, so the send thread
+ * sees them as one run and can send them segmented. Waits for the send thread
+ * when the ring is full, there's no point in processing more messages when
+ * their responses can't be sent.
+ */
+void MasterdTransport::pipeDatagrams(const char *buff, size_t length, U16 segSize, struct sockaddr_in *to)
+{
+	tPipeSlot	*slot;
+	U32			space, count;
+	size_t		len;
+
+
+	while(length)
+	{
+		space = txRing->Space();
+		if(!space)
+		{
+			pstats.procStalls++;
+			wakeEvent(txEvent, txSleeping);
+			millisleep(1);
+			continue;
+		}
+
+		// fill as many free slots as we have datagrams for
+		for(count = 0; count < space && length; count++)
+		{
+			len = (length < segSize) ? length : segSize;
+
+			slot			= &txRing->Back(count);
+			slot->addr		= *to;
+			slot->length	= (U16)len;
+			memcpy(slot->data, buff, len);
+
+			buff	+= len;
+			length	-= len;
+		}
+
+		txRing->Publish(count);
+		wakeEvent(txEvent, txSleeping);
+	}
+}
+
+/**
+ * @brief Send thread, send a batch of datagrams from the send ring.
+ *
+ * Runs of datagrams to the same destination where all but the last have the
+ * same size become a single segmented message, all messages of the batch go
+ * out with one sendmmsg() call.
+ */
+void MasterdTransport::sendBatch(void)
+{
+	struct mmsghdr	msgs[PIPE_SEND_BATCH];
+	struct iovec	iovs[PIPE_SEND_BATCH];
+	char			control[PIPE_SEND_BATCH][CMSG_SPACE(sizeof(U16))];
+	tPipeSlot		*first, *slot;
+	U32				count, i, j, run, bytes, m, done;
+	U16				segSize;
+	int				result;
+
+
+	count = txRing->Count();
+	if(count > PIPE_SEND_BATCH)
+		count = PIPE_SEND_BATCH;
+
+	// build the messages
+	for(i = m = 0; i < count; i += run, m++)
+	{
+		first	= &txRing->Front(i);
+		segSize	= first->length;
+		bytes	= segSize;
+		run		= 1;
+
+#ifdef UDP_SEGMENT
+		while(gsoOK && i + run < count && run < GSO_MAX_SEGMENTS)
+		{
+			slot = &txRing->Front(i + run);
+
+			if(	slot->addr.sin_addr.s_addr != first->addr.sin_addr.s_addr ||
+				slot->addr.sin_port        != first->addr.sin_port        ||
+				slot->length > segSize || bytes + slot->length > GSO_MAX_BYTES)
+				break;
+
+			bytes += slot->length;
+			run++;
+
+			// only the last segment may be shorter
+			if(slot->length < segSize)
+				break;
+		}
+#endif
+
+		for(j=0; j < run; j++)
+		{
+			slot = &txRing->Front(i + j);
+			iovs[i + j].iov_base	= slot->data;
+			iovs[i + j].iov_len		= slot->length;
+		}
+
+		memset(&msgs[m], 0, sizeof(msgs[m]));
+		msgs[m].msg_hdr.msg_name	= &first->addr;
+		msgs[m].msg_hdr.msg_namelen	= sizeof(first->addr);
+		msgs[m].msg_hdr.msg_iov		= &iovs[i];
+		msgs[m].msg_hdr.msg_iovlen	= run;
+
+#ifdef UDP_SEGMENT
+		if(run > 1)
+		{
+			struct cmsghdr *cm;
+
+			// tell the kernel the size to segment the message into
+			msgs[m].msg_hdr.msg_control		= control[m];
+			msgs[m].msg_hdr.msg_controllen	= sizeof(control[m]);
+
+			cm					= CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+			cm->cmsg_level		= SOL_UDP;
+			cm->cmsg_type		= UDP_SEGMENT;
+			cm->cmsg_len		= CMSG_LEN(sizeof(U16));
+			memcpy(CMSG_DATA(cm), &segSize, sizeof(U16));
+
+			pstats.txSegments += run;
+		}
+#endif
+	}
+
+	// send them, the socket blocks while its buffer is full
+	for(done = 0; done < m;)
+	{
+		result = sendmmsg(sock->getHandle(), &msgs[done], m - done, 0);
+		pstats.txBatches++;
+
+		if(result > 0)
+		{
+			done += result;
+			continue;
+		}
+
+		// device is out of buffers, try again in a bit
+		if(errno == ENOBUFS || errno == EAGAIN || errno == EINTR)
+		{
+			millisleep(1);
+			continue;
+		}
+
+		// kernel or device can't do segmentation, send the run one by one
+		if(msgs[done].msg_hdr.msg_controllen && (errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EIO))
+		{
+			debugPrintf(DPRINT_WARN, " - UDP segmentation offload unavailable, error: [%d] %s\n",
+						errno, strerror(errno));
+			gsoOK = false;
+
+			for(j=0; j < msgs[done].msg_hdr.msg_iovlen; j++)
+			{
+				if(::sendto(sock->getHandle(), msgs[done].msg_hdr.msg_iov[j].iov_base,
+							msgs[done].msg_hdr.msg_iov[j].iov_len, 0,
+							(struct sockaddr *)msgs[done].msg_hdr.msg_name, sizeof(struct sockaddr_in)) < 0)
+					pstats.txErrors++;
+			}
+
+			done++;
+			continue;
+		}
+
+		// datagrams of the message are lost
+		pstats.txErrors += msgs[done].msg_hdr.msg_iovlen;
+		done++;
+	}
+
+	pstats.txDatagrams += count;
+	txRing->Release(count);
+}
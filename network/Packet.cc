@@ -76,7 +76,7 @@ void Packet::writeBytes(const void *data, size_t length)
 		return;
 	
 	// verify we have enough buffer space to write to
-	if(!(getLength() + length) > size)
+	if((getLength() + length) > size)
 	{
 		// not enough bytes remain, abort
 		statusOK = false;
@@ -217,6 +217,14 @@ size_t Packet::getLength()
 	return ptr - buff;
 }
 
+/**
+ * @brief Get the size of the packet, the whole datagram of a received one.
+ */
+size_t Packet::getSize()
+{
+	return size;
+}
+
 /**
  * @brief Write standard protocol header to the packet.
  */
@@ -233,6 +241,35 @@ void Packet::writeHeader(tPacketHeader &header)
 	writeHeader(header.type, header.flags, header.session, header.key);
 }
 
+/**
+ * @brief Overwrite the header of an already written packet.
+ *
+ * Leaves the write position alone, used to resend a prepared packet under
+ * a different session and key.
+ */
+void Packet::rewriteHeader(U8 type, U8 flags, U16 session, U16 key)
+{
+	if(readOnly || size < PACKET_HEADER_SIZE)
+	{
+		statusOK = false;
+		return;
+	}
+
+	buff[0] = type;
+	buff[1] = flags;
+	memcpy(buff +2, &session, sizeof(session));
+	memcpy(buff +4, &key,     sizeof(key));
+}
+
+/**
+ * @brief Rewind a writable packet so it can be filled again.
+ */
+void Packet::reset()
+{
+	ptr			= buff;
+	statusOK	= true;
+}
+
 /**
  * @brief Read standard protocol header to the packet.
  */
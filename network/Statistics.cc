@@ -0,0 +1,88 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "Statistics.h"
+#include "masterd.h"
+#include <string.h>
+
+
+void Histogram::Clear(void)
+{
+	memset(m_Buckets, 0, sizeof(m_Buckets));
+	m_Count	= 0;
+	m_Sum	= 0;
+	m_Max	= 0;
+}
+
+void Histogram::Add(U64 value)
+{
+	U32 bucket = 0;
+
+	// bucket is the number of significant bits of the value
+	while(value >> bucket && bucket < HISTOGRAM_BUCKETS -1)
+		bucket++;
+
+	m_Buckets[bucket]++;
+	m_Count++;
+	m_Sum += value;
+	if(value > m_Max)
+		m_Max = value;
+}
+
+/**
+ * @brief Get the upper bound of the bucket the percentile falls into.
+ */
+U64 Histogram::Percentile(U32 pct) const
+{
+	U64	want, seen = 0;
+	U32	i;
+
+
+	if(!m_Count)
+		return 0;
+
+	// number of samples at or below the percentile, at least one
+	want = (m_Count * pct + 99) / 100;
+	if(!want)
+		want = 1;
+
+	for(i=0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += m_Buckets[i];
+		if(seen >= want)
+			break;
+	}
+
+	// the largest sample is a better bound for the top bucket
+	if(i >= HISTOGRAM_BUCKETS -1 || ((U64)1 << i) -1 > m_Max)
+		return m_Max;
+
+	return ((U64)1 << i) -1;
+}
+
+void Histogram::Report(const char *name, const char *unit) const
+{
+	debugPrintf(DPRINT_INFO, "     %s: %llu samples, mean %llu%s, p50 %llu%s, p90 %llu%s, p99 %llu%s, max %llu%s\n",
+				name, (unsigned long long)m_Count,
+				(unsigned long long)Mean(), unit,
+				(unsigned long long)Percentile(50), unit,
+				(unsigned long long)Percentile(90), unit,
+				(unsigned long long)Percentile(99), unit,
+				(unsigned long long)m_Max, unit);
+}
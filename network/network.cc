@@ -59,6 +59,122 @@ int getAbsTime()
 	return (int)time(NULL);
 }
 
+/**
+ * @brief Get the current time in milliseconds.
+ *
+ * The time is from a monotonic clock, it is only good for measuring
+ * intervals and doesn't jump when the system time is changed.
+ *
+ * @return current time in milliseconds.
+ */
+U64 getMilliTime()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (U64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 64-bit FNV-1a hash of a buffer.
+ *
+ * Fast and good enough to tell whether a payload changed, not meant to
+ * withstand anyone trying to produce collisions.
+ */
+U64 fnv1a64(const void *data, size_t length)
+{
+	const U8	*p = (const U8 *)data;
+	U64			hash = 0xCBF29CE484222325ULL;	// offset basis
+
+
+	while(length--)
+	{
+		hash ^= *p++;
+		hash *= 0x100000001B3ULL;			// FNV prime
+	}
+
+	return hash;
+}
+
+/**
+ * @brief Next number of a 32-bit xorshift generator.
+ *
+ * Good enough for sessions and keys that only match a response to its
+ * request, not for anything secret. The state must not be 0.
+ */
+U32 xorshift32(U32 &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+
+	return state;
+}
+
+#define SIPROUND(v0, v1, v2, v3)							\
+	do {													\
+		v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0;	\
+		v0 = (v0 << 32) | (v0 >> 32);						\
+		v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2;	\
+		v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0;	\
+		v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2;	\
+		v2 = (v2 << 32) | (v2 >> 32);						\
+	} while(0)
+
+/**
+ * @brief SipHash-2-4 of a buffer under a 128-bit key.
+ *
+ * Unlike fnv1a64() the result can't be guessed without the key, which makes
+ * it fit for tokens only we can issue.
+ */
+U64 siphash24(const U8 key[16], const void *data, size_t length)
+{
+	const U8	*p = (const U8 *)data;
+	U64			k0 = 0, k1 = 0, m, v0, v1, v2, v3;
+	size_t		left = length & 7;
+	int			i;
+
+
+	for(i=0; i < 8; i++)
+	{
+		k0 |= (U64)key[i]   << (i*8);
+		k1 |= (U64)key[i+8] << (i*8);
+	}
+
+	v0 = k0 ^ 0x736F6D6570736575ULL;
+	v1 = k1 ^ 0x646F72616E646F6DULL;
+	v2 = k0 ^ 0x6C7967656E657261ULL;
+	v3 = k1 ^ 0x7465646279746573ULL;
+
+	// whole words, little endian
+	for(; p != (const U8 *)data + (length - left); p += 8)
+	{
+		for(m=0, i=0; i < 8; i++)
+			m |= (U64)p[i] << (i*8);
+
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	// the last bytes and the length
+	for(m = (U64)length << 56, i=0; i < (int)left; i++)
+		m |= (U64)p[i] << (i*8);
+
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xFF;
+	for(i=0; i < 4; i++)
+		SIPROUND(v0, v1, v2, v3);
+
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
 /**
  * @brief Sleep for the specified number of milliseconds.
  *
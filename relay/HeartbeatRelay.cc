@@ -0,0 +1,303 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "HeartbeatRelay.h"
+
+
+/**
+ * @param	transport	Socket the game servers heartbeat and the updates go out on.
+ * @param	master		Master server to forward to.
+ * @param	secret		Secret shared with the master.
+ * @param	interval	Milliseconds between updates.
+ * @param	refresh		Seconds before unchanged info is forwarded again.
+ * @param	expire		Seconds without a heartbeat before a server is dropped.
+ */
+HeartbeatRelay::HeartbeatRelay(MasterdTransport *transport, ServerAddress *master, const char *secret,
+							   U32 interval, U32 refresh, U32 expire)
+{
+	m_Transport		= transport;
+	m_Master		= *master;
+	m_Interval		= interval ? interval : 1;
+	m_Refresh		= (U64)refresh * 1000;
+	m_Expire		= (U64)expire * 1000;
+	m_NextUpdate	= 0;
+	m_Random		= (U32)getMilliTime() | 1;
+
+	// higher than the sequence numbers of any earlier run
+	m_Sequence		= (U64)getAbsTime() << 20;
+
+	relayKey(secret, m_Key);
+
+	memset(&m_Stats, 0, sizeof(m_Stats));
+}
+
+/**
+ * @brief Handle a datagram from a game server.
+ */
+void HeartbeatRelay::Message(ServerAddress *from, Packet *pack)
+{
+	tPacketHeader	header;
+	U64				slot = from->toSlot();
+
+
+	pack->readHeader(header);
+	if(!pack->getStatus())
+		return;
+
+	switch(header.type)
+	{
+		case GameHeartbeat:
+			Heartbeat(from, slot, header, pack);
+			break;
+
+		case GameMasterInfoResponse:
+			InfoResponse(slot, header, pack);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/**
+ * @brief Ask a heartbeating server for its info, unless it just told us.
+ */
+void HeartbeatRelay::Heartbeat(ServerAddress *from, U64 slot, tPacketHeader &header, Packet *pack)
+{
+	tRelayedServer	*srv = &m_Servers[slot];
+	tPacketHeader	request;
+	tOutDatagram	out;
+	char			data[PACKET_HEADER_SIZE];
+	U64				now = getMilliTime();
+	U32				r;
+
+
+	m_Stats.heartbeats++;
+	srv->lastHeart = now;
+
+	// carries info under the session and key we asked with, as good as a response
+	if((header.flags & GameHeartbeatInfoFlag) && srv->asked &&
+	   header.session == srv->session && header.key == srv->key)
+	{
+		TakeInfo(srv, pack);
+		return;
+	}
+
+	if(srv->asked && now < srv->asked + RELAY_REQUEST_WINDOW)
+		return;
+
+	// random session and key, they only match the response to the request
+	r = xorshift32(m_Random);
+
+	srv->session	= (U16)r;
+	srv->key		= (U16)(r >> 16);
+	srv->asked		= now;
+
+	// GameMasterInfoRequest is just a header
+	request.type	= GameMasterInfoRequest;
+	request.flags	= 0;
+	request.session	= srv->session;
+	request.key		= srv->key;
+	memcpy(data, &request.type, 1);
+	memcpy(data +1, &request.flags, 1);
+	memcpy(data +2, &request.session, sizeof(U16));
+	memcpy(data +4, &request.key, sizeof(U16));
+
+	out.to		= from;
+	out.data	= data;
+	out.length	= PACKET_HEADER_SIZE;
+	m_Transport->sendBatched(&out, 1, SEND_PRIORITY_INFOREQUEST);
+
+	m_Stats.requests++;
+}
+
+/**
+ * @brief Take the info of a server we asked.
+ */
+void HeartbeatRelay::InfoResponse(U64 slot, tPacketHeader &header, Packet *pack)
+{
+	tcRelayedServers::iterator it;
+
+
+	it = m_Servers.find(slot);
+	if(it == m_Servers.end() || !it->second.asked ||
+	   header.session != it->second.session || header.key != it->second.key)
+		return;
+
+	TakeInfo(&it->second, pack);
+}
+
+void HeartbeatRelay::TakeInfo(tRelayedServer *srv, Packet *pack)
+{
+	const char	*info = pack->getBufferPtr() + pack->getLength();
+	size_t		size = pack->getSize() - pack->getLength();
+	U64			fingerprint;
+
+
+	// the master checks it over, an update can only carry so much though
+	if(RELAY_UPDATE_MIN_SIZE + RELAY_SERVER_HEADER + size > RELAY_UPDATE_MAX_SIZE)
+	{
+		m_Stats.oversized++;
+		return;
+	}
+
+	m_Stats.responses++;
+
+	fingerprint = fnv1a64(info, size);
+	if(!srv->info.empty() && fingerprint == srv->fingerprint)
+		return;
+
+	srv->info.assign(info, info + size);
+	srv->fingerprint	= fingerprint;
+	srv->changed		= true;
+}
+
+/**
+ * @brief Send the update once the interval is up.
+ */
+void HeartbeatRelay::DoProcessing(void)
+{
+	if(getMilliTime() < m_NextUpdate)
+		return;
+
+	m_NextUpdate = getMilliTime() + m_Interval;
+
+	Forward();
+}
+
+/**
+ * @brief Fill in the server count and sign the update that starts at start.
+ */
+void HeartbeatRelay::Seal(size_t start, U8 count)
+{
+	U64 mac;
+
+
+	m_Buffers[start + PACKET_HEADER_SIZE + 8] = count;
+
+	// relayMac() leaves out the MAC, make room for it first
+	m_Buffers.resize(m_Buffers.size() + RELAY_MAC_SIZE);
+	mac = relayMac(m_Key, &m_Buffers[start], m_Buffers.size() - start);
+	memcpy(&m_Buffers[m_Buffers.size() - RELAY_MAC_SIZE], &mac, RELAY_MAC_SIZE);
+}
+
+/**
+ * @brief Send the master the info of every server that changed or is due.
+ *
+ * Servers that stopped heartbeating are dropped on the way, the master
+ * expires them on its own.
+ */
+void HeartbeatRelay::Forward(void)
+{
+	tcRelayedServers::iterator	it;
+	std::vector<size_t>			starts;
+	tOutDatagram				out;
+	U64							now = getMilliTime();
+	size_t						start = 0, i;
+	U32							address;
+	U16							port, size;
+	U8							count = 0;
+
+
+	m_Buffers.clear();
+
+	for(it = m_Servers.begin(); it != m_Servers.end();)
+	{
+		if(now >= it->second.lastHeart + m_Expire)
+		{
+			m_Servers.erase(it++);
+			m_Stats.expired++;
+			continue;
+		}
+
+		if(it->second.info.empty() ||
+		   (!it->second.changed && now < it->second.forwarded + m_Refresh))
+		{
+			it++;
+			continue;
+		}
+
+		size = it->second.info.size();
+
+		// start another update if it doesn't fit this one
+		if(count && (count == 0xFF ||
+		   m_Buffers.size() - start + RELAY_SERVER_HEADER + size + RELAY_MAC_SIZE > RELAY_UPDATE_MAX_SIZE))
+		{
+			Seal(start, count);
+			count = 0;
+		}
+
+		if(!count)
+		{
+			start = m_Buffers.size();
+			starts.push_back(start);
+
+			// header, flags, session and key are all 0
+			m_Buffers.push_back(MasterRelayUpdate);
+			m_Buffers.resize(start + PACKET_HEADER_SIZE, 0);
+
+			m_Sequence++;
+			m_Buffers.insert(m_Buffers.end(), (char *)&m_Sequence, (char *)&m_Sequence + sizeof(U64));
+			m_Buffers.push_back(0);		// server count, filled in by Seal()
+		}
+
+		address	= (U32)(it->first >> 16);
+		port	= (U16)it->first;
+		m_Buffers.insert(m_Buffers.end(), (char *)&address, (char *)&address + sizeof(U32));
+		m_Buffers.insert(m_Buffers.end(), (char *)&port,    (char *)&port + sizeof(U16));
+		m_Buffers.insert(m_Buffers.end(), (char *)&size,    (char *)&size + sizeof(U16));
+		m_Buffers.insert(m_Buffers.end(), it->second.info.begin(), it->second.info.end());
+		count++;
+
+		it->second.changed		= false;
+		it->second.forwarded	= now;
+		m_Stats.forwarded++;
+		it++;
+	}
+
+	if(starts.empty())
+		return;
+
+	Seal(start, count);
+
+	// the buffer doesn't move anymore
+	starts.push_back(m_Buffers.size());
+	m_Out.clear();
+	for(i=0; i +1 < starts.size(); i++)
+	{
+		out.to		= &m_Master;
+		out.data	= &m_Buffers[starts[i]];
+		out.length	= starts[i+1] - starts[i];
+		m_Out.push_back(out);
+	}
+
+	m_Transport->sendBatched(&m_Out[0], m_Out.size(), SEND_PRIORITY_NORMAL);
+	m_Stats.updates += m_Out.size();
+}
+
+void HeartbeatRelay::Report(void)
+{
+	debugPrintf(DPRINT_INFO, " - Relay: %lu servers, %llu heartbeats, %llu info requests, %llu responses\n",
+				(unsigned long)m_Servers.size(), (unsigned long long)m_Stats.heartbeats,
+				(unsigned long long)m_Stats.requests, (unsigned long long)m_Stats.responses);
+	debugPrintf(DPRINT_INFO, " - Relay: %llu updates carrying %llu servers, %llu expired, %llu too large\n",
+				(unsigned long long)m_Stats.updates, (unsigned long long)m_Stats.forwarded,
+				(unsigned long long)m_Stats.expired, (unsigned long long)m_Stats.oversized);
+}
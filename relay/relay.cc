@@ -0,0 +1,208 @@
+/*
+	(c) Nathan Martin <nmartin@gmail.com> 2011
+
+    This file is part of the Pushbutton Master Server.
+
+    PMS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    PMS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with the PMS; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#include "masterd.h"
+#include "HeartbeatRelay.h"
+#include <stdarg.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+
+pbms-relay, heartbeat aggregation relay.
+
+Runs at a hosting site next to its game servers, which are set up to heartbeat
+the relay instead of the master server. The relay forwards their info to the
+master in batches, the master has to list the relay's address in its
+relay::Trusted preference and share its relay::Secret.
+
+*/
+
+static HeartbeatRelay	*gm_pRelay		= NULL;
+static U32				gm_Verbosity	= DPRINT_INFO;
+static volatile bool	gm_Running		= true;
+static volatile bool	gm_Report		= false;
+
+MasterdTransport		*gm_pTransport	= NULL;
+
+
+void debugPrintf(const int level, const char *format, ...)
+{
+	va_list args;
+
+
+	if(level > (int)gm_Verbosity)
+		return;
+
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+static void sigproc(int sig)
+{
+	switch(sig)
+	{
+		case SIGINT:
+		case SIGTERM:
+			gm_Running = false;
+			break;
+
+		case SIGUSR1:
+			// printed by the main loop, not from in here
+			gm_Report = true;
+			break;
+	}
+}
+
+static void usage(const char *name)
+{
+	printf("Usage: %s -m <master ip:port> [options]\n"
+		   "  -l <ip:port>   address to listen on for heartbeats (0.0.0.0:28002)\n"
+		   "  -m <ip:port>   master server to forward to\n"
+		   "  -s <secret>    secret shared with the master's relay::Secret\n"
+		   "  -i <ms>        milliseconds between updates (1000)\n"
+		   "  -r <seconds>   forward unchanged info again after this long (60)\n"
+		   "  -e <seconds>   drop servers that stop heartbeating for this long (180)\n"
+		   "  -b <bytes>     socket receive buffer size (4194304)\n"
+		   "  -v <level>     verbosity, 0 to 4 (3)\n", name);
+}
+
+/**
+ * @brief Split ip:port, the port is left alone if there is none.
+ */
+static bool parseAddress(const char *arg, char *host, size_t hostSize, U16 *port)
+{
+	unsigned int	a, b, c, d, p;
+	int				n;
+
+
+	n = sscanf(arg, "%u.%u.%u.%u:%u", &a, &b, &c, &d, &p);
+	if(n < 4 || a > 255 || b > 255 || c > 255 || d > 255 || (n == 5 && (!p || p > 0xFFFF)))
+		return false;
+
+	snprintf(host, hostSize, "%u.%u.%u.%u", a, b, c, d);
+	if(n == 5)
+		*port = (U16)p;
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	char			listenHost[32] = "0.0.0.0", masterHost[32] = "";
+	U16				listenPort = 28002, masterPort = 28002;
+	const char		*secret = "";
+	U32				interval = 1000, refresh = 60, expire = 180;
+	U32				recvBuffer = 4 << 20;
+	ServerAddress	master, *from;
+	Packet			*data;
+	int				opt;
+
+
+	while((opt = getopt(argc, argv, "l:m:s:i:r:e:b:v:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'l':
+				if(!parseAddress(optarg, listenHost, sizeof(listenHost), &listenPort))
+				{
+					printf("Bad listen address %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 'm':
+				if(!parseAddress(optarg, masterHost, sizeof(masterHost), &masterPort))
+				{
+					printf("Bad master address %s\n", optarg);
+					return 1;
+				}
+				break;
+
+			case 's':	secret		= optarg;				break;
+			case 'i':	interval	= strtoul(optarg, NULL, 10);	break;
+			case 'r':	refresh		= strtoul(optarg, NULL, 10);	break;
+			case 'e':	expire		= strtoul(optarg, NULL, 10);	break;
+			case 'b':	recvBuffer	= strtoul(optarg, NULL, 10);	break;
+			case 'v':	gm_Verbosity	= strtoul(optarg, NULL, 10);	break;
+
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(!masterHost[0])
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(!secret[0])
+		debugPrintf(DPRINT_WARN, " - No secret given, updates are signed with an empty one\n");
+
+	signal(SIGINT, sigproc);
+	signal(SIGTERM, sigproc);
+	signal(SIGUSR1, sigproc);
+
+	gm_pTransport = new MasterdTransport(listenHost, listenPort);
+	if(!gm_pTransport->GetStatus())
+	{
+		debugPrintf(DPRINT_ERROR, " - Failed to listen on %s:%u\n", listenHost, listenPort);
+		delete gm_pTransport;
+		return 1;
+	}
+
+	// a whole site's servers answering info requests at once is quite a burst
+	gm_pTransport->SetBufferSizes(recvBuffer, 0);
+
+	master.set(masterHost, masterPort);
+	gm_pRelay = new HeartbeatRelay(gm_pTransport, &master, secret, interval, refresh, expire);
+
+	debugPrintf(DPRINT_INFO, " - Relaying heartbeats on %s:%u to %s:%u, %u bytes receive buffer\n",
+				listenHost, listenPort, masterHost, masterPort, gm_pTransport->GetStats().recvBufferSize);
+
+	while(gm_Running)
+	{
+		while(gm_pTransport->poll(&data, &from, 10))
+		{
+			gm_pRelay->Message(from, data);
+
+			delete data;
+			delete from;
+		}
+
+		gm_pRelay->DoProcessing();
+
+		if(gm_Report)
+		{
+			gm_Report = false;
+			gm_pRelay->Report();
+		}
+	}
+
+	debugPrintf(DPRINT_INFO, " - Shutting down...\n");
+	gm_pRelay->Report();
+
+	delete gm_pRelay;
+	delete gm_pTransport;
+
+	return 0;
+}